@@ -4,21 +4,27 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "config.h"
 #include "http2_client.h"
 
-#define BACKEND_POOL_MAX_SIZE 20
+#define BACKEND_POOL_MAX_SIZE 1024
 #define BACKEND_POOL_DEFAULT_SIZE 10
+#define BACKEND_POOL_DEFAULT_MIN_SIZE 1
+#define BACKEND_POOL_DEFAULT_ACQUIRE_TIMEOUT_MS 1000
 #define BACKEND_POOL_IDLE_TIMEOUT_SEC 60
+#define BACKEND_POOL_REFRESH_INTERVAL_MS 1000
+#define BACKEND_POOL_WAIT_SLICE_MS 10
 
 #define BACKEND_POOL_HEALTHY_THRESHOLD      2
 #define BACKEND_POOL_UNHEALTHY_THRESHOLD    3
 #define BACKEND_POOL_DEFAULT_INTERVAL_SEC   10
 #define BACKEND_POOL_DEFAULT_TIMEOUT_SEC    5
 
-#define CIRCUIT_BREAKER_FAILURE_THRESHOLD   5
-#define CIRCUIT_BREAKER_RECOVERY_TIMEOUT_SEC 30
-#define CIRCUIT_BREAKER_SUCCESS_THRESHOLD   2
+/* The error-rate window is this many time buckets, striped by CPU so
+ * requests finishing on different cores do not share a cache line */
+#define CIRCUIT_BREAKER_WINDOW_BUCKETS      10
+#define CIRCUIT_BREAKER_STRIPES             16
 
 typedef enum {
     BACKEND_HEALTH_UNKNOWN = 0,
@@ -26,6 +32,12 @@ typedef enum {
     BACKEND_HEALTH_UNHEALTHY = 2
 } backend_health_t;
 
+typedef enum {
+    BACKEND_ACQUIRE_OK = 0,
+    BACKEND_ACQUIRE_EXHAUSTED = 1,      /* every slot stayed busy until the deadline */
+    BACKEND_ACQUIRE_UNAVAILABLE = 2     /* no usable connection at all */
+} backend_acquire_result_t;
+
 typedef enum {
     HEALTH_CHECK_STATE_STOPPED = 0,
     HEALTH_CHECK_STATE_RUNNING = 1
@@ -41,22 +53,39 @@ typedef struct backend_pool_s backend_pool_t;
 
 typedef HealthCheckConfig health_check_config_t;
 typedef CircuitBreakerConfig circuit_breaker_config_t;
+typedef ConnectionPoolConfig backend_pool_config_t;
+
+/* A thread parked in backend_pool_acquire_timed(); lives on its stack */
+typedef struct backend_waiter_s backend_waiter_t;
+
+/* One CPU's share of the window. Each bucket packs its bucket number,
+ * requests and failures into one word that is updated with CAS. Padded
+ * to whole cache lines; pools come from calloc, so not aligned to them. */
+typedef struct {
+    _Atomic uint64_t buckets[CIRCUIT_BREAKER_WINDOW_BUCKETS];
+    char pad[128 - CIRCUIT_BREAKER_WINDOW_BUCKETS * sizeof(uint64_t)];
+} circuit_breaker_stripe_t;
 
+/* State changes are CAS transitions: of the requests that see the same
+ * failure or probe outcome, only one opens or closes the breaker. */
 typedef struct {
     _Atomic circuit_breaker_state_t state;
-    _Atomic int failure_count;
-    _Atomic int success_count;
+    _Atomic int failure_count;          /* failures in a row */
+    _Atomic int success_count;          /* probe successes in HALF_OPEN */
+    _Atomic int probes;                 /* probe slots in use in HALF_OPEN */
     _Atomic long last_failure_time;
     _Atomic long last_state_change;
     _Atomic long total_opens;
     _Atomic long total_closes;
+    _Atomic uint64_t window_start;      /* first bucket counted since the last close */
+    long bucket_ms;
+    circuit_breaker_stripe_t stripes[CIRCUIT_BREAKER_STRIPES];
     circuit_breaker_config_t config;
 } circuit_breaker_t;
 
 typedef struct {
     struct backend_pool_s *pool;
     health_check_config_t config;
-    pthread_t thread;
     _Atomic health_check_state_t state;
     _Atomic int consecutive_failures;
     _Atomic int consecutive_successes;
@@ -66,29 +95,54 @@ typedef struct {
     _Atomic long failed_checks;
 } health_checker_t;
 
+/* One upstream HTTP/2 connection. It is shared: every acquire() hands out
+ * one stream slot, up to the peer's SETTINGS_MAX_CONCURRENT_STREAMS.
+ * A connection with no streams is either on the pool's free list or
+ * retired, waiting for the refresher to reconnect it. */
 typedef struct {
     struct backend_pool_s *pool;
     http2_client_t client;
-    _Atomic bool in_use;
+    int index;
+    _Atomic int streams;                /* stream slots handed out */
+    _Atomic int free_next;              /* free list link: index + 1, 0 = end */
+    _Atomic bool retired;
     _Atomic long last_used;
-    backend_health_t health;
+    _Atomic backend_health_t health;    /* written under 'lock', read without it */
     int consecutive_failures;
     int consecutive_successes;
     pthread_mutex_t lock;
 } backend_conn_t;
 
 typedef struct backend_pool_s {
-    backend_conn_t *connections[BACKEND_POOL_MAX_SIZE];
+    backend_conn_t **connections;       /* max_size slots, [0, size) populated */
     _Atomic int size;
-    _Atomic int active_count;
+    int min_size;
+    int max_size;
+    int acquire_timeout_ms;
+    pthread_mutex_t grow_lock;
+    _Atomic int active_count;           /* connections with at least one stream */
     _Atomic int idle_count;
+    _Atomic int stream_count;           /* stream slots in use across the pool */
     _Atomic int healthy_count;
     char backend_host[256];
     int backend_port;
     bool tls_enabled;
     bool tls_verify;
     int idle_timeout_sec;
-    pthread_mutex_t pool_lock;
+    /* Lock-free LIFO of connections without streams. Low 32 bits: index + 1
+     * of the top connection (0 = empty); high 32 bits: ABA tag. */
+    _Atomic uint64_t free_head;
+    pthread_mutex_t pool_lock;          /* refresher sleep/wakeup only */
+    pthread_cond_t refresher_cond;
+    pthread_t refresher;
+    _Atomic bool refresher_running;
+    /* FIFO of threads waiting for a stream slot; released slots are handed
+     * to the head waiter directly */
+    pthread_mutex_t wait_lock;
+    backend_waiter_t *wait_head;
+    backend_waiter_t *wait_tail;
+    _Atomic int waiters;
+    _Atomic long exhausted_total;
     backend_config_t config;
     health_checker_t health_checker;
     bool health_check_enabled;
@@ -100,10 +154,16 @@ typedef struct backend_pool_s {
 backend_pool_t* backend_pool_create(const char *host, int port, 
                                      bool tls_enabled, bool tls_verify,
                                      int pool_size);
+backend_pool_t* backend_pool_create_with_config(const char *host, int port,
+                                                 bool tls_enabled, bool tls_verify,
+                                                 const backend_pool_config_t *config);
 void backend_pool_destroy(backend_pool_t *pool);
 
-// Connection acquisition
+// Stream slot acquisition
 backend_conn_t* backend_pool_acquire(backend_pool_t *pool);
+backend_conn_t* backend_pool_acquire_timed(backend_pool_t *pool, int timeout_ms,
+                                            backend_acquire_result_t *result);
+int backend_pool_connect(backend_conn_t *conn);
 void backend_pool_release(backend_conn_t *conn);
 
 // Health tracking
@@ -114,6 +174,10 @@ backend_health_t backend_pool_get_health(backend_conn_t *conn);
 // Pool statistics
 int backend_pool_get_active_count(backend_pool_t *pool);
 int backend_pool_get_idle_count(backend_pool_t *pool);
+int backend_pool_get_stream_count(backend_pool_t *pool);
+int backend_pool_get_size(backend_pool_t *pool);
+int backend_pool_get_waiter_count(backend_pool_t *pool);
+long backend_pool_get_exhausted_total(backend_pool_t *pool);
 int backend_pool_get_healthy_count(backend_pool_t *pool);
 bool backend_pool_has_healthy_connection(backend_pool_t *pool);
 
@@ -121,6 +185,7 @@ bool backend_pool_has_healthy_connection(backend_pool_t *pool);
 int backend_pool_start_health_checker(backend_pool_t *pool, health_check_config_t *config);
 void backend_pool_stop_health_checker(backend_pool_t *pool);
 backend_health_t backend_pool_get_overall_health(backend_pool_t *pool);
+bool backend_pool_is_available(backend_pool_t *pool);
 
 // Circuit breaker
 int backend_pool_init_circuit_breaker(backend_pool_t *pool, circuit_breaker_config_t *config);
@@ -128,8 +193,10 @@ void backend_pool_destroy_circuit_breaker(backend_pool_t *pool);
 bool backend_pool_circuit_breaker_allow_request(backend_pool_t *pool);
 void backend_pool_circuit_breaker_record_success(backend_pool_t *pool);
 void backend_pool_circuit_breaker_record_failure(backend_pool_t *pool);
+void backend_pool_circuit_breaker_cancel_request(backend_pool_t *pool);
 circuit_breaker_state_t backend_pool_circuit_breaker_get_state(backend_pool_t *pool);
 int backend_pool_circuit_breaker_get_failure_count(backend_pool_t *pool);
+void backend_pool_circuit_breaker_get_window(backend_pool_t *pool, long *requests, long *failures);
 long backend_pool_circuit_breaker_get_total_opens(backend_pool_t *pool);
 long backend_pool_circuit_breaker_get_total_closes(backend_pool_t *pool);
 
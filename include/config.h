@@ -2,12 +2,47 @@
 #define CONFIG_H
 
 #define MAX_ROUTES 16
+#define MAX_ROUTE_BACKENDS 16
 #define MAX_LOG_LEVEL 16
+#define BACKEND_POOL_MAX_SIZE 1024
 #define BACKEND_POOL_DEFAULT_SIZE 10
+#define BACKEND_POOL_DEFAULT_MIN_SIZE 1
+#define BACKEND_POOL_DEFAULT_ACQUIRE_TIMEOUT_MS 1000
 #define BACKEND_POOL_IDLE_TIMEOUT_SEC 60
+#define WEBSOCKET_DEFAULT_IDLE_TIMEOUT_SEC 60
+#define RESPONSE_CACHE_CONFIG_DEFAULT_SIZE_MB 64
+#define RESPONSE_CACHE_CONFIG_DEFAULT_SHARDS 16
+#define RESPONSE_CACHE_CONFIG_DEFAULT_ENTRY_KB 1024
+#define RESPONSE_CACHE_CONFIG_DEFAULT_COALESCE_MS 5000
+#define RESPONSE_CACHE_CONFIG_DEFAULT_DISK_MB 1024
+#define RESPONSE_CACHE_CONFIG_DEFAULT_DISK_SLAB_KB 64
+#define RESPONSE_CACHE_CONFIG_DEFAULT_DISK_OBJECT_MB 64
+#define CIRCUIT_BREAKER_DEFAULT_FAILURE_THRESHOLD 5
+#define CIRCUIT_BREAKER_DEFAULT_RECOVERY_SEC 30
+#define CIRCUIT_BREAKER_DEFAULT_FAILURE_PERCENT 50
+#define CIRCUIT_BREAKER_DEFAULT_MIN_REQUESTS 20
+#define CIRCUIT_BREAKER_DEFAULT_WINDOW_SEC 10
+#define CIRCUIT_BREAKER_DEFAULT_SUCCESS_THRESHOLD 2
+#define CIRCUIT_BREAKER_DEFAULT_HALF_OPEN_REQUESTS 1
+#define OUTLIER_DEFAULT_CONSECUTIVE_5XX 5
+#define OUTLIER_DEFAULT_INTERVAL_SEC 10
+#define OUTLIER_DEFAULT_EJECTION_SEC 30
+#define OUTLIER_DEFAULT_MAX_EJECTION_PERCENT 10
+#define OUTLIER_DEFAULT_FAILURE_PERCENT 50
+#define OUTLIER_DEFAULT_MIN_REQUESTS 20
+#define OUTLIER_DEFAULT_LATENCY_FACTOR 3
+#define CONCURRENCY_DEFAULT_INITIAL_LIMIT 20
+#define CONCURRENCY_DEFAULT_MIN_LIMIT 5
+#define CONCURRENCY_DEFAULT_MAX_LIMIT 1000
+#define CONCURRENCY_DEFAULT_RTT_TOLERANCE_PERCENT 150
+#define CONCURRENCY_DEFAULT_SMOOTHING_PERCENT 20
+#define RETRY_DEFAULT_MAX_RETRIES 1
+#define RETRY_DEFAULT_BUDGET_PERCENT 20
+#define RETRY_DEFAULT_BUDGET_BURST 10
 #define MAX_SECURITY_HEADERS 10
 #define MAX_HEADER_NAME 64
 #define MAX_HEADER_VALUE 256
+#define MAX_AFFINITY_CPUS 256
 
 #include <limits.h>
 #include <stdbool.h>
@@ -23,17 +58,84 @@ typedef struct {
 } HealthCheckConfig;
 
 typedef struct {
-    int size;
+    int size;                   /* maximum connections (max_size) */
+    int min_size;               /* connections kept open while idle */
+    int acquire_timeout_ms;     /* how long a request waits for a free slot */
     int idle_timeout_seconds;
 } ConnectionPoolConfig;
 
+/* The breaker opens on 'failure_threshold' failures in a row, or on an
+ * error rate of 'failure_percent' over the last 'window_seconds' once that
+ * window holds 'minimum_requests'. Zeroes take the defaults, except that a
+ * 'failure_percent' of 0 turns the error rate off. */
 typedef struct {
     bool enabled;
     int failure_threshold;
     int recovery_timeout_seconds;
+    int failure_percent;
+    int minimum_requests;
+    int window_seconds;
+    int success_threshold;          /* probe successes in HALF_OPEN that close it */
+    int half_open_max_requests;     /* probes in flight at once in HALF_OPEN */
 } CircuitBreakerConfig;
 
-typedef struct backend_pool_s RouteBackendPool;
+/* Passive health: endpoints are judged by the responses they give to
+ * proxied requests and taken out of rotation for a while */
+typedef struct {
+    bool enabled;
+    int consecutive_5xx;            /* in a row, including failed exchanges; 0 = off */
+    int interval_seconds;           /* how often error rates and latencies are compared */
+    int base_ejection_time_seconds; /* multiplied by the times ejected before */
+    int max_ejection_percent;       /* of the cluster; one endpoint can always go */
+    int failure_percent;            /* share of 5xx in an interval; 0 = off */
+    int min_requests;               /* for an interval to count for an endpoint */
+    int latency_factor;             /* p95 over this times the cluster median; 0 = off */
+} OutlierDetectionConfig;
+
+/* Adaptive limit on the requests in flight to each endpoint (gradient2):
+ * it grows while response times hold and shrinks once they rise, and
+ * requests over it are answered 503 at once */
+typedef struct {
+    bool enabled;
+    int initial_limit;
+    int min_limit;
+    int max_limit;
+    int rtt_tolerance_percent;      /* latency growth tolerated before the limit shrinks */
+    int smoothing_percent;          /* weight of each new estimate */
+} ConcurrencyLimitConfig;
+
+/* Resending idempotent requests that failed, and hedging slow ones. Both
+ * draw on one budget that grows with the route's traffic, so retries
+ * cannot multiply the load on a backend that is already failing. */
+typedef struct {
+    bool enabled;
+    int max_retries;                /* extra attempts per request */
+    int budget_percent;             /* retries and hedges allowed, as a share of requests */
+    int budget_burst;               /* retries that may be spent at once */
+    bool hedge;                     /* send a second request when the first is slow */
+    int hedge_delay_ms;             /* 0 = the route's p95 time to response headers */
+} RetryPolicyConfig;
+
+typedef struct {
+    bool enabled;
+    int ttl_seconds;            /* > 0 replaces the lifetime the backend declares */
+    int coalesce_timeout_ms;    /* how long a miss waits on an identical fetch; 0 = never */
+    int stale_while_revalidate_seconds; /* expired entries served while one request refreshes */
+    int stale_if_error_seconds; /* expired entries served when the backend fails */
+} RouteCacheConfig;
+
+typedef enum {
+    LB_ROUND_ROBIN = 0,
+    LB_LEAST_REQUEST,
+    LB_P2C,
+    LB_EWMA,
+    LB_MAGLEV
+} LoadBalancerPolicy;
+
+typedef struct upstream_cluster_s RouteCluster;
+typedef struct resolver_endpoint_s RouteEndpoint;
+typedef struct http1_pool_s RouteHttp1Pool;
+typedef struct response_cache_s RouteResponseCache;
 
 typedef struct {
     char name[MAX_HEADER_NAME];
@@ -61,17 +163,30 @@ typedef struct {
     char document_root[256];
     char document_root_real[PATH_MAX];
     int document_root_resolved;
-    char backend[64];
+    char backend[64];               /* first entry of 'backends' */
+    char backends[MAX_ROUTE_BACKENDS][64];
+    int backend_count;
+    LoadBalancerPolicy load_balancer;
+    char hash_header[MAX_HEADER_NAME];  /* Maglev key; empty = request path */
     bool http2_enabled;
     bool tls_enabled;
     bool tls_verify;
+    bool websocket_enabled;             /* proxy Upgrade: websocket and RFC 8441 CONNECT */
+    int websocket_idle_timeout_seconds; /* close a tunnel after this long without traffic */
     HealthCheckConfig health_check;
     ConnectionPoolConfig connection_pool;
     CircuitBreakerConfig circuit_breaker;
+    OutlierDetectionConfig outlier_detection;
+    RetryPolicyConfig retry;
+    ConcurrencyLimitConfig concurrency_limit;
     SecurityHeadersConfig security_headers;
     bool inherit_global_headers;
     CORSConfig cors;
-    RouteBackendPool *pool;
+    RouteCacheConfig cache;
+    RouteCluster *cluster;
+    RouteEndpoint *endpoint;        /* 'backend' resolved at startup */
+    RouteHttp1Pool *h1_pool;        /* keep-alive connections for HTTP/1.1 clients */
+    RouteResponseCache *response_cache; /* shared cache when 'cache.enabled' */
 } Route;
 
 typedef struct {
@@ -91,6 +206,27 @@ typedef struct {
     int max_concurrent_streams;
 } HTTP2Config;
 
+/* Shared by every route with 'cache.enabled' */
+typedef struct {
+    int max_size_mb;
+    int shards;
+    int max_entry_size_kb;      /* larger bodies go to the disk tier, if any */
+    char disk_path[256];        /* disk tier file; empty keeps the cache in memory */
+    int disk_size_mb;
+    int disk_slab_kb;
+    int disk_max_object_mb;     /* larger bodies are relayed but not stored */
+} ResponseCacheConfig;
+
+typedef struct {
+    bool enabled;
+    char worker_cpus[256];   // cpulist, e.g. "2-15,18-31"; empty = inherit
+    int worker_cpu_list[MAX_AFFINITY_CPUS];
+    int worker_cpu_count;
+    int acceptor_cpu;        // -1 = not pinned
+    int logger_cpu;
+    int metrics_cpu;
+} CPUAffinityConfig;
+
 typedef struct {
     int port;
     int max_connections;
@@ -105,6 +241,8 @@ typedef struct {
     SSLConfig ssl;
     HTTP2Config http2;
     SecurityHeadersConfig security_headers;
+    CPUAffinityConfig cpu_affinity;
+    ResponseCacheConfig response_cache;
 } ServerConfig;
 
 int load_config(ServerConfig *config, const char *file_path);
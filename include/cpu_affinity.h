@@ -0,0 +1,25 @@
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#include <pthread.h>
+#include <sched.h>
+
+struct io_uring;
+
+/* Parses a Linux cpulist ("0-3,8,10-11") into 'cpus', at most 'max_cpus'
+ * of them (MAX_AFFINITY_CPUS from config.h for configured lists).
+ * Returns the number of CPUs parsed, or -1 on syntax error / overflow. */
+int cpu_affinity_parse_list(const char *list, int *cpus, int max_cpus);
+
+/* Removes CPUs the process is not allowed to run on from 'cpus' (logging each
+ * one dropped). Returns the number of CPUs left. */
+int cpu_affinity_filter_available(int *cpus, int count);
+
+/* Pins 'thread' to a single CPU. Returns 0 on success, -1 on failure. */
+int cpu_affinity_pin_thread(pthread_t thread, int cpu);
+
+/* Restricts io_uring async workers (io-wq) of 'ring' to the CPUs the calling
+ * thread is allowed to run on, so offloaded work stays on the same node. */
+int cpu_affinity_bind_ring(struct io_uring *ring);
+
+#endif // CPU_AFFINITY_H
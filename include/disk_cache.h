@@ -0,0 +1,85 @@
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#define DISK_CACHE_DEFAULT_SLAB_KB 64
+#define DISK_CACHE_BUCKETS 4096
+/* Entries waiting for the writer; more are dropped rather than queued */
+#define DISK_CACHE_WRITE_QUEUE_SIZE 256
+
+struct response_cache_entry_s;
+struct disk_cache_s;
+
+/* Tells whether a stored variant answers the request in 'ctx' */
+typedef bool (*disk_cache_match_fn)(const struct response_cache_entry_s *entry, const void *ctx);
+
+/* One response written to the file. Only this index lives in memory; the
+ * key, headers and body are read from the mapping. */
+typedef struct disk_cache_record_s {
+    struct disk_cache_s *owner;
+    unsigned long hash;
+    size_t offset;                      /* slab aligned */
+    size_t length;                      /* strings, then body */
+    size_t key_len;
+    size_t strings_len;
+    size_t body_len;
+    int header_count;
+    int vary_count;
+    int status;
+    const char *reason;
+    time_t stored_at;                   /* CLOCK_MONOTONIC seconds */
+    time_t expires_at;
+    long initial_age;
+    long stale_while_revalidate;
+    long stale_if_error;
+    int pins;                           /* entries served from the mapping */
+    struct disk_cache_record_s *chain;  /* hash bucket, newest first */
+    struct disk_cache_record_s *next;   /* write order, oldest first */
+} disk_cache_record_t;
+
+/* A ring of slabs in one preallocated, mapped file. Writes go round it in
+ * order and overwrite the oldest records; a record being served is never
+ * overwritten. */
+typedef struct disk_cache_s {
+    int fd;
+    char *map;
+    size_t size;
+    size_t slab_size;
+    size_t max_object_size;
+    size_t head;                        /* where the next record goes */
+    pthread_mutex_t lock;
+    disk_cache_record_t *buckets[DISK_CACHE_BUCKETS];
+    disk_cache_record_t *oldest;
+    disk_cache_record_t *newest;
+
+    /* Write-behind: the writer thread copies queued entries into the map */
+    pthread_t writer;
+    pthread_cond_t queued;
+    pthread_cond_t drained;
+    struct response_cache_entry_s *queue[DISK_CACHE_WRITE_QUEUE_SIZE];
+    int queue_head;
+    int queue_len;
+    bool writing;
+    bool stopping;
+
+    _Atomic long writes;
+    _Atomic long dropped;
+    _Atomic long evictions;
+} disk_cache_t;
+
+disk_cache_t *disk_cache_create(const char *path, size_t size, size_t slab_size, size_t max_object_size);
+void disk_cache_destroy(disk_cache_t *disk);
+
+bool disk_cache_store(disk_cache_t *disk, struct response_cache_entry_s *entry);
+void disk_cache_flush(disk_cache_t *disk);
+struct response_cache_entry_s *disk_cache_lookup(disk_cache_t *disk, unsigned long hash,
+                                                 const char *key, size_t key_len,
+                                                 disk_cache_match_fn match, const void *ctx);
+void disk_cache_unpin(disk_cache_record_t *record);
+
+#endif // DISK_CACHE_H
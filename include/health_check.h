@@ -0,0 +1,17 @@
+#ifndef HEALTH_CHECK_H
+#define HEALTH_CHECK_H
+
+#include "backend_pool.h"
+
+/* Next check: the interval, give or take this share of it, so checks of
+ * many pools do not line up */
+#define HEALTH_CHECK_JITTER_PERCENT 10
+#define HEALTH_CHECK_MAX_EVENTS 64
+/* Bytes of HTTP/2 frames a probe may have queued for the socket */
+#define HEALTH_CHECK_OUTPUT_SIZE 4096
+
+int health_check_register(health_checker_t *checker);
+void health_check_unregister(health_checker_t *checker);
+void health_check_shutdown(void);
+
+#endif // HEALTH_CHECK_H
@@ -0,0 +1,82 @@
+#ifndef HTTP1_CLIENT_H
+#define HTTP1_CLIENT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+#include "http_parser.h"
+#include "resolver.h"
+
+#define HTTP1_CLIENT_HEAD_BUFFER_SIZE 16384
+#define HTTP1_CLIENT_IO_BUFFER_SIZE 16384
+#define HTTP1_CLIENT_RESPONSE_TIMEOUT_MS 30000
+
+typedef enum {
+    HTTP1_BODY_NONE = 0,
+    HTTP1_BODY_LENGTH,          /* Content-Length */
+    HTTP1_BODY_CHUNKED,         /* Transfer-Encoding: chunked */
+    HTTP1_BODY_UNTIL_CLOSE      /* response without framing, ends at EOF */
+} http1_body_kind_t;
+
+/* Finds the end of a message body as it streams past. The bytes are not
+ * altered, so chunked bodies are relayed with their framing intact. */
+typedef struct {
+    http1_body_kind_t kind;
+    unsigned long long remaining;   /* LENGTH: body left; CHUNKED: chunk data left */
+    int chunk_state;
+    bool done;
+} http1_body_t;
+
+typedef struct {
+    int status;
+    int minor_version;
+    bool keep_alive;            /* upstream accepts another request on the connection */
+    size_t head_len;            /* status line and headers, body follows */
+    http1_body_t body;
+} http1_response_head_t;
+
+typedef struct {
+    int fd;
+    time_t idle_since;
+} http1_idle_conn_t;
+
+/* Keep-alive connections to one plaintext HTTP/1.1 backend. Idle sockets
+ * are reused most recent first, so the oldest ones age out under light load. */
+typedef struct http1_pool_s {
+    resolver_endpoint_t *endpoint;
+    char authority[64];                 /* host:port, sent as Host */
+    pthread_mutex_t lock;
+    http1_idle_conn_t *idle;            /* oldest first */
+    int idle_count;
+    int max_idle;
+    int idle_timeout_seconds;
+    _Atomic long connects;
+    _Atomic long reuses;
+} http1_pool_t;
+
+// Connection pool
+http1_pool_t *http1_pool_create(resolver_endpoint_t *endpoint, const char *authority,
+                                int max_idle, int idle_timeout_seconds);
+void http1_pool_destroy(http1_pool_t *pool);
+int http1_pool_acquire(http1_pool_t *pool, bool *reused);
+void http1_pool_release(http1_pool_t *pool, int fd, bool reusable);
+int http1_pool_connect(http1_pool_t *pool);
+
+// Message framing
+bool http1_is_hop_by_hop(const char *name, size_t name_len);
+bool http1_request_upgrades_to(const HttpRequest *req, const char *protocol);
+int http1_build_request_head(const HttpRequest *req, const char *authority, const char *upgrade,
+                             char *out, size_t out_size, http1_body_t *body);
+int http1_parse_response_head(const char *buf, size_t len, const char *method,
+                              http1_response_head_t *head);
+const char *http1_response_header(const char *head, size_t head_len, const char *name,
+                                  size_t *value_len);
+int http1_rewrite_response_head(const char *head, size_t head_len, bool chunk_body,
+                                char *out, size_t out_size);
+void http1_body_init(http1_body_t *body, http1_body_kind_t kind, unsigned long long length);
+ssize_t http1_body_consume(http1_body_t *body, const char *data, size_t len);
+
+#endif // HTTP1_CLIENT_H
@@ -3,59 +3,142 @@
 
 #include <nghttp2/nghttp2.h>
 #include <openssl/ssl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <sys/types.h>
 #include "config.h"
+#include "resolver.h"
 
-#define HTTP2_CLIENT_MAX_HEADERS 32
-#define HTTP2_CLIENT_BUFFER_SIZE 65536
+#define HTTP2_CLIENT_MAX_HEADERS 64
+/* Room for one response's header names and values; also advertised as
+ * SETTINGS_MAX_HEADER_LIST_SIZE. A response that does not fit is reset. */
+#define HTTP2_CLIENT_HEADER_ARENA_SIZE 16384
 
+/* Receive window per stream. Response bytes are credited back to the
+ * backend only as the caller reads them, so this is also the most a slow
+ * reader keeps buffered. The connection window covers every stream. */
+#define HTTP2_CLIENT_STREAM_WINDOW (256 * 1024)
+#define HTTP2_CLIENT_CONNECTION_WINDOW (HTTP2_CLIENT_MAX_STREAMS * HTTP2_CLIENT_STREAM_WINDOW)
+
+/* http2_client_read(): nothing buffered yet, try again later */
+#define HTTP2_CLIENT_AGAIN (-2)
+
+/* Upper bound on concurrent streams per connection, whatever the peer advertises */
+#define HTTP2_CLIENT_MAX_STREAMS 100
+#define HTTP2_CLIENT_RESPONSE_TIMEOUT_MS 30000
+
+/* One received DATA payload, queued until the caller reads it */
+typedef struct http2_body_chunk_s {
+    struct http2_body_chunk_s *next;
+    size_t off;
+    size_t len;
+    uint8_t data[];
+} http2_body_chunk_t;
+
+/* Per-request state. A stream is owned by the caller that submitted it and
+ * must stay valid until http2_client_release() was called for it. */
 typedef struct {
-    SSL *ssl;
-    int socket_fd;
-    nghttp2_session *session;
-    nghttp2_session_callbacks *callbacks;
-    
+    int32_t stream_id;
+    nghttp2_session *session;           /* connection the stream was opened on */
+
     // Request state
-    const char *method;
-    const char *path;
-    const char *host;
     const char *request_body;
     size_t request_body_len;
     size_t body_sent;
-    
+
     // Response state
-    char response_buffer[HTTP2_CLIENT_BUFFER_SIZE];
-    size_t response_received;
+    http2_body_chunk_t *body_head;      /* received and not yet read */
+    http2_body_chunk_t *body_tail;
+    size_t response_received;           /* DATA bytes received so far */
+    size_t body_read;                   /* of which the caller has taken */
+    size_t body_consumed;               /* of which credited to the flow-control windows */
+    bool consume_on_receive;            /* awaited whole: keep the window open */
     int response_status;
     char response_status_text[64];
-    char response_headers[HTTP2_CLIENT_MAX_HEADERS][256];
+    /* Final response headers without hop-by-hop ones, as received. The
+     * entries point into header_arena and can be submitted as they are. */
+    nghttp2_nv response_headers[HTTP2_CLIENT_MAX_HEADERS];
     size_t response_header_count;
-    
+    char header_arena[HTTP2_CLIENT_HEADER_ARENA_SIZE];
+    size_t header_arena_used;
+
+    int headers_done;                   /* final (non-1xx) response HEADERS arrived */
+    int done;
+    int error_code;
+} http2_stream_t;
+
+/* One HTTP/2 connection shared by any number of streams. 'lock' serialises
+ * access to the nghttp2 session and SSL object; one waiter at a time drives
+ * the socket while the others sleep on 'cond'. */
+typedef struct {
+    SSL *ssl;
+    int socket_fd;
+    nghttp2_session *session;
+    nghttp2_session_callbacks *callbacks;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool io_active;                     /* a waiter is polling the socket */
+    _Atomic bool broken;                /* connection failed, no new streams */
+    _Atomic int max_concurrent_streams; /* peer SETTINGS, capped at HTTP2_CLIENT_MAX_STREAMS */
+
     // Connection state
     int want_read;
     int want_write;
-    int done;
-    int error_code;
+
+    /* Stream used by the single-request API (send_request/recv_response) */
+    http2_stream_t default_stream;
 } http2_client_t;
 
+/* TLS state shared by every connection to one backend: a single SSL_CTX
+ * (the CA bundle is loaded once) and the newest session ticket, so
+ * reconnects resume instead of running a full handshake */
+typedef struct {
+    SSL_CTX *ctx;
+    pthread_mutex_t lock;
+    SSL_SESSION *session;
+    _Atomic long handshakes;
+    _Atomic long resumed;
+} http2_client_tls_t;
+
 typedef struct {
     char host[256];
     int port;
     bool tls_enabled;
     bool tls_verify;
+    http2_client_tls_t *tls;            /* shared context; NULL = one per connection */
+    resolver_endpoint_t *endpoint;      /* cached addresses; NULL = look up 'host' */
 } backend_config_t;
 
 // Lifecycle functions
 int http2_client_init(http2_client_t *client, const backend_config_t *backend);
 int http2_client_connect(http2_client_t *client, const backend_config_t *backend);
-int http2_client_send_request(http2_client_t *client, const char *method, 
+int http2_client_send_request(http2_client_t *client, const char *method,
                                const char *path, const char *host,
                                const char *body, size_t body_len);
 int http2_client_recv_response(http2_client_t *client);
+void http2_client_disconnect(http2_client_t *client);
 void http2_client_cleanup(http2_client_t *client);
 
+// Shared client TLS context
+http2_client_tls_t *http2_client_tls_create(bool verify_certs);
+void http2_client_tls_destroy(http2_client_tls_t *tls);
+
+// Multiplexed streams (thread-safe)
+int http2_client_submit(http2_client_t *client, http2_stream_t *stream,
+                        const char *method, const char *path, const char *host,
+                        const char *body, size_t body_len);
+int http2_client_await(http2_client_t *client, http2_stream_t *stream, int timeout_ms);
+int http2_client_await_headers(http2_client_t *client, http2_stream_t *stream, int timeout_ms);
+int http2_client_poll_headers(http2_client_t *client, http2_stream_t *stream, int timeout_ms);
+ssize_t http2_client_read(http2_client_t *client, http2_stream_t *stream, uint8_t *buf, size_t len);
+bool http2_client_stream_ready(http2_client_t *client, http2_stream_t *stream);
+void http2_client_release(http2_client_t *client, http2_stream_t *stream);
+bool http2_client_is_connected(http2_client_t *client);
+int http2_client_get_max_streams(http2_client_t *client);
+
 // Helper functions
-const char* http2_client_get_response_body(http2_client_t *client);
 size_t http2_client_get_response_length(http2_client_t *client);
 int http2_client_get_response_status(http2_client_t *client);
 bool http2_client_is_done(http2_client_t *client);
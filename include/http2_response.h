@@ -7,6 +7,9 @@
 
 #define MAKE_NV(NAME, VALUE) (nghttp2_nv){(uint8_t *)(NAME), (uint8_t *)(VALUE), strlen(NAME), strlen(VALUE), NGHTTP2_NV_FLAG_NONE}
 
+struct proxy_stream_s;
+struct response_cache_entry_s;
+
 typedef struct Http2Response {
     nghttp2_nv headers[16];
     size_t num_headers;
@@ -17,6 +20,8 @@ typedef struct Http2Response {
     char content_length_str[32];
     char status_text[32];
     char content_type[64];
+    struct proxy_stream_s *upstream;    /* body still arriving from a backend; 'body' unused */
+    struct response_cache_entry_s *cached;  /* served from the response cache; 'body' unused */
 } Http2Response;
 
 void h2_response_init(Http2Response *resp);
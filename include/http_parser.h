@@ -4,6 +4,7 @@
 #include <stddef.h>
 
 #define MAX_HEADERS 20
+#define HTTP_CLIENT_ADDR_LEN 46     /* INET6_ADDRSTRLEN */
 
 typedef struct Http2Response Http2Response;
 
@@ -19,12 +20,18 @@ typedef struct {
     int header_count;
     HttpHeader headers[MAX_HEADERS];
     char request_id[37];
+    size_t head_len;                /* request line and headers, body follows */
+    char client_addr[HTTP_CLIENT_ADDR_LEN];
 } HttpRequest;
 
+struct websocket_stream_s;
+
 typedef struct {
     HttpRequest req;
     Http2Response *resp;
     size_t resp_sent;
+    char *protocol;                     /* :protocol of an extended CONNECT (RFC 8441) */
+    struct websocket_stream_s *ws;      /* bridged backend once the CONNECT succeeded */
 } StreamData;
 
 int parse_http_request(char *buffer, size_t len, HttpRequest *req);
@@ -15,6 +15,9 @@ int log_init(const LoggingConfig *config);
 /* Invia un messaggio di log; il formato è come printf */
 void log_message(LogLevel level, const char *format, ...);
 
+/* Pins the logger thread to 'cpu'; returns 0 on success */
+int log_set_thread_affinity(int cpu);
+
 /* Termina il logger e libera le risorse */
 void log_shutdown(void);
 
@@ -79,6 +79,7 @@ void metrics_init(void);
 void metrics_shutdown(void);
 int metrics_start_server(int port);
 void metrics_stop_server(void);
+int metrics_set_server_thread_affinity(int cpu);
 
 void metrics_increment_request(const char *method, const char *path, int status);
 void metrics_record_request_duration(double duration_seconds);
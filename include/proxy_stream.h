@@ -0,0 +1,41 @@
+#ifndef PROXY_STREAM_H
+#define PROXY_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include "backend_pool.h"
+#include "http2_client.h"
+#include "response_cache.h"
+#include "upstream.h"
+
+/* A backend response whose body is relayed to an HTTP/2 client as it
+ * arrives. It keeps the backend stream, and the pool slot or private
+ * connection carrying it, until the client's stream ends. */
+typedef struct proxy_stream_s {
+    http2_client_t *client;
+    http2_stream_t *stream;
+    backend_conn_t *conn;               /* pool slot; NULL = 'client' is private */
+    upstream_endpoint_t *endpoint;      /* cluster member to report back to, or NULL */
+    long latency_us;                    /* time until the response headers arrived */
+    response_cache_t *cache;
+    response_cache_entry_t *fill;       /* copy of the body being stored, or NULL */
+    int32_t stream_id;                  /* client stream the body goes out on */
+    bool waiting;                       /* deferred until the backend sends more */
+    bool complete;                      /* the whole body was relayed */
+    bool failed;                        /* the backend reset, dropped or stalled it */
+    struct timespec last_activity;
+    struct proxy_stream_s *next;
+} proxy_stream_t;
+
+proxy_stream_t *proxy_stream_create(http2_client_t *client, http2_stream_t *stream,
+                                    backend_conn_t *conn);
+ssize_t proxy_stream_read(proxy_stream_t *ps, uint8_t *buf, size_t len);
+bool proxy_stream_ready(proxy_stream_t *ps);
+int proxy_stream_fd(const proxy_stream_t *ps);
+bool proxy_stream_idle(const proxy_stream_t *ps, int timeout_ms);
+void proxy_stream_close(proxy_stream_t *ps);
+
+#endif // PROXY_STREAM_H
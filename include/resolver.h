@@ -0,0 +1,45 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#define RESOLVER_MAX_ADDRS 8
+#define RESOLVER_DEFAULT_TTL_SEC 30     /* when the record TTL is unknown */
+#define RESOLVER_MIN_TTL_SEC 1
+#define RESOLVER_MAX_TTL_SEC 300
+#define RESOLVER_RETRY_SEC 1            /* after a failed lookup */
+#define RESOLVER_CONNECT_ATTEMPT_DELAY_MS 250   /* RFC 8305 section 5 */
+#define RESOLVER_CONNECT_TIMEOUT_MS 5000
+
+typedef struct {
+    struct sockaddr_storage addrs[RESOLVER_MAX_ADDRS];
+    socklen_t addr_lens[RESOLVER_MAX_ADDRS];
+    int count;
+} resolved_addrs_t;
+
+/* A backend host:port resolved ahead of the request path. Entries live for
+ * the whole process; hostname entries are re-resolved in the background
+ * when their TTL runs out, and keep serving the last good addresses if a
+ * refresh fails. */
+typedef struct resolver_endpoint_s {
+    char host[256];
+    int port;
+    bool numeric;                       /* IP literal, never re-resolved */
+    pthread_mutex_t lock;
+    resolved_addrs_t addrs;             /* IPv6 and IPv4 interleaved, RFC 8305 order */
+    time_t expires_at;
+    _Atomic long refreshes;
+    _Atomic long failures;
+    struct resolver_endpoint_s *next;
+} resolver_endpoint_t;
+
+resolver_endpoint_t *resolver_get_endpoint(const char *host, int port);
+int resolver_endpoint_addrs(resolver_endpoint_t *endpoint, resolved_addrs_t *out);
+int resolver_connect(resolver_endpoint_t *endpoint, int timeout_ms);
+void resolver_shutdown(void);
+
+#endif // RESOLVER_H
@@ -0,0 +1,154 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include "disk_cache.h"
+#include "http_parser.h"
+
+#define RESPONSE_CACHE_DEFAULT_MAX_SIZE_MB 64
+#define RESPONSE_CACHE_DEFAULT_SHARDS 16
+#define RESPONSE_CACHE_DEFAULT_MAX_ENTRY_KB 1024
+#define RESPONSE_CACHE_MAX_SHARDS 256
+#define RESPONSE_CACHE_BUCKETS_PER_SHARD 1024
+#define RESPONSE_CACHE_MAX_HEADERS 64
+#define RESPONSE_CACHE_MAX_VARY 4
+/* Share of a shard's bytes kept for entries that were hit again */
+#define RESPONSE_CACHE_PROTECTED_PERCENT 80
+
+/* A response header as seen by the cache; the bytes are not owned */
+typedef struct {
+    const char *name;
+    size_t name_len;
+    const char *value;
+    size_t value_len;
+} response_cache_header_t;
+
+struct response_cache_shard_s;
+
+/* A backend fetch other requests for the same key wait on instead of
+ * sending their own (single flight). It lands when the leader's response
+ * was stored or turned out not to be storable. */
+typedef struct response_cache_flight_s {
+    unsigned long hash;
+    char *key;
+    size_t key_len;
+    pthread_t leader;
+    int waiters;
+    bool landed;
+    pthread_cond_t landed_cond;
+    struct response_cache_shard_s *shard;
+    struct response_cache_flight_s *next;
+} response_cache_flight_t;
+
+/* One stored response. Entries never change once committed and are
+ * reference counted, so a hit can be served after the lock is dropped
+ * and while the entry is evicted under it. */
+typedef struct response_cache_entry_s {
+    _Atomic int refs;
+    unsigned long hash;
+    char *key;                          /* method, authority and path, NUL separated */
+    size_t key_len;
+    int status;
+    const char *reason;
+    time_t stored_at;                   /* CLOCK_MONOTONIC seconds */
+    time_t expires_at;
+    long initial_age;                   /* Age the backend reported */
+    long stale_while_revalidate;        /* seconds past expiry served while refreshing; -1 = unset */
+    long stale_if_error;                /* seconds past expiry served when the backend fails; -1 = unset */
+    response_cache_header_t *headers;
+    int header_count;
+    response_cache_header_t *vary;      /* request headers the response varies on */
+    int vary_count;
+    char *blob;                         /* header arrays, then key, header and vary bytes */
+    char *body;                         /* in the disk tier's mapping when 'disk_record' is set */
+    size_t body_len;
+    size_t body_cap;
+    size_t max_body;
+    size_t size;                        /* bytes charged against the cache */
+    response_cache_flight_t *flight;    /* landed once this fill is committed or dropped */
+    disk_cache_record_t *disk_record;   /* pinned while a disk hit is served */
+    bool protected_segment;
+    struct response_cache_entry_s *chain;
+    struct response_cache_entry_s *prev;
+    struct response_cache_entry_s *next;
+} response_cache_entry_t;
+
+/* Segmented LRU: new entries start on probation and move to the protected
+ * segment when hit again, so one-off responses are evicted first */
+typedef struct response_cache_shard_s {
+    pthread_mutex_t lock;
+    response_cache_entry_t *buckets[RESPONSE_CACHE_BUCKETS_PER_SHARD];
+    response_cache_flight_t *flights;   /* fetches in progress for missed keys */
+    response_cache_entry_t *probation;  /* most recent first */
+    response_cache_entry_t *probation_tail;
+    response_cache_entry_t *protected_head;
+    response_cache_entry_t *protected_tail;
+    size_t probation_bytes;
+    size_t protected_bytes;
+    size_t capacity;
+} response_cache_shard_t;
+
+typedef struct {
+    long hits;
+    long misses;
+    long stores;
+    long evictions;
+    long coalesced;
+    long stale;
+    long entries;
+    long bytes;
+    long disk_hits;
+    long disk_writes;
+    long disk_dropped;
+} response_cache_stats_t;
+
+typedef struct response_cache_s {
+    response_cache_shard_t *shards;
+    int shard_count;
+    size_t max_entry_size;
+    disk_cache_t *disk;                 /* second tier, or NULL */
+    _Atomic long hits;
+    _Atomic long misses;
+    _Atomic long stores;
+    _Atomic long evictions;
+    _Atomic long coalesced;
+    _Atomic long stale;
+    _Atomic long disk_hits;
+} response_cache_t;
+
+response_cache_t *response_cache_create(size_t max_bytes, int shards, size_t max_entry_size);
+void response_cache_destroy(response_cache_t *cache);
+int response_cache_enable_disk(response_cache_t *cache, const char *path, size_t size, size_t slab_size,
+                               size_t max_object_size);
+
+// Serving
+response_cache_entry_t *response_cache_lookup(response_cache_t *cache, const HttpRequest *req);
+long response_cache_age(const response_cache_entry_t *entry);
+void response_cache_release(response_cache_entry_t *entry);
+
+// Single flight
+response_cache_entry_t *response_cache_lookup_coalesced(response_cache_t *cache, const HttpRequest *req,
+                                                        int wait_ms, response_cache_flight_t **flight);
+void response_cache_attach_flight(response_cache_entry_t *fill, response_cache_flight_t *flight);
+void response_cache_land(response_cache_flight_t *flight);
+
+// Serving stale (RFC 5861)
+response_cache_entry_t *response_cache_lookup_stale(response_cache_t *cache, const HttpRequest *req);
+bool response_cache_is_stale(const response_cache_entry_t *entry);
+
+// Storing
+response_cache_entry_t *response_cache_begin(response_cache_t *cache, const HttpRequest *req,
+                                             int status, const response_cache_header_t *headers,
+                                             int header_count, int ttl_override_seconds);
+void response_cache_default_stale(response_cache_entry_t *entry, long while_revalidate_seconds,
+                                  long if_error_seconds);
+int response_cache_append(response_cache_entry_t *entry, const void *data, size_t len);
+void response_cache_commit(response_cache_t *cache, response_cache_entry_t *entry);
+
+void response_cache_get_stats(response_cache_t *cache, response_cache_stats_t *stats);
+
+#endif // RESPONSE_CACHE_H
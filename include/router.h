@@ -4,10 +4,16 @@
 #include "config.h"
 #include "http2_response.h"
 #include "http_parser.h" 
+#include "websocket.h"
 #include <openssl/ssl.h>
- 
+
+/* The exchange left the client connection out of sync; close it */
+#define ROUTE_CLOSE_CONNECTION -2
+
 int serve_static_tls(HttpRequest *req, ServerConfig *config, SSL *ssl);
 int proxy_bidirectional_tls(SSL *ssl, int backend_fd);
 int proxy_request_tls(HttpRequest *req, const char *raw_request, size_t req_len, ServerConfig *config, SSL *ssl);
 int route_request_tls(HttpRequest *req, const char *raw, size_t raw_len, ServerConfig *config, SSL *ssl, Http2Response *h2resp);
+int route_websocket_h2(HttpRequest *req, ServerConfig *config, websocket_stream_t **out);
+void router_shutdown(void);
 #endif
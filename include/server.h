@@ -31,7 +31,7 @@ typedef struct {
 
 extern shutdown_context_t g_shutdown_ctx;
 
-void handle_client(int client_fd, ServerConfig *config, struct io_uring *ring);
+void handle_client(int client_fd, ServerConfig *config);
 int start_server(ServerConfig *config);
 
 #endif
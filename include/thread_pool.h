@@ -23,7 +23,14 @@ typedef struct ThreadPool ThreadPool;
 // Creates a thread pool with at least 'min_threads' and at most 'max_threads' worker threads.
 ThreadPool *thread_pool_create(size_t min_threads, size_t max_threads);
 
-// Adds a task to the thread pool; returns true if the task was added.
+// Like thread_pool_create(), but worker N is pinned to cpus[N % cpu_count].
+// With cpus == NULL workers keep the affinity of the calling thread.
+ThreadPool *thread_pool_create_pinned(size_t min_threads, size_t max_threads,
+                                      const int *cpus, size_t cpu_count);
+
+// Adds a task to the thread pool; returns false if the pool is shutting down or
+// its bounded injection queue is full. Tasks submitted from a worker thread go
+// to that worker's local deque and may be stolen by idle peers.
 bool thread_pool_add_task(ThreadPool *pool, void (*function)(void *), void *arg);
 
 // Destroys the thread pool and cleans up resources.
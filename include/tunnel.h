@@ -0,0 +1,24 @@
+#ifndef TUNNEL_H
+#define TUNNEL_H
+
+#include <openssl/ssl.h>
+#include <stdbool.h>
+
+#define TUNNEL_BUFFER_SIZE 16384
+#define TUNNEL_DEFAULT_IDLE_TIMEOUT_MS 60000
+/* Buffers moved in one direction before the other gets a turn */
+#define TUNNEL_MAX_BURST 4
+
+typedef struct {
+    unsigned long long bytes_to_backend;
+    unsigned long long bytes_to_client;
+    bool idle_timeout;                  /* ended because nothing moved */
+} tunnel_stats_t;
+
+/* Relays bytes between a TLS client and a connected backend socket in both
+ * directions at once until either side closes, an error occurs, or nothing
+ * moves for idle_timeout_ms (0 = no limit). Returns 0 when the tunnel ran,
+ * -1 when it could not start. Neither connection is closed. */
+int tunnel_relay(SSL *ssl, int backend_fd, int idle_timeout_ms, tunnel_stats_t *stats);
+
+#endif // TUNNEL_H
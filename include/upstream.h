@@ -0,0 +1,135 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "backend_pool.h"
+#include "config.h"
+
+/* Maglev lookup table size; prime and much larger than MAX_ROUTE_BACKENDS so
+ * each endpoint owns ~M/N slots and losing one moves only its own keys */
+#define UPSTREAM_MAGLEV_TABLE_SIZE 65537
+/* Latency smoothing: ewma += (sample - ewma) / 2^SHIFT */
+#define UPSTREAM_EWMA_SHIFT 3
+/* Latency recorded for a failed request, so fast failures do not make an
+ * endpoint look attractive */
+#define UPSTREAM_EWMA_FAILURE_PENALTY_US 1000000L
+/* Latency histogram for outlier detection: 4 buckets per power of two of
+ * microseconds, up to about 2^31 us */
+#define UPSTREAM_LATENCY_SUB_BUCKETS 4
+#define UPSTREAM_LATENCY_BUCKETS (32 * UPSTREAM_LATENCY_SUB_BUCKETS)
+#define UPSTREAM_LATENCY_PERCENTILE 95
+/* Ejections beyond this many in a row do not lengthen the next one */
+#define UPSTREAM_MAX_EJECTION_MULTIPLIER 10
+/* Adaptive concurrency limit (gradient2). Response times are averaged over
+ * about this many responses: the long average is the latency baseline,
+ * the short one the latency now. */
+#define UPSTREAM_LIMIT_SHORT_WINDOW 10
+#define UPSTREAM_LIMIT_LONG_WINDOW 600
+/* Requests allowed to queue at the backend; how fast the limit grows */
+#define UPSTREAM_LIMIT_QUEUE_SIZE 4
+/* Share of the limit kept after a failed exchange */
+#define UPSTREAM_LIMIT_BACKOFF_PERCENT 90
+/* The retry budget is kept in thousandths of a retry */
+#define UPSTREAM_RETRY_TOKEN 1000
+/* The hedge delay (p95) is recomputed every this many responses, and the
+ * latency histogram halved once it holds the window, so it follows changes */
+#define UPSTREAM_HEDGE_REFRESH_SAMPLES 64
+#define UPSTREAM_HEDGE_WINDOW_SAMPLES 1024
+
+/* Outcome passed to upstream_endpoint_release() in place of an HTTP status */
+#define UPSTREAM_STATUS_FAILED 0        /* no response: connect, protocol or stream error */
+#define UPSTREAM_STATUS_NOT_SENT (-1)   /* refused locally (open breaker, exhausted pool) */
+
+/* One backend address of a cluster, with its own pool, health checker and
+ * circuit breaker */
+struct upstream_cluster_s;
+
+typedef struct {
+    struct upstream_cluster_s *cluster;
+    backend_pool_t *pool;
+    char name[64];                      /* host:port, sent as :authority */
+    _Atomic int outstanding;            /* picked and not yet released */
+    _Atomic long ewma_us;               /* smoothed response latency, 0 = no sample */
+    _Atomic long total_requests;
+
+    /* Passive outlier detection */
+    _Atomic int consecutive_5xx;
+    _Atomic long ejected_until_ms;      /* CLOCK_MONOTONIC; past = in rotation */
+    _Atomic int ejection_streak;        /* lengthens the next ejection */
+    _Atomic long total_ejections;
+    _Atomic long interval_requests;     /* since the last sweep */
+    _Atomic long interval_errors;
+    _Atomic long interval_latency[UPSTREAM_LATENCY_BUCKETS];
+
+    /* Adaptive concurrency limit, checked against 'outstanding' */
+    _Atomic int concurrency_limit;      /* 0 = unlimited */
+    _Atomic long total_shed;
+    pthread_mutex_t limit_lock;         /* estimate updates only, taken with trylock */
+    double estimated_limit;
+    double short_rtt_us;
+    double long_rtt_us;
+} upstream_endpoint_t;
+
+/* The endpoints behind one reverse proxy route and the policy that chooses
+ * among them. Endpoints are added at startup; picking is lock-free. */
+typedef struct upstream_cluster_s {
+    upstream_endpoint_t endpoints[MAX_ROUTE_BACKENDS];
+    int count;
+    LoadBalancerPolicy policy;
+    char hash_header[MAX_HEADER_NAME];
+    _Atomic unsigned int rr_next;
+    uint8_t *maglev_table;              /* endpoint index per slot (LB_MAGLEV) */
+    OutlierDetectionConfig outlier;     /* not enabled = nothing is ejected */
+    _Atomic long next_sweep_ms;
+    pthread_mutex_t eject_lock;         /* ejections only, to keep the cap */
+
+    ConcurrencyLimitConfig concurrency;  /* not enabled = no limit */
+
+    /* Retries and hedging */
+    RetryPolicyConfig retry;            /* not enabled = every request is sent once */
+    _Atomic long retry_tokens;          /* budget, in UPSTREAM_RETRY_TOKENs */
+    _Atomic long latency_samples;       /* in 'latency', decaying */
+    _Atomic long latency[UPSTREAM_LATENCY_BUCKETS];
+    _Atomic long hedge_delay_us;        /* p95 of 'latency'; 0 = too few samples */
+    _Atomic long total_retries;
+    _Atomic long total_hedges;
+    _Atomic long retries_throttled;     /* wanted, but the budget was spent */
+} upstream_cluster_t;
+
+// Cluster lifecycle
+upstream_cluster_t *upstream_cluster_create(LoadBalancerPolicy policy, const char *hash_header);
+int upstream_cluster_add_endpoint(upstream_cluster_t *cluster, const char *name,
+                                  backend_pool_t *pool);
+void upstream_cluster_destroy(upstream_cluster_t *cluster);
+void upstream_cluster_set_outlier_detection(upstream_cluster_t *cluster,
+                                            const OutlierDetectionConfig *config);
+void upstream_cluster_set_retry_policy(upstream_cluster_t *cluster, const RetryPolicyConfig *config);
+void upstream_cluster_set_concurrency_limit(upstream_cluster_t *cluster, const ConcurrencyLimitConfig *config);
+
+// Load balancing
+upstream_endpoint_t *upstream_cluster_pick(upstream_cluster_t *cluster,
+                                           const char *hash_key, size_t hash_key_len);
+upstream_endpoint_t *upstream_cluster_pick_other(upstream_cluster_t *cluster,
+                                                 const char *hash_key, size_t hash_key_len,
+                                                 const upstream_endpoint_t *exclude);
+void upstream_endpoint_release(upstream_endpoint_t *endpoint, long latency_us, int status);
+
+// Outlier detection
+void upstream_cluster_detect_outliers(upstream_cluster_t *cluster);
+bool upstream_endpoint_is_ejected(const upstream_endpoint_t *endpoint);
+
+// Adaptive concurrency limit
+bool upstream_endpoint_over_limit(upstream_endpoint_t *endpoint);
+
+// Retry budget and hedging
+void upstream_cluster_earn_retry(upstream_cluster_t *cluster);
+bool upstream_cluster_take_retry(upstream_cluster_t *cluster);
+long upstream_cluster_hedge_delay_ms(upstream_cluster_t *cluster);
+
+const char *upstream_lb_policy_name(LoadBalancerPolicy policy);
+
+#endif // UPSTREAM_H
@@ -0,0 +1,92 @@
+#ifndef URING_IO_H
+#define URING_IO_H
+
+#include <liburing.h>
+#include <openssl/bio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Provided receive buffers (one buffer group per worker ring). A connection
+ * only holds one of these while it has undelivered ciphertext, so idle
+ * connections pin no receive memory. Count must be a power of two. */
+#define URING_IO_BUF_GROUP 0
+#define URING_IO_RECV_BUF_COUNT 8
+#define URING_IO_RECV_BUF_SIZE 16384
+
+/* Buffer used for static file reads, registered with the ring when possible */
+#define URING_IO_FILE_BUF_SIZE 32768
+
+/* Size of each worker ring's sparse fixed-file table */
+#define URING_IO_FIXED_FILES 64
+
+/* One socket watched by uring_worker_poll_many() */
+typedef struct {
+    int fd;
+    bool fixed;                         /* 'fd' is a fixed-file index */
+    short events;                       /* POLLIN/POLLOUT, 0 = not watched */
+    short revents;                      /* set on return */
+} uring_poll_target_t;
+
+/* Per-worker io_uring context. Owned by the worker thread that created it
+ * and released by a thread-specific destructor when that thread exits. */
+typedef struct {
+    struct io_uring ring;
+    struct io_uring_buf_ring *buf_ring; /* NULL if provided buffer rings are unsupported */
+    unsigned char *recv_bufs;
+    unsigned char *file_buf;
+    bool file_buf_registered;
+    bool fixed_files;                   /* sparse file table registered */
+} uring_worker_t;
+
+/* Returns the calling thread's worker context, creating it on first use.
+ * With bind_cpu set, io-wq threads are restricted to the caller's CPUs. */
+uring_worker_t *uring_worker_get(bool bind_cpu);
+
+/* Returns the calling thread's worker context, or NULL if it has none */
+uring_worker_t *uring_worker_current(void);
+
+/* Discards completions left behind by a previous connection */
+void uring_worker_drain(uring_worker_t *worker);
+
+/* Registers 'fd' in a free slot of the worker's fixed-file table. The table
+ * holds its own reference, so the caller may close 'fd' right away. Returns
+ * the fixed index, or -1 if the kernel lacks sparse tables or the table is full. */
+int uring_worker_install_fd(uring_worker_t *worker, int fd);
+
+/* Releases a fixed-file slot returned by uring_worker_install_fd() */
+void uring_worker_close_fixed(uring_worker_t *worker, int index);
+
+/* Waits up to timeout_ms for 'events' (POLLIN/POLLOUT) on 'fd', a fixed index
+ * when 'fixed' is set. Returns the ready events, 0 on timeout, or -1 on error. */
+int uring_worker_poll(uring_worker_t *worker, int fd, bool fixed, short events, int timeout_ms);
+
+/* Waits up to timeout_ms (0 = no limit) until any target is ready and sets
+ * each target's revents. Polls still pending are cancelled before returning,
+ * so nothing is left on the ring. Returns the number of ready targets, 0 on
+ * timeout, or -1 on error. */
+int uring_worker_poll_many(uring_worker_t *worker, uring_poll_target_t *targets, int count,
+                           int timeout_ms);
+
+/* Reads up to URING_IO_FILE_BUF_SIZE bytes of 'fd' (a fixed index when 'fixed'
+ * is set) at 'offset' into the worker's file buffer, with IORING_OP_READ_FIXED
+ * when that buffer is registered. Returns the byte count (0 at EOF) and points
+ * *data at the buffer, or -1 on error. The data is valid until the next call. */
+ssize_t uring_worker_read_file(uring_worker_t *worker, int fd, bool fixed, off_t offset, const char **data);
+
+/* Creates a socket BIO whose reads and writes are submitted on 'worker'.
+ * 'fd' is a fixed index when 'fixed' is set. The BIO never closes it.
+ * Returns NULL on allocation failure. */
+BIO *uring_bio_new(uring_worker_t *worker, int fd, bool fixed);
+
+/* Fails blocking reads/writes that do not complete within timeout_ms (0 = no limit) */
+void uring_bio_set_timeout(BIO *bio, int timeout_ms);
+
+/* Finds the worker and socket behind an io_uring BIO. Returns -1 for any
+ * other kind of BIO. */
+int uring_bio_get_socket(BIO *bio, uring_worker_t **worker, int *fd, bool *fixed);
+
+/* In nonblocking mode reads/writes that would block return -1 with the
+ * BIO retry flags set instead of waiting */
+void uring_bio_set_nonblocking(BIO *bio, bool nonblocking);
+
+#endif // URING_IO_H
@@ -0,0 +1,54 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include "http1_client.h"
+#include "http_parser.h"
+#include "tunnel.h"
+
+#define WEBSOCKET_KEY_SIZE 25           /* base64 of 16 random bytes, NUL */
+#define WEBSOCKET_ACCEPT_SIZE 29        /* base64 of a SHA-1 digest, NUL */
+
+/* An RFC 8441 stream bridged to an upgraded HTTP/1.1 backend connection.
+ * 'buf' holds backend bytes not yet handed to the client as DATA frames;
+ * 'out' holds client bytes the backend has not taken yet. The client's
+ * flow-control window is only reopened for bytes the backend took, which
+ * bounds 'out' by the stream window. */
+typedef struct websocket_stream_s {
+    int fd;
+    int32_t stream_id;
+    char buf[TUNNEL_BUFFER_SIZE];
+    size_t off;
+    size_t len;
+    bool backend_eof;
+    uint8_t *out;
+    size_t out_len;
+    size_t out_cap;
+    bool shutdown_pending;              /* client ended the stream; half-close once 'out' drains */
+    int idle_timeout_ms;                /* 0 = no limit */
+    struct timespec last_activity;
+    char protocol[128];                 /* Sec-WebSocket-Protocol chosen by the backend */
+    char extensions[256];               /* Sec-WebSocket-Extensions chosen by the backend */
+    struct websocket_stream_s *next;
+} websocket_stream_t;
+
+// Opening handshake (RFC 6455 section 4)
+int websocket_generate_key(char key[WEBSOCKET_KEY_SIZE]);
+int websocket_accept_key(const char *key, char accept[WEBSOCKET_ACCEPT_SIZE]);
+
+// Extended CONNECT bridging
+int websocket_stream_open(websocket_stream_t **out, http1_pool_t *pool, const HttpRequest *req,
+                          int idle_timeout_ms);
+int websocket_stream_pull(websocket_stream_t *ws);
+size_t websocket_stream_take(websocket_stream_t *ws, uint8_t *out, size_t len);
+ssize_t websocket_stream_write(websocket_stream_t *ws, const uint8_t *data, size_t len);
+ssize_t websocket_stream_flush(websocket_stream_t *ws);
+void websocket_stream_shutdown(websocket_stream_t *ws);
+bool websocket_stream_idle(const websocket_stream_t *ws);
+void websocket_stream_close(websocket_stream_t *ws);
+
+#endif // WEBSOCKET_H
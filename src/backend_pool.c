@@ -2,19 +2,29 @@
  *
  * This module manages a pool of reusable HTTP/2 connections to backend servers.
  * Features:
- *   - Fixed-size connection pool with mutex protection
- *   - Connection reuse across multiple requests
+ *   - Elastic pool: min_size connections up front, growth on demand up to
+ *     max_size, and a FIFO wait queue with a deadline once every slot is busy
+ *   - Stream multiplexing: acquire() hands out stream slots, packing requests
+ *     onto connected backends up to their SETTINGS_MAX_CONCURRENT_STREAMS
+ *     before opening another connection
+ *   - Lock-free acquisition: CAS on per-connection stream counts plus a
+ *     LIFO free list of idle connections
+ *   - Background refresher that reconnects failed, unhealthy and idle-expired
+ *     connections, so no request waits on another's reconnect
  *   - Health tracking per connection
+ *   - Circuit breaker with CAS state transitions, a per-CPU sliding window
+ *     of error rates and a bounded number of half-open probes
  *   - Idle timeout for connection cleanup
- *   - Thread-safe acquisition/release
  */
 
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include "backend_pool.h"
+#include "health_check.h"
 #include "log.h"
 #include "http2_client.h"
 #include "metrics.h"
@@ -46,9 +56,9 @@ static backend_conn_t* create_backend_connection(backend_pool_t *pool, const bac
     }
     
     conn->pool = pool;
-    atomic_store(&conn->in_use, false);
+    atomic_store(&conn->streams, 0);
     atomic_store(&conn->last_used, time(NULL));
-    conn->health = BACKEND_HEALTH_UNKNOWN;
+    atomic_store(&conn->health, BACKEND_HEALTH_UNKNOWN);
     conn->consecutive_failures = 0;
     conn->consecutive_successes = 0;
     
@@ -72,18 +82,260 @@ static void destroy_backend_connection(backend_conn_t *conn)
     free(conn);
 }
 
-// Connect a backend connection to the server
-static int connect_backend_connection(backend_conn_t *conn, const backend_config_t *config)
+#define FREE_INDEX_MASK 0xffffffffULL
+
+static void free_list_push(backend_pool_t *pool, backend_conn_t *conn)
+{
+    uint64_t head = atomic_load(&pool->free_head);
+    uint64_t next;
+    do {
+        atomic_store(&conn->free_next, (int)(head & FREE_INDEX_MASK));
+        next = (((head >> 32) + 1) << 32) | (uint64_t)(conn->index + 1);
+    } while (!atomic_compare_exchange_weak(&pool->free_head, &head, next));
+}
+
+static backend_conn_t *free_list_pop(backend_pool_t *pool)
+{
+    uint64_t head = atomic_load(&pool->free_head);
+    uint64_t next;
+    int top;
+    do {
+        top = (int)(head & FREE_INDEX_MASK);
+        if (top == 0) {
+            return NULL;
+        }
+        /* The tag in the high bits makes this CAS fail if 'top' was popped
+         * and pushed back in between, so a stale free_next is never installed */
+        uint64_t link = (uint64_t)atomic_load(&pool->connections[top - 1]->free_next);
+        next = (((head >> 32) + 1) << 32) | link;
+    } while (!atomic_compare_exchange_weak(&pool->free_head, &head, next));
+    
+    return pool->connections[top - 1];
+}
+
+struct backend_waiter_s {
+    pthread_cond_t cond;
+    backend_conn_t *conn;               /* set when a slot is handed over */
+    struct backend_waiter_s *next;
+};
+
+// Remove 'waiter' from the wait queue. Caller holds wait_lock.
+static void waiter_unlink(backend_pool_t *pool, backend_waiter_t *waiter)
+{
+    backend_waiter_t **link = &pool->wait_head;
+    backend_waiter_t *prev = NULL;
+    while (*link && *link != waiter) {
+        prev = *link;
+        link = &(*link)->next;
+    }
+    if (!*link) {
+        return;
+    }
+    *link = waiter->next;
+    if (pool->wait_tail == waiter) {
+        pool->wait_tail = prev;
+    }
+    /* A new head may now take slots itself */
+    if (pool->wait_head) {
+        pthread_cond_signal(&pool->wait_head->cond);
+    }
+}
+
+/* Gives the stream slot held on 'conn' to the longest waiting thread.
+ * Returns false, leaving the slot with the caller, if nobody is waiting. */
+static bool handoff_to_waiter(backend_pool_t *pool, backend_conn_t *conn)
+{
+    if (atomic_load(&pool->waiters) == 0) {
+        return false;
+    }
+    
+    pthread_mutex_lock(&pool->wait_lock);
+    backend_waiter_t *waiter = pool->wait_head;
+    if (waiter) {
+        waiter->conn = conn;
+        waiter_unlink(pool, waiter);
+        pthread_cond_signal(&waiter->cond);
+    }
+    pthread_mutex_unlock(&pool->wait_lock);
+    
+    return waiter != NULL;
+}
+
+// Count a connection going from idle to active
+static void mark_conn_active(backend_pool_t *pool)
+{
+    atomic_fetch_add(&pool->active_count, 1);
+    atomic_fetch_sub(&pool->idle_count, 1);
+}
+
+// Claim the first stream of a connection nobody else can reach
+static void claim_idle_connection(backend_pool_t *pool, backend_conn_t *conn)
+{
+    atomic_store(&conn->streams, 1);
+    atomic_fetch_add(&pool->stream_count, 1);
+    mark_conn_active(pool);
+}
+
+/* Returns a connection without streams to service: straight to a waiter if
+ * there is one, otherwise onto the free list. Done under wait_lock so a
+ * thread that is enqueueing either gets the handoff or finds it on the list. */
+static void make_available(backend_pool_t *pool, backend_conn_t *conn)
+{
+    pthread_mutex_lock(&pool->wait_lock);
+    backend_waiter_t *waiter = pool->wait_head;
+    if (waiter) {
+        claim_idle_connection(pool, conn);
+        waiter->conn = conn;
+        waiter_unlink(pool, waiter);
+        pthread_cond_signal(&waiter->cond);
+    } else {
+        free_list_push(pool, conn);
+    }
+    pthread_mutex_unlock(&pool->wait_lock);
+}
+
+/* Hands a connection without streams to the refresher, which reconnects it
+ * off the request path and then returns it to the free list */
+static void retire_connection(backend_pool_t *pool, backend_conn_t *conn)
+{
+    atomic_store(&conn->retired, true);
+    pthread_mutex_lock(&pool->pool_lock);
+    pthread_cond_signal(&pool->refresher_cond);
+    pthread_mutex_unlock(&pool->pool_lock);
+}
+
+/* Stream slots 'conn' can hold right now: the peer's limit once connected,
+ * none while it is unconnected, failed or unhealthy. An idle connection is
+ * claimed from the free list regardless, and its owner connects it. */
+static int conn_stream_capacity(backend_conn_t *conn)
+{
+    if (atomic_load(&conn->client.broken) || atomic_load(&conn->health) == BACKEND_HEALTH_UNHEALTHY) {
+        return 0;
+    }
+    return http2_client_get_max_streams(&conn->client);
+}
+
+static void refresh_connection(backend_pool_t *pool, backend_conn_t *conn)
+{
+    pthread_mutex_lock(&conn->lock);
+    
+    http2_client_disconnect(&conn->client);
+    atomic_store(&conn->health, BACKEND_HEALTH_UNKNOWN);
+    conn->consecutive_failures = 0;
+    conn->consecutive_successes = 0;
+    
+    /* Only the first min_size connections are kept open; the rest are
+     * reopened by their next owner. A failed connect is retried the same way. */
+    if (conn->index < pool->min_size &&
+        http2_client_connect(&conn->client, &pool->config) != 0) {
+        log_message(LOG_LEVEL_DEBUG, "Refresher could not reconnect connection %d to %s:%d",
+                    conn->index, pool->backend_host, pool->backend_port);
+    }
+    atomic_store(&conn->last_used, time(NULL));
+    
+    pthread_mutex_unlock(&conn->lock);
+    
+    atomic_store(&conn->retired, false);
+    make_available(pool, conn);
+}
+
+static void *refresher_thread(void *arg)
+{
+    backend_pool_t *pool = (backend_pool_t *)arg;
+    
+    while (atomic_load(&pool->refresher_running)) {
+        int size = atomic_load(&pool->size);
+        for (int i = 0; i < size && atomic_load(&pool->refresher_running); i++) {
+            backend_conn_t *conn = pool->connections[i];
+            if (conn && atomic_load(&conn->retired)) {
+                refresh_connection(pool, conn);
+            }
+        }
+        
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_sec += BACKEND_POOL_REFRESH_INTERVAL_MS / 1000;
+        until.tv_nsec += (BACKEND_POOL_REFRESH_INTERVAL_MS % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        
+        pthread_mutex_lock(&pool->pool_lock);
+        if (atomic_load(&pool->refresher_running)) {
+            pthread_cond_timedwait(&pool->refresher_cond, &pool->pool_lock, &until);
+        }
+        pthread_mutex_unlock(&pool->pool_lock);
+    }
+    
+    return NULL;
+}
+
+static int start_refresher(backend_pool_t *pool)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int ret = pthread_cond_init(&pool->refresher_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (ret != 0) {
+        return -1;
+    }
+    
+    atomic_store(&pool->refresher_running, true);
+    if (pthread_create(&pool->refresher, NULL, refresher_thread, pool) != 0) {
+        atomic_store(&pool->refresher_running, false);
+        pthread_cond_destroy(&pool->refresher_cond);
+        return -1;
+    }
+    return 0;
+}
+
+static void stop_refresher(backend_pool_t *pool)
 {
-    if (!conn) return -1;
-    return http2_client_connect(&conn->client, config);
+    pthread_mutex_lock(&pool->pool_lock);
+    atomic_store(&pool->refresher_running, false);
+    pthread_cond_signal(&pool->refresher_cond);
+    pthread_mutex_unlock(&pool->pool_lock);
+    
+    pthread_join(pool->refresher, NULL);
+    pthread_cond_destroy(&pool->refresher_cond);
 }
 
 backend_pool_t* backend_pool_create(const char *host, int port,
                                      bool tls_enabled, bool tls_verify,
                                      int pool_size)
 {
-    if (!host || pool_size <= 0 || pool_size > BACKEND_POOL_MAX_SIZE) {
+    /* Fixed size, and acquire fails at once when every slot is busy */
+    backend_pool_config_t config = {
+        .size = pool_size,
+        .min_size = pool_size,
+        .acquire_timeout_ms = 0,
+        .idle_timeout_seconds = BACKEND_POOL_IDLE_TIMEOUT_SEC
+    };
+    return backend_pool_create_with_config(host, port, tls_enabled, tls_verify, &config);
+}
+
+static void free_pool(backend_pool_t *pool)
+{
+    int size = atomic_load(&pool->size);
+    for (int i = 0; i < size; i++) {
+        destroy_backend_connection(pool->connections[i]);
+    }
+    pthread_mutex_destroy(&pool->wait_lock);
+    pthread_mutex_destroy(&pool->grow_lock);
+    pthread_mutex_destroy(&pool->pool_lock);
+    http2_client_tls_destroy(pool->config.tls);
+    free(pool->connections);
+    free(pool);
+}
+
+backend_pool_t* backend_pool_create_with_config(const char *host, int port,
+                                                 bool tls_enabled, bool tls_verify,
+                                                 const backend_pool_config_t *config)
+{
+    if (!host || !config || config->size <= 0 || config->size > BACKEND_POOL_MAX_SIZE ||
+        config->min_size < 0 || config->min_size > config->size) {
         log_message(LOG_LEVEL_ERROR, "Invalid backend pool parameters");
         return NULL;
     }
@@ -94,30 +346,50 @@ backend_pool_t* backend_pool_create(const char *host, int port,
         return NULL;
     }
     
-    if (pthread_mutex_init(&pool->pool_lock, NULL) != 0) {
-        log_message(LOG_LEVEL_ERROR, "Failed to initialize pool mutex");
+    pool->connections = calloc((size_t)config->size, sizeof(backend_conn_t *));
+    if (!pool->connections) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate backend pool");
         free(pool);
         return NULL;
     }
     
+    pthread_mutex_init(&pool->pool_lock, NULL);
+    pthread_mutex_init(&pool->grow_lock, NULL);
+    pthread_mutex_init(&pool->wait_lock, NULL);
+    pool->min_size = config->min_size;
+    pool->max_size = config->size;
+    pool->acquire_timeout_ms = config->acquire_timeout_ms;
+    
     strncpy(pool->backend_host, host, sizeof(pool->backend_host) - 1);
     pool->backend_port = port;
     pool->tls_enabled = tls_enabled;
     pool->tls_verify = tls_verify;
-    pool->idle_timeout_sec = BACKEND_POOL_IDLE_TIMEOUT_SEC;
+    pool->idle_timeout_sec = config->idle_timeout_seconds > 0 ?
+                             config->idle_timeout_seconds : BACKEND_POOL_IDLE_TIMEOUT_SEC;
     atomic_store(&pool->size, 0);
     atomic_store(&pool->active_count, 0);
     atomic_store(&pool->idle_count, 0);
+    atomic_store(&pool->stream_count, 0);
     atomic_store(&pool->healthy_count, 0);
+    atomic_store(&pool->free_head, 0);
+    atomic_store(&pool->waiters, 0);
+    atomic_store(&pool->exhausted_total, 0);
     
     pool->config.host[sizeof(pool->config.host) - 1] = '\0';
     strncpy(pool->config.host, host, sizeof(pool->config.host) - 1);
     pool->config.port = port;
     pool->config.tls_enabled = tls_enabled;
     pool->config.tls_verify = tls_verify;
+    pool->config.endpoint = resolver_get_endpoint(host, port);
+    /* One SSL_CTX and session cache for every connection to this backend */
+    pool->config.tls = http2_client_tls_create(tls_verify);
+    if (!pool->config.tls) {
+        log_message(LOG_LEVEL_WARN, "No shared TLS context for %s:%d, connections will not resume",
+                    host, port);
+    }
     
-    // Pre-create connections
-    for (int i = 0; i < pool_size; i++) {
+    // Pre-create the minimum; the rest are added on demand
+    for (int i = 0; i < config->min_size; i++) {
         backend_conn_t *conn = create_backend_connection(pool, &pool->config);
         if (!conn) {
             log_message(LOG_LEVEL_WARN, "Failed to create connection %d for %s:%d", 
@@ -125,6 +397,7 @@ backend_pool_t* backend_pool_create(const char *host, int port,
             break;
         }
         
+        conn->index = i;
         pool->connections[i] = conn;
         atomic_fetch_add(&pool->size, 1);
         atomic_fetch_add(&pool->idle_count, 1);
@@ -133,8 +406,19 @@ backend_pool_t* backend_pool_create(const char *host, int port,
                     i, host, port);
     }
     
-    log_message(LOG_LEVEL_INFO, "Backend pool created for %s:%d (size=%d, tls=%s)", 
-                host, port, atomic_load(&pool->size), tls_enabled ? "yes" : "no");
+    /* Pushed in reverse so connection 0 is handed out first */
+    for (int i = atomic_load(&pool->size) - 1; i >= 0; i--) {
+        free_list_push(pool, pool->connections[i]);
+    }
+    
+    if (start_refresher(pool) != 0) {
+        log_message(LOG_LEVEL_ERROR, "Failed to start connection refresher for %s:%d", host, port);
+        free_pool(pool);
+        return NULL;
+    }
+    
+    log_message(LOG_LEVEL_INFO, "Backend pool created for %s:%d (size=%d, max=%d, tls=%s)", 
+                host, port, atomic_load(&pool->size), pool->max_size, tls_enabled ? "yes" : "no");
     
     return pool;
 }
@@ -146,97 +430,250 @@ void backend_pool_destroy(backend_pool_t *pool)
     log_message(LOG_LEVEL_INFO, "Destroying backend pool for %s:%d", 
                 pool->backend_host, pool->backend_port);
     
-    pthread_mutex_lock(&pool->pool_lock);
-    
+    /* Probes use the pool's TLS context */
+    backend_pool_stop_health_checker(pool);
+    stop_refresher(pool);
+    free_pool(pool);
+}
+
+static backend_conn_t *try_acquire(backend_pool_t *pool)
+{
     int size = atomic_load(&pool->size);
+    
+    /* Pack streams onto connections that already carry some, so upstream
+     * connections are only opened once the busy ones are full */
     for (int i = 0; i < size; i++) {
-        if (pool->connections[i]) {
-            destroy_backend_connection(pool->connections[i]);
-            pool->connections[i] = NULL;
+        backend_conn_t *conn = pool->connections[i];
+        int streams = atomic_load(&conn->streams);
+        while (streams > 0 && streams < conn_stream_capacity(conn)) {
+            if (atomic_compare_exchange_weak(&conn->streams, &streams, streams + 1)) {
+                atomic_fetch_add(&pool->stream_count, 1);
+                H2C_LOG("backend_pool: acquired stream %d on connection %d", streams + 1, i);
+                return conn;
+            }
         }
     }
     
-    pthread_mutex_unlock(&pool->pool_lock);
-    pthread_mutex_destroy(&pool->pool_lock);
-    free(pool);
+    /* Otherwise take the most recently released idle connection. Nobody else
+     * can add streams to it until it has one, so the claim cannot fail. */
+    backend_conn_t *conn;
+    time_t now = time(NULL);
+    while ((conn = free_list_pop(pool)) != NULL) {
+        if (http2_client_get_max_streams(&conn->client) > 0 &&
+            now - atomic_load(&conn->last_used) > pool->idle_timeout_sec) {
+            log_message(LOG_LEVEL_INFO, "Connection %d idle timeout, refreshing", conn->index);
+            retire_connection(pool, conn);
+            continue;
+        }
+        
+        claim_idle_connection(pool, conn);
+        H2C_LOG("backend_pool: acquired idle connection %d", conn->index);
+        return conn;
+    }
+    
+    return NULL;
 }
 
-backend_conn_t* backend_pool_acquire(backend_pool_t *pool)
+/* Adds a connection when the pool is below max_size. The new connection is
+ * returned with its first stream claimed; its owner connects it. */
+static backend_conn_t *grow_pool(backend_pool_t *pool)
 {
-    if (!pool) return NULL;
+    if (atomic_load(&pool->size) >= pool->max_size) {
+        return NULL;
+    }
     
-    pthread_mutex_lock(&pool->pool_lock);
+    pthread_mutex_lock(&pool->grow_lock);
     
-    int size = atomic_load(&pool->size);
-    time_t now = time(NULL);
+    int index = atomic_load(&pool->size);
+    backend_conn_t *conn = NULL;
+    if (index < pool->max_size) {
+        conn = create_backend_connection(pool, &pool->config);
+    }
+    if (conn) {
+        conn->index = index;
+        pool->connections[index] = conn;
+        atomic_fetch_add(&pool->idle_count, 1);
+        claim_idle_connection(pool, conn);
+        /* Publish only once the slot is filled in; scanners stop at size */
+        atomic_store(&pool->size, index + 1);
+        log_message(LOG_LEVEL_INFO, "Backend pool for %s:%d grew to %d connections",
+                    pool->backend_host, pool->backend_port, index + 1);
+    }
     
-    // Find an idle, healthy connection
-    for (int i = 0; i < size; i++) {
-        backend_conn_t *conn = pool->connections[i];
-        if (!conn) continue;
-        
-        pthread_mutex_lock(&conn->lock);
-        
-        bool in_use = atomic_load(&conn->in_use);
-        if (!in_use && conn->health != BACKEND_HEALTH_UNHEALTHY) {
-            // Check idle timeout
-            long last_used = atomic_load(&conn->last_used);
-            if (now - last_used > pool->idle_timeout_sec) {
-                log_message(LOG_LEVEL_INFO, "Connection %d idle timeout, reconnecting", i);
-                http2_client_cleanup(&conn->client);
-                if (http2_client_init(&conn->client, &pool->config) == 0) {
-                    if (connect_backend_connection(conn, &pool->config) == 0) {
-                        atomic_store(&conn->last_used, now);
-                    } else {
-                        conn->health = BACKEND_HEALTH_UNHEALTHY;
-                        pthread_mutex_unlock(&conn->lock);
-                        continue;
-                    }
-                } else {
-                    conn->health = BACKEND_HEALTH_UNHEALTHY;
-                    pthread_mutex_unlock(&conn->lock);
-                    continue;
-                }
+    pthread_mutex_unlock(&pool->grow_lock);
+    return conn;
+}
+
+static long monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* Parks the caller in the FIFO wait queue until a slot is handed over or
+ * the deadline passes. Only the head waiter looks for slots itself, so
+ * threads are served in arrival order. */
+static backend_conn_t *wait_for_slot(backend_pool_t *pool, int timeout_ms)
+{
+    backend_waiter_t waiter = {0};
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&waiter.cond, &attr);
+    pthread_condattr_destroy(&attr);
+    
+    long deadline = monotonic_ms() + timeout_ms;
+    
+    pthread_mutex_lock(&pool->wait_lock);
+    if (pool->wait_tail) {
+        pool->wait_tail->next = &waiter;
+    } else {
+        pool->wait_head = &waiter;
+    }
+    pool->wait_tail = &waiter;
+    atomic_fetch_add(&pool->waiters, 1);
+    
+    while (!waiter.conn) {
+        if (pool->wait_head == &waiter) {
+            backend_conn_t *conn = try_acquire(pool);
+            if (!conn) conn = grow_pool(pool);
+            if (conn) {
+                waiter.conn = conn;
+                waiter_unlink(pool, &waiter);
+                break;
             }
-            
-            atomic_store(&conn->in_use, true);
-            atomic_fetch_add(&pool->active_count, 1);
-            atomic_fetch_sub(&pool->idle_count, 1);
-            
-            pthread_mutex_unlock(&conn->lock);
-            pthread_mutex_unlock(&pool->pool_lock);
-            
-            H2C_LOG("backend_pool: acquired connection %d", i);
-            return conn;
         }
         
-        pthread_mutex_unlock(&conn->lock);
+        long remaining = deadline - monotonic_ms();
+        if (remaining <= 0) {
+            waiter_unlink(pool, &waiter);
+            break;
+        }
+        
+        /* Slots freed by releases on busy connections are not handed over,
+         * so the head also rechecks on a short period */
+        long slice = remaining < BACKEND_POOL_WAIT_SLICE_MS ? remaining : BACKEND_POOL_WAIT_SLICE_MS;
+        struct timespec until;
+        clock_gettime(CLOCK_MONOTONIC, &until);
+        until.tv_nsec += slice * 1000000L;
+        until.tv_sec += until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&waiter.cond, &pool->wait_lock, &until);
     }
     
-    pthread_mutex_unlock(&pool->pool_lock);
+    atomic_fetch_sub(&pool->waiters, 1);
+    pthread_mutex_unlock(&pool->wait_lock);
+    pthread_cond_destroy(&waiter.cond);
     
-    log_message(LOG_LEVEL_WARN, "No available connections in pool for %s:%d", 
-                pool->backend_host, pool->backend_port);
+    return waiter.conn;
+}
+
+backend_conn_t* backend_pool_acquire_timed(backend_pool_t *pool, int timeout_ms,
+                                            backend_acquire_result_t *result)
+{
+    if (result) *result = BACKEND_ACQUIRE_UNAVAILABLE;
+    if (!pool) return NULL;
+    
+    /* Queued waiters go first; only take a slot directly when nobody waits */
+    backend_conn_t *conn = NULL;
+    if (atomic_load(&pool->waiters) == 0) {
+        conn = try_acquire(pool);
+        if (!conn) conn = grow_pool(pool);
+    }
+    if (!conn && timeout_ms > 0) {
+        conn = wait_for_slot(pool, timeout_ms);
+    }
+    
+    if (conn) {
+        if (result) *result = BACKEND_ACQUIRE_OK;
+        return conn;
+    }
+    
+    /* Busy slots mean the backend is fine and simply saturated */
+    if (atomic_load(&pool->stream_count) > 0) {
+        if (result) *result = BACKEND_ACQUIRE_EXHAUSTED;
+        atomic_fetch_add(&pool->exhausted_total, 1);
+        log_message(LOG_LEVEL_WARN, "Backend pool for %s:%d exhausted (%d connections busy)",
+                    pool->backend_host, pool->backend_port, atomic_load(&pool->size));
+    } else {
+        log_message(LOG_LEVEL_WARN, "No available connections in pool for %s:%d", 
+                    pool->backend_host, pool->backend_port);
+    }
     return NULL;
 }
 
+backend_conn_t* backend_pool_acquire(backend_pool_t *pool)
+{
+    if (!pool) return NULL;
+    return backend_pool_acquire_timed(pool, pool->acquire_timeout_ms, NULL);
+}
+
+int backend_pool_connect(backend_conn_t *conn)
+{
+    if (!conn || !conn->pool) return -1;
+    
+    int ret = 0;
+    pthread_mutex_lock(&conn->lock);
+    
+    if (!conn->client.session) {
+        ret = http2_client_connect(&conn->client, &conn->pool->config);
+        if (ret == 0) {
+            atomic_store(&conn->last_used, time(NULL));
+        }
+    } else if (!http2_client_is_connected(&conn->client)) {
+        ret = -1;
+    }
+    
+    pthread_mutex_unlock(&conn->lock);
+    return ret;
+}
+
 void backend_pool_release(backend_conn_t *conn)
 {
     if (!conn || !conn->pool) return;
     
     backend_pool_t *pool = conn->pool;
+    bool usable = !atomic_load(&conn->client.broken) &&
+                  atomic_load(&conn->health) != BACKEND_HEALTH_UNHEALTHY;
     
-    pthread_mutex_lock(&conn->lock);
-    
-    atomic_store(&conn->in_use, false);
     atomic_store(&conn->last_used, time(NULL));
     
-    pthread_mutex_unlock(&conn->lock);
+    /* A queued thread takes over the slot as is */
+    if (usable && handoff_to_waiter(pool, conn)) {
+        H2C_LOG("backend_pool: handed stream to waiter");
+        return;
+    }
+    
+    atomic_fetch_sub(&pool->stream_count, 1);
     
-    atomic_fetch_sub(&pool->active_count, 1);
-    atomic_fetch_add(&pool->idle_count, 1);
+    if (atomic_fetch_sub(&conn->streams, 1) == 1) {
+        atomic_fetch_sub(&pool->active_count, 1);
+        atomic_fetch_add(&pool->idle_count, 1);
+        
+        /* Failed or unhealthy connections are rebuilt by the refresher
+         * instead of going back into service */
+        if (usable) {
+            make_available(pool, conn);
+        } else {
+            retire_connection(pool, conn);
+        }
+    }
     
-    H2C_LOG("backend_pool: released connection");
+    H2C_LOG("backend_pool: released stream");
+}
+
+/* The health check's thresholds when it runs, else the defaults */
+static int healthy_threshold(const backend_pool_t *pool)
+{
+    int threshold = pool->health_check_enabled ? pool->health_checker.config.healthy_threshold : 0;
+    return threshold > 0 ? threshold : BACKEND_POOL_HEALTHY_THRESHOLD;
+}
+
+static int unhealthy_threshold(const backend_pool_t *pool)
+{
+    int threshold = pool->health_check_enabled ? pool->health_checker.config.unhealthy_threshold : 0;
+    return threshold > 0 ? threshold : BACKEND_POOL_UNHEALTHY_THRESHOLD;
 }
 
 void backend_pool_mark_success(backend_conn_t *conn)
@@ -248,8 +685,9 @@ void backend_pool_mark_success(backend_conn_t *conn)
     conn->consecutive_failures = 0;
     conn->consecutive_successes++;
     
-    if (conn->consecutive_successes >= 2 && conn->health != BACKEND_HEALTH_HEALTHY) {
-        conn->health = BACKEND_HEALTH_HEALTHY;
+    if (conn->consecutive_successes >= healthy_threshold(conn->pool) &&
+        atomic_load(&conn->health) != BACKEND_HEALTH_HEALTHY) {
+        atomic_store(&conn->health, BACKEND_HEALTH_HEALTHY);
         log_message(LOG_LEVEL_INFO, "Backend connection marked healthy");
     }
     
@@ -265,8 +703,8 @@ void backend_pool_mark_failure(backend_conn_t *conn)
     conn->consecutive_successes = 0;
     conn->consecutive_failures++;
     
-    if (conn->consecutive_failures >= 3) {
-        conn->health = BACKEND_HEALTH_UNHEALTHY;
+    if (conn->consecutive_failures >= unhealthy_threshold(conn->pool)) {
+        atomic_store(&conn->health, BACKEND_HEALTH_UNHEALTHY);
         log_message(LOG_LEVEL_WARN, "Backend connection marked unhealthy after %d failures", 
                     conn->consecutive_failures);
     }
@@ -278,11 +716,7 @@ backend_health_t backend_pool_get_health(backend_conn_t *conn)
 {
     if (!conn) return BACKEND_HEALTH_UNKNOWN;
     
-    pthread_mutex_lock(&conn->lock);
-    backend_health_t health = conn->health;
-    pthread_mutex_unlock(&conn->lock);
-    
-    return health;
+    return atomic_load(&conn->health);
 }
 
 int backend_pool_get_active_count(backend_pool_t *pool)
@@ -297,135 +731,54 @@ int backend_pool_get_idle_count(backend_pool_t *pool)
     return atomic_load(&pool->idle_count);
 }
 
-int backend_pool_get_healthy_count(backend_pool_t *pool)
+int backend_pool_get_stream_count(backend_pool_t *pool)
 {
     if (!pool) return 0;
-    
-    int healthy = 0;
-    int size = atomic_load(&pool->size);
-    
-    for (int i = 0; i < size; i++) {
-        backend_conn_t *conn = pool->connections[i];
-        if (conn && conn->health == BACKEND_HEALTH_HEALTHY) {
-            healthy++;
-        }
-    }
-    
-    return healthy;
+    return atomic_load(&pool->stream_count);
 }
 
-bool backend_pool_has_healthy_connection(backend_pool_t *pool)
+int backend_pool_get_size(backend_pool_t *pool)
 {
-    return backend_pool_get_healthy_count(pool) > 0;
+    if (!pool) return 0;
+    return atomic_load(&pool->size);
 }
 
-static void handle_health_check_success(health_checker_t *checker, backend_conn_t *conn)
+int backend_pool_get_waiter_count(backend_pool_t *pool)
 {
-    int prev_failures = atomic_load(&checker->consecutive_failures);
-    atomic_store(&checker->consecutive_failures, 0);
-    int successes = atomic_fetch_add(&checker->consecutive_successes, 1) + 1;
-    
-    backend_pool_mark_success(conn);
-    
-    if (prev_failures >= checker->config.unhealthy_threshold && 
-        successes >= checker->config.healthy_threshold) {
-        backend_health_t old_health = atomic_load(&checker->health);
-        if (old_health != BACKEND_HEALTH_HEALTHY) {
-            atomic_store(&checker->health, BACKEND_HEALTH_HEALTHY);
-            log_message(LOG_LEVEL_INFO, "Health check: backend marked HEALTHY");
-        }
-    }
+    if (!pool) return 0;
+    return atomic_load(&pool->waiters);
 }
 
-static void handle_health_check_failure(health_checker_t *checker, backend_conn_t *conn)
+long backend_pool_get_exhausted_total(backend_pool_t *pool)
 {
-    int prev_successes = atomic_load(&checker->consecutive_successes);
-    atomic_store(&checker->consecutive_successes, 0);
-    int failures = atomic_fetch_add(&checker->consecutive_failures, 1) + 1;
-    
-    backend_pool_mark_failure(conn);
-    
-    if (prev_successes >= checker->config.healthy_threshold &&
-        failures >= checker->config.unhealthy_threshold) {
-        backend_health_t old_health = atomic_load(&checker->health);
-        if (old_health != BACKEND_HEALTH_UNHEALTHY) {
-            atomic_store(&checker->health, BACKEND_HEALTH_UNHEALTHY);
-            log_message(LOG_LEVEL_WARN, "Health check: backend marked UNHEALTHY after %d failures",
-                       failures);
-        }
-    }
+    if (!pool) return 0;
+    return atomic_load(&pool->exhausted_total);
 }
 
-static bool perform_health_check(health_checker_t *checker, backend_conn_t *conn)
+int backend_pool_get_healthy_count(backend_pool_t *pool)
 {
-    const char *health_path = checker->config.path;
-    if (health_path[0] == '\0') {
-        health_path = "/health";
-    }
+    if (!pool) return 0;
     
-    int status = http2_client_send_request(&conn->client, "GET", 
-                                           health_path, "health-check", NULL, 0);
+    int healthy = 0;
+    int size = atomic_load(&pool->size);
     
-    if (status >= 0) {
-        int response_status = http2_client_recv_response(&conn->client);
-        if (response_status >= HTTP_STATUS_SUCCESS_MIN && response_status < HTTP_STATUS_CLIENT_ERROR_MIN) {
-            return true;
-        } else {
-            log_message(LOG_LEVEL_WARN, "Health check: backend returned status %d", 
-                       response_status);
+    for (int i = 0; i < size; i++) {
+        backend_conn_t *conn = pool->connections[i];
+        if (conn && atomic_load(&conn->health) == BACKEND_HEALTH_HEALTHY) {
+            healthy++;
         }
-    } else {
-        log_message(LOG_LEVEL_WARN, "Health check: failed to send/receive");
     }
-    return false;
+    
+    return healthy;
 }
 
-static void *health_check_thread(void *arg)
+bool backend_pool_has_healthy_connection(backend_pool_t *pool)
 {
-    health_checker_t *checker = (health_checker_t *)arg;
-    if (!checker || !checker->pool) {
-        return NULL;
-    }
-    
-    log_message(LOG_LEVEL_DEBUG, "Health check thread started");
-    
-    while (atomic_load(&checker->state) == HEALTH_CHECK_STATE_RUNNING) {
-        backend_conn_t *conn = backend_pool_acquire(checker->pool);
-        if (!conn) {
-            log_message(LOG_LEVEL_WARN, "Health check: failed to acquire connection");
-            atomic_fetch_add(&checker->consecutive_failures, 1);
-            atomic_store(&checker->consecutive_successes, 0);
-            atomic_store(&checker->health, BACKEND_HEALTH_UNHEALTHY);
-            atomic_fetch_add(&checker->failed_checks, 1);
-            atomic_fetch_add(&checker->total_checks, 1);
-            atomic_store(&checker->last_check_time, (long)time(NULL));
-            sleep(checker->config.interval_seconds);
-            continue;
-        }
-        
-        bool check_success = perform_health_check(checker, conn);
-        
-        if (check_success) {
-            handle_health_check_success(checker, conn);
-        } else {
-            handle_health_check_failure(checker, conn);
-        }
-        
-        atomic_fetch_add(&checker->total_checks, 1);
-        if (!check_success) {
-            atomic_fetch_add(&checker->failed_checks, 1);
-        }
-        atomic_store(&checker->last_check_time, (long)time(NULL));
-        
-        backend_pool_release(conn);
-        backend_pool_update_metrics(checker->pool);
-        sleep(checker->config.interval_seconds);
-    }
-    
-    log_message(LOG_LEVEL_DEBUG, "Health check thread stopped");
-    return NULL;
+    return backend_pool_get_healthy_count(pool) > 0;
 }
 
+/* Checks run on the shared scheduler in health_check.c, over connections
+ * of their own rather than the pool's */
 static int health_checker_start(health_checker_t *checker, backend_pool_t *pool, 
                                 health_check_config_t *config)
 {
@@ -436,14 +789,13 @@ static int health_checker_start(health_checker_t *checker, backend_pool_t *pool,
     memset(checker, 0, sizeof(*checker));
     checker->pool = pool;
     memcpy(&checker->config, config, sizeof(*config));
-    atomic_store(&checker->state, HEALTH_CHECK_STATE_RUNNING);
     atomic_store(&checker->health, BACKEND_HEALTH_UNKNOWN);
     atomic_store(&checker->last_check_time, 0);
     
-    if (pthread_create(&checker->thread, NULL, health_check_thread, checker) != 0) {
-        log_message(LOG_LEVEL_ERROR, "Failed to create health check thread");
+    if (health_check_register(checker) != 0) {
         return -1;
     }
+    atomic_store(&checker->state, HEALTH_CHECK_STATE_RUNNING);
     
     log_message(LOG_LEVEL_INFO, "Health checker started (interval=%ds, path=%s)",
                checker->config.interval_seconds, checker->config.path);
@@ -456,12 +808,9 @@ static void health_checker_stop(health_checker_t *checker)
         return;
     }
     
+    health_check_unregister(checker);
     atomic_store(&checker->state, HEALTH_CHECK_STATE_STOPPED);
     
-    if (checker->thread) {
-        pthread_join(checker->thread, NULL);
-    }
-    
     log_message(LOG_LEVEL_DEBUG, "Health checker stopped");
 }
 
@@ -484,6 +833,7 @@ int backend_pool_start_health_checker(backend_pool_t *pool, health_check_config_
     if (health_checker_start(&pool->health_checker, pool, config) != 0) {
         log_message(LOG_LEVEL_ERROR, "Failed to start health checker for %s:%d",
                    pool->backend_host, pool->backend_port);
+        pool->health_check_enabled = false;
         return -1;
     }
     
@@ -514,6 +864,38 @@ backend_health_t backend_pool_get_overall_health(backend_pool_t *pool)
            BACKEND_HEALTH_HEALTHY : BACKEND_HEALTH_UNKNOWN;
 }
 
+/* Whether a load balancer should send new requests here: not failing
+ * active health checks and not behind an open circuit breaker. Unlike
+ * backend_pool_circuit_breaker_allow_request() this has no side effects;
+ * an open breaker whose recovery timeout has passed counts as available
+ * so the request that picks it can probe in half-open state, and a
+ * half-open one only while it has a probe slot free. */
+bool backend_pool_is_available(backend_pool_t *pool)
+{
+    if (!pool) {
+        return false;
+    }
+    
+    if (pool->health_check_enabled &&
+        health_checker_get_health(&pool->health_checker) == BACKEND_HEALTH_UNHEALTHY) {
+        return false;
+    }
+    
+    if (pool->circuit_breaker_enabled) {
+        circuit_breaker_t *cb = &pool->circuit_breaker;
+        circuit_breaker_state_t state = atomic_load(&cb->state);
+        if (state == CIRCUIT_BREAKER_OPEN) {
+            long elapsed = time(NULL) - atomic_load(&cb->last_state_change);
+            return elapsed >= cb->config.recovery_timeout_seconds;
+        }
+        if (state == CIRCUIT_BREAKER_HALF_OPEN) {
+            return atomic_load(&cb->probes) < cb->config.half_open_max_requests;
+        }
+    }
+    
+    return true;
+}
+
 void backend_pool_update_metrics(backend_pool_t *pool)
 {
     if (!pool) {
@@ -545,26 +927,153 @@ void backend_pool_update_metrics(backend_pool_t *pool)
     }
 }
 
+/* Window buckets: bits 0-23 are the bucket number, then 20 bits of
+ * requests and 20 of failures */
+#define CB_BUCKET_MASK 0xFFFFFFULL
+#define CB_COUNT_MAX 0xFFFFFULL
+#define CB_REQUESTS_SHIFT 24
+#define CB_FAILURES_SHIFT 44
+
+static uint64_t cb_current_bucket(const circuit_breaker_t *cb)
+{
+    return (uint64_t)monotonic_ms() / (uint64_t)cb->bucket_ms;
+}
+
+/* Counts a finished request in this CPU's stripe. A bucket left over from
+ * an earlier lap of the ring starts again from zero. */
+static void cb_window_record(circuit_breaker_t *cb, bool failed)
+{
+    uint64_t bucket = cb_current_bucket(cb);
+    int cpu = sched_getcpu();
+    circuit_breaker_stripe_t *stripe = &cb->stripes[(cpu < 0 ? 0 : cpu) % CIRCUIT_BREAKER_STRIPES];
+    _Atomic uint64_t *slot = &stripe->buckets[bucket % CIRCUIT_BREAKER_WINDOW_BUCKETS];
+    uint64_t old = atomic_load_explicit(slot, memory_order_relaxed);
+    uint64_t next;
+
+    do {
+        uint64_t requests = 0;
+        uint64_t failures = 0;
+        if ((old & CB_BUCKET_MASK) == (bucket & CB_BUCKET_MASK)) {
+            requests = (old >> CB_REQUESTS_SHIFT) & CB_COUNT_MAX;
+            failures = old >> CB_FAILURES_SHIFT;
+        }
+        if (requests < CB_COUNT_MAX) {
+            requests++;
+        }
+        if (failed && failures < CB_COUNT_MAX) {
+            failures++;
+        }
+        next = (bucket & CB_BUCKET_MASK) | requests << CB_REQUESTS_SHIFT | failures << CB_FAILURES_SHIFT;
+    } while (!atomic_compare_exchange_weak_explicit(slot, &old, next, memory_order_relaxed,
+                                                    memory_order_relaxed));
+}
+
+/* Requests and failures in the window. After the breaker closed, counting
+ * starts again with the next bucket. */
+static void cb_window_sum(circuit_breaker_t *cb, long *requests, long *failures)
+{
+    uint64_t now = cb_current_bucket(cb);
+    uint64_t start = atomic_load(&cb->window_start);
+
+    *requests = 0;
+    *failures = 0;
+    if (now < start) {
+        return;
+    }
+    uint64_t since = now - start;
+    for (int i = 0; i < CIRCUIT_BREAKER_STRIPES; i++) {
+        for (int b = 0; b < CIRCUIT_BREAKER_WINDOW_BUCKETS; b++) {
+            uint64_t word = atomic_load_explicit(&cb->stripes[i].buckets[b], memory_order_relaxed);
+            uint64_t age = (now - word) & CB_BUCKET_MASK;
+            if (age < CIRCUIT_BREAKER_WINDOW_BUCKETS && age <= since) {
+                *requests += (long)((word >> CB_REQUESTS_SHIFT) & CB_COUNT_MAX);
+                *failures += (long)(word >> CB_FAILURES_SHIFT);
+            }
+        }
+    }
+}
+
+/* Gives back a HALF_OPEN probe slot, if any is taken */
+static void cb_release_probe(circuit_breaker_t *cb)
+{
+    int probes = atomic_load(&cb->probes);
+    while (probes > 0 && !atomic_compare_exchange_weak(&cb->probes, &probes, probes - 1)) {
+    }
+}
+
+/* Takes a probe slot. Slots held by requests that never reported back
+ * are reclaimed once a whole recovery timeout passed without a verdict. */
+static bool cb_take_probe(circuit_breaker_t *cb, long now)
+{
+    int probes = atomic_load(&cb->probes);
+    for (;;) {
+        if (probes < cb->config.half_open_max_requests) {
+            if (atomic_compare_exchange_weak(&cb->probes, &probes, probes + 1)) {
+                return true;
+            }
+            continue;
+        }
+        long changed = atomic_load(&cb->last_state_change);
+        if (now - changed < cb->config.recovery_timeout_seconds ||
+            !atomic_compare_exchange_strong(&cb->last_state_change, &changed, now)) {
+            return false;
+        }
+        atomic_store(&cb->probes, 1);
+        return true;
+    }
+}
+
+/* Only the caller whose CAS moves the state from 'from' opens the breaker */
+static bool cb_open(backend_pool_t *pool, circuit_breaker_state_t from)
+{
+    circuit_breaker_t *cb = &pool->circuit_breaker;
+    circuit_breaker_state_t expected = from;
+
+    if (!atomic_compare_exchange_strong(&cb->state, &expected, CIRCUIT_BREAKER_OPEN)) {
+        return false;
+    }
+    atomic_store(&cb->last_state_change, time(NULL));
+    atomic_store(&cb->probes, 0);
+    atomic_store(&cb->success_count, 0);
+    atomic_fetch_add(&cb->total_opens, 1);
+    return true;
+}
+
 int backend_pool_init_circuit_breaker(backend_pool_t *pool, circuit_breaker_config_t *config)
 {
     if (!pool || !config || !config->enabled) {
         return -1;
     }
     
-    memset(&pool->circuit_breaker, 0, sizeof(pool->circuit_breaker));
-    memcpy(&pool->circuit_breaker.config, config, sizeof(*config));
-    atomic_store(&pool->circuit_breaker.state, CIRCUIT_BREAKER_CLOSED);
-    atomic_store(&pool->circuit_breaker.failure_count, 0);
-    atomic_store(&pool->circuit_breaker.success_count, 0);
-    atomic_store(&pool->circuit_breaker.last_failure_time, 0);
-    atomic_store(&pool->circuit_breaker.last_state_change, time(NULL));
-    atomic_store(&pool->circuit_breaker.total_opens, 0);
-    atomic_store(&pool->circuit_breaker.total_closes, 0);
+    circuit_breaker_t *cb = &pool->circuit_breaker;
+    memset(cb, 0, sizeof(*cb));
+    memcpy(&cb->config, config, sizeof(*config));
+    if (cb->config.minimum_requests <= 0) {
+        cb->config.minimum_requests = CIRCUIT_BREAKER_DEFAULT_MIN_REQUESTS;
+    }
+    if (cb->config.window_seconds <= 0) {
+        cb->config.window_seconds = CIRCUIT_BREAKER_DEFAULT_WINDOW_SEC;
+    }
+    if (cb->config.success_threshold <= 0) {
+        cb->config.success_threshold = CIRCUIT_BREAKER_DEFAULT_SUCCESS_THRESHOLD;
+    }
+    if (cb->config.half_open_max_requests <= 0) {
+        cb->config.half_open_max_requests = CIRCUIT_BREAKER_DEFAULT_HALF_OPEN_REQUESTS;
+    }
+    cb->bucket_ms = (long)cb->config.window_seconds * 1000 / CIRCUIT_BREAKER_WINDOW_BUCKETS;
+    if (cb->bucket_ms < 1) {
+        cb->bucket_ms = 1;
+    }
+    atomic_store(&cb->state, CIRCUIT_BREAKER_CLOSED);
+    atomic_store(&cb->last_state_change, time(NULL));
+    atomic_store(&cb->window_start, cb_current_bucket(cb));
     pool->circuit_breaker_enabled = true;
     
-    log_message(LOG_LEVEL_INFO, "Circuit breaker initialized for %s:%d (threshold=%d, recovery=%ds)",
-               pool->backend_host, pool->backend_port, 
-               config->failure_threshold, config->recovery_timeout_seconds);
+    log_message(LOG_LEVEL_INFO, "Circuit breaker initialized for %s:%d (threshold=%d, error rate=%d%% of %d "
+               "in %ds, recovery=%ds, %d probe(s))",
+               pool->backend_host, pool->backend_port, config->failure_threshold,
+               cb->config.failure_percent, cb->config.minimum_requests, cb->config.window_seconds,
+               config->recovery_timeout_seconds, cb->config.half_open_max_requests);
     return 0;
 }
 
@@ -579,38 +1088,37 @@ void backend_pool_destroy_circuit_breaker(backend_pool_t *pool)
                pool->backend_host, pool->backend_port);
 }
 
+/* In HALF_OPEN only 'half_open_max_requests' probes are let through at a
+ * time; a probe's result frees its slot */
 bool backend_pool_circuit_breaker_allow_request(backend_pool_t *pool)
 {
     if (!pool || !pool->circuit_breaker_enabled) {
         return true;
     }
     
-    circuit_breaker_state_t state = atomic_load(&pool->circuit_breaker.state);
+    circuit_breaker_t *cb = &pool->circuit_breaker;
+    circuit_breaker_state_t state = atomic_load(&cb->state);
     
     if (state == CIRCUIT_BREAKER_CLOSED) {
         return true;
     }
     
+    long now = time(NULL);
     if (state == CIRCUIT_BREAKER_OPEN) {
-        long now = time(NULL);
-        long last_failure = atomic_load(&pool->circuit_breaker.last_failure_time);
-        int recovery_timeout = pool->circuit_breaker.config.recovery_timeout_seconds;
-        
-        if (now - last_failure >= recovery_timeout) {
-            atomic_store(&pool->circuit_breaker.state, CIRCUIT_BREAKER_HALF_OPEN);
-            atomic_store(&pool->circuit_breaker.last_state_change, now);
+        if (now - atomic_load(&cb->last_state_change) < cb->config.recovery_timeout_seconds) {
+            return false;
+        }
+        circuit_breaker_state_t expected = CIRCUIT_BREAKER_OPEN;
+        if (atomic_compare_exchange_strong(&cb->state, &expected, CIRCUIT_BREAKER_HALF_OPEN)) {
+            atomic_store(&cb->last_state_change, now);
             log_message(LOG_LEVEL_INFO, "Circuit breaker transitioning to HALF-OPEN for %s:%d",
                        pool->backend_host, pool->backend_port);
-            return true;
+        } else if (expected != CIRCUIT_BREAKER_HALF_OPEN) {
+            return expected == CIRCUIT_BREAKER_CLOSED;
         }
-        return false;
-    }
-    
-    if (state == CIRCUIT_BREAKER_HALF_OPEN) {
-        return true;
     }
     
-    return false;
+    return cb_take_probe(cb, now);
 }
 
 void backend_pool_circuit_breaker_record_success(backend_pool_t *pool)
@@ -619,21 +1127,26 @@ void backend_pool_circuit_breaker_record_success(backend_pool_t *pool)
         return;
     }
     
-    circuit_breaker_state_t state = atomic_load(&pool->circuit_breaker.state);
+    circuit_breaker_t *cb = &pool->circuit_breaker;
+    cb_window_record(cb, false);
+    circuit_breaker_state_t state = atomic_load(&cb->state);
     
     if (state == CIRCUIT_BREAKER_HALF_OPEN) {
-        int successes = atomic_fetch_add(&pool->circuit_breaker.success_count, 1) + 1;
-        if (successes >= 2) {
-            atomic_store(&pool->circuit_breaker.state, CIRCUIT_BREAKER_CLOSED);
-            atomic_store(&pool->circuit_breaker.failure_count, 0);
-            atomic_store(&pool->circuit_breaker.success_count, 0);
-            atomic_store(&pool->circuit_breaker.last_state_change, time(NULL));
-            atomic_fetch_add(&pool->circuit_breaker.total_closes, 1);
+        cb_release_probe(cb);
+        int successes = atomic_fetch_add(&cb->success_count, 1) + 1;
+        circuit_breaker_state_t expected = CIRCUIT_BREAKER_HALF_OPEN;
+        if (successes >= cb->config.success_threshold &&
+            atomic_compare_exchange_strong(&cb->state, &expected, CIRCUIT_BREAKER_CLOSED)) {
+            atomic_store(&cb->failure_count, 0);
+            atomic_store(&cb->success_count, 0);
+            atomic_store(&cb->window_start, cb_current_bucket(cb) + 1);
+            atomic_store(&cb->last_state_change, time(NULL));
+            atomic_fetch_add(&cb->total_closes, 1);
             log_message(LOG_LEVEL_INFO, "Circuit breaker CLOSED for %s:%d after successful recovery",
                        pool->backend_host, pool->backend_port);
         }
     } else if (state == CIRCUIT_BREAKER_CLOSED) {
-        atomic_store(&pool->circuit_breaker.failure_count, 0);
+        atomic_store(&cb->failure_count, 0);
     }
 }
 
@@ -643,26 +1156,53 @@ void backend_pool_circuit_breaker_record_failure(backend_pool_t *pool)
         return;
     }
     
-    circuit_breaker_state_t state = atomic_load(&pool->circuit_breaker.state);
-    long now = time(NULL);
+    circuit_breaker_t *cb = &pool->circuit_breaker;
+    cb_window_record(cb, true);
+    atomic_store(&cb->last_failure_time, time(NULL));
+    circuit_breaker_state_t state = atomic_load(&cb->state);
     
-    if (state == CIRCUIT_BREAKER_CLOSED || state == CIRCUIT_BREAKER_HALF_OPEN) {
-        int failures = atomic_fetch_add(&pool->circuit_breaker.failure_count, 1) + 1;
-        atomic_store(&pool->circuit_breaker.last_failure_time, now);
-        
-        if (state == CIRCUIT_BREAKER_HALF_OPEN) {
-            atomic_store(&pool->circuit_breaker.state, CIRCUIT_BREAKER_OPEN);
-            atomic_store(&pool->circuit_breaker.last_state_change, now);
-            atomic_fetch_add(&pool->circuit_breaker.total_opens, 1);
+    if (state == CIRCUIT_BREAKER_HALF_OPEN) {
+        cb_release_probe(cb);
+        if (cb_open(pool, CIRCUIT_BREAKER_HALF_OPEN)) {
             log_message(LOG_LEVEL_WARN, "Circuit breaker OPENED for %s:%d (failure in half-open state)",
                        pool->backend_host, pool->backend_port);
-        } else if (failures >= pool->circuit_breaker.config.failure_threshold) {
-            atomic_store(&pool->circuit_breaker.state, CIRCUIT_BREAKER_OPEN);
-            atomic_store(&pool->circuit_breaker.last_state_change, now);
-            atomic_fetch_add(&pool->circuit_breaker.total_opens, 1);
+        }
+        return;
+    }
+    if (state != CIRCUIT_BREAKER_CLOSED) {
+        return;
+    }
+
+    int failures = atomic_fetch_add(&cb->failure_count, 1) + 1;
+    if (failures >= cb->config.failure_threshold) {
+        if (cb_open(pool, CIRCUIT_BREAKER_CLOSED)) {
             log_message(LOG_LEVEL_WARN, "Circuit breaker OPENED for %s:%d after %d failures",
                        pool->backend_host, pool->backend_port, failures);
         }
+        return;
+    }
+    if (cb->config.failure_percent > 0) {
+        long requests;
+        long failed;
+        cb_window_sum(cb, &requests, &failed);
+        if (requests >= cb->config.minimum_requests &&
+            failed * 100 >= (long)cb->config.failure_percent * requests &&
+            cb_open(pool, CIRCUIT_BREAKER_CLOSED)) {
+            log_message(LOG_LEVEL_WARN, "Circuit breaker OPENED for %s:%d: %ld of %ld requests failed in %ds",
+                       pool->backend_host, pool->backend_port, failed, requests, cb->config.window_seconds);
+        }
+    }
+}
+
+/* For a request let through that will report neither success nor
+ * failure, such as one the pool had no slot for: frees its probe slot */
+void backend_pool_circuit_breaker_cancel_request(backend_pool_t *pool)
+{
+    if (!pool || !pool->circuit_breaker_enabled) {
+        return;
+    }
+    if (atomic_load(&pool->circuit_breaker.state) == CIRCUIT_BREAKER_HALF_OPEN) {
+        cb_release_probe(&pool->circuit_breaker);
     }
 }
 
@@ -682,6 +1222,16 @@ int backend_pool_circuit_breaker_get_failure_count(backend_pool_t *pool)
     return atomic_load(&pool->circuit_breaker.failure_count);
 }
 
+void backend_pool_circuit_breaker_get_window(backend_pool_t *pool, long *requests, long *failures)
+{
+    if (!pool || !pool->circuit_breaker_enabled) {
+        *requests = 0;
+        *failures = 0;
+        return;
+    }
+    cb_window_sum(&pool->circuit_breaker, requests, failures);
+}
+
 long backend_pool_circuit_breaker_get_total_opens(backend_pool_t *pool)
 {
     if (!pool) {
@@ -7,6 +7,7 @@
 #include <yaml.h>
 #include "log.h"
 #include "config.h"
+#include "cpu_affinity.h"
 
 static yaml_node_t *find_yaml_node(yaml_document_t *doc, yaml_node_t *node, const char *key)
 {
@@ -112,6 +113,18 @@ static void set_config_defaults(ServerConfig *config)
     
     config->security_headers.enabled = true;
     config->security_headers.header_count = 0;
+
+    config->cpu_affinity.enabled = false;
+    config->cpu_affinity.acceptor_cpu = -1;
+    config->cpu_affinity.logger_cpu = -1;
+    config->cpu_affinity.metrics_cpu = -1;
+
+    config->response_cache.max_size_mb = RESPONSE_CACHE_CONFIG_DEFAULT_SIZE_MB;
+    config->response_cache.shards = RESPONSE_CACHE_CONFIG_DEFAULT_SHARDS;
+    config->response_cache.max_entry_size_kb = RESPONSE_CACHE_CONFIG_DEFAULT_ENTRY_KB;
+    config->response_cache.disk_size_mb = RESPONSE_CACHE_CONFIG_DEFAULT_DISK_MB;
+    config->response_cache.disk_slab_kb = RESPONSE_CACHE_CONFIG_DEFAULT_DISK_SLAB_KB;
+    config->response_cache.disk_max_object_mb = RESPONSE_CACHE_CONFIG_DEFAULT_DISK_OBJECT_MB;
 }
 
 static int get_yaml_string_ext(yaml_node_t *node, const char *field, char *buffer, size_t size, int line)
@@ -282,6 +295,23 @@ static int parse_log_format(const char *value, LogFormat *format)
     return 0;
 }
 
+static int parse_load_balancer(const char *value, LoadBalancerPolicy *policy)
+{
+    if (strcasecmp(value, "round_robin") == 0)
+        *policy = LB_ROUND_ROBIN;
+    else if (strcasecmp(value, "least_request") == 0)
+        *policy = LB_LEAST_REQUEST;
+    else if (strcasecmp(value, "p2c") == 0)
+        *policy = LB_P2C;
+    else if (strcasecmp(value, "ewma") == 0)
+        *policy = LB_EWMA;
+    else if (strcasecmp(value, "maglev") == 0)
+        *policy = LB_MAGLEV;
+    else
+        return -1;
+    return 0;
+}
+
 static int parse_appender_flags(yaml_document_t *doc, yaml_node_t *node, LoggingConfig *log_cfg)
 {
     if (!node)
@@ -382,17 +412,18 @@ static int parse_health_check_config(yaml_document_t *doc, yaml_node_t *node, He
 
 static int parse_connection_pool_config(yaml_document_t *doc, yaml_node_t *node, ConnectionPoolConfig *cp)
 {
+    cp->size = BACKEND_POOL_DEFAULT_SIZE;
+    cp->min_size = BACKEND_POOL_DEFAULT_MIN_SIZE;
+    cp->acquire_timeout_ms = BACKEND_POOL_DEFAULT_ACQUIRE_TIMEOUT_MS;
+    cp->idle_timeout_seconds = BACKEND_POOL_IDLE_TIMEOUT_SEC;
+    
     if (!node || node->type != YAML_MAPPING_NODE) {
-        cp->size = BACKEND_POOL_DEFAULT_SIZE;
-        cp->idle_timeout_seconds = BACKEND_POOL_IDLE_TIMEOUT_SEC;
         return 0;
     }
     
-    cp->size = BACKEND_POOL_DEFAULT_SIZE;
-    cp->idle_timeout_seconds = BACKEND_POOL_IDLE_TIMEOUT_SEC;
-    
     yaml_node_t *field;
     
+    /* 'size' predates min/max sizing and is kept as an alias for max_size */
     field = find_yaml_node(doc, node, "size");
     if (field) {
         int val;
@@ -401,6 +432,30 @@ static int parse_connection_pool_config(yaml_document_t *doc, yaml_node_t *node,
         }
     }
     
+    field = find_yaml_node(doc, node, "max_size");
+    if (field) {
+        int val;
+        if (get_yaml_int(field, "connection_pool.max_size", &val) == 0) {
+            cp->size = val;
+        }
+    }
+    
+    field = find_yaml_node(doc, node, "min_size");
+    if (field) {
+        int val;
+        if (get_yaml_int(field, "connection_pool.min_size", &val) == 0) {
+            cp->min_size = val;
+        }
+    }
+    
+    field = find_yaml_node(doc, node, "acquire_timeout_ms");
+    if (field) {
+        int val;
+        if (get_yaml_int(field, "connection_pool.acquire_timeout_ms", &val) == 0) {
+            cp->acquire_timeout_ms = val;
+        }
+    }
+    
     field = find_yaml_node(doc, node, "idle_timeout_seconds");
     if (field) {
         int val;
@@ -414,17 +469,19 @@ static int parse_connection_pool_config(yaml_document_t *doc, yaml_node_t *node,
 
 static int parse_circuit_breaker_config(yaml_document_t *doc, yaml_node_t *node, CircuitBreakerConfig *cb)
 {
+    cb->enabled = false;
+    cb->failure_threshold = CIRCUIT_BREAKER_DEFAULT_FAILURE_THRESHOLD;
+    cb->recovery_timeout_seconds = CIRCUIT_BREAKER_DEFAULT_RECOVERY_SEC;
+    cb->failure_percent = CIRCUIT_BREAKER_DEFAULT_FAILURE_PERCENT;
+    cb->minimum_requests = CIRCUIT_BREAKER_DEFAULT_MIN_REQUESTS;
+    cb->window_seconds = CIRCUIT_BREAKER_DEFAULT_WINDOW_SEC;
+    cb->success_threshold = CIRCUIT_BREAKER_DEFAULT_SUCCESS_THRESHOLD;
+    cb->half_open_max_requests = CIRCUIT_BREAKER_DEFAULT_HALF_OPEN_REQUESTS;
+
     if (!node || node->type != YAML_MAPPING_NODE) {
-        cb->enabled = false;
-        cb->failure_threshold = 5;
-        cb->recovery_timeout_seconds = 30;
         return 0;
     }
     
-    cb->enabled = false;
-    cb->failure_threshold = 5;
-    cb->recovery_timeout_seconds = 30;
-    
     yaml_node_t *field;
     
     field = find_yaml_node(doc, node, "enabled");
@@ -450,10 +507,252 @@ static int parse_circuit_breaker_config(yaml_document_t *doc, yaml_node_t *node,
             cb->recovery_timeout_seconds = val;
         }
     }
+
+    field = find_yaml_node(doc, node, "failure_percent");
+    if (field && get_yaml_int_in_range(field, "circuit_breaker.failure_percent", 0, 100,
+                                       &cb->failure_percent) != 0) {
+        return -1;
+    }
+    field = find_yaml_node(doc, node, "minimum_requests");
+    if (field && get_yaml_int_in_range(field, "circuit_breaker.minimum_requests", 1, 1000000,
+                                       &cb->minimum_requests) != 0) {
+        return -1;
+    }
+    field = find_yaml_node(doc, node, "window_seconds");
+    if (field && get_yaml_int_in_range(field, "circuit_breaker.window_seconds", 1, 3600,
+                                       &cb->window_seconds) != 0) {
+        return -1;
+    }
+    field = find_yaml_node(doc, node, "success_threshold");
+    if (field && get_yaml_int_in_range(field, "circuit_breaker.success_threshold", 1, 1000,
+                                       &cb->success_threshold) != 0) {
+        return -1;
+    }
+    field = find_yaml_node(doc, node, "half_open_max_requests");
+    if (field && get_yaml_int_in_range(field, "circuit_breaker.half_open_max_requests", 1, 1000,
+                                       &cb->half_open_max_requests) != 0) {
+        return -1;
+    }
     
     return 0;
 }
 
+static int parse_outlier_detection_config(yaml_document_t *doc, yaml_node_t *node,
+                                          OutlierDetectionConfig *od)
+{
+    od->enabled = false;
+    od->consecutive_5xx = OUTLIER_DEFAULT_CONSECUTIVE_5XX;
+    od->interval_seconds = OUTLIER_DEFAULT_INTERVAL_SEC;
+    od->base_ejection_time_seconds = OUTLIER_DEFAULT_EJECTION_SEC;
+    od->max_ejection_percent = OUTLIER_DEFAULT_MAX_EJECTION_PERCENT;
+    od->failure_percent = OUTLIER_DEFAULT_FAILURE_PERCENT;
+    od->min_requests = OUTLIER_DEFAULT_MIN_REQUESTS;
+    od->latency_factor = OUTLIER_DEFAULT_LATENCY_FACTOR;
+
+    if (!node || node->type != YAML_MAPPING_NODE) {
+        return 0;
+    }
+
+    yaml_node_t *field = find_yaml_node(doc, node, "enabled");
+    if (field) {
+        int val;
+        if (get_yaml_bool(field, "outlier_detection.enabled", &val) == 0) {
+            od->enabled = (bool)val;
+        }
+    }
+
+    field = find_yaml_node(doc, node, "consecutive_5xx");
+    if (field &&
+        get_yaml_int_in_range(field, "outlier_detection.consecutive_5xx", 0, 1000, &od->consecutive_5xx) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "interval_seconds");
+    if (field &&
+        get_yaml_int_in_range(field, "outlier_detection.interval_seconds", 1, 3600, &od->interval_seconds) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "base_ejection_time_seconds");
+    if (field &&
+        get_yaml_int_in_range(field, "outlier_detection.base_ejection_time_seconds", 1, 3600,
+                              &od->base_ejection_time_seconds) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "max_ejection_percent");
+    if (field &&
+        get_yaml_int_in_range(field, "outlier_detection.max_ejection_percent", 0, 100,
+                              &od->max_ejection_percent) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "failure_percent");
+    if (field &&
+        get_yaml_int_in_range(field, "outlier_detection.failure_percent", 0, 100, &od->failure_percent) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "min_requests");
+    if (field &&
+        get_yaml_int_in_range(field, "outlier_detection.min_requests", 1, 1000000, &od->min_requests) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "latency_factor");
+    if (field &&
+        get_yaml_int_in_range(field, "outlier_detection.latency_factor", 0, 1000, &od->latency_factor) != 0)
+        return -1;
+
+    return 0;
+}
+
+static int parse_concurrency_limit_config(yaml_document_t *doc, yaml_node_t *node,
+                                          ConcurrencyLimitConfig *limit)
+{
+    limit->enabled = false;
+    limit->initial_limit = CONCURRENCY_DEFAULT_INITIAL_LIMIT;
+    limit->min_limit = CONCURRENCY_DEFAULT_MIN_LIMIT;
+    limit->max_limit = CONCURRENCY_DEFAULT_MAX_LIMIT;
+    limit->rtt_tolerance_percent = CONCURRENCY_DEFAULT_RTT_TOLERANCE_PERCENT;
+    limit->smoothing_percent = CONCURRENCY_DEFAULT_SMOOTHING_PERCENT;
+
+    if (!node || node->type != YAML_MAPPING_NODE) {
+        return 0;
+    }
+
+    yaml_node_t *field = find_yaml_node(doc, node, "enabled");
+    if (field) {
+        int val;
+        if (get_yaml_bool(field, "concurrency_limit.enabled", &val) == 0) {
+            limit->enabled = (bool)val;
+        }
+    }
+
+    field = find_yaml_node(doc, node, "initial_limit");
+    if (field &&
+        get_yaml_int_in_range(field, "concurrency_limit.initial_limit", 1, 100000, &limit->initial_limit) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "min_limit");
+    if (field && get_yaml_int_in_range(field, "concurrency_limit.min_limit", 1, 100000, &limit->min_limit) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "max_limit");
+    if (field && get_yaml_int_in_range(field, "concurrency_limit.max_limit", 1, 100000, &limit->max_limit) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "rtt_tolerance_percent");
+    if (field &&
+        get_yaml_int_in_range(field, "concurrency_limit.rtt_tolerance_percent", 100, 1000,
+                              &limit->rtt_tolerance_percent) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "smoothing_percent");
+    if (field &&
+        get_yaml_int_in_range(field, "concurrency_limit.smoothing_percent", 1, 100, &limit->smoothing_percent) != 0)
+        return -1;
+
+    if (limit->min_limit > limit->max_limit) {
+        fprintf(stderr, "Invalid 'concurrency_limit.min_limit' (line %d): above max_limit (%d)\n",
+                get_node_line(node), limit->max_limit);
+        return -1;
+    }
+    if (limit->initial_limit < limit->min_limit) {
+        limit->initial_limit = limit->min_limit;
+    } else if (limit->initial_limit > limit->max_limit) {
+        limit->initial_limit = limit->max_limit;
+    }
+    return 0;
+}
+
+static int parse_retry_config(yaml_document_t *doc, yaml_node_t *node, RetryPolicyConfig *retry)
+{
+    retry->enabled = false;
+    retry->max_retries = RETRY_DEFAULT_MAX_RETRIES;
+    retry->budget_percent = RETRY_DEFAULT_BUDGET_PERCENT;
+    retry->budget_burst = RETRY_DEFAULT_BUDGET_BURST;
+    retry->hedge = false;
+    retry->hedge_delay_ms = 0;
+
+    if (!node || node->type != YAML_MAPPING_NODE) {
+        return 0;
+    }
+
+    yaml_node_t *field = find_yaml_node(doc, node, "enabled");
+    if (field) {
+        int val;
+        if (get_yaml_bool(field, "retry.enabled", &val) == 0) {
+            retry->enabled = (bool)val;
+        }
+    }
+
+    field = find_yaml_node(doc, node, "max_retries");
+    if (field && get_yaml_int_in_range(field, "retry.max_retries", 0, 5, &retry->max_retries) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "budget_percent");
+    if (field && get_yaml_int_in_range(field, "retry.budget_percent", 1, 100, &retry->budget_percent) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "budget_burst");
+    if (field && get_yaml_int_in_range(field, "retry.budget_burst", 1, 100000, &retry->budget_burst) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "hedge");
+    if (field) {
+        int val;
+        if (get_yaml_bool(field, "retry.hedge", &val) == 0) {
+            retry->hedge = (bool)val;
+        }
+    }
+
+    field = find_yaml_node(doc, node, "hedge_delay_ms");
+    if (field && get_yaml_int_in_range(field, "retry.hedge_delay_ms", 0, 60000, &retry->hedge_delay_ms) != 0)
+        return -1;
+
+    return 0;
+}
+
+static int parse_route_cache_config(yaml_document_t *doc, yaml_node_t *node, RouteCacheConfig *cache)
+{
+    cache->enabled = false;
+    cache->ttl_seconds = 0;
+    cache->coalesce_timeout_ms = RESPONSE_CACHE_CONFIG_DEFAULT_COALESCE_MS;
+    cache->stale_while_revalidate_seconds = 0;
+    cache->stale_if_error_seconds = 0;
+
+    if (!node || node->type != YAML_MAPPING_NODE) {
+        return 0;
+    }
+
+    yaml_node_t *field = find_yaml_node(doc, node, "enabled");
+    if (field) {
+        int val;
+        if (get_yaml_bool(field, "cache.enabled", &val) == 0) {
+            cache->enabled = (bool)val;
+        }
+    }
+
+    field = find_yaml_node(doc, node, "ttl_seconds");
+    if (field &&
+        get_yaml_int_in_range(field, "cache.ttl_seconds", 0, 31536000, &cache->ttl_seconds) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "coalesce_timeout_ms");
+    if (field &&
+        get_yaml_int_in_range(field, "cache.coalesce_timeout_ms", 0, 60000, &cache->coalesce_timeout_ms) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "stale_while_revalidate_seconds");
+    if (field &&
+        get_yaml_int_in_range(field, "cache.stale_while_revalidate_seconds", 0, 604800,
+                              &cache->stale_while_revalidate_seconds) != 0)
+        return -1;
+
+    field = find_yaml_node(doc, node, "stale_if_error_seconds");
+    if (field &&
+        get_yaml_int_in_range(field, "cache.stale_if_error_seconds", 0, 604800,
+                              &cache->stale_if_error_seconds) != 0)
+        return -1;
+
+    return 0;
+}
+
 static int parse_security_headers_config(yaml_document_t *doc, yaml_node_t *node, SecurityHeadersConfig *shc)
 {
     if (!node || node->type != YAML_MAPPING_NODE) {
@@ -565,8 +864,13 @@ int parse_backend_url(const char *backend, char *host, size_t host_size, int *po
 
     if (!backend || backend[0] == '\0')
         return -1;
-    if (sscanf(backend, "%255[^:]:%d%c", temp_host, &temp_port, &trailing) != 2)
+    /* IPv6 literals are bracketed: [::1]:8443 */
+    if (backend[0] == '[') {
+        if (sscanf(backend, "[%255[^]]]:%d%c", temp_host, &temp_port, &trailing) != 2)
+            return -1;
+    } else if (sscanf(backend, "%255[^:]:%d%c", temp_host, &temp_port, &trailing) != 2) {
         return -1;
+    }
     if (temp_host[0] == '\0')
         return -1;
     if (temp_port < 1 || temp_port > 65535)
@@ -609,6 +913,26 @@ static int validate_routes(const ServerConfig *config)
                 fprintf(stderr, "Invalid routes[%d].backend: expected host:port\n", i);
                 return -1;
             }
+            for (int b = 0; b < route->backend_count; b++) {
+                if (validate_backend(route->backends[b]) != 0) {
+                    fprintf(stderr, "Invalid routes[%d].backends[%d]: expected host:port\n", i, b);
+                    return -1;
+                }
+            }
+            const ConnectionPoolConfig *cp = &route->connection_pool;
+            if (cp->size < 1 || cp->size > BACKEND_POOL_MAX_SIZE) {
+                fprintf(stderr, "Invalid routes[%d].connection_pool.max_size: must be 1-%d\n",
+                        i, BACKEND_POOL_MAX_SIZE);
+                return -1;
+            }
+            if (cp->min_size < 0 || cp->min_size > cp->size) {
+                fprintf(stderr, "Invalid routes[%d].connection_pool.min_size: must be 0-max_size\n", i);
+                return -1;
+            }
+            if (cp->acquire_timeout_ms < 0) {
+                fprintf(stderr, "Invalid routes[%d].connection_pool.acquire_timeout_ms: must be >= 0\n", i);
+                return -1;
+            }
         } else {
             fprintf(stderr, "Invalid routes[%d].technology '%s': unsupported\n", i, route->technology);
             return -1;
@@ -734,6 +1058,62 @@ static int parse_http2_section(ConfigParser *ctx, yaml_node_t *node)
     return 0;
 }
 
+static int parse_response_cache_section(ConfigParser *ctx, yaml_node_t *node)
+{
+    ctx->section_name = "response_cache";
+
+    if (node->type != YAML_MAPPING_NODE) {
+        fprintf(stderr, "Invalid 'response_cache' (line %d): expected mapping\n",
+                get_node_line(node));
+        return -1;
+    }
+
+    PARSE_FIELD("max_size_mb", get_yaml_int_in_range, 1, 65536, &ctx->config->response_cache.max_size_mb);
+    PARSE_FIELD("shards", get_yaml_int_in_range, 1, 256, &ctx->config->response_cache.shards);
+    PARSE_FIELD("max_entry_size_kb", get_yaml_int_in_range, 1, 1048576, &ctx->config->response_cache.max_entry_size_kb);
+    PARSE_STRING("disk_path", ctx->config->response_cache.disk_path, sizeof(ctx->config->response_cache.disk_path));
+    PARSE_FIELD("disk_size_mb", get_yaml_int_in_range, 1, 1048576, &ctx->config->response_cache.disk_size_mb);
+    PARSE_FIELD("disk_slab_kb", get_yaml_int_in_range, 4, 65536, &ctx->config->response_cache.disk_slab_kb);
+    PARSE_FIELD("disk_max_object_mb", get_yaml_int_in_range, 1, 4096, &ctx->config->response_cache.disk_max_object_mb);
+
+    return 0;
+}
+
+static int parse_cpu_affinity_section(ConfigParser *ctx, yaml_node_t *node)
+{
+    CPUAffinityConfig *aff = &ctx->config->cpu_affinity;
+    int enabled = aff->enabled;
+
+    ctx->section_name = "cpu_affinity";
+
+    if (node->type != YAML_MAPPING_NODE) {
+        fprintf(stderr, "Invalid 'cpu_affinity' (line %d): expected mapping\n",
+                get_node_line(node));
+        return -1;
+    }
+
+    PARSE_BOOL("enabled", &enabled);
+    aff->enabled = enabled;
+    PARSE_STRING("worker_cpus", aff->worker_cpus, sizeof(aff->worker_cpus));
+    PARSE_FIELD("acceptor_cpu", get_yaml_int_in_range, -1, CPU_SETSIZE - 1, &aff->acceptor_cpu);
+    PARSE_FIELD("logger_cpu", get_yaml_int_in_range, -1, CPU_SETSIZE - 1, &aff->logger_cpu);
+    PARSE_FIELD("metrics_cpu", get_yaml_int_in_range, -1, CPU_SETSIZE - 1, &aff->metrics_cpu);
+
+    aff->worker_cpu_count = 0;
+    if (aff->worker_cpus[0] != '\0') {
+        int count = cpu_affinity_parse_list(aff->worker_cpus, aff->worker_cpu_list,
+                                            MAX_AFFINITY_CPUS);
+        if (count < 0) {
+            fprintf(stderr, "Invalid 'cpu_affinity.worker_cpus': '%s' is not a valid CPU list\n",
+                    aff->worker_cpus);
+            return -1;
+        }
+        aff->worker_cpu_count = count;
+    }
+
+    return 0;
+}
+
 static int parse_route_entry(ConfigParser *ctx, yaml_node_t *route_node)
 {
     if (ctx->config->route_count >= MAX_ROUTES) {
@@ -772,6 +1152,55 @@ static int parse_route_entry(ConfigParser *ctx, yaml_node_t *route_node)
                         route->backend, sizeof(route->backend)) != 0)
         return -1;
 
+    /* 'backends' lists every endpoint of the upstream cluster; a single
+     * 'backend' is a one-endpoint cluster */
+    route_field = find_yaml_node(ctx->document, route_node, "backends");
+    if (route_field) {
+        if (route_field->type != YAML_SEQUENCE_NODE) {
+            fprintf(stderr, "Invalid 'routes[].backends' (line %d): expected sequence\n",
+                    get_node_line(route_field));
+            return -1;
+        }
+        for (yaml_node_item_t *item = route_field->data.sequence.items.start;
+             item < route_field->data.sequence.items.top; item++) {
+            if (route->backend_count >= MAX_ROUTE_BACKENDS) {
+                fprintf(stderr, "Too many routes[].backends: maximum supported is %d\n",
+                        MAX_ROUTE_BACKENDS);
+                return -1;
+            }
+            yaml_node_t *entry = yaml_document_get_node(ctx->document, *item);
+            if (!entry || get_yaml_string(entry, "routes[].backends[]",
+                                          route->backends[route->backend_count],
+                                          sizeof(route->backends[0])) != 0)
+                return -1;
+            route->backend_count++;
+        }
+        if (route->backend_count > 0 && route->backend[0] == '\0') {
+            memcpy(route->backend, route->backends[0], sizeof(route->backend));
+        }
+    } else if (route->backend[0] != '\0') {
+        memcpy(route->backends[0], route->backend, sizeof(route->backends[0]));
+        route->backend_count = 1;
+    }
+
+    route->load_balancer = LB_ROUND_ROBIN;
+    route_field = find_yaml_node(ctx->document, route_node, "load_balancer");
+    if (route_field) {
+        char policy[32];
+        if (get_yaml_string(route_field, "routes[].load_balancer", policy, sizeof(policy)) != 0 ||
+            parse_load_balancer(policy, &route->load_balancer) != 0) {
+            fprintf(stderr, "Invalid 'routes[].load_balancer' (line %d): expected "
+                    "round_robin/least_request/p2c/ewma/maglev\n", get_node_line(route_field));
+            return -1;
+        }
+    }
+
+    route_field = find_yaml_node(ctx->document, route_node, "hash_header");
+    if (route_field &&
+        get_yaml_string(route_field, "routes[].hash_header",
+                        route->hash_header, sizeof(route->hash_header)) != 0)
+        return -1;
+
     // Parse HTTP/2 reverse proxy options
     route->http2_enabled = false;
     route->tls_enabled = true;
@@ -800,6 +1229,23 @@ static int parse_route_entry(ConfigParser *ctx, yaml_node_t *route_node)
             route->tls_verify = (bool)val;
         }
     }
+
+    route->websocket_enabled = true;
+    route->websocket_idle_timeout_seconds = WEBSOCKET_DEFAULT_IDLE_TIMEOUT_SEC;
+
+    route_field = find_yaml_node(ctx->document, route_node, "websocket_enabled");
+    if (route_field) {
+        int val;
+        if (get_yaml_bool(route_field, "routes[].websocket_enabled", &val) == 0) {
+            route->websocket_enabled = (bool)val;
+        }
+    }
+
+    route_field = find_yaml_node(ctx->document, route_node, "websocket_idle_timeout_seconds");
+    if (route_field &&
+        get_yaml_int_in_range(route_field, "routes[].websocket_idle_timeout_seconds",
+                              0, 86400, &route->websocket_idle_timeout_seconds) != 0)
+        return -1;
     
     // Parse nested config sections
     yaml_node_t *hc_node = find_yaml_node(ctx->document, route_node, "health_check");
@@ -809,13 +1255,30 @@ static int parse_route_entry(ConfigParser *ctx, yaml_node_t *route_node)
     parse_connection_pool_config(ctx->document, cp_node, &route->connection_pool);
     
     yaml_node_t *cb_node = find_yaml_node(ctx->document, route_node, "circuit_breaker");
-    parse_circuit_breaker_config(ctx->document, cb_node, &route->circuit_breaker);
+    if (parse_circuit_breaker_config(ctx->document, cb_node, &route->circuit_breaker) != 0)
+        return -1;
+
+    yaml_node_t *od_node = find_yaml_node(ctx->document, route_node, "outlier_detection");
+    if (parse_outlier_detection_config(ctx->document, od_node, &route->outlier_detection) != 0)
+        return -1;
+
+    yaml_node_t *retry_node = find_yaml_node(ctx->document, route_node, "retry");
+    if (parse_retry_config(ctx->document, retry_node, &route->retry) != 0)
+        return -1;
+
+    yaml_node_t *limit_node = find_yaml_node(ctx->document, route_node, "concurrency_limit");
+    if (parse_concurrency_limit_config(ctx->document, limit_node, &route->concurrency_limit) != 0)
+        return -1;
     
     yaml_node_t *sh_node = find_yaml_node(ctx->document, route_node, "security_headers");
     parse_security_headers_config(ctx->document, sh_node, &route->security_headers);
     
     yaml_node_t *cors_node = find_yaml_node(ctx->document, route_node, "cors");
     parse_cors_config(ctx->document, cors_node, &route->cors);
+
+    yaml_node_t *cache_node = find_yaml_node(ctx->document, route_node, "cache");
+    if (parse_route_cache_config(ctx->document, cache_node, &route->cache) != 0)
+        return -1;
     
     route->inherit_global_headers = true;
     yaml_node_t *inherit_node = find_yaml_node(ctx->document, route_node, "inherit_global_headers");
@@ -951,6 +1414,14 @@ int load_config(ServerConfig *config, const char *file_path)
     if (node && parse_http2_section(&ctx, node) != 0)
         goto cleanup;
 
+    node = find_yaml_node(&document, root, "cpu_affinity");
+    if (node && parse_cpu_affinity_section(&ctx, node) != 0)
+        goto cleanup;
+
+    node = find_yaml_node(&document, root, "response_cache");
+    if (node && parse_response_cache_section(&ctx, node) != 0)
+        goto cleanup;
+
     node = find_yaml_node(&document, root, "routes");
     if (node && parse_routes_section(&ctx, node) != 0)
         goto cleanup;
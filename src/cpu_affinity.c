@@ -0,0 +1,109 @@
+/* cpu_affinity.c - CPU pinning helpers for worker, acceptor and service threads */
+#include "cpu_affinity.h"
+#include "log.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <liburing.h>
+
+static int parse_cpu_number(const char **cursor, int *cpu)
+{
+    char *end;
+    long value;
+
+    if (!isdigit((unsigned char)**cursor))
+        return -1;
+    errno = 0;
+    value = strtol(*cursor, &end, 10);
+    if (errno != 0 || value < 0 || value >= CPU_SETSIZE)
+        return -1;
+    *cpu = (int)value;
+    *cursor = end;
+    return 0;
+}
+
+int cpu_affinity_parse_list(const char *list, int *cpus, int max_cpus)
+{
+    const char *p = list;
+    int count = 0;
+
+    if (!list || !cpus || max_cpus <= 0)
+        return -1;
+
+    while (*p) {
+        int first, last;
+
+        while (*p == ' ')
+            p++;
+        if (parse_cpu_number(&p, &first) != 0)
+            return -1;
+        last = first;
+        if (*p == '-') {
+            p++;
+            if (parse_cpu_number(&p, &last) != 0 || last < first)
+                return -1;
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            if (count >= max_cpus)
+                return -1;
+            cpus[count++] = cpu;
+        }
+        while (*p == ' ')
+            p++;
+        if (*p == ',')
+            p++;
+        else if (*p != '\0')
+            return -1;
+    }
+    return count;
+}
+
+int cpu_affinity_filter_available(int *cpus, int count)
+{
+    cpu_set_t allowed;
+    int kept = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return count;
+    for (int i = 0; i < count; i++) {
+        if (CPU_ISSET(cpus[i], &allowed))
+            cpus[kept++] = cpus[i];
+        else
+            log_message(LOG_LEVEL_WARN, "CPU %d is not available to this process, skipping", cpus[i]);
+    }
+    return kept;
+}
+
+int cpu_affinity_pin_thread(pthread_t thread, int cpu)
+{
+    cpu_set_t set;
+    int ret;
+
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return -1;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    ret = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (ret != 0) {
+        log_message(LOG_LEVEL_WARN, "Failed to pin thread to CPU %d: %s", cpu, strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+int cpu_affinity_bind_ring(struct io_uring *ring)
+{
+    cpu_set_t set;
+    int ret;
+
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        return -1;
+    ret = io_uring_register_iowq_aff(ring, sizeof(set), &set);
+    if (ret < 0) {
+        log_message(LOG_LEVEL_DEBUG, "io_uring_register_iowq_aff failed: %s", strerror(-ret));
+        return -1;
+    }
+    return 0;
+}
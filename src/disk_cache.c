@@ -0,0 +1,415 @@
+/* disk_cache.c - Disk tier behind the shared response cache
+ *
+ * Responses too large for memory, and those the memory tier evicts while
+ * still usable, are written to one preallocated file that stays mapped.
+ * The file is a ring of fixed-size slabs: each record takes the next run
+ * of slabs, and once the ring wraps the oldest records are dropped to make
+ * room. Writes are therefore sequential, and nothing is ever compacted.
+ *
+ * Only the index (key hash, offsets, freshness) is kept in memory. A hit
+ * is served straight from the mapping: the entry handed out points at the
+ * mapped key, headers and body, and pins its record so the writer cannot
+ * overwrite it meanwhile. The page cache decides what stays resident.
+ *
+ * Writing is left to a thread of its own (write-behind), so a request
+ * never waits for the copy into the mapping or for the page faults it
+ * takes; the kernel writes the dirty pages back in its own time. When the
+ * writer falls behind, or the slabs in the way are being served, the
+ * write is dropped: the response simply stays uncached.
+ *
+ * The index does not survive a restart, so neither does the content.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "disk_cache.h"
+#include "response_cache.h"
+#include "log.h"
+
+static size_t slab_span(const disk_cache_t *disk, size_t length)
+{
+    return (length + disk->slab_size - 1) / disk->slab_size * disk->slab_size;
+}
+
+/* Bytes the key, header and vary strings take, each NUL terminated */
+static size_t strings_size(const response_cache_entry_t *entry)
+{
+    size_t size = entry->key_len + 1;
+
+    for (int i = 0; i < entry->header_count; i++) {
+        size += entry->headers[i].name_len + entry->headers[i].value_len + 2;
+    }
+    for (int i = 0; i < entry->vary_count; i++) {
+        size += entry->vary[i].name_len + entry->vary[i].value_len + 2;
+    }
+    return size;
+}
+
+static char *put_string(char *p, const char *s, size_t len)
+{
+    if (len > 0) {
+        memcpy(p, s, len);
+    }
+    p[len] = '\0';
+    return p + len + 1;
+}
+
+static const char *get_string(const char *p, const char **s, size_t *len)
+{
+    *s = p;
+    *len = strlen(p);
+    return p + *len + 1;
+}
+
+static bool overlaps(const disk_cache_t *disk, const disk_cache_record_t *record, size_t start, size_t span)
+{
+    return record->offset < start + span && start < record->offset + slab_span(disk, record->length);
+}
+
+static void evict_oldest(disk_cache_t *disk)
+{
+    disk_cache_record_t *record = disk->oldest;
+
+    disk->oldest = record->next;
+    if (!disk->oldest) {
+        disk->newest = NULL;
+    }
+    disk_cache_record_t **link = &disk->buckets[record->hash % DISK_CACHE_BUCKETS];
+    while (*link && *link != record) {
+        link = &(*link)->chain;
+    }
+    if (*link) {
+        *link = record->chain;
+    }
+    free(record);
+    atomic_fetch_add(&disk->evictions, 1);
+}
+
+/* Reserves the next run of slabs, dropping the records in the way. NULL
+ * when one of them is being served. */
+static disk_cache_record_t *reserve(disk_cache_t *disk, size_t length)
+{
+    size_t span = slab_span(disk, length);
+    bool wrap = disk->head + span > disk->size;
+    size_t start = wrap ? 0 : disk->head;
+
+    /* The oldest records are the ones in front of the head; on a wrap that
+     * includes everything between the head and the end of the file */
+    for (disk_cache_record_t *old = disk->oldest; old; old = disk->oldest) {
+        if (!(wrap && old->offset >= disk->head) && !overlaps(disk, old, start, span)) {
+            break;
+        }
+        if (old->pins > 0) {
+            return NULL;
+        }
+        evict_oldest(disk);
+    }
+
+    disk_cache_record_t *record = calloc(1, sizeof(*record));
+    if (!record) {
+        return NULL;
+    }
+    record->owner = disk;
+    record->offset = start;
+    record->length = length;
+    disk->head = start + span;
+    return record;
+}
+
+/* Copies an entry into the mapping and indexes it */
+static void write_entry(disk_cache_t *disk, const response_cache_entry_t *entry)
+{
+    size_t strings_len = strings_size(entry);
+
+    pthread_mutex_lock(&disk->lock);
+    disk_cache_record_t *record = reserve(disk, strings_len + entry->body_len);
+    pthread_mutex_unlock(&disk->lock);
+    if (!record) {
+        atomic_fetch_add(&disk->dropped, 1);
+        return;
+    }
+
+    /* The slabs are ours alone until the record is linked */
+    char *p = disk->map + record->offset;
+    p = put_string(p, entry->key, entry->key_len);
+    for (int i = 0; i < entry->header_count; i++) {
+        p = put_string(p, entry->headers[i].name, entry->headers[i].name_len);
+        p = put_string(p, entry->headers[i].value, entry->headers[i].value_len);
+    }
+    for (int i = 0; i < entry->vary_count; i++) {
+        p = put_string(p, entry->vary[i].name, entry->vary[i].name_len);
+        p = put_string(p, entry->vary[i].value, entry->vary[i].value_len);
+    }
+    if (entry->body_len > 0) {
+        memcpy(p, entry->body, entry->body_len);
+    }
+
+    record->hash = entry->hash;
+    record->key_len = entry->key_len;
+    record->strings_len = strings_len;
+    record->body_len = entry->body_len;
+    record->header_count = entry->header_count;
+    record->vary_count = entry->vary_count;
+    record->status = entry->status;
+    record->reason = entry->reason;
+    record->stored_at = entry->stored_at;
+    record->expires_at = entry->expires_at;
+    record->initial_age = entry->initial_age;
+    record->stale_while_revalidate = entry->stale_while_revalidate;
+    record->stale_if_error = entry->stale_if_error;
+
+    pthread_mutex_lock(&disk->lock);
+    disk_cache_record_t **bucket = &disk->buckets[record->hash % DISK_CACHE_BUCKETS];
+    record->chain = *bucket;
+    *bucket = record;
+    if (disk->newest) {
+        disk->newest->next = record;
+    } else {
+        disk->oldest = record;
+    }
+    disk->newest = record;
+    pthread_mutex_unlock(&disk->lock);
+    atomic_fetch_add(&disk->writes, 1);
+}
+
+static void *writer_thread(void *arg)
+{
+    disk_cache_t *disk = arg;
+
+    pthread_mutex_lock(&disk->lock);
+    for (;;) {
+        while (disk->queue_len == 0 && !disk->stopping) {
+            pthread_cond_wait(&disk->queued, &disk->lock);
+        }
+        if (disk->queue_len == 0) {
+            break;
+        }
+        response_cache_entry_t *entry = disk->queue[disk->queue_head];
+        disk->queue_head = (disk->queue_head + 1) % DISK_CACHE_WRITE_QUEUE_SIZE;
+        disk->queue_len--;
+        disk->writing = true;
+        pthread_mutex_unlock(&disk->lock);
+
+        write_entry(disk, entry);
+        response_cache_release(entry);
+
+        pthread_mutex_lock(&disk->lock);
+        disk->writing = false;
+        if (disk->queue_len == 0) {
+            pthread_cond_broadcast(&disk->drained);
+        }
+    }
+    pthread_mutex_unlock(&disk->lock);
+    return NULL;
+}
+
+/* Maps 'size' bytes of the file at 'path', allocating them up front so
+ * writes never fail for lack of space */
+disk_cache_t *disk_cache_create(const char *path, size_t size, size_t slab_size, size_t max_object_size)
+{
+    if (!path || slab_size == 0 || size < slab_size) {
+        log_message(LOG_LEVEL_ERROR, "Invalid disk cache size or slab size");
+        return NULL;
+    }
+    size -= size % slab_size;
+
+    disk_cache_t *disk = calloc(1, sizeof(*disk));
+    if (!disk) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate disk cache");
+        return NULL;
+    }
+    disk->size = size;
+    disk->slab_size = slab_size;
+    disk->max_object_size = max_object_size;
+    disk->map = MAP_FAILED;
+    disk->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (disk->fd < 0) {
+        log_message(LOG_LEVEL_ERROR, "Failed to open disk cache %s: %s", path, strerror(errno));
+        goto fail;
+    }
+    int err = posix_fallocate(disk->fd, 0, (off_t)size);
+    if (err != 0) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate %zu bytes for disk cache %s: %s",
+                    size, path, strerror(err));
+        goto fail;
+    }
+    disk->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, disk->fd, 0);
+    if (disk->map == MAP_FAILED) {
+        log_message(LOG_LEVEL_ERROR, "Failed to map disk cache %s: %s", path, strerror(errno));
+        goto fail;
+    }
+
+    pthread_mutex_init(&disk->lock, NULL);
+    pthread_cond_init(&disk->queued, NULL);
+    pthread_cond_init(&disk->drained, NULL);
+    if (pthread_create(&disk->writer, NULL, writer_thread, disk) != 0) {
+        log_message(LOG_LEVEL_ERROR, "Failed to start disk cache writer");
+        pthread_cond_destroy(&disk->drained);
+        pthread_cond_destroy(&disk->queued);
+        pthread_mutex_destroy(&disk->lock);
+        goto fail;
+    }
+    return disk;
+
+fail:
+    if (disk->map != MAP_FAILED) {
+        munmap(disk->map, size);
+    }
+    if (disk->fd >= 0) {
+        close(disk->fd);
+    }
+    free(disk);
+    return NULL;
+}
+
+/* Writes what is queued, then unmaps. Nothing may be served from it any
+ * more. */
+void disk_cache_destroy(disk_cache_t *disk)
+{
+    if (!disk) {
+        return;
+    }
+
+    pthread_mutex_lock(&disk->lock);
+    disk->stopping = true;
+    pthread_cond_signal(&disk->queued);
+    pthread_mutex_unlock(&disk->lock);
+    pthread_join(disk->writer, NULL);
+
+    while (disk->oldest) {
+        evict_oldest(disk);
+    }
+    munmap(disk->map, disk->size);
+    close(disk->fd);
+    pthread_cond_destroy(&disk->drained);
+    pthread_cond_destroy(&disk->queued);
+    pthread_mutex_destroy(&disk->lock);
+    free(disk);
+}
+
+/* Queues a committed entry for the writer, which takes a reference of its
+ * own. Returns false when it was dropped. */
+bool disk_cache_store(disk_cache_t *disk, response_cache_entry_t *entry)
+{
+    if (entry->body_len > disk->max_object_size || strings_size(entry) + entry->body_len > disk->size) {
+        atomic_fetch_add(&disk->dropped, 1);
+        return false;
+    }
+
+    pthread_mutex_lock(&disk->lock);
+    if (disk->stopping || disk->queue_len == DISK_CACHE_WRITE_QUEUE_SIZE) {
+        pthread_mutex_unlock(&disk->lock);
+        atomic_fetch_add(&disk->dropped, 1);
+        return false;
+    }
+    atomic_fetch_add(&entry->refs, 1);
+    disk->queue[(disk->queue_head + disk->queue_len) % DISK_CACHE_WRITE_QUEUE_SIZE] = entry;
+    disk->queue_len++;
+    pthread_cond_signal(&disk->queued);
+    pthread_mutex_unlock(&disk->lock);
+    return true;
+}
+
+/* Waits until every queued entry was written or dropped */
+void disk_cache_flush(disk_cache_t *disk)
+{
+    pthread_mutex_lock(&disk->lock);
+    while (disk->queue_len > 0 || disk->writing) {
+        pthread_cond_wait(&disk->drained, &disk->lock);
+    }
+    pthread_mutex_unlock(&disk->lock);
+}
+
+/* An entry that reads the record's strings and body from the mapping */
+static response_cache_entry_t *load_entry(disk_cache_t *disk, disk_cache_record_t *record)
+{
+    int count = record->header_count + record->vary_count;
+    response_cache_entry_t *entry = calloc(1, sizeof(*entry));
+    response_cache_header_t *arrays = calloc(count > 0 ? (size_t)count : 1, sizeof(*arrays));
+
+    if (!entry || !arrays) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate disk cache entry");
+        free(entry);
+        free(arrays);
+        return NULL;
+    }
+    atomic_init(&entry->refs, 1);
+    entry->hash = record->hash;
+    entry->key = disk->map + record->offset;
+    entry->key_len = record->key_len;
+    entry->blob = (char *)arrays;
+    entry->headers = arrays;
+    entry->header_count = record->header_count;
+    entry->vary = arrays + record->header_count;
+    entry->vary_count = record->vary_count;
+
+    const char *p = entry->key + entry->key_len + 1;
+    for (int i = 0; i < count; i++) {
+        p = get_string(p, &arrays[i].name, &arrays[i].name_len);
+        p = get_string(p, &arrays[i].value, &arrays[i].value_len);
+    }
+    entry->status = record->status;
+    entry->reason = record->reason;
+    entry->stored_at = record->stored_at;
+    entry->expires_at = record->expires_at;
+    entry->initial_age = record->initial_age;
+    entry->stale_while_revalidate = record->stale_while_revalidate;
+    entry->stale_if_error = record->stale_if_error;
+    entry->body = disk->map + record->offset + record->strings_len;
+    entry->body_len = record->body_len;
+    entry->disk_record = record;
+    return entry;
+}
+
+/* The newest record for the key that 'match' accepts, as an entry pinning
+ * it until released, or NULL */
+response_cache_entry_t *disk_cache_lookup(disk_cache_t *disk, unsigned long hash,
+                                          const char *key, size_t key_len,
+                                          disk_cache_match_fn match, const void *ctx)
+{
+    response_cache_entry_t *found = NULL;
+
+    pthread_mutex_lock(&disk->lock);
+    for (disk_cache_record_t *record = disk->buckets[hash % DISK_CACHE_BUCKETS]; record;
+         record = record->chain) {
+        if (record->hash != hash || record->key_len != key_len ||
+            memcmp(disk->map + record->offset, key, key_len) != 0) {
+            continue;
+        }
+        response_cache_entry_t *entry = load_entry(disk, record);
+        if (!entry) {
+            break;
+        }
+        if (!match || match(entry, ctx)) {
+            record->pins++;
+            found = entry;
+            break;
+        }
+        free(entry->blob);
+        free(entry);
+    }
+    pthread_mutex_unlock(&disk->lock);
+
+    /* Start reading the body in while the response head goes out */
+    if (found && found->body_len > 0) {
+        uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t)found->body & ~(page - 1);
+        madvise((void *)start, (uintptr_t)found->body + found->body_len - start, MADV_WILLNEED);
+    }
+    return found;
+}
+
+void disk_cache_unpin(disk_cache_record_t *record)
+{
+    disk_cache_t *disk = record->owner;
+
+    pthread_mutex_lock(&disk->lock);
+    record->pins--;
+    pthread_mutex_unlock(&disk->lock);
+}
@@ -0,0 +1,667 @@
+/* health_check.c - Active health checks for every backend pool
+ *
+ * One scheduler thread checks all pools. It runs an epoll loop, so a
+ * check never blocks it: each check is a state machine that connects,
+ * completes the TLS handshake and sends 'GET <path>' over HTTP/2 without
+ * blocking, and is advanced whenever its socket is ready.
+ *
+ * Checks use probe connections of their own, opened for the check and
+ * closed after it. They never take a pool connection or stream slot, so
+ * a busy pool is not starved by its own checks. A check that has no
+ * answer after 'timeout_seconds' fails.
+ *
+ * The next check is due after the pool's interval, plus or minus
+ * HEALTH_CHECK_JITTER_PERCENT, so checks of many pools spread out. A pool
+ * is marked unhealthy after 'unhealthy_threshold' failed checks in a row,
+ * and healthy again after 'healthy_threshold' good ones.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <nghttp2/nghttp2.h>
+#include <openssl/ssl.h>
+#include "health_check.h"
+#include "http_status.h"
+#include "log.h"
+#include "resolver.h"
+
+#define WAKE_EVENT_ID 0
+
+typedef enum {
+    PROBE_IDLE = 0,
+    PROBE_CONNECTING,
+    PROBE_HANDSHAKE,
+    PROBE_EXCHANGE
+} probe_state_t;
+
+typedef struct health_probe_s {
+    health_checker_t *checker;
+    probe_state_t state;
+    long due_ms;                        /* next check, while idle */
+    long deadline_ms;                   /* end of the running check */
+    uint64_t connection_id;             /* epoll tag of the current socket */
+    resolved_addrs_t addrs;
+    int addr_index;
+    int fd;
+    SSL *ssl;
+    nghttp2_session *session;
+    int32_t stream_id;
+    int status;                         /* final :status, 0 = none yet */
+    bool answered;
+    bool reset;
+    uint8_t out[HEALTH_CHECK_OUTPUT_SIZE];  /* one frame chunk being written */
+    size_t out_len;
+    size_t out_off;
+    struct health_probe_s *next;
+} health_probe_t;
+
+/* The thread holds the lock except while it waits, so a probe removed
+ * under the lock is never touched again */
+static pthread_mutex_t scheduler_lock = PTHREAD_MUTEX_INITIALIZER;
+static health_probe_t *probes = NULL;
+static uint64_t next_connection_id = WAKE_EVENT_ID + 1;
+static uint64_t jitter_state = 0;
+static int epoll_fd = -1;
+static int wake_fd = -1;
+static nghttp2_session_callbacks *callbacks = NULL;
+static pthread_t scheduler;
+static bool scheduler_running = false;
+static bool scheduler_stop = false;
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static long random_below(long bound)
+{
+    if (jitter_state == 0) {
+        jitter_state = (uint64_t)now_ms() * 0x9e3779b97f4a7c15ULL | 1;
+    }
+    /* xorshift64 */
+    jitter_state ^= jitter_state << 13;
+    jitter_state ^= jitter_state >> 7;
+    jitter_state ^= jitter_state << 17;
+    return bound > 0 ? (long)(jitter_state % (uint64_t)bound) : 0;
+}
+
+static long interval_ms(const health_checker_t *checker)
+{
+    int seconds = checker->config.interval_seconds > 0 ? checker->config.interval_seconds :
+                  BACKEND_POOL_DEFAULT_INTERVAL_SEC;
+    return seconds * 1000L;
+}
+
+static long jittered_interval_ms(const health_checker_t *checker)
+{
+    long interval = interval_ms(checker);
+    long jitter = interval * HEALTH_CHECK_JITTER_PERCENT / 100;
+    return interval - jitter + random_below(2 * jitter + 1);
+}
+
+static int timeout_ms(const health_checker_t *checker)
+{
+    int seconds = checker->config.timeout_seconds > 0 ? checker->config.timeout_seconds :
+                  BACKEND_POOL_DEFAULT_TIMEOUT_SEC;
+    return seconds * 1000;
+}
+
+static void record_result(health_checker_t *checker, bool healthy, const char *detail)
+{
+    backend_pool_t *pool = checker->pool;
+    int healthy_threshold = checker->config.healthy_threshold > 0 ? checker->config.healthy_threshold :
+                            BACKEND_POOL_HEALTHY_THRESHOLD;
+    int unhealthy_threshold = checker->config.unhealthy_threshold > 0 ? checker->config.unhealthy_threshold :
+                              BACKEND_POOL_UNHEALTHY_THRESHOLD;
+
+    atomic_fetch_add(&checker->total_checks, 1);
+    atomic_store(&checker->last_check_time, (long)time(NULL));
+
+    if (healthy) {
+        atomic_store(&checker->consecutive_failures, 0);
+        int successes = atomic_fetch_add(&checker->consecutive_successes, 1) + 1;
+        if (successes >= healthy_threshold &&
+            atomic_exchange(&checker->health, BACKEND_HEALTH_HEALTHY) != BACKEND_HEALTH_HEALTHY) {
+            log_message(LOG_LEVEL_INFO, "Health check: %s:%d marked HEALTHY",
+                        pool->backend_host, pool->backend_port);
+        }
+        return;
+    }
+
+    atomic_fetch_add(&checker->failed_checks, 1);
+    atomic_store(&checker->consecutive_successes, 0);
+    int failures = atomic_fetch_add(&checker->consecutive_failures, 1) + 1;
+    log_message(LOG_LEVEL_WARN, "Health check of %s:%d failed: %s",
+                pool->backend_host, pool->backend_port, detail);
+    if (failures >= unhealthy_threshold &&
+        atomic_exchange(&checker->health, BACKEND_HEALTH_UNHEALTHY) != BACKEND_HEALTH_UNHEALTHY) {
+        log_message(LOG_LEVEL_WARN, "Health check: %s:%d marked UNHEALTHY after %d failures",
+                    pool->backend_host, pool->backend_port, failures);
+    }
+}
+
+static void close_probe(health_probe_t *probe)
+{
+    if (probe->session) {
+        nghttp2_session_del(probe->session);
+        probe->session = NULL;
+    }
+    if (probe->ssl) {
+        /* No close_notify: the peer may be the reason the check failed */
+        SSL_set_shutdown(probe->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        SSL_free(probe->ssl);
+        probe->ssl = NULL;
+    }
+    if (probe->fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, probe->fd, NULL);
+        close(probe->fd);
+        probe->fd = -1;
+    }
+    probe->out_len = 0;
+    probe->out_off = 0;
+}
+
+static void finish_check(health_probe_t *probe, bool healthy, const char *detail, long now)
+{
+    close_probe(probe);
+    record_result(probe->checker, healthy, detail);
+    backend_pool_update_metrics(probe->checker->pool);
+    probe->state = PROBE_IDLE;
+    probe->due_ms = now + jittered_interval_ms(probe->checker);
+}
+
+static void watch(health_probe_t *probe, uint32_t events)
+{
+    struct epoll_event ev = {.events = events, .data.u64 = probe->connection_id};
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, probe->fd, &ev);
+}
+
+static void connect_next(health_probe_t *probe, long now)
+{
+    while (probe->addr_index < probe->addrs.count) {
+        const struct sockaddr_storage *addr = &probe->addrs.addrs[probe->addr_index];
+        int fd = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd >= 0 &&
+            (connect(fd, (const struct sockaddr *)addr, probe->addrs.addr_lens[probe->addr_index]) == 0 ||
+             errno == EINPROGRESS)) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            probe->fd = fd;
+            probe->connection_id = next_connection_id++;
+            probe->state = PROBE_CONNECTING;
+            struct epoll_event ev = {.events = EPOLLOUT, .data.u64 = probe->connection_id};
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+            return;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        probe->addr_index++;
+    }
+    finish_check(probe, false, "connect failed", now);
+}
+
+static void start_check(health_probe_t *probe, long now)
+{
+    backend_pool_t *pool = probe->checker->pool;
+    resolver_endpoint_t *endpoint = pool->config.endpoint;
+
+    if (!endpoint) {
+        endpoint = resolver_get_endpoint(pool->backend_host, pool->backend_port);
+    }
+    probe->deadline_ms = now + timeout_ms(probe->checker);
+    probe->addr_index = 0;
+    probe->status = 0;
+    probe->answered = false;
+    probe->reset = false;
+    if (resolver_endpoint_addrs(endpoint, &probe->addrs) <= 0) {
+        finish_check(probe, false, "no address", now);
+        return;
+    }
+    connect_next(probe, now);
+}
+
+static int on_header(nghttp2_session *session, const nghttp2_frame *frame, const uint8_t *name,
+                     size_t namelen, const uint8_t *value, size_t valuelen, uint8_t flags,
+                     void *user_data)
+{
+    health_probe_t *probe = user_data;
+    (void)session;
+    (void)valuelen;
+    (void)flags;
+
+    /* nghttp2 NUL-terminates names and values */
+    if (frame->hd.type == NGHTTP2_HEADERS && frame->hd.stream_id == probe->stream_id &&
+        namelen == 7 && memcmp(name, ":status", 7) == 0) {
+        probe->status = atoi((const char *)value);
+    }
+    return 0;
+}
+
+static int on_frame_recv(nghttp2_session *session, const nghttp2_frame *frame, void *user_data)
+{
+    health_probe_t *probe = user_data;
+    (void)session;
+
+    /* Interim 1xx responses are skipped; the body is not needed */
+    if (frame->hd.type == NGHTTP2_HEADERS && frame->hd.stream_id == probe->stream_id &&
+        (frame->hd.flags & NGHTTP2_FLAG_END_HEADERS) && probe->status >= HTTP_STATUS_SUCCESS_MIN) {
+        probe->answered = true;
+    }
+    return 0;
+}
+
+static int on_stream_close(nghttp2_session *session, int32_t stream_id, uint32_t error_code,
+                           void *user_data)
+{
+    health_probe_t *probe = user_data;
+    (void)session;
+    (void)error_code;
+
+    if (stream_id == probe->stream_id && !probe->answered) {
+        probe->reset = true;
+    }
+    return 0;
+}
+
+/* Writes the session's output, one chunk at a time. -1 on error; 0 when
+ * all was written or the socket is full. */
+static int flush_output(health_probe_t *probe)
+{
+    for (;;) {
+        if (probe->out_off == probe->out_len) {
+            const uint8_t *data;
+            ssize_t n = nghttp2_session_mem_send(probe->session, &data);
+            if (n < 0 || (size_t)n > sizeof(probe->out)) {
+                return -1;
+            }
+            if (n == 0) {
+                return 0;
+            }
+            memcpy(probe->out, data, (size_t)n);
+            probe->out_len = (size_t)n;
+            probe->out_off = 0;
+        }
+        int written = SSL_write(probe->ssl, probe->out + probe->out_off,
+                                (int)(probe->out_len - probe->out_off));
+        if (written <= 0) {
+            int err = SSL_get_error(probe->ssl, written);
+            return err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ ? 0 : -1;
+        }
+        probe->out_off += (size_t)written;
+    }
+}
+
+static void exchange(health_probe_t *probe, long now)
+{
+    uint8_t buf[4096];
+
+    for (;;) {
+        if (flush_output(probe) != 0) {
+            finish_check(probe, false, "write failed", now);
+            return;
+        }
+        if (probe->answered || probe->reset) {
+            break;
+        }
+        int n = SSL_read(probe->ssl, buf, sizeof(buf));
+        if (n <= 0) {
+            int err = SSL_get_error(probe->ssl, n);
+            if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+                break;
+            }
+            finish_check(probe, false, "connection closed", now);
+            return;
+        }
+        if (nghttp2_session_mem_recv(probe->session, buf, (size_t)n) < 0) {
+            finish_check(probe, false, "HTTP/2 protocol error", now);
+            return;
+        }
+    }
+
+    if (probe->answered) {
+        char detail[32];
+        snprintf(detail, sizeof(detail), "status %d", probe->status);
+        finish_check(probe, probe->status < HTTP_STATUS_CLIENT_ERROR_MIN, detail, now);
+    } else if (probe->reset) {
+        finish_check(probe, false, "stream reset", now);
+    } else {
+        watch(probe, EPOLLIN | (probe->out_off < probe->out_len ? EPOLLOUT : 0));
+    }
+}
+
+static void begin_exchange(health_probe_t *probe, long now)
+{
+    backend_pool_t *pool = probe->checker->pool;
+    const unsigned char *alpn = NULL;
+    unsigned int alpn_len = 0;
+
+    SSL_get0_alpn_selected(probe->ssl, &alpn, &alpn_len);
+    if (!alpn || alpn_len != 2 || memcmp(alpn, "h2", 2) != 0) {
+        finish_check(probe, false, "ALPN h2 not negotiated", now);
+        return;
+    }
+    if (nghttp2_session_client_new(&probe->session, callbacks, probe) != 0 ||
+        nghttp2_submit_settings(probe->session, NGHTTP2_FLAG_NONE, NULL, 0) != 0) {
+        finish_check(probe, false, "HTTP/2 session setup failed", now);
+        return;
+    }
+
+    char authority[300];
+    snprintf(authority, sizeof(authority), "%s:%d", pool->backend_host, pool->backend_port);
+    const char *path = probe->checker->config.path[0] != '\0' ? probe->checker->config.path : "/health";
+    nghttp2_nv request[] = {
+        {(uint8_t *)":method", (uint8_t *)"GET", 7, 3, NGHTTP2_NV_FLAG_NONE},
+        {(uint8_t *)":scheme", (uint8_t *)"https", 7, 5, NGHTTP2_NV_FLAG_NONE},
+        {(uint8_t *)":authority", (uint8_t *)authority, 10, strlen(authority), NGHTTP2_NV_FLAG_NONE},
+        {(uint8_t *)":path", (uint8_t *)path, 5, strlen(path), NGHTTP2_NV_FLAG_NONE},
+        {(uint8_t *)"user-agent", (uint8_t *)"emme-health-check", 10, 17, NGHTTP2_NV_FLAG_NONE},
+    };
+    probe->stream_id = nghttp2_submit_request(probe->session, NULL, request,
+                                              sizeof(request) / sizeof(request[0]), NULL, NULL);
+    if (probe->stream_id < 0) {
+        finish_check(probe, false, "request not submitted", now);
+        return;
+    }
+    probe->state = PROBE_EXCHANGE;
+    exchange(probe, now);
+}
+
+static void handshake(health_probe_t *probe, long now)
+{
+    int ret = SSL_connect(probe->ssl);
+    if (ret == 1) {
+        begin_exchange(probe, now);
+        return;
+    }
+
+    int err = SSL_get_error(probe->ssl, ret);
+    if (err == SSL_ERROR_WANT_READ) {
+        watch(probe, EPOLLIN);
+    } else if (err == SSL_ERROR_WANT_WRITE) {
+        watch(probe, EPOLLOUT);
+    } else {
+        finish_check(probe, false, "TLS handshake failed", now);
+    }
+}
+
+/* The socket is connected, or the attempt failed */
+static void connected(health_probe_t *probe, long now)
+{
+    backend_pool_t *pool = probe->checker->pool;
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    if (getsockopt(probe->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+        close_probe(probe);
+        probe->addr_index++;
+        connect_next(probe, now);
+        return;
+    }
+
+    /* The pool's context, so probes resume its TLS sessions; without one,
+     * a private context as pooled connections then use */
+    http2_client_tls_t *tls = pool->config.tls;
+    if (tls) {
+        probe->ssl = SSL_new(tls->ctx);
+    } else {
+        http2_client_tls_t *own = http2_client_tls_create(pool->config.tls_verify);
+        probe->ssl = own ? SSL_new(own->ctx) : NULL;
+        /* The SSL object keeps the context alive */
+        http2_client_tls_destroy(own);
+    }
+    if (!probe->ssl) {
+        finish_check(probe, false, "TLS setup failed", now);
+        return;
+    }
+    SSL_set_fd(probe->ssl, probe->fd);
+    SSL_set_connect_state(probe->ssl);
+
+    struct in6_addr numeric_host;
+    if (inet_pton(AF_INET, pool->backend_host, &numeric_host) != 1 &&
+        inet_pton(AF_INET6, pool->backend_host, &numeric_host) != 1) {
+        SSL_set_tlsext_host_name(probe->ssl, pool->backend_host);
+    }
+    if (tls) {
+        pthread_mutex_lock(&tls->lock);
+        if (tls->session && SSL_SESSION_is_resumable(tls->session)) {
+            SSL_set_session(probe->ssl, tls->session);
+        }
+        pthread_mutex_unlock(&tls->lock);
+    }
+
+    probe->state = PROBE_HANDSHAKE;
+    handshake(probe, now);
+}
+
+static health_probe_t *find_connection(uint64_t connection_id)
+{
+    for (health_probe_t *probe = probes; probe; probe = probe->next) {
+        if (probe->state != PROBE_IDLE && probe->connection_id == connection_id) {
+            return probe;
+        }
+    }
+    return NULL;
+}
+
+/* Starts the checks that are due, fails those past their deadline, and
+ * returns how long to wait for the next of either */
+static int run_timers(long now)
+{
+    long next = LONG_MAX;
+
+    for (health_probe_t *probe = probes; probe; probe = probe->next) {
+        if (probe->state == PROBE_IDLE && probe->due_ms <= now) {
+            start_check(probe, now);
+        } else if (probe->state != PROBE_IDLE && probe->deadline_ms <= now) {
+            char detail[48];
+            snprintf(detail, sizeof(detail), "no answer within %d ms", timeout_ms(probe->checker));
+            finish_check(probe, false, detail, now);
+        }
+        long at = probe->state == PROBE_IDLE ? probe->due_ms : probe->deadline_ms;
+        if (at < next) {
+            next = at;
+        }
+    }
+
+    if (next == LONG_MAX) {
+        return -1;
+    }
+    return next > now ? (int)(next - now) : 0;
+}
+
+static void *scheduler_thread(void *arg)
+{
+    struct epoll_event events[HEALTH_CHECK_MAX_EVENTS];
+    (void)arg;
+
+    /* Probes write through OpenSSL to backends that may have hung up; the
+     * EPIPE is handled, the signal must not kill a process that did not
+     * ignore it */
+    sigset_t pipe_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, NULL);
+
+    pthread_mutex_lock(&scheduler_lock);
+    while (!scheduler_stop) {
+        int timeout = run_timers(now_ms());
+        pthread_mutex_unlock(&scheduler_lock);
+        int n = epoll_wait(epoll_fd, events, HEALTH_CHECK_MAX_EVENTS, timeout);
+        pthread_mutex_lock(&scheduler_lock);
+
+        long now = now_ms();
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 == WAKE_EVENT_ID) {
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    log_message(LOG_LEVEL_WARN, "Health check scheduler wakeup failed: %s", strerror(errno));
+                }
+                continue;
+            }
+            /* Events of a connection closed meanwhile find nothing */
+            health_probe_t *probe = find_connection(events[i].data.u64);
+            if (!probe) {
+                continue;
+            }
+            switch (probe->state) {
+            case PROBE_CONNECTING:
+                connected(probe, now);
+                break;
+            case PROBE_HANDSHAKE:
+                handshake(probe, now);
+                break;
+            case PROBE_EXCHANGE:
+                exchange(probe, now);
+                break;
+            case PROBE_IDLE:
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&scheduler_lock);
+    return NULL;
+}
+
+static void wake_scheduler(void)
+{
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        log_message(LOG_LEVEL_WARN, "Failed to wake health check scheduler: %s", strerror(errno));
+    }
+}
+
+static void close_scheduler_fds(void)
+{
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+        wake_fd = -1;
+    }
+}
+
+/* Called with the lock held */
+static int start_scheduler(void)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0) {
+        log_message(LOG_LEVEL_ERROR, "Failed to set up health check scheduler: %s", strerror(errno));
+        close_scheduler_fds();
+        return -1;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.u64 = WAKE_EVENT_ID};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+    if (nghttp2_session_callbacks_new(&callbacks) != 0) {
+        log_message(LOG_LEVEL_ERROR, "Failed to create health check callbacks");
+        close_scheduler_fds();
+        return -1;
+    }
+    nghttp2_session_callbacks_set_on_header_callback(callbacks, on_header);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, on_frame_recv);
+    nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, on_stream_close);
+
+    scheduler_stop = false;
+    if (pthread_create(&scheduler, NULL, scheduler_thread, NULL) != 0) {
+        log_message(LOG_LEVEL_ERROR, "Failed to create health check scheduler thread");
+        nghttp2_session_callbacks_del(callbacks);
+        callbacks = NULL;
+        close_scheduler_fds();
+        return -1;
+    }
+    scheduler_running = true;
+    log_message(LOG_LEVEL_DEBUG, "Health check scheduler started");
+    return 0;
+}
+
+/* Schedules the checker's checks; the first comes within the jitter of
+ * its interval */
+int health_check_register(health_checker_t *checker)
+{
+    if (!checker || !checker->pool) {
+        return -1;
+    }
+
+    health_probe_t *probe = calloc(1, sizeof(*probe));
+    if (!probe) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate health check probe");
+        return -1;
+    }
+    probe->checker = checker;
+    probe->fd = -1;
+    probe->state = PROBE_IDLE;
+
+    pthread_mutex_lock(&scheduler_lock);
+    if (!scheduler_running && start_scheduler() != 0) {
+        pthread_mutex_unlock(&scheduler_lock);
+        free(probe);
+        return -1;
+    }
+    probe->due_ms = now_ms() + random_below(interval_ms(checker) * HEALTH_CHECK_JITTER_PERCENT / 100 + 1);
+    probe->next = probes;
+    probes = probe;
+    wake_scheduler();
+    pthread_mutex_unlock(&scheduler_lock);
+    return 0;
+}
+
+/* Once this returns the checker is no longer used */
+void health_check_unregister(health_checker_t *checker)
+{
+    pthread_mutex_lock(&scheduler_lock);
+    for (health_probe_t **link = &probes; *link; link = &(*link)->next) {
+        health_probe_t *probe = *link;
+        if (probe->checker == checker) {
+            *link = probe->next;
+            close_probe(probe);
+            free(probe);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&scheduler_lock);
+}
+
+void health_check_shutdown(void)
+{
+    pthread_mutex_lock(&scheduler_lock);
+    if (!scheduler_running) {
+        pthread_mutex_unlock(&scheduler_lock);
+        return;
+    }
+    scheduler_stop = true;
+    wake_scheduler();
+    pthread_mutex_unlock(&scheduler_lock);
+
+    pthread_join(scheduler, NULL);
+
+    pthread_mutex_lock(&scheduler_lock);
+    while (probes) {
+        health_probe_t *probe = probes;
+        probes = probe->next;
+        close_probe(probe);
+        free(probe);
+    }
+    nghttp2_session_callbacks_del(callbacks);
+    callbacks = NULL;
+    close_scheduler_fds();
+    scheduler_running = false;
+    pthread_mutex_unlock(&scheduler_lock);
+}
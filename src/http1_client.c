@@ -0,0 +1,801 @@
+/* http1_client.c - Keep-alive HTTP/1.1 client for plaintext backends
+ *
+ * The HTTP/1.1 proxy path forwards each request over a pooled upstream
+ * connection instead of connecting per request. This module provides:
+ *   - A per-backend pool of idle keep-alive sockets
+ *   - Request rewriting: hop-by-hop headers removed, Host set to the
+ *     backend, X-Forwarded-For/-Host/-Proto added
+ *   - Response head parsing and body framing (Content-Length, chunked or
+ *     read until close), so the proxy knows when a response ends and
+ *     whether its connection can be reused
+ *   - Upgrade request heads for WebSocket handshakes, which take their
+ *     connection out of the pool for good
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "http1_client.h"
+#include "log.h"
+
+/* Larger chunk sizes are rejected rather than risking overflow */
+#define HTTP1_MAX_CHUNK_SIZE (1ULL << 60)
+
+enum {
+    CHUNK_SIZE_FIRST = 0,
+    CHUNK_SIZE,
+    CHUNK_EXT,
+    CHUNK_SIZE_LF,
+    CHUNK_DATA,
+    CHUNK_DATA_CR,
+    CHUNK_DATA_LF,
+    CHUNK_TRAILER_START,
+    CHUNK_TRAILER_LINE,
+    CHUNK_TRAILER_LINE_LF,
+    CHUNK_TRAILER_END_LF
+};
+
+/* ---- Connection pool ---- */
+
+http1_pool_t *http1_pool_create(resolver_endpoint_t *endpoint, const char *authority,
+                                int max_idle, int idle_timeout_seconds)
+{
+    if (!endpoint || !authority || max_idle < 0) {
+        return NULL;
+    }
+
+    http1_pool_t *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate HTTP/1.1 pool");
+        return NULL;
+    }
+    pool->idle = calloc((size_t)(max_idle > 0 ? max_idle : 1), sizeof(*pool->idle));
+    if (!pool->idle) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate HTTP/1.1 pool");
+        free(pool);
+        return NULL;
+    }
+
+    pool->endpoint = endpoint;
+    snprintf(pool->authority, sizeof(pool->authority), "%s", authority);
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->max_idle = max_idle;
+    pool->idle_timeout_seconds = idle_timeout_seconds;
+    atomic_init(&pool->connects, 0);
+    atomic_init(&pool->reuses, 0);
+    return pool;
+}
+
+void http1_pool_destroy(http1_pool_t *pool)
+{
+    if (!pool) {
+        return;
+    }
+
+    for (int i = 0; i < pool->idle_count; i++) {
+        close(pool->idle[i].fd);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->idle);
+    free(pool);
+}
+
+/* An idle socket with pending data or EOF was closed or broken by the
+ * backend; only "nothing to read" means it is still usable */
+static bool idle_socket_alive(int fd)
+{
+    char byte;
+    ssize_t n = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/* Opens a new connection that is not taken from the idle list, for
+ * exchanges that take the socket over (protocol upgrades) */
+int http1_pool_connect(http1_pool_t *pool)
+{
+    if (!pool) {
+        return -1;
+    }
+
+    int fd = resolver_connect(pool->endpoint, RESOLVER_CONNECT_TIMEOUT_MS);
+    if (fd < 0) {
+        return -1;
+    }
+
+    /* Requests use blocking I/O bounded by the socket timeouts */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+    struct timeval timeout = {
+        .tv_sec = HTTP1_CLIENT_RESPONSE_TIMEOUT_MS / 1000,
+        .tv_usec = (HTTP1_CLIENT_RESPONSE_TIMEOUT_MS % 1000) * 1000
+    };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    atomic_fetch_add(&pool->connects, 1);
+    return fd;
+}
+
+/* Returns a connected blocking socket, reused when an idle one is alive.
+ * '*reused' tells the caller a failure may be a stale connection. */
+int http1_pool_acquire(http1_pool_t *pool, bool *reused)
+{
+    if (reused) {
+        *reused = false;
+    }
+    if (!pool) {
+        return -1;
+    }
+
+    time_t now = time(NULL);
+    for (;;) {
+        int fd = -1;
+        bool expired = false;
+
+        pthread_mutex_lock(&pool->lock);
+        if (pool->idle_count > 0) {
+            http1_idle_conn_t *conn = &pool->idle[--pool->idle_count];
+            fd = conn->fd;
+            expired = now - conn->idle_since >= pool->idle_timeout_seconds;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        if (fd < 0) {
+            break;
+        }
+        if (!expired && idle_socket_alive(fd)) {
+            atomic_fetch_add(&pool->reuses, 1);
+            if (reused) {
+                *reused = true;
+            }
+            return fd;
+        }
+        close(fd);
+    }
+
+    return http1_pool_connect(pool);
+}
+
+/* Keeps 'fd' for the next request when the exchange left it reusable */
+void http1_pool_release(http1_pool_t *pool, int fd, bool reusable)
+{
+    if (!pool || fd < 0) {
+        return;
+    }
+
+    time_t now = time(NULL);
+    int expired = 0;
+    bool kept = false;
+
+    pthread_mutex_lock(&pool->lock);
+    /* The oldest entries come first; drop those past the idle timeout */
+    while (expired < pool->idle_count &&
+           now - pool->idle[expired].idle_since >= pool->idle_timeout_seconds) {
+        close(pool->idle[expired].fd);
+        expired++;
+    }
+    if (expired > 0) {
+        pool->idle_count -= expired;
+        memmove(pool->idle, pool->idle + expired, (size_t)pool->idle_count * sizeof(*pool->idle));
+    }
+    if (reusable && pool->idle_count < pool->max_idle) {
+        pool->idle[pool->idle_count].fd = fd;
+        pool->idle[pool->idle_count].idle_since = now;
+        pool->idle_count++;
+        kept = true;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!kept) {
+        close(fd);
+    }
+}
+
+/* ---- Headers ---- */
+
+/* RFC 9110 section 7.6.1, plus the proxy authentication pair. Transfer-Encoding
+ * is left out: bodies are relayed verbatim, framing included. */
+bool http1_is_hop_by_hop(const char *name, size_t name_len)
+{
+    static const char *const hop_by_hop[] = {
+        "Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate",
+        "Proxy-Authorization", "TE", "Upgrade"
+    };
+
+    for (size_t i = 0; i < sizeof(hop_by_hop) / sizeof(hop_by_hop[0]); i++) {
+        if (strlen(hop_by_hop[i]) == name_len && strncasecmp(name, hop_by_hop[i], name_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* True when a comma-separated header value lists 'token' (case-insensitive) */
+static bool value_has_token(const char *value, size_t value_len, const char *token, size_t token_len)
+{
+    const char *p = value;
+    const char *end = value + value_len;
+
+    while (p < end) {
+        while (p < end && (*p == ',' || *p == ' ' || *p == '\t')) {
+            p++;
+        }
+        const char *start = p;
+        while (p < end && *p != ',') {
+            p++;
+        }
+        const char *stop = p;
+        while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t')) {
+            stop--;
+        }
+        if ((size_t)(stop - start) == token_len && strncasecmp(start, token, token_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* The last transfer coding must be chunked for the body to be framed */
+static bool last_coding_is_chunked(const char *value, size_t value_len)
+{
+    const char *end = value + value_len;
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    const char *start = end;
+    while (start > value && start[-1] != ',') {
+        start--;
+    }
+    while (start < end && (*start == ' ' || *start == '\t')) {
+        start++;
+    }
+    return end - start == 7 && strncasecmp(start, "chunked", 7) == 0;
+}
+
+static int parse_content_length(const char *value, size_t value_len, unsigned long long *out)
+{
+    unsigned long long length = 0;
+    size_t digits = 0;
+
+    while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t')) {
+        value_len--;
+    }
+    for (size_t i = 0; i < value_len; i++) {
+        if (!isdigit((unsigned char)value[i]) || length > HTTP1_MAX_CHUNK_SIZE) {
+            return -1;
+        }
+        length = length * 10 + (unsigned long long)(value[i] - '0');
+        digits++;
+    }
+    if (digits == 0) {
+        return -1;
+    }
+    *out = length;
+    return 0;
+}
+
+static int append(char *out, size_t out_size, size_t *len, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static int append(char *out, size_t out_size, size_t *len, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out + *len, out_size - *len, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= out_size - *len) {
+        return -1;
+    }
+    *len += (size_t)n;
+    return 0;
+}
+
+static const char *find_request_header(const HttpRequest *req, const char *name)
+{
+    for (int i = 0; i < req->header_count; i++) {
+        if (strcasecmp(req->headers[i].field, name) == 0) {
+            return req->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+/* True when the client asks to switch the connection to 'protocol': the
+ * Upgrade header lists it and Connection lists "upgrade" (RFC 9110 7.8) */
+bool http1_request_upgrades_to(const HttpRequest *req, const char *protocol)
+{
+    if (!req || !protocol) {
+        return false;
+    }
+
+    const char *connection = find_request_header(req, "Connection");
+    const char *upgrade = find_request_header(req, "Upgrade");
+    return connection && upgrade &&
+           value_has_token(connection, strlen(connection), "upgrade", 7) &&
+           value_has_token(upgrade, strlen(upgrade), protocol, strlen(protocol));
+}
+
+/* Builds the request head sent upstream and sets '*body' to the framing of
+ * the client's request body. With 'upgrade' set the head asks the backend
+ * to switch to that protocol instead of keeping the connection alive.
+ * Returns the head length, or -1 when the head does not fit or the body
+ * framing is invalid. */
+int http1_build_request_head(const HttpRequest *req, const char *authority, const char *upgrade,
+                             char *out, size_t out_size, http1_body_t *body)
+{
+    if (!req || !req->method || !req->path || !authority || !out || !body) {
+        return -1;
+    }
+
+    const char *connection = find_request_header(req, "Connection");
+    size_t connection_len = connection ? strlen(connection) : 0;
+    const char *host = find_request_header(req, "Host");
+    const char *forwarded_for = NULL;
+    bool chunked = false, has_length = false;
+    unsigned long long length = 0;
+    size_t len = 0;
+
+    for (int i = 0; i < req->header_count; i++) {
+        const char *field = req->headers[i].field;
+        const char *value = req->headers[i].value;
+        if (strcasecmp(field, "Transfer-Encoding") == 0) {
+            if (!last_coding_is_chunked(value, strlen(value))) {
+                return -1;
+            }
+            chunked = true;
+        } else if (strcasecmp(field, "Content-Length") == 0) {
+            unsigned long long parsed;
+            if (parse_content_length(value, strlen(value), &parsed) != 0 ||
+                (has_length && parsed != length)) {
+                return -1;
+            }
+            length = parsed;
+            has_length = true;
+        } else if (strcasecmp(field, "X-Forwarded-For") == 0) {
+            forwarded_for = value;
+        }
+    }
+
+    if (append(out, out_size, &len, "%s %s HTTP/1.1\r\n", req->method, req->path) != 0) {
+        return -1;
+    }
+    for (int i = 0; i < req->header_count; i++) {
+        const char *field = req->headers[i].field;
+        size_t field_len = strlen(field);
+        if (http1_is_hop_by_hop(field, field_len) ||
+            (connection && value_has_token(connection, connection_len, field, field_len)) ||
+            strcasecmp(field, "Host") == 0 ||
+            strcasecmp(field, "X-Forwarded-For") == 0 ||
+            strcasecmp(field, "X-Forwarded-Host") == 0 ||
+            strcasecmp(field, "X-Forwarded-Proto") == 0 ||
+            strcasecmp(field, "Expect") == 0 ||
+            /* Chunked framing wins over a conflicting length (RFC 9112 6.3) */
+            (chunked && strcasecmp(field, "Content-Length") == 0)) {
+            continue;
+        }
+        if (append(out, out_size, &len, "%s: %s\r\n", field, req->headers[i].value) != 0) {
+            return -1;
+        }
+    }
+
+    if (append(out, out_size, &len, "Host: %s\r\n", authority) != 0) {
+        return -1;
+    }
+    if (req->client_addr[0] != '\0') {
+        if (append(out, out_size, &len, "X-Forwarded-For: %s%s%s\r\n",
+                   forwarded_for ? forwarded_for : "", forwarded_for ? ", " : "",
+                   req->client_addr) != 0) {
+            return -1;
+        }
+    } else if (forwarded_for &&
+               append(out, out_size, &len, "X-Forwarded-For: %s\r\n", forwarded_for) != 0) {
+        return -1;
+    }
+    if (host && append(out, out_size, &len, "X-Forwarded-Host: %s\r\n", host) != 0) {
+        return -1;
+    }
+    if (append(out, out_size, &len, "X-Forwarded-Proto: https\r\n") != 0) {
+        return -1;
+    }
+    if (upgrade) {
+        if (append(out, out_size, &len, "Upgrade: %s\r\nConnection: upgrade\r\n\r\n", upgrade) != 0) {
+            return -1;
+        }
+    } else if (append(out, out_size, &len, "Connection: keep-alive\r\n\r\n") != 0) {
+        return -1;
+    }
+
+    if (chunked) {
+        http1_body_init(body, HTTP1_BODY_CHUNKED, 0);
+    } else if (has_length) {
+        http1_body_init(body, HTTP1_BODY_LENGTH, length);
+    } else {
+        http1_body_init(body, HTTP1_BODY_NONE, 0);
+    }
+    return (int)len;
+}
+
+static const char *find_head_end(const char *buf, size_t len)
+{
+    for (size_t i = 0; i + 3 < len; i++) {
+        if (buf[i] == '\r' && buf[i + 1] == '\n' && buf[i + 2] == '\r' && buf[i + 3] == '\n') {
+            return buf + i + 4;
+        }
+    }
+    return NULL;
+}
+
+/* Whether every line of a complete head ends in CRLF, with no bare CR or
+ * LF inside a line, and no header line is folded (starts with SP or HT).
+ * A bare LF would let one backend line turn into two headers for the
+ * client that the framing checks never saw. */
+static bool head_lines_valid(const char *head, size_t head_len)
+{
+    for (size_t i = 0; i < head_len; i++) {
+        if (head[i] == '\r') {
+            if (i + 1 >= head_len || head[i + 1] != '\n') {
+                return false;
+            }
+            i++;
+            if (i + 1 < head_len && (head[i + 1] == ' ' || head[i + 1] == '\t')) {
+                return false;
+            }
+        } else if (head[i] == '\n') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Returns 1 with '*head' filled once the head is complete, 0 when more
+ * bytes are needed, -1 when it is malformed. 'method' decides whether a
+ * body follows (HEAD responses have none). */
+int http1_parse_response_head(const char *buf, size_t len, const char *method,
+                              http1_response_head_t *head)
+{
+    if (!buf || !head) {
+        return -1;
+    }
+
+    const char *end = find_head_end(buf, len);
+    if (!end) {
+        return 0;
+    }
+
+    memset(head, 0, sizeof(*head));
+    head->head_len = (size_t)(end - buf);
+    if (!head_lines_valid(buf, head->head_len)) {
+        return -1;
+    }
+
+    /* Status line: HTTP/1.x SP 3DIGIT SP reason */
+    if (head->head_len < 14 || strncmp(buf, "HTTP/1.", 7) != 0 ||
+        !isdigit((unsigned char)buf[7]) || buf[8] != ' ' ||
+        !isdigit((unsigned char)buf[9]) || !isdigit((unsigned char)buf[10]) ||
+        !isdigit((unsigned char)buf[11])) {
+        return -1;
+    }
+    head->minor_version = buf[7] - '0';
+    head->status = (buf[9] - '0') * 100 + (buf[10] - '0') * 10 + (buf[11] - '0');
+
+    bool close_token = false, keep_alive_token = false;
+    bool chunked = false, has_encoding = false, has_length = false;
+    unsigned long long length = 0;
+
+    const char *line = memchr(buf, '\n', head->head_len) + 1;
+    while (line < end - 2) {
+        const char *eol = memchr(line, '\r', (size_t)(end - line));
+        const char *colon = memchr(line, ':', (size_t)(eol - line));
+        if (!colon || colon == line) {
+            return -1;
+        }
+        size_t name_len = (size_t)(colon - line);
+        const char *value = colon + 1;
+        while (value < eol && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+        size_t value_len = (size_t)(eol - value);
+
+        if (name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+            unsigned long long parsed;
+            if (parse_content_length(value, value_len, &parsed) != 0 ||
+                (has_length && parsed != length)) {
+                return -1;
+            }
+            length = parsed;
+            has_length = true;
+        } else if (name_len == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+            has_encoding = true;
+            chunked = last_coding_is_chunked(value, value_len);
+        } else if (name_len == 10 && strncasecmp(line, "Connection", 10) == 0) {
+            close_token |= value_has_token(value, value_len, "close", 5);
+            keep_alive_token |= value_has_token(value, value_len, "keep-alive", 10);
+        }
+        line = eol + 2;
+    }
+
+    head->keep_alive = head->minor_version >= 1 ? !close_token : keep_alive_token;
+
+    bool is_head = method && strcmp(method, "HEAD") == 0;
+    if (is_head || (head->status >= 100 && head->status < 200) ||
+        head->status == 204 || head->status == 304) {
+        http1_body_init(&head->body, HTTP1_BODY_NONE, 0);
+    } else if (has_encoding) {
+        http1_body_init(&head->body, chunked ? HTTP1_BODY_CHUNKED : HTTP1_BODY_UNTIL_CLOSE, 0);
+    } else if (has_length) {
+        http1_body_init(&head->body, HTTP1_BODY_LENGTH, length);
+    } else {
+        http1_body_init(&head->body, HTTP1_BODY_UNTIL_CLOSE, 0);
+    }
+    if (head->body.kind == HTTP1_BODY_UNTIL_CLOSE) {
+        head->keep_alive = false;
+    }
+    return 1;
+}
+
+/* Finds header 'name' in a complete response head. Returns its value with
+ * surrounding whitespace removed, not NUL-terminated, or NULL (also for a
+ * malformed head). */
+const char *http1_response_header(const char *head, size_t head_len, const char *name,
+                                  size_t *value_len)
+{
+    const char *end = find_head_end(head, head_len);
+    const char *line = end ? memchr(head, '\n', (size_t)(end - head)) : NULL;
+    size_t name_len = strlen(name);
+
+    if (!line || !head_lines_valid(head, (size_t)(end - head))) {
+        return NULL;
+    }
+    for (line++; line < end - 2;) {
+        const char *eol = memchr(line, '\r', (size_t)(end - line));
+        if ((size_t)(eol - line) > name_len && line[name_len] == ':' &&
+            strncasecmp(line, name, name_len) == 0) {
+            const char *value = line + name_len + 1;
+            const char *stop = eol;
+            while (value < stop && (*value == ' ' || *value == '\t')) {
+                value++;
+            }
+            while (stop > value && (stop[-1] == ' ' || stop[-1] == '\t')) {
+                stop--;
+            }
+            *value_len = (size_t)(stop - value);
+            return value;
+        }
+        line = eol + 2;
+    }
+    return NULL;
+}
+
+/* Copies a parsed response head for the client: HTTP/1.1 status line,
+ * connection-scoped headers dropped, and Content-Length too when a
+ * Transfer-Encoding frames the body. With 'chunk_body' the proxy re-frames
+ * an until-close body as chunked so the client connection stays open. */
+int http1_rewrite_response_head(const char *head, size_t head_len, bool chunk_body,
+                                char *out, size_t out_size)
+{
+    if (!head || head_len < 14 || !out || !head_lines_valid(head, head_len)) {
+        return -1;
+    }
+
+    const char *end = head + head_len;
+    const char *status_end = memchr(head, '\r', head_len);
+    size_t len = 0;
+    bool encoding_written = false;
+
+    if (!status_end ||
+        append(out, out_size, &len, "HTTP/1.1%.*s\r\n", (int)(status_end - head - 8), head + 8) != 0) {
+        return -1;
+    }
+
+    /* Tokens of the Connection header name more hop-by-hop headers */
+    const char *connection = NULL;
+    size_t connection_len = 0;
+    bool has_encoding = chunk_body;
+    for (const char *line = status_end + 2; line < end - 2;) {
+        const char *eol = memchr(line, '\r', (size_t)(end - line));
+        if (eol - line > 18 && strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+            has_encoding = true;
+        } else if (eol - line > 11 && strncasecmp(line, "Connection:", 11) == 0) {
+            connection = line + 11;
+            connection_len = (size_t)(eol - connection);
+            while (connection_len > 0 && (*connection == ' ' || *connection == '\t')) {
+                connection++;
+                connection_len--;
+            }
+        }
+        line = eol + 2;
+    }
+
+    for (const char *line = status_end + 2; line < end - 2;) {
+        const char *eol = memchr(line, '\r', (size_t)(end - line));
+        const char *colon = memchr(line, ':', (size_t)(eol - line));
+        size_t name_len = colon ? (size_t)(colon - line) : 0;
+
+        if (colon && !http1_is_hop_by_hop(line, name_len) &&
+            !(connection && value_has_token(connection, connection_len, line, name_len)) &&
+            /* Chunked framing wins over a conflicting length (RFC 9112 6.3) */
+            !(has_encoding && name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0)) {
+            if (chunk_body && name_len == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+                if (append(out, out_size, &len, "%.*s, chunked\r\n", (int)(eol - line), line) != 0) {
+                    return -1;
+                }
+                encoding_written = true;
+            } else if (append(out, out_size, &len, "%.*s\r\n", (int)(eol - line), line) != 0) {
+                return -1;
+            }
+        }
+        line = eol + 2;
+    }
+
+    if (chunk_body && !encoding_written &&
+        append(out, out_size, &len, "Transfer-Encoding: chunked\r\n") != 0) {
+        return -1;
+    }
+    if (append(out, out_size, &len, "\r\n") != 0) {
+        return -1;
+    }
+    return (int)len;
+}
+
+/* ---- Body framing ---- */
+
+void http1_body_init(http1_body_t *body, http1_body_kind_t kind, unsigned long long length)
+{
+    memset(body, 0, sizeof(*body));
+    body->kind = kind;
+    body->remaining = kind == HTTP1_BODY_LENGTH ? length : 0;
+    body->chunk_state = CHUNK_SIZE_FIRST;
+    body->done = kind == HTTP1_BODY_NONE || (kind == HTTP1_BODY_LENGTH && length == 0);
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static ssize_t consume_chunked(http1_body_t *body, const char *data, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len && !body->done) {
+        char c = data[i];
+        switch (body->chunk_state) {
+        case CHUNK_SIZE_FIRST:
+        case CHUNK_SIZE: {
+            int digit = hex_value(c);
+            if (digit >= 0) {
+                if (body->remaining >= HTTP1_MAX_CHUNK_SIZE) {
+                    return -1;
+                }
+                body->remaining = body->remaining * 16 + (unsigned long long)digit;
+                body->chunk_state = CHUNK_SIZE;
+            } else if (body->chunk_state == CHUNK_SIZE_FIRST) {
+                return -1;
+            } else if (c == '\r') {
+                body->chunk_state = CHUNK_SIZE_LF;
+            } else if (c == ';' || c == ' ' || c == '\t') {
+                body->chunk_state = CHUNK_EXT;
+            } else {
+                return -1;
+            }
+            i++;
+            break;
+        }
+        case CHUNK_EXT:
+            if (c == '\r') {
+                body->chunk_state = CHUNK_SIZE_LF;
+            } else if (c == '\n') {
+                return -1;
+            }
+            i++;
+            break;
+        case CHUNK_SIZE_LF:
+            if (c != '\n') {
+                return -1;
+            }
+            body->chunk_state = body->remaining == 0 ? CHUNK_TRAILER_START : CHUNK_DATA;
+            i++;
+            break;
+        case CHUNK_DATA: {
+            size_t take = len - i;
+            if (take > body->remaining) {
+                take = (size_t)body->remaining;
+            }
+            body->remaining -= take;
+            i += take;
+            if (body->remaining == 0) {
+                body->chunk_state = CHUNK_DATA_CR;
+            }
+            break;
+        }
+        case CHUNK_DATA_CR:
+            if (c != '\r') {
+                return -1;
+            }
+            body->chunk_state = CHUNK_DATA_LF;
+            i++;
+            break;
+        case CHUNK_DATA_LF:
+            if (c != '\n') {
+                return -1;
+            }
+            body->chunk_state = CHUNK_SIZE_FIRST;
+            i++;
+            break;
+        case CHUNK_TRAILER_START:
+            body->chunk_state = c == '\r' ? CHUNK_TRAILER_END_LF : CHUNK_TRAILER_LINE;
+            i++;
+            break;
+        case CHUNK_TRAILER_LINE:
+            if (c == '\r') {
+                body->chunk_state = CHUNK_TRAILER_LINE_LF;
+            }
+            i++;
+            break;
+        case CHUNK_TRAILER_LINE_LF:
+            if (c != '\n') {
+                return -1;
+            }
+            body->chunk_state = CHUNK_TRAILER_START;
+            i++;
+            break;
+        case CHUNK_TRAILER_END_LF:
+            if (c != '\n') {
+                return -1;
+            }
+            body->done = true;
+            i++;
+            break;
+        default:
+            return -1;
+        }
+    }
+    return (ssize_t)i;
+}
+
+/* Returns how many of the 'len' bytes belong to the body; the rest belong
+ * to whatever follows the message. Sets body->done at the end of the body
+ * (never for until-close bodies). Returns -1 on malformed chunked framing. */
+ssize_t http1_body_consume(http1_body_t *body, const char *data, size_t len)
+{
+    if (!body || (!data && len > 0)) {
+        return -1;
+    }
+    if (body->done) {
+        return 0;
+    }
+
+    switch (body->kind) {
+    case HTTP1_BODY_LENGTH: {
+        size_t take = len;
+        if (take > body->remaining) {
+            take = (size_t)body->remaining;
+        }
+        body->remaining -= take;
+        body->done = body->remaining == 0;
+        return (ssize_t)take;
+    }
+    case HTTP1_BODY_CHUNKED:
+        return consume_chunked(body, data, len);
+    case HTTP1_BODY_UNTIL_CLOSE:
+        return (ssize_t)len;
+    case HTTP1_BODY_NONE:
+    default:
+        body->done = true;
+        return 0;
+    }
+}
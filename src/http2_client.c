@@ -5,7 +5,13 @@
  *   - TLS connection establishment
  *   - nghttp2 session management (client mode)
  *   - HTTP/2 request/response framing
- *   - Stream multiplexing (single request per client for simplicity)
+ *   - Stream multiplexing: any number of threads may submit requests on one
+ *     connection, up to the peer's SETTINGS_MAX_CONCURRENT_STREAMS. Whichever
+ *     waiter finds the socket idle drives I/O for all streams on it.
+ *   - Response streaming: DATA payloads are queued per stream as they arrive
+ *     and only credited back to the backend's flow-control window once the
+ *     caller has read them, so a slow reader slows its backend stream down
+ *     instead of growing a buffer.
  */
 
 #include <stdio.h>
@@ -16,13 +22,14 @@
 #include <errno.h>
 #include <poll.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <netdb.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include "http2_client.h"
+#include "http1_client.h"
 #include "log.h"
 #include "tls.h"
 #include "metrics.h"
@@ -30,6 +37,7 @@
 #define HTTP2_ALPN "h2"
 #define HTTP2_ALPN_LEN 2
 #define HTTP2_POLL_TIMEOUT_MS 5000
+#define HTTP2_IO_SLICE_MS 100
 
 #define MAKE_NV(NAME, VALUE) \
     (nghttp2_nv){(uint8_t *)(NAME), (uint8_t *)(VALUE), strlen(NAME), strlen(VALUE), NGHTTP2_NV_FLAG_NONE}
@@ -46,6 +54,22 @@
             log_message(LOG_LEVEL_DEBUG, __VA_ARGS__); \
     } while (0)
 
+static long monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static void update_max_streams(http2_client_t *client)
+{
+    uint32_t peer_max = nghttp2_session_get_remote_settings(client->session,
+                                                             NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS);
+    int max_streams = peer_max > HTTP2_CLIENT_MAX_STREAMS ? HTTP2_CLIENT_MAX_STREAMS : (int)peer_max;
+    atomic_store(&client->max_concurrent_streams, max_streams);
+    H2C_LOG("http2_client: peer allows %u concurrent streams, using %d", peer_max, max_streams);
+}
+
 // nghttp2 callback: send data
 static ssize_t http2_client_send_callback(nghttp2_session *session,
                                            const uint8_t *data, size_t length,
@@ -103,22 +127,98 @@ static ssize_t http2_client_recv_callback(nghttp2_session *session,
     return n;
 }
 
+/* The final response after 1xx ones arrives as NGHTTP2_HCAT_HEADERS, like
+ * trailers; it is told apart by the stream still lacking a final status */
+static bool is_response_block(const http2_stream_t *stream, const nghttp2_frame *frame)
+{
+    return frame->headers.cat == NGHTTP2_HCAT_RESPONSE ||
+           (frame->headers.cat == NGHTTP2_HCAT_HEADERS && !stream->headers_done);
+}
+
 // nghttp2 callback: on frame received
 static int http2_client_on_frame_recv(nghttp2_session *session,
                                        const nghttp2_frame *frame,
                                        void *user_data)
 {
     http2_client_t *client = (http2_client_t *)user_data;
-    (void)session;
     
-    if (frame->hd.type == NGHTTP2_HEADERS && 
-        frame->hd.flags & NGHTTP2_FLAG_END_HEADERS) {
-        client->response_status = frame->headers.cat;
-        H2C_LOG("http2_client: received HEADERS, status=%d", client->response_status);
+    if (frame->hd.type == NGHTTP2_SETTINGS && !(frame->hd.flags & NGHTTP2_FLAG_ACK)) {
+        update_max_streams(client);
+    } else if (frame->hd.type == NGHTTP2_HEADERS &&
+               frame->hd.flags & NGHTTP2_FLAG_END_HEADERS) {
+        H2C_LOG("http2_client: received HEADERS on stream %d", frame->hd.stream_id);
+        http2_stream_t *stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+        /* Interim 1xx responses are followed by the real one */
+        if (stream && is_response_block(stream, frame) && stream->response_status >= 200) {
+            stream->headers_done = 1;
+        }
     } else if (frame->hd.type == NGHTTP2_DATA) {
-        H2C_LOG("http2_client: received DATA frame, length=%d", frame->hd.length);
+        H2C_LOG("http2_client: received DATA frame, length=%zu", frame->hd.length);
+    }
+    
+    return 0;
+}
+
+/* Headers that only describe the backend connection. HTTP/2 peers may not
+ * send most of them at all; nghttp2 already rejects those. */
+static bool is_hop_by_hop(const uint8_t *name, size_t namelen)
+{
+    return http1_is_hop_by_hop((const char *)name, namelen) ||
+           (namelen == 17 && memcmp(name, "transfer-encoding", 17) == 0);
+}
+
+// nghttp2 callback: on header received
+static int http2_client_on_header(nghttp2_session *session, const nghttp2_frame *frame,
+                                   const uint8_t *name, size_t namelen,
+                                   const uint8_t *value, size_t valuelen,
+                                   uint8_t flags, void *user_data)
+{
+    (void)flags;
+    (void)user_data;
+    
+    if (frame->hd.type != NGHTTP2_HEADERS) {
+        return 0;
     }
     
+    http2_stream_t *stream = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (!stream || !is_response_block(stream, frame)) {
+        return 0;
+    }
+    
+    if (namelen == 7 && memcmp(name, ":status", 7) == 0) {
+        int status = 0;
+        for (size_t i = 0; i < valuelen && value[i] >= '0' && value[i] <= '9'; i++) {
+            status = status * 10 + (value[i] - '0');
+        }
+        stream->response_status = status;
+        /* :status opens every block; a final response replaces interim ones */
+        stream->response_header_count = 0;
+        stream->header_arena_used = 0;
+        return 0;
+    }
+    if (is_hop_by_hop(name, namelen)) {
+        return 0;
+    }
+    
+    /* Names arrive lowercased and validated, so they are kept verbatim */
+    size_t needed = namelen + 1 + valuelen + 1;
+    if (stream->response_header_count == HTTP2_CLIENT_MAX_HEADERS ||
+        needed > sizeof(stream->header_arena) - stream->header_arena_used) {
+        log_message(LOG_LEVEL_WARN, "HTTP/2 client: response headers on stream %d exceed %d entries or %d bytes",
+                    frame->hd.stream_id, HTTP2_CLIENT_MAX_HEADERS, HTTP2_CLIENT_HEADER_ARENA_SIZE);
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+    
+    uint8_t *dst = (uint8_t *)stream->header_arena + stream->header_arena_used;
+    memcpy(dst, name, namelen);
+    dst[namelen] = '\0';
+    memcpy(dst + namelen + 1, value, valuelen);
+    dst[namelen + 1 + valuelen] = '\0';
+    stream->response_headers[stream->response_header_count++] = (nghttp2_nv){
+        dst, dst + namelen + 1, namelen, valuelen, NGHTTP2_NV_FLAG_NONE
+    };
+    stream->header_arena_used += needed;
+    
     return 0;
 }
 
@@ -128,18 +228,37 @@ static int http2_client_on_data_chunk_recv(nghttp2_session *session,
                                             const uint8_t *data, size_t len,
                                             void *user_data)
 {
-    http2_client_t *client = (http2_client_t *)user_data;
-    (void)session;
     (void)flags;
-    (void)stream_id;
+    (void)user_data;
     
-    if (client->response_received + len <= HTTP2_CLIENT_BUFFER_SIZE) {
-        memcpy(client->response_buffer + client->response_received, data, len);
-        client->response_received += len;
-        H2C_LOG("http2_client: accumulated %zu bytes", client->response_received);
+    http2_stream_t *stream = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (!stream) {
+        /* Nobody will read it; give the connection window back */
+        nghttp2_session_consume(session, stream_id, len);
+        return 0;
+    }
+    
+    http2_body_chunk_t *chunk = malloc(sizeof(*chunk) + len);
+    if (!chunk) {
+        log_message(LOG_LEVEL_ERROR, "HTTP/2 client out of memory on stream %d", stream_id);
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
+    chunk->next = NULL;
+    chunk->off = 0;
+    chunk->len = len;
+    memcpy(chunk->data, data, len);
+    if (stream->body_tail) {
+        stream->body_tail->next = chunk;
     } else {
-        log_message(LOG_LEVEL_ERROR, "HTTP/2 client response buffer overflow");
-        return -1;
+        stream->body_head = chunk;
+    }
+    stream->body_tail = chunk;
+    stream->response_received += len;
+    H2C_LOG("http2_client: stream %d received %zu bytes", stream_id, stream->response_received);
+    
+    if (stream->consume_on_receive) {
+        nghttp2_session_consume(session, stream_id, len);
+        stream->body_consumed += len;
     }
     
     return 0;
@@ -149,14 +268,14 @@ static int http2_client_on_data_chunk_recv(nghttp2_session *session,
 static int http2_client_on_stream_close(nghttp2_session *session, int32_t stream_id,
                                          uint32_t error_code, void *user_data)
 {
-    http2_client_t *client = (http2_client_t *)user_data;
-    (void)session;
-    (void)stream_id;
-    (void)error_code;
+    (void)user_data;
     
-    client->done = 1;
-    client->error_code = error_code;
-    H2C_LOG("http2_client: stream closed, error_code=%u", error_code);
+    http2_stream_t *stream = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (stream) {
+        stream->done = 1;
+        stream->error_code = error_code;
+    }
+    H2C_LOG("http2_client: stream %d closed, error_code=%u", stream_id, error_code);
     
     return 0;
 }
@@ -168,17 +287,22 @@ static ssize_t http2_client_data_read(nghttp2_session *session, int32_t stream_i
                                        nghttp2_data_source *source,
                                        void *user_data)
 {
-    http2_client_t *client = (http2_client_t *)user_data;
-    (void)session;
-    (void)stream_id;
     (void)source;
+    (void)user_data;
+    
+    /* Looked up rather than taken from 'source' so a stream abandoned by
+     * its waiter is reset instead of read after it was freed */
+    http2_stream_t *stream = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (!stream) {
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    }
     
-    size_t remaining = client->request_body_len - client->body_sent;
+    size_t remaining = stream->request_body_len - stream->body_sent;
     size_t to_send = (remaining < length) ? remaining : length;
     
     if (to_send > 0) {
-        memcpy(buf, client->request_body + client->body_sent, to_send);
-        client->body_sent += to_send;
+        memcpy(buf, stream->request_body + stream->body_sent, to_send);
+        stream->body_sent += to_send;
         H2C_LOG("http2_client: sent %zu body bytes", to_send);
     }
     
@@ -215,44 +339,78 @@ static SSL_CTX* create_http2_client_ssl_ctx(bool verify_certs)
     return ctx;
 }
 
-// Connect to backend server
-static int connect_to_backend(const char *host, int port)
+/* Keeps the newest ticket; TLS 1.3 servers send them after the handshake,
+ * so this usually runs from SSL_read() on an established connection */
+static int http2_client_on_new_session(SSL *ssl, SSL_SESSION *session)
 {
-    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock_fd < 0) {
-        log_message(LOG_LEVEL_ERROR, "Failed to create socket for backend %s:%d", host, port);
-        return -1;
+    http2_client_tls_t *tls = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    if (!tls) {
+        return 0;
     }
     
-    // Set non-blocking
-    int flags = fcntl(sock_fd, F_GETFL, 0);
-    fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK);
+    pthread_mutex_lock(&tls->lock);
+    SSL_SESSION *old = tls->session;
+    tls->session = session;
+    pthread_mutex_unlock(&tls->lock);
     
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
+    if (old) SSL_SESSION_free(old);
+    return 1;
+}
+
+http2_client_tls_t *http2_client_tls_create(bool verify_certs)
+{
+    http2_client_tls_t *tls = calloc(1, sizeof(*tls));
+    if (!tls) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate HTTP/2 client TLS context");
+        return NULL;
+    }
     
-    if (inet_pton(AF_INET, host, &addr.sin_addr) <= 0) {
-        // Try DNS resolution
-        struct hostent *he = gethostbyname(host);
-        if (!he) {
-            log_message(LOG_LEVEL_ERROR, "Failed to resolve backend host: %s", host);
-            close(sock_fd);
-            return -1;
-        }
-        memcpy(&addr.sin_addr, he->h_addr_list[0], he->h_length);
+    tls->ctx = create_http2_client_ssl_ctx(verify_certs);
+    if (!tls->ctx) {
+        free(tls);
+        return NULL;
+    }
+    if (pthread_mutex_init(&tls->lock, NULL) != 0) {
+        SSL_CTX_free(tls->ctx);
+        free(tls);
+        return NULL;
     }
     
-    int ret = connect(sock_fd, (struct sockaddr*)&addr, sizeof(addr));
-    if (ret < 0 && errno != EINPROGRESS) {
-        log_message(LOG_LEVEL_ERROR, "Failed to connect to backend %s:%d: %s", 
-                    host, port, strerror(errno));
-        close(sock_fd);
+    /* Clients never look sessions up in the internal cache; the callback
+     * hands them to us and connect offers the newest one */
+    SSL_CTX_set_app_data(tls->ctx, tls);
+    SSL_CTX_set_session_cache_mode(tls->ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(tls->ctx, http2_client_on_new_session);
+    atomic_init(&tls->handshakes, 0);
+    atomic_init(&tls->resumed, 0);
+    return tls;
+}
+
+/* Connections may still hold references to the SSL_CTX; it is freed with
+ * the last of them */
+void http2_client_tls_destroy(http2_client_tls_t *tls)
+{
+    if (!tls) return;
+    
+    SSL_CTX_set_app_data(tls->ctx, NULL);
+    SSL_CTX_free(tls->ctx);
+    if (tls->session) SSL_SESSION_free(tls->session);
+    pthread_mutex_destroy(&tls->lock);
+    free(tls);
+}
+
+// Connect to backend server
+static int connect_to_backend(const backend_config_t *backend)
+{
+    resolver_endpoint_t *endpoint = backend->endpoint;
+    if (!endpoint) {
+        endpoint = resolver_get_endpoint(backend->host, backend->port);
+    }
+    if (!endpoint) {
+        log_message(LOG_LEVEL_ERROR, "Failed to resolve backend host: %s", backend->host);
         return -1;
     }
-    
-    return sock_fd;
+    return resolver_connect(endpoint, HTTP2_POLL_TIMEOUT_MS);
 }
 
 // Initialize HTTP/2 client callbacks
@@ -266,12 +424,49 @@ static int init_client_callbacks(http2_client_t *client)
     nghttp2_session_callbacks_set_send_callback(client->callbacks, http2_client_send_callback);
     nghttp2_session_callbacks_set_recv_callback(client->callbacks, http2_client_recv_callback);
     nghttp2_session_callbacks_set_on_frame_recv_callback(client->callbacks, http2_client_on_frame_recv);
+    nghttp2_session_callbacks_set_on_header_callback(client->callbacks, http2_client_on_header);
     nghttp2_session_callbacks_set_on_data_chunk_recv_callback(client->callbacks, http2_client_on_data_chunk_recv);
     nghttp2_session_callbacks_set_on_stream_close_callback(client->callbacks, http2_client_on_stream_close);
     
     return 0;
 }
 
+// Release the session, TLS state and socket, leaving the client reusable
+static void close_connection(http2_client_t *client)
+{
+    if (client->session) {
+        nghttp2_session_del(client->session);
+        client->session = NULL;
+    }
+    
+    if (client->ssl) {
+        SSL *ssl = client->ssl;
+        SSL_CTX *ctx = SSL_get_SSL_CTX(ssl);
+        /* SSL_free() without a shutdown marks the session unresumable. A
+         * healthy connection's session stays good; skip close_notify, the
+         * peer may already be gone and a write could raise SIGPIPE. */
+        if (!atomic_load(&client->broken)) {
+            SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        }
+        SSL_free(ssl);
+        if (ctx) SSL_CTX_free(ctx);
+        client->ssl = NULL;
+    }
+    
+    if (client->socket_fd >= 0) {
+        close(client->socket_fd);
+        client->socket_fd = -1;
+    }
+}
+
+static void mark_broken(http2_client_t *client, const char *reason)
+{
+    if (!atomic_exchange(&client->broken, true)) {
+        log_message(LOG_LEVEL_WARN, "HTTP/2 client connection failed: %s", reason);
+    }
+    pthread_cond_broadcast(&client->cond);
+}
+
 int http2_client_init(http2_client_t *client, const backend_config_t *backend)
 {
     (void)backend;
@@ -283,7 +478,23 @@ int http2_client_init(http2_client_t *client, const backend_config_t *backend)
     memset(client, 0, sizeof(http2_client_t));
     client->socket_fd = -1;
     
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (pthread_mutex_init(&client->lock, NULL) != 0) {
+        pthread_condattr_destroy(&attr);
+        return -1;
+    }
+    if (pthread_cond_init(&client->cond, &attr) != 0) {
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_destroy(&client->lock);
+        return -1;
+    }
+    pthread_condattr_destroy(&attr);
+    
     if (init_client_callbacks(client) != 0) {
+        pthread_cond_destroy(&client->cond);
+        pthread_mutex_destroy(&client->lock);
         return -1;
     }
     
@@ -292,20 +503,27 @@ int http2_client_init(http2_client_t *client, const backend_config_t *backend)
 
 int http2_client_connect(http2_client_t *client, const backend_config_t *backend)
 {
-    if (!client || !backend) {
+    if (!client || !backend || !client->callbacks) {
         return -1;
     }
     
     // Connect to backend
-    client->socket_fd = connect_to_backend(backend->host, backend->port);
+    client->socket_fd = connect_to_backend(backend);
     if (client->socket_fd < 0) {
         return -1;
     }
     
-    // Create SSL context
-    SSL_CTX *ssl_ctx = create_http2_client_ssl_ctx(backend->tls_verify);
+    // Use the backend's shared SSL context, or a private one
+    http2_client_tls_t *tls = backend->tls;
+    SSL_CTX *ssl_ctx;
+    if (tls) {
+        ssl_ctx = tls->ctx;
+        SSL_CTX_up_ref(ssl_ctx);
+    } else {
+        ssl_ctx = create_http2_client_ssl_ctx(backend->tls_verify);
+    }
     if (!ssl_ctx) {
-        close(client->socket_fd);
+        close_connection(client);
         return -1;
     }
     
@@ -314,13 +532,28 @@ int http2_client_connect(http2_client_t *client, const backend_config_t *backend
     if (!client->ssl) {
         log_message(LOG_LEVEL_ERROR, "Failed to create SSL object for HTTP/2 client");
         SSL_CTX_free(ssl_ctx);
-        close(client->socket_fd);
+        close_connection(client);
         return -1;
     }
     
+    /* The SSL object holds its own reference; close_connection() drops both */
     SSL_set_fd(client->ssl, client->socket_fd);
     SSL_set_connect_state(client->ssl);
     
+    struct in6_addr numeric_host;
+    if (inet_pton(AF_INET, backend->host, &numeric_host) != 1 &&
+        inet_pton(AF_INET6, backend->host, &numeric_host) != 1) {
+        SSL_set_tlsext_host_name(client->ssl, backend->host);
+    }
+    
+    if (tls) {
+        pthread_mutex_lock(&tls->lock);
+        if (tls->session && SSL_SESSION_is_resumable(tls->session)) {
+            SSL_set_session(client->ssl, tls->session);
+        }
+        pthread_mutex_unlock(&tls->lock);
+    }
+    
     // Perform non-blocking handshake
     struct timeval start, end;
     gettimeofday(&start, NULL);
@@ -336,17 +569,13 @@ int http2_client_connect(http2_client_t *client, const backend_config_t *backend
             int poll_ret = poll(&pfd, 1, HTTP2_POLL_TIMEOUT_MS);
             if (poll_ret <= 0) {
                 log_message(LOG_LEVEL_ERROR, "HTTP/2 client TLS handshake timeout");
-                SSL_free(client->ssl);
-                SSL_CTX_free(ssl_ctx);
-                close(client->socket_fd);
+                close_connection(client);
                 return -1;
             }
             ret = SSL_connect(client->ssl);
         } else {
             log_message(LOG_LEVEL_ERROR, "HTTP/2 client TLS handshake failed: %d", err);
-            SSL_free(client->ssl);
-            SSL_CTX_free(ssl_ctx);
-            close(client->socket_fd);
+            close_connection(client);
             return -1;
         }
     }
@@ -354,7 +583,13 @@ int http2_client_connect(http2_client_t *client, const backend_config_t *backend
     gettimeofday(&end, NULL);
     long handshake_ms = (end.tv_sec - start.tv_sec) * 1000 + 
                         (end.tv_usec - start.tv_usec) / 1000;
-    log_message(LOG_LEVEL_INFO, "HTTP/2 client TLS handshake completed in %ld ms", handshake_ms);
+    bool resumed = SSL_session_reused(client->ssl);
+    if (tls) {
+        atomic_fetch_add(&tls->handshakes, 1);
+        if (resumed) atomic_fetch_add(&tls->resumed, 1);
+    }
+    log_message(LOG_LEVEL_INFO, "HTTP/2 client TLS handshake completed in %ld ms%s",
+                handshake_ms, resumed ? " (resumed)" : "");
     metrics_increment_tls_handshake(1);
     metrics_record_tls_handshake_duration(handshake_ms / 1000.0);
     
@@ -364,9 +599,7 @@ int http2_client_connect(http2_client_t *client, const backend_config_t *backend
     SSL_get0_alpn_selected(client->ssl, &alpn, &alpn_len);
     if (!alpn || alpn_len != 2 || memcmp(alpn, "h2", 2) != 0) {
         log_message(LOG_LEVEL_ERROR, "HTTP/2 ALPN negotiation failed");
-        SSL_free(client->ssl);
-        SSL_CTX_free(ssl_ctx);
-        close(client->socket_fd);
+        close_connection(client);
         return -1;
     }
     
@@ -374,53 +607,74 @@ int http2_client_connect(http2_client_t *client, const backend_config_t *backend
                 backend->host, backend->port);
     
     // Create nghttp2 session (client mode)
-    nghttp2_option *options;
+    nghttp2_option *options = NULL;
     if (nghttp2_option_new(&options) == 0) {
-        nghttp2_option_set_peer_max_concurrent_streams(options, 100);
+        nghttp2_option_set_peer_max_concurrent_streams(options, HTTP2_CLIENT_MAX_STREAMS);
+        /* Windows are credited as readers take the bytes (http2_client_read) */
+        nghttp2_option_set_no_auto_window_update(options, 1);
     }
     
     if (nghttp2_session_client_new2(&client->session, client->callbacks, 
                                      client, options) != 0) {
         log_message(LOG_LEVEL_ERROR, "Failed to create HTTP/2 client session");
-        nghttp2_option_del(options);
-        SSL_free(client->ssl);
-        SSL_CTX_free(ssl_ctx);
-        close(client->socket_fd);
+        if (options) nghttp2_option_del(options);
+        close_connection(client);
         return -1;
     }
     
     if (options) nghttp2_option_del(options);
     
+    /* Until the peer's SETTINGS arrive only the first stream may be opened */
+    atomic_store(&client->max_concurrent_streams, 1);
+    atomic_store(&client->broken, false);
+    
     // Send client connection preface and SETTINGS
-    if (nghttp2_submit_settings(client->session, NGHTTP2_FLAG_NONE, NULL, 0) != 0) {
+    nghttp2_settings_entry settings[] = {
+        {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, HTTP2_CLIENT_STREAM_WINDOW},
+        {NGHTTP2_SETTINGS_MAX_HEADER_LIST_SIZE, HTTP2_CLIENT_HEADER_ARENA_SIZE},
+    };
+    if (nghttp2_submit_settings(client->session, NGHTTP2_FLAG_NONE, settings, 2) != 0 ||
+        nghttp2_session_set_local_window_size(client->session, NGHTTP2_FLAG_NONE, 0,
+                                              HTTP2_CLIENT_CONNECTION_WINDOW) != 0) {
         log_message(LOG_LEVEL_ERROR, "Failed to submit HTTP/2 SETTINGS");
-        http2_client_cleanup(client);
+        close_connection(client);
         return -1;
     }
     
     if (nghttp2_session_send(client->session) != 0) {
         log_message(LOG_LEVEL_ERROR, "Failed to send HTTP/2 client preface");
-        http2_client_cleanup(client);
+        close_connection(client);
         return -1;
     }
     
     return 0;
 }
 
-int http2_client_send_request(http2_client_t *client, const char *method,
-                               const char *path, const char *host,
-                               const char *body, size_t body_len)
+int http2_client_submit(http2_client_t *client, http2_stream_t *stream,
+                        const char *method, const char *path, const char *host,
+                        const char *body, size_t body_len)
 {
-    if (!client || !client->session || !method || !path || !host) {
+    if (!client || !stream || !method || !path || !host) {
         return -1;
     }
     
-    client->method = method;
-    client->path = path;
-    client->host = host;
-    client->request_body = body;
-    client->request_body_len = body_len;
-    client->body_sent = 0;
+    stream->stream_id = 0;
+    stream->session = NULL;
+    stream->request_body = body;
+    stream->request_body_len = body_len;
+    stream->body_sent = 0;
+    stream->body_head = NULL;
+    stream->body_tail = NULL;
+    stream->response_received = 0;
+    stream->body_read = 0;
+    stream->body_consumed = 0;
+    stream->consume_on_receive = false;
+    stream->response_status = 0;
+    stream->response_header_count = 0;
+    stream->header_arena_used = 0;
+    stream->headers_done = 0;
+    stream->done = 0;
+    stream->error_code = 0;
     
     // Build HTTP/2 headers
     nghttp2_nv headers[HTTP2_CLIENT_MAX_HEADERS];
@@ -449,161 +703,407 @@ int http2_client_send_request(http2_client_t *client, const char *method,
     // Submit request
     nghttp2_data_provider data_prd = {0};
     if (body && body_len > 0) {
-        data_prd.source.ptr = NULL;
+        data_prd.source.ptr = stream;
         data_prd.read_callback = http2_client_data_read;
     }
     
-    int stream_id = nghttp2_submit_request(client->session, NULL, headers, 
-                                            num_headers, body ? &data_prd : NULL, 
-                                            client);
+    pthread_mutex_lock(&client->lock);
+    
+    if (!client->session || atomic_load(&client->broken)) {
+        pthread_mutex_unlock(&client->lock);
+        return -1;
+    }
+    
+    int stream_id = nghttp2_submit_request(client->session, NULL, headers, num_headers,
+                                            (body && body_len > 0) ? &data_prd : NULL,
+                                            stream);
     if (stream_id < 0) {
+        pthread_mutex_unlock(&client->lock);
         log_message(LOG_LEVEL_ERROR, "Failed to submit HTTP/2 request: %s", 
                     nghttp2_strerror(stream_id));
         return -1;
     }
     
+    stream->stream_id = stream_id;
+    stream->session = client->session;
     H2C_LOG("http2_client: submitted request on stream %d", stream_id);
     
     // Send the request
     if (nghttp2_session_send(client->session) != 0) {
-        log_message(LOG_LEVEL_ERROR, "Failed to send HTTP/2 request");
+        mark_broken(client, "failed to send request");
+        pthread_mutex_unlock(&client->lock);
         return -1;
     }
     
+    pthread_mutex_unlock(&client->lock);
     return stream_id;
 }
 
-int http2_client_recv_response(http2_client_t *client)
+/* Polls the socket for up to timeout_ms on behalf of every stream and feeds
+ * what arrives to the session. Called and returns with client->lock held;
+ * the lock is dropped while polling so other threads can submit. */
+static void drive_io(http2_client_t *client, int timeout_ms)
 {
-    if (!client || !client->session) {
-        return -1;
+    short events = 0;
+    if (nghttp2_session_want_read(client->session)) events |= POLLIN;
+    if (nghttp2_session_want_write(client->session)) events |= POLLOUT;
+    
+    if (events == 0) {
+        mark_broken(client, "session closed by peer");
+        return;
     }
     
-    struct timeval start = {0};
-    gettimeofday(&start, NULL);
+    struct pollfd pfd = {
+        .fd = client->socket_fd,
+        .events = events
+    };
     
-    while (!client->done) {
-        // Check timeout (30 seconds)
-        struct timeval now;
-        gettimeofday(&now, NULL);
-        long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + 
-                          (now.tv_usec - start.tv_usec) / 1000;
-        if (elapsed_ms > 30000) {
-            log_message(LOG_LEVEL_ERROR, "HTTP/2 client response timeout");
-            return -1;
-        }
-        
-        client->want_read = 0;
-        client->want_write = 0;
-        
-        // Check if session wants read/write
-        short events = 0;
-        if (nghttp2_session_want_read(client->session)) events |= POLLIN;
-        if (nghttp2_session_want_write(client->session)) events |= POLLOUT;
-        
-        if (events == 0) break;
-        
-        struct pollfd pfd = {
-            .fd = client->socket_fd,
-            .events = events
-        };
-        
-        int poll_ret = poll(&pfd, 1, 100); // 100ms poll timeout
-        if (poll_ret < 0) {
-            log_message(LOG_LEVEL_ERROR, "HTTP/2 client poll failed: %s", strerror(errno));
-            return -1;
-        }
-        if (poll_ret == 0) continue;
-        
-        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
-            log_message(LOG_LEVEL_ERROR, "HTTP/2 client socket error");
-            return -1;
+    client->io_active = true;
+    pthread_mutex_unlock(&client->lock);
+    int poll_ret = poll(&pfd, 1, timeout_ms);
+    pthread_mutex_lock(&client->lock);
+    client->io_active = false;
+    
+    if (poll_ret < 0 && errno != EINTR) {
+        mark_broken(client, strerror(errno));
+        return;
+    }
+    
+    if (poll_ret > 0) {
+        if (pfd.revents & (POLLERR | POLLNVAL)) {
+            mark_broken(client, "socket error");
+            return;
         }
         
         // Receive data
-        if (pfd.revents & POLLIN) {
+        if (pfd.revents & (POLLIN | POLLHUP)) {
+            client->want_read = 0;
             int ret = nghttp2_session_recv(client->session);
             if (ret < 0 && ret != NGHTTP2_ERR_WOULDBLOCK) {
-                log_message(LOG_LEVEL_ERROR, "HTTP/2 session recv failed: %s", 
-                            nghttp2_strerror(ret));
-                return -1;
+                mark_broken(client, nghttp2_strerror(ret));
+                return;
             }
         }
         
-        // Send data
-        if (pfd.revents & POLLOUT) {
-            int ret = nghttp2_session_send(client->session);
-            if (ret < 0 && ret != NGHTTP2_ERR_WOULDBLOCK) {
-                log_message(LOG_LEVEL_ERROR, "HTTP/2 session send failed: %s", 
-                            nghttp2_strerror(ret));
-                return -1;
+        // Send data, including any WINDOW_UPDATE or SETTINGS ack queued by recv
+        client->want_write = 0;
+        int ret = nghttp2_session_send(client->session);
+        if (ret < 0 && ret != NGHTTP2_ERR_WOULDBLOCK) {
+            mark_broken(client, nghttp2_strerror(ret));
+            return;
+        }
+    }
+    
+    pthread_cond_broadcast(&client->cond);
+}
+
+/* Detaches a stream so late frames for it are dropped, and cancels it if
+ * the connection is still usable. Called with client->lock held. */
+static void abandon_stream(http2_client_t *client, http2_stream_t *stream)
+{
+    if (client->session && stream->session == client->session) {
+        nghttp2_session_set_stream_user_data(client->session, stream->stream_id, NULL);
+        if (!atomic_load(&client->broken) &&
+            nghttp2_submit_rst_stream(client->session, NGHTTP2_FLAG_NONE,
+                                      stream->stream_id, NGHTTP2_CANCEL) == 0) {
+            nghttp2_session_send(client->session);
+        }
+    }
+    stream->done = 1;
+    stream->error_code = NGHTTP2_CANCEL;
+}
+
+/* Credits the stream's received bytes up to 'upto' to both flow-control
+ * windows and flushes the WINDOW_UPDATE. Called with client->lock held. */
+static void consume_body(http2_client_t *client, http2_stream_t *stream, size_t upto)
+{
+    if (upto <= stream->body_consumed) {
+        return;
+    }
+    if (client->session && stream->session == client->session) {
+        nghttp2_session_consume(client->session, stream->stream_id, upto - stream->body_consumed);
+        int ret = nghttp2_session_send(client->session);
+        if (ret < 0 && ret != NGHTTP2_ERR_WOULDBLOCK) {
+            mark_broken(client, nghttp2_strerror(ret));
+        }
+    }
+    stream->body_consumed = upto;
+}
+
+/* Drives the connection until the stream has closed, or with 'whole' unset
+ * until its response headers arrived. Called and returns with client->lock
+ * held; a stream that timed out is abandoned unless 'keep' is set. */
+static bool wait_for_stream(http2_client_t *client, http2_stream_t *stream, bool whole,
+                            int timeout_ms, bool keep)
+{
+    long deadline = monotonic_ms() + timeout_ms;
+    
+    while (!stream->done && (whole || !stream->headers_done) && !atomic_load(&client->broken)) {
+        long remaining = deadline - monotonic_ms();
+        if (remaining <= 0) {
+            if (!keep) {
+                log_message(LOG_LEVEL_ERROR, "HTTP/2 client response timeout on stream %d",
+                            stream->stream_id);
             }
+            break;
+        }
+        int slice = remaining < HTTP2_IO_SLICE_MS ? (int)remaining : HTTP2_IO_SLICE_MS;
+        
+        if (client->io_active) {
+            struct timespec until;
+            clock_gettime(CLOCK_MONOTONIC, &until);
+            until.tv_nsec += (long)slice * 1000000L;
+            until.tv_sec += until.tv_nsec / 1000000000L;
+            until.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&client->cond, &client->lock, &until);
+            continue;
         }
+        
+        drive_io(client, slice);
     }
     
-    return client->response_status;
+    if (stream->done || (!whole && stream->headers_done)) {
+        return true;
+    }
+    if (!keep || atomic_load(&client->broken)) {
+        abandon_stream(client, stream);
+    }
+    return false;
 }
 
-void http2_client_cleanup(http2_client_t *client)
+/* Waits for the complete response. The body stays queued for
+ * http2_client_read() but no longer holds the backend's window. */
+int http2_client_await(http2_client_t *client, http2_stream_t *stream, int timeout_ms)
 {
-    if (!client) return;
+    if (!client || !stream || stream->stream_id <= 0) {
+        return -1;
+    }
     
-    if (client->session) {
-        nghttp2_session_del(client->session);
-        client->session = NULL;
+    pthread_mutex_lock(&client->lock);
+    stream->consume_on_receive = true;
+    consume_body(client, stream, stream->response_received);
+    bool complete = wait_for_stream(client, stream, true, timeout_ms, false);
+    pthread_mutex_unlock(&client->lock);
+    
+    return complete ? stream->response_status : -1;
+}
+
+/* Waits only for the response status and headers; the body is then
+ * streamed with http2_client_read(). Returns the status, -1 on failure. */
+int http2_client_await_headers(http2_client_t *client, http2_stream_t *stream, int timeout_ms)
+{
+    if (!client || !stream || stream->stream_id <= 0) {
+        return -1;
     }
     
-    if (client->callbacks) {
-        nghttp2_session_callbacks_del(client->callbacks);
-        client->callbacks = NULL;
+    pthread_mutex_lock(&client->lock);
+    bool arrived = wait_for_stream(client, stream, false, timeout_ms, false) && stream->headers_done;
+    pthread_mutex_unlock(&client->lock);
+    
+    return arrived ? stream->response_status : -1;
+}
+
+/* Like http2_client_await_headers(), but a stream still waiting when the
+ * time is up is left open and 0 returned, so the caller can attend to
+ * another stream meanwhile and come back to this one (hedging). Returns
+ * the status once the headers are in, -1 when the stream failed. */
+int http2_client_poll_headers(http2_client_t *client, http2_stream_t *stream, int timeout_ms)
+{
+    if (!client || !stream || stream->stream_id <= 0) {
+        return -1;
     }
     
-    if (client->ssl) {
-        SSL *ssl = client->ssl;
-        SSL_CTX *ctx = SSL_get_SSL_CTX(ssl);
-        SSL_free(ssl);
-        if (ctx) SSL_CTX_free(ctx);
-        client->ssl = NULL;
+    pthread_mutex_lock(&client->lock);
+    wait_for_stream(client, stream, false, timeout_ms, true);
+    int result = stream->headers_done ? stream->response_status : stream->done ? -1 : 0;
+    pthread_mutex_unlock(&client->lock);
+    
+    return result;
+}
+
+/* Moves the connection along without blocking when the stream has nothing
+ * buffered and no other thread is already polling the socket. Called with
+ * client->lock held. */
+static void poll_stream(http2_client_t *client, http2_stream_t *stream)
+{
+    if (!stream->body_head && !stream->done && !client->io_active &&
+        client->session && !atomic_load(&client->broken)) {
+        drive_io(client, 0);
+    }
+}
+
+/* True when http2_client_read() has something to report: bytes, the end
+ * of the body, or a failure */
+bool http2_client_stream_ready(http2_client_t *client, http2_stream_t *stream)
+{
+    if (!client || !stream) {
+        return true;
     }
     
-    if (client->socket_fd >= 0) {
-        close(client->socket_fd);
-        client->socket_fd = -1;
+    pthread_mutex_lock(&client->lock);
+    poll_stream(client, stream);
+    bool ready = stream->body_head || stream->done || atomic_load(&client->broken);
+    pthread_mutex_unlock(&client->lock);
+    return ready;
+}
+
+/* Copies up to 'len' response body bytes without blocking and credits them
+ * back to the backend. Returns the number copied, 0 at the end of the body,
+ * HTTP2_CLIENT_AGAIN when nothing has arrived yet, -1 when the stream was
+ * reset or the connection failed. */
+ssize_t http2_client_read(http2_client_t *client, http2_stream_t *stream, uint8_t *buf, size_t len)
+{
+    if (!client || !stream || !buf) {
+        return -1;
+    }
+    
+    pthread_mutex_lock(&client->lock);
+    poll_stream(client, stream);
+    
+    size_t copied = 0;
+    while (copied < len && stream->body_head) {
+        http2_body_chunk_t *chunk = stream->body_head;
+        size_t n = chunk->len - chunk->off;
+        if (n > len - copied) {
+            n = len - copied;
+        }
+        memcpy(buf + copied, chunk->data + chunk->off, n);
+        chunk->off += n;
+        copied += n;
+        if (chunk->off == chunk->len) {
+            stream->body_head = chunk->next;
+            if (!stream->body_head) {
+                stream->body_tail = NULL;
+            }
+            free(chunk);
+        }
+    }
+    stream->body_read += copied;
+    consume_body(client, stream, stream->body_read);
+    
+    ssize_t result;
+    if (copied > 0) {
+        result = (ssize_t)copied;
+    } else if (stream->done) {
+        result = stream->error_code == NGHTTP2_NO_ERROR ? 0 : -1;
+    } else if (atomic_load(&client->broken)) {
+        result = -1;
+    } else {
+        result = HTTP2_CLIENT_AGAIN;
+    }
+    
+    pthread_mutex_unlock(&client->lock);
+    return result;
+}
+
+/* Ends the caller's use of a stream: cancels it if it is still open, frees
+ * what was never read and returns its share of the connection window */
+void http2_client_release(http2_client_t *client, http2_stream_t *stream)
+{
+    if (!client || !stream) {
+        return;
+    }
+    
+    pthread_mutex_lock(&client->lock);
+    if (!stream->done && stream->stream_id > 0) {
+        abandon_stream(client, stream);
+    }
+    consume_body(client, stream, stream->response_received);
+    pthread_mutex_unlock(&client->lock);
+    
+    while (stream->body_head) {
+        http2_body_chunk_t *next = stream->body_head->next;
+        free(stream->body_head);
+        stream->body_head = next;
+    }
+    stream->body_tail = NULL;
+}
+
+void http2_client_disconnect(http2_client_t *client)
+{
+    if (!client) return;
+    
+    pthread_mutex_lock(&client->lock);
+    close_connection(client);
+    atomic_store(&client->broken, false);
+    atomic_store(&client->max_concurrent_streams, 0);
+    pthread_mutex_unlock(&client->lock);
+}
+
+bool http2_client_is_connected(http2_client_t *client)
+{
+    if (!client) return false;
+    return client->session != NULL && !atomic_load(&client->broken);
+}
+
+int http2_client_get_max_streams(http2_client_t *client)
+{
+    if (!client) return 0;
+    return atomic_load(&client->max_concurrent_streams);
+}
+
+int http2_client_send_request(http2_client_t *client, const char *method,
+                               const char *path, const char *host,
+                               const char *body, size_t body_len)
+{
+    if (!client) {
+        return -1;
+    }
+    /* The previous response's unread body goes with it */
+    http2_client_release(client, &client->default_stream);
+    return http2_client_submit(client, &client->default_stream, method, path, host,
+                               body, body_len);
+}
+
+int http2_client_recv_response(http2_client_t *client)
+{
+    if (!client || !client->session) {
+        return -1;
     }
+    return http2_client_await(client, &client->default_stream, HTTP2_CLIENT_RESPONSE_TIMEOUT_MS);
 }
 
-const char* http2_client_get_response_body(http2_client_t *client)
+void http2_client_cleanup(http2_client_t *client)
 {
-    if (!client) return NULL;
-    return client->response_buffer;
+    if (!client) return;
+    
+    close_connection(client);
+    
+    if (client->callbacks) {
+        http2_client_release(client, &client->default_stream);
+        nghttp2_session_callbacks_del(client->callbacks);
+        client->callbacks = NULL;
+        pthread_cond_destroy(&client->cond);
+        pthread_mutex_destroy(&client->lock);
+    }
 }
 
 size_t http2_client_get_response_length(http2_client_t *client)
 {
     if (!client) return 0;
-    return client->response_received;
+    return client->default_stream.response_received;
 }
 
 int http2_client_get_response_status(http2_client_t *client)
 {
     if (!client) return 0;
-    return client->response_status;
+    return client->default_stream.response_status;
 }
 
 bool http2_client_is_done(http2_client_t *client)
 {
     if (!client) return true;
-    return client->done;
+    return client->default_stream.done;
 }
 
 bool http2_client_has_error(http2_client_t *client)
 {
     if (!client) return true;
-    return client->error_code != 0 || client->response_status == 0;
+    return client->default_stream.error_code != 0 || client->default_stream.response_status == 0;
 }
 
 int http2_client_get_error_code(http2_client_t *client)
 {
     if (!client) return -1;
-    return client->error_code;
+    return client->default_stream.error_code;
 }
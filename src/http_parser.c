@@ -71,5 +71,6 @@ int parse_http_request(char *buffer, size_t len, HttpRequest *req) {
     }
 
     // The parser has also read the empty line separating headers and body
+    req->head_len = (cursor + 2 <= end) ? (size_t)(cursor + 2 - buffer) : len;
     return 0;
 }
@@ -1,4 +1,5 @@
 #include "log.h"
+#include "cpu_affinity.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -191,6 +192,13 @@ int log_init(const LoggingConfig *config) {
     return 0;
 }
 
+/* Pins the logger thread to a single CPU */
+int log_set_thread_affinity(int cpu) {
+    if (!atomic_load(&logger_running))
+        return -1;
+    return cpu_affinity_pin_thread(logger_thread, cpu);
+}
+
 /* Funzione per inviare messaggi di log */
 void log_message(LogLevel level, const char *format, ...) {
     if (!log_buffer || !atomic_load(&logger_running))
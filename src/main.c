@@ -6,10 +6,138 @@
 #include "log.h"
 #include "metrics.h"
 #include "backend_pool.h"
+#include "upstream.h"
+#include "resolver.h"
+#include "health_check.h"
+#include "http1_client.h"
+#include "response_cache.h"
+#include "router.h"
 
 #define DEFAULT_METRICS_PORT 9090
 #define MAX_PORT_NUMBER 65535
 
+static backend_pool_t *create_endpoint_pool(Route *route, const char *backend)
+{
+    char host[256];
+    int port;
+
+    if (parse_backend_url(backend, host, sizeof(host), &port) != 0) {
+        return NULL;
+    }
+
+    backend_pool_t *pool = backend_pool_create_with_config(host, port, route->tls_enabled,
+                                                           route->tls_verify,
+                                                           &route->connection_pool);
+    if (!pool) {
+        log_message(LOG_LEVEL_ERROR, "Failed to create pool for %s", backend);
+        return NULL;
+    }
+    log_message(LOG_LEVEL_INFO, "Created connection pool for %s (min=%d, max=%d)",
+               backend, route->connection_pool.min_size, route->connection_pool.size);
+
+    if (route->health_check.enabled) {
+        if (backend_pool_start_health_checker(pool, &route->health_check) == 0) {
+            log_message(LOG_LEVEL_INFO, "Health checker started for %s", backend);
+        }
+    }
+
+    if (route->circuit_breaker.enabled) {
+        if (backend_pool_init_circuit_breaker(pool, &route->circuit_breaker) == 0) {
+            log_message(LOG_LEVEL_INFO, "Circuit breaker initialized for %s", backend);
+        }
+    }
+    return pool;
+}
+
+/* One pool, health checker and circuit breaker per backend of the route */
+static RouteCluster *create_route_cluster(Route *route)
+{
+    upstream_cluster_t *cluster = upstream_cluster_create(route->load_balancer,
+                                                          route->hash_header);
+    if (!cluster) {
+        return NULL;
+    }
+
+    for (int b = 0; b < route->backend_count; b++) {
+        backend_pool_t *pool = create_endpoint_pool(route, route->backends[b]);
+        if (!pool) {
+            continue;
+        }
+        if (upstream_cluster_add_endpoint(cluster, route->backends[b], pool) != 0) {
+            backend_pool_stop_health_checker(pool);
+            backend_pool_destroy(pool);
+        }
+    }
+
+    if (cluster->count == 0) {
+        upstream_cluster_destroy(cluster);
+        return NULL;
+    }
+    log_message(LOG_LEVEL_INFO, "Route %s balances %d backend(s) with %s",
+               route->path, cluster->count, upstream_lb_policy_name(cluster->policy));
+
+    if (route->outlier_detection.enabled) {
+        upstream_cluster_set_outlier_detection(cluster, &route->outlier_detection);
+        log_message(LOG_LEVEL_INFO, "Outlier detection for %s: %d consecutive 5xx, %d%% errors, "
+                   "%dx median p95 latency; up to %d%% ejected",
+                   route->path, route->outlier_detection.consecutive_5xx,
+                   route->outlier_detection.failure_percent, route->outlier_detection.latency_factor,
+                   route->outlier_detection.max_ejection_percent);
+    }
+
+    if (route->retry.enabled) {
+        upstream_cluster_set_retry_policy(cluster, &route->retry);
+        log_message(LOG_LEVEL_INFO, "Retries for %s: up to %d per idempotent request within %d%% of traffic; "
+                   "hedging %s", route->path, route->retry.max_retries, route->retry.budget_percent,
+                   !route->retry.hedge ? "off" : route->retry.hedge_delay_ms > 0 ? "after a fixed delay" : "after p95");
+    }
+
+    if (route->concurrency_limit.enabled) {
+        upstream_cluster_set_concurrency_limit(cluster, &route->concurrency_limit);
+        log_message(LOG_LEVEL_INFO, "Concurrency limit for %s: starts at %d per backend, adapts within %d-%d",
+                   route->path, route->concurrency_limit.initial_limit, route->concurrency_limit.min_limit,
+                   route->concurrency_limit.max_limit);
+    }
+    return cluster;
+}
+
+/* One cache for every route that enables it, so the memory bound is global */
+static void attach_response_cache(ServerConfig *config)
+{
+    response_cache_t *cache = NULL;
+
+    for (int i = 0; i < config->route_count; i++) {
+        Route *route = &config->routes[i];
+        if (!route->cache.enabled || strcmp(route->technology, "reverse_proxy") != 0) {
+            continue;
+        }
+        if (!cache) {
+            cache = response_cache_create((size_t)config->response_cache.max_size_mb * 1024 * 1024,
+                                          config->response_cache.shards,
+                                          (size_t)config->response_cache.max_entry_size_kb * 1024);
+            if (!cache) {
+                return;
+            }
+            log_message(LOG_LEVEL_INFO, "Response cache: %d MB in %d shards, entries up to %d KB",
+                        config->response_cache.max_size_mb, config->response_cache.shards,
+                        config->response_cache.max_entry_size_kb);
+            if (config->response_cache.disk_path[0] != '\0') {
+                if (response_cache_enable_disk(cache, config->response_cache.disk_path,
+                                               (size_t)config->response_cache.disk_size_mb * 1024 * 1024,
+                                               (size_t)config->response_cache.disk_slab_kb * 1024,
+                                               (size_t)config->response_cache.disk_max_object_mb * 1024 * 1024) == 0) {
+                    log_message(LOG_LEVEL_INFO, "Response cache disk tier: %d MB at %s, objects up to %d MB",
+                                config->response_cache.disk_size_mb, config->response_cache.disk_path,
+                                config->response_cache.disk_max_object_mb);
+                } else {
+                    log_message(LOG_LEVEL_WARN, "Response cache disk tier disabled, caching in memory only");
+                }
+            }
+        }
+        route->response_cache = cache;
+    }
+}
+
 int main(int argc, char **argv) {
     ServerConfig config;
     char *config_path = "config.yaml";
@@ -37,40 +165,30 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
+    if (config.cpu_affinity.enabled && config.cpu_affinity.logger_cpu >= 0 &&
+        log_set_thread_affinity(config.cpu_affinity.logger_cpu) == 0) {
+        log_message(LOG_LEVEL_INFO, "Logger thread pinned to CPU %d", config.cpu_affinity.logger_cpu);
+    }
+
     for (int i = 0; i < config.route_count; i++) {
         Route *route = &config.routes[i];
-        if (route->http2_enabled && route->backend[0] != '\0') {
-            char host[256];
-            int port;
-            if (parse_backend_url(route->backend, host, sizeof(host), &port) == 0) {
-                route->pool = backend_pool_create(host, port, route->tls_enabled, 
-                                                   route->tls_verify, 
-                                                   route->connection_pool.size);
-                if (route->pool) {
-                    log_message(LOG_LEVEL_INFO, "Created connection pool for %s (size=%d)",
-                               route->backend, route->connection_pool.size);
-                    
-                    if (route->health_check.enabled) {
-                        if (backend_pool_start_health_checker(route->pool, 
-                                                              &route->health_check) == 0) {
-                            log_message(LOG_LEVEL_INFO, "Health checker started for %s",
-                                       route->backend);
-                        }
-                    }
-                    
-                    if (route->circuit_breaker.enabled) {
-                        if (backend_pool_init_circuit_breaker(route->pool, 
-                                                              &route->circuit_breaker) == 0) {
-                            log_message(LOG_LEVEL_INFO, "Circuit breaker initialized for %s",
-                                       route->backend);
-                        }
-                    }
-                } else {
-                    log_message(LOG_LEVEL_ERROR, "Failed to create pool for %s", route->backend);
-                }
-            }
+        char host[256];
+        int port;
+        /* Resolve now so requests only read cached addresses */
+        if (route->backend[0] != '\0' &&
+            parse_backend_url(route->backend, host, sizeof(host), &port) == 0) {
+            route->endpoint = resolver_get_endpoint(host, port);
+        }
+        if (route->endpoint && strcmp(route->technology, "reverse_proxy") == 0) {
+            route->h1_pool = http1_pool_create(route->endpoint, route->backend,
+                                               route->connection_pool.size,
+                                               route->connection_pool.idle_timeout_seconds);
+        }
+        if (route->http2_enabled && route->backend_count > 0) {
+            route->cluster = create_route_cluster(route);
         }
     }
+    attach_response_cache(&config);
 
     metrics_init();
     
@@ -89,6 +207,9 @@ int main(int argc, char **argv) {
     
     if (metrics_start_server(metrics_port) != 0) {
         log_message(LOG_LEVEL_ERROR, "Failed to start metrics server on port %d", metrics_port);
+    } else if (config.cpu_affinity.enabled && config.cpu_affinity.metrics_cpu >= 0 &&
+               metrics_set_server_thread_affinity(config.cpu_affinity.metrics_cpu) == 0) {
+        log_message(LOG_LEVEL_INFO, "Metrics thread pinned to CPU %d", config.cpu_affinity.metrics_cpu);
     }
 
     log_message(LOG_LEVEL_INFO, "Starting server on port %d (max_connections=%d)",
@@ -96,11 +217,18 @@ int main(int argc, char **argv) {
 
     if (start_server(&config) != 0) {
         log_message(LOG_LEVEL_ERROR, "Error starting server");
+        router_shutdown();
+        health_check_shutdown();
+        resolver_shutdown();
         metrics_shutdown();
         log_shutdown();
         exit(EXIT_FAILURE);
     }
 
+    /* Refreshes still use the routes' caches and pools */
+    router_shutdown();
+    health_check_shutdown();
+    resolver_shutdown();
     metrics_shutdown();
     log_shutdown();
     return EXIT_SUCCESS;
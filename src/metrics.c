@@ -1,5 +1,6 @@
 #include "metrics.h"
 #include "log.h"
+#include "cpu_affinity.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -606,6 +607,13 @@ int metrics_start_server(int port)
     return 0;
 }
 
+int metrics_set_server_thread_affinity(int cpu)
+{
+    if (!atomic_load(&g_server_running))
+        return -1;
+    return cpu_affinity_pin_thread(g_metrics_server_thread, cpu);
+}
+
 void metrics_stop_server(void)
 {
     if (atomic_load(&g_server_running)) {
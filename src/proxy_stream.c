@@ -0,0 +1,126 @@
+/* proxy_stream.c - Relaying backend response bodies as they arrive
+ *
+ * The HTTP/2 proxy path answers a client as soon as the backend's response
+ * headers are in. The body follows through a deferred nghttp2 data
+ * provider that reads straight from the backend stream's receive queue, so
+ * each DATA payload is copied once into the queue and once into the
+ * outgoing frame, whatever its size. Backpressure runs end to end: bytes
+ * are credited to the backend's window only when the client's window let
+ * them go out.
+ *
+ * A response the cache may store is copied into its entry on the way
+ * through and committed once the body ended cleanly.
+ *
+ * Outcome accounting (pool health, circuit breaker, cluster latency) waits
+ * until the body has been relayed, since a backend can still fail halfway.
+ */
+
+#include <stdlib.h>
+#include "proxy_stream.h"
+#include "log.h"
+
+static void touch(proxy_stream_t *ps)
+{
+    clock_gettime(CLOCK_MONOTONIC, &ps->last_activity);
+}
+
+/* Takes ownership of 'stream' (heap-allocated, already answered with
+ * headers) and, when 'conn' is NULL, of the private 'client' */
+proxy_stream_t *proxy_stream_create(http2_client_t *client, http2_stream_t *stream,
+                                    backend_conn_t *conn)
+{
+    proxy_stream_t *ps = calloc(1, sizeof(*ps));
+    if (!ps) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate proxy stream");
+        return NULL;
+    }
+    ps->client = client;
+    ps->stream = stream;
+    ps->conn = conn;
+    touch(ps);
+    return ps;
+}
+
+/* Same contract as http2_client_read() */
+ssize_t proxy_stream_read(proxy_stream_t *ps, uint8_t *buf, size_t len)
+{
+    ssize_t n = http2_client_read(ps->client, ps->stream, buf, len);
+
+    if (n > 0) {
+        touch(ps);
+        if (ps->fill && response_cache_append(ps->fill, buf, (size_t)n) != 0) {
+            response_cache_release(ps->fill);
+            ps->fill = NULL;
+        }
+    } else if (n == 0) {
+        ps->complete = true;
+        if (ps->fill) {
+            response_cache_commit(ps->cache, ps->fill);
+            ps->fill = NULL;
+        }
+    } else if (n != HTTP2_CLIENT_AGAIN) {
+        log_message(LOG_LEVEL_WARN, "Backend stream %d failed after %zu body bytes",
+                    ps->stream->stream_id, ps->stream->body_read);
+        ps->failed = true;
+    }
+    return n;
+}
+
+bool proxy_stream_ready(proxy_stream_t *ps)
+{
+    return http2_client_stream_ready(ps->client, ps->stream);
+}
+
+/* The backend socket, to wait on while the stream is deferred */
+int proxy_stream_fd(const proxy_stream_t *ps)
+{
+    return ps->client->socket_fd;
+}
+
+bool proxy_stream_idle(const proxy_stream_t *ps, int timeout_ms)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long idle_ms = (now.tv_sec - ps->last_activity.tv_sec) * 1000L +
+                   (now.tv_nsec - ps->last_activity.tv_nsec) / 1000000L;
+    return idle_ms >= timeout_ms;
+}
+
+/* Cancels the backend stream if it is still running and settles its
+ * outcome. A client that went away before the end is not held against
+ * the backend, but the breaker still gets back the probe slot it took. */
+void proxy_stream_close(proxy_stream_t *ps)
+{
+    if (!ps) {
+        return;
+    }
+
+    log_message(LOG_LEVEL_DEBUG, "Proxied body on stream %d: %zu bytes%s", ps->stream_id,
+                ps->stream->body_read, ps->complete ? "" : ps->failed ? " (failed)" : " (cancelled)");
+    response_cache_release(ps->fill);
+    int status = ps->failed ? UPSTREAM_STATUS_FAILED : ps->stream->response_status;
+    http2_client_release(ps->client, ps->stream);
+    free(ps->stream);
+
+    if (ps->conn) {
+        backend_pool_t *pool = ps->conn->pool;
+        if (ps->failed) {
+            backend_pool_mark_failure(ps->conn);
+            backend_pool_circuit_breaker_record_failure(pool);
+        } else if (ps->complete) {
+            backend_pool_mark_success(ps->conn);
+            backend_pool_circuit_breaker_record_success(pool);
+        } else {
+            backend_pool_circuit_breaker_cancel_request(pool);
+        }
+        backend_pool_release(ps->conn);
+    } else {
+        http2_client_cleanup(ps->client);
+        free(ps->client);
+    }
+
+    if (ps->endpoint) {
+        upstream_endpoint_release(ps->endpoint, ps->latency_us, status);
+    }
+    free(ps);
+}
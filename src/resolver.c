@@ -0,0 +1,418 @@
+/* resolver.c - Cached backend name resolution and happy-eyeballs connect
+ *
+ * Backend addresses are resolved once, when a route or pool is set up, and
+ * kept in a process-wide registry. A background thread re-resolves hostname
+ * entries when their DNS TTL expires, so the request path only copies
+ * cached addresses and never blocks on DNS. Connects race IPv6 and IPv4
+ * addresses as described in RFC 8305.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+#include "resolver.h"
+#include "log.h"
+
+#define DNS_HEADER_SIZE 12
+#define DNS_ANSWER_BUFFER_SIZE 4096
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t registry_cond = PTHREAD_COND_INITIALIZER;
+static resolver_endpoint_t *_Atomic registry_head = NULL;
+static pthread_t refresher;
+static bool refresher_running = false;
+static bool refresher_stop = false;
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* Advances past a possibly compressed name; NULL if it runs off the end */
+static const unsigned char *skip_dns_name(const unsigned char *p, const unsigned char *end)
+{
+    while (p < end) {
+        if ((*p & 0xC0) == 0xC0) {
+            return p + 2 <= end ? p + 2 : NULL;
+        }
+        if (*p == 0) {
+            return p + 1;
+        }
+        p += *p + 1;
+    }
+    return NULL;
+}
+
+/* Lowest TTL among the answers of the given type, or -1 */
+static long query_record_ttl(res_state res, const char *host, int type)
+{
+    unsigned char answer[DNS_ANSWER_BUFFER_SIZE];
+    int len = res_nquery(res, host, ns_c_in, type, answer, sizeof(answer));
+    if (len < DNS_HEADER_SIZE) {
+        return -1;
+    }
+    if (len > (int)sizeof(answer)) {
+        len = sizeof(answer);
+    }
+
+    const unsigned char *end = answer + len;
+    const unsigned char *p = answer + DNS_HEADER_SIZE;
+    int questions = (answer[4] << 8) | answer[5];
+    int answers = (answer[6] << 8) | answer[7];
+    long ttl = -1;
+
+    for (int i = 0; i < questions && p; i++) {
+        p = skip_dns_name(p, end);
+        p = (p && p + 4 <= end) ? p + 4 : NULL;
+    }
+    for (int i = 0; i < answers && p; i++) {
+        p = skip_dns_name(p, end);
+        if (!p || p + 10 > end) {
+            break;
+        }
+        int rtype = (p[0] << 8) | p[1];
+        long rttl = ((long)p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+        int rdlength = (p[8] << 8) | p[9];
+        if (rtype == type && (ttl < 0 || rttl < ttl)) {
+            ttl = rttl;
+        }
+        p += 10 + rdlength;
+    }
+    return ttl;
+}
+
+/* getaddrinfo() does not report TTLs, so ask DNS for them separately. Names
+ * answered from /etc/hosts have none and get the default. */
+static long lookup_ttl(const char *host)
+{
+    static __thread struct __res_state res;
+    static __thread bool res_ready = false;
+
+    if (!res_ready) {
+        if (res_ninit(&res) != 0) {
+            return RESOLVER_DEFAULT_TTL_SEC;
+        }
+        res.retrans = 1;
+        res.retry = 1;
+        res_ready = true;
+    }
+
+    long ttl_a = query_record_ttl(&res, host, ns_t_a);
+    long ttl_aaaa = query_record_ttl(&res, host, ns_t_aaaa);
+    long ttl = ttl_a < 0 ? ttl_aaaa : (ttl_aaaa < 0 || ttl_a < ttl_aaaa ? ttl_a : ttl_aaaa);
+
+    if (ttl < 0) return RESOLVER_DEFAULT_TTL_SEC;
+    if (ttl < RESOLVER_MIN_TTL_SEC) return RESOLVER_MIN_TTL_SEC;
+    if (ttl > RESOLVER_MAX_TTL_SEC) return RESOLVER_MAX_TTL_SEC;
+    return ttl;
+}
+
+/* Alternates address families, starting with the one getaddrinfo() ranked
+ * first (RFC 6724), so a broken family costs at most one attempt delay */
+static void interleave_families(const struct addrinfo *list, resolved_addrs_t *out)
+{
+    const struct addrinfo *families[2][RESOLVER_MAX_ADDRS];
+    int counts[2] = {0, 0};
+    int first = list && list->ai_family == AF_INET ? 1 : 0;
+
+    for (const struct addrinfo *ai = list; ai; ai = ai->ai_next) {
+        int f = ai->ai_family == AF_INET6 ? 0 : ai->ai_family == AF_INET ? 1 : -1;
+        if (f >= 0 && counts[f] < RESOLVER_MAX_ADDRS) {
+            families[f][counts[f]++] = ai;
+        }
+    }
+
+    out->count = 0;
+    for (int i = 0; out->count < RESOLVER_MAX_ADDRS && (i < counts[0] || i < counts[1]); i++) {
+        for (int k = 0; k < 2 && out->count < RESOLVER_MAX_ADDRS; k++) {
+            int f = k == 0 ? first : 1 - first;
+            if (i < counts[f]) {
+                memcpy(&out->addrs[out->count], families[f][i]->ai_addr, families[f][i]->ai_addrlen);
+                out->addr_lens[out->count] = families[f][i]->ai_addrlen;
+                out->count++;
+            }
+        }
+    }
+}
+
+static int resolve_endpoint(resolver_endpoint_t *endpoint, bool query_ttl)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = endpoint->numeric ? AI_NUMERICHOST : 0
+    };
+    struct addrinfo *list = NULL;
+    char port[16];
+    resolved_addrs_t addrs;
+
+    snprintf(port, sizeof(port), "%d", endpoint->port);
+    int rc = getaddrinfo(endpoint->host, port, &hints, &list);
+    if (rc != 0 || !list) {
+        atomic_fetch_add(&endpoint->failures, 1);
+        pthread_mutex_lock(&endpoint->lock);
+        endpoint->expires_at = time(NULL) + RESOLVER_RETRY_SEC;
+        int stale = endpoint->addrs.count;
+        pthread_mutex_unlock(&endpoint->lock);
+        log_message(LOG_LEVEL_WARN, "Failed to resolve backend host %s: %s%s", endpoint->host,
+                    gai_strerror(rc), stale > 0 ? " (keeping previous addresses)" : "");
+        return -1;
+    }
+
+    interleave_families(list, &addrs);
+    freeaddrinfo(list);
+
+    long ttl = endpoint->numeric ? 0 :
+               query_ttl ? lookup_ttl(endpoint->host) : RESOLVER_DEFAULT_TTL_SEC;
+
+    pthread_mutex_lock(&endpoint->lock);
+    endpoint->addrs = addrs;
+    endpoint->expires_at = endpoint->numeric ? 0 : time(NULL) + ttl;
+    pthread_mutex_unlock(&endpoint->lock);
+    atomic_fetch_add(&endpoint->refreshes, 1);
+
+    log_message(LOG_LEVEL_DEBUG, "Resolved backend %s:%d to %d address(es), ttl=%lds",
+                endpoint->host, endpoint->port, addrs.count, ttl);
+    return 0;
+}
+
+static void *refresher_thread(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&registry_lock);
+    while (!refresher_stop) {
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += RESOLVER_RETRY_SEC;
+        pthread_cond_timedwait(&registry_cond, &registry_lock, &wake);
+        if (refresher_stop) {
+            break;
+        }
+        pthread_mutex_unlock(&registry_lock);
+
+        /* Entries are only ever prepended, so the list is safe to walk */
+        time_t now = time(NULL);
+        for (resolver_endpoint_t *e = atomic_load(&registry_head); e; e = e->next) {
+            if (e->numeric) {
+                continue;
+            }
+            pthread_mutex_lock(&e->lock);
+            bool expired = e->expires_at <= now;
+            pthread_mutex_unlock(&e->lock);
+            if (expired) {
+                resolve_endpoint(e, true);
+            }
+        }
+
+        pthread_mutex_lock(&registry_lock);
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return NULL;
+}
+
+/* Returns the registry entry for host:port, resolving it on first use. A
+ * hostname that does not resolve yet still gets an entry; the background
+ * refresher keeps retrying it. */
+resolver_endpoint_t *resolver_get_endpoint(const char *host, int port)
+{
+    if (!host || host[0] == '\0' || port <= 0) {
+        return NULL;
+    }
+
+    for (resolver_endpoint_t *e = atomic_load(&registry_head); e; e = e->next) {
+        if (e->port == port && strcmp(e->host, host) == 0) {
+            return e;
+        }
+    }
+
+    resolver_endpoint_t *endpoint = calloc(1, sizeof(*endpoint));
+    if (!endpoint) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate resolver entry for %s", host);
+        return NULL;
+    }
+    snprintf(endpoint->host, sizeof(endpoint->host), "%s", host);
+    endpoint->port = port;
+    pthread_mutex_init(&endpoint->lock, NULL);
+    atomic_init(&endpoint->refreshes, 0);
+    atomic_init(&endpoint->failures, 0);
+
+    struct in6_addr probe;
+    endpoint->numeric = inet_pton(AF_INET, host, &probe) == 1 ||
+                        inet_pton(AF_INET6, host, &probe) == 1;
+
+    /* The first lookup runs here, at setup time; TTL queries are left to
+     * the refresher so a DNS outage cannot stall startup */
+    resolve_endpoint(endpoint, false);
+
+    pthread_mutex_lock(&registry_lock);
+    for (resolver_endpoint_t *e = atomic_load(&registry_head); e; e = e->next) {
+        if (e->port == port && strcmp(e->host, host) == 0) {
+            pthread_mutex_unlock(&registry_lock);
+            pthread_mutex_destroy(&endpoint->lock);
+            free(endpoint);
+            return e;
+        }
+    }
+    endpoint->next = atomic_load(&registry_head);
+    atomic_store(&registry_head, endpoint);
+
+    if (!endpoint->numeric && !refresher_running) {
+        refresher_stop = false;
+        if (pthread_create(&refresher, NULL, refresher_thread, NULL) == 0) {
+            refresher_running = true;
+        } else {
+            log_message(LOG_LEVEL_ERROR, "Failed to start DNS refresher thread");
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return endpoint;
+}
+
+/* Copies the cached addresses. Expired entries keep being served until the
+ * refresher replaces them. */
+int resolver_endpoint_addrs(resolver_endpoint_t *endpoint, resolved_addrs_t *out)
+{
+    if (!endpoint || !out) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&endpoint->lock);
+    *out = endpoint->addrs;
+    pthread_mutex_unlock(&endpoint->lock);
+    return out->count;
+}
+
+static int start_attempt(const struct sockaddr_storage *addr, socklen_t len, bool *connected)
+{
+    int fd = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    *connected = false;
+    if (connect(fd, (const struct sockaddr *)addr, len) == 0) {
+        *connected = true;
+    } else if (errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Connects to the first address that answers. A new attempt starts every
+ * RESOLVER_CONNECT_ATTEMPT_DELAY_MS, or as soon as one fails, while earlier
+ * ones stay in flight. Returns a connected non-blocking socket, or -1. */
+int resolver_connect(resolver_endpoint_t *endpoint, int timeout_ms)
+{
+    resolved_addrs_t addrs;
+    struct pollfd pfds[RESOLVER_MAX_ADDRS];
+    int started = 0, pending = 0, winner = -1, last_error = 0;
+
+    if (resolver_endpoint_addrs(endpoint, &addrs) <= 0) {
+        log_message(LOG_LEVEL_ERROR, "No addresses for backend %s:%d",
+                    endpoint ? endpoint->host : "?", endpoint ? endpoint->port : 0);
+        return -1;
+    }
+
+    long deadline = now_ms() + timeout_ms;
+    long next_attempt = now_ms();
+
+    while (winner < 0) {
+        long now = now_ms();
+        if (now >= deadline) {
+            last_error = ETIMEDOUT;
+            break;
+        }
+
+        if (started < addrs.count && (pending == 0 || now >= next_attempt)) {
+            bool connected;
+            int fd = start_attempt(&addrs.addrs[started], addrs.addr_lens[started], &connected);
+            pfds[started].fd = fd;
+            pfds[started].events = POLLOUT;
+            pfds[started].revents = 0;
+            if (fd < 0) {
+                last_error = errno;
+            } else if (connected) {
+                winner = started;
+            } else {
+                pending++;
+            }
+            started++;
+            next_attempt = now + RESOLVER_CONNECT_ATTEMPT_DELAY_MS;
+            continue;
+        }
+        if (pending == 0) {
+            break;
+        }
+
+        long wait = deadline - now;
+        if (started < addrs.count && next_attempt - now < wait) {
+            wait = next_attempt - now;
+        }
+        if (poll(pfds, (nfds_t)started, (int)wait) < 0 && errno != EINTR) {
+            last_error = errno;
+            break;
+        }
+
+        for (int i = 0; i < started && winner < 0; i++) {
+            if (pfds[i].fd < 0 || pfds[i].revents == 0) {
+                continue;
+            }
+            int err = 0;
+            socklen_t err_len = sizeof(err);
+            getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+            if (err == 0 && (pfds[i].revents & POLLOUT)) {
+                winner = i;
+            } else {
+                last_error = err ? err : ECONNREFUSED;
+                close(pfds[i].fd);
+                pfds[i].fd = -1;
+                pending--;
+                next_attempt = now_ms();
+            }
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        if (i != winner && pfds[i].fd >= 0) {
+            close(pfds[i].fd);
+        }
+    }
+
+    if (winner < 0) {
+        log_message(LOG_LEVEL_ERROR, "Failed to connect to backend %s:%d: %s",
+                    endpoint->host, endpoint->port, strerror(last_error));
+        return -1;
+    }
+    return pfds[winner].fd;
+}
+
+/* Stops the refresher; entries stay valid for pools that still hold them */
+void resolver_shutdown(void)
+{
+    pthread_mutex_lock(&registry_lock);
+    if (!refresher_running) {
+        pthread_mutex_unlock(&registry_lock);
+        return;
+    }
+    refresher_stop = true;
+    pthread_cond_broadcast(&registry_cond);
+    pthread_mutex_unlock(&registry_lock);
+
+    pthread_join(refresher, NULL);
+
+    pthread_mutex_lock(&registry_lock);
+    refresher_running = false;
+    pthread_mutex_unlock(&registry_lock);
+}
@@ -0,0 +1,1108 @@
+/* response_cache.c - Shared in-memory cache for proxied responses
+ *
+ * Responses are keyed by method, authority and path, plus the values of
+ * the request headers named by the response's Vary. The key hash picks one
+ * of several shards, each with its own lock, hash table and byte budget,
+ * so workers serving different URLs rarely contend.
+ *
+ * Within a shard, eviction follows a segmented LRU. A new entry goes on
+ * probation; a second hit moves it to the protected segment, which may
+ * hold RESPONSE_CACHE_PROTECTED_PERCENT of the shard. Entries fall out of
+ * probation first, so a scan of one-off URLs cannot flush the responses
+ * that are actually requested again.
+ *
+ * Only what RFC 9111 lets a shared cache store is kept: GET responses with
+ * an explicit lifetime (s-maxage, max-age or Expires) or a route TTL, and
+ * nothing marked no-store, no-cache or private, carrying Set-Cookie, or
+ * answering a request with credentials.
+ *
+ * An expired entry is kept for the stale windows of RFC 5861, set by the
+ * response's stale-while-revalidate and stale-if-error directives or the
+ * route's defaults. Within the first, lookups still hit and the first of
+ * them is handed a flight to refetch the response in the background;
+ * within the second, it answers in place of a failed backend. After both
+ * it is dropped. must-revalidate and proxy-revalidate rule both out.
+ *
+ * Behind the memory tier there can be a disk tier (see disk_cache.c). It
+ * takes the responses too large for memory and those memory evicts while
+ * still usable, and is searched when memory misses.
+ *
+ * Misses for the same key are coalesced: while one request fetches from
+ * the backend, the others wait for its response to be stored and are then
+ * served from the cache instead of each taking a backend connection.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "response_cache.h"
+#include "http1_client.h"
+#include "log.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037UL
+#define FNV_PRIME 1099511628211UL
+#define BODY_INITIAL_CAPACITY 4096
+
+typedef struct {
+    int status;
+    const char *reason;
+} cacheable_status_t;
+
+/* Statuses cacheable by default (RFC 9110 section 15.1), less 206 */
+static const cacheable_status_t cacheable_statuses[] = {
+    {200, "OK"},
+    {203, "Non-Authoritative Information"},
+    {204, "No Content"},
+    {300, "Multiple Choices"},
+    {301, "Moved Permanently"},
+    {308, "Permanent Redirect"},
+    {404, "Not Found"},
+    {405, "Method Not Allowed"},
+    {410, "Gone"},
+    {414, "URI Too Long"},
+    {501, "Not Implemented"},
+};
+
+static time_t now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+static const char *status_reason(int status)
+{
+    for (size_t i = 0; i < sizeof(cacheable_statuses) / sizeof(cacheable_statuses[0]); i++) {
+        if (cacheable_statuses[i].status == status) {
+            return cacheable_statuses[i].reason;
+        }
+    }
+    return NULL;
+}
+
+static const char *request_header(const HttpRequest *req, const char *name)
+{
+    for (int i = 0; i < req->header_count; i++) {
+        if (req->headers[i].field && req->headers[i].value &&
+            strcasecmp(req->headers[i].field, name) == 0) {
+            return req->headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+static const response_cache_header_t *response_header(const response_cache_header_t *headers,
+                                                      int count, const char *name)
+{
+    size_t name_len = strlen(name);
+
+    for (int i = 0; i < count; i++) {
+        if (headers[i].name_len == name_len && strncasecmp(headers[i].name, name, name_len) == 0) {
+            return &headers[i];
+        }
+    }
+    return NULL;
+}
+
+/* delta-seconds (RFC 9111 section 1.2.2), saturating far in the future */
+static bool parse_delta_seconds(const char *p, const char *end, long *seconds)
+{
+    long n = 0;
+
+    if (p >= end || !isdigit((unsigned char)*p)) {
+        return false;
+    }
+    while (p < end && isdigit((unsigned char)*p) && n < 100000000L) {
+        n = n * 10 + (*p++ - '0');
+    }
+    *seconds = n;
+    return true;
+}
+
+/* Finds 'directive' in a comma separated Cache-Control value. With
+ * 'seconds', the directive must carry a delta-seconds argument. */
+static bool find_directive(const char *value, size_t len, const char *directive, long *seconds)
+{
+    size_t dlen = strlen(directive);
+    const char *end = value + len;
+
+    for (const char *p = value; p < end;) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        const char *token = p;
+        while (p < end && *p != ',' && *p != '=' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        bool match = (size_t)(p - token) == dlen && strncasecmp(token, directive, dlen) == 0;
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        const char *arg = NULL;
+        if (p < end && *p == '=') {
+            arg = ++p;
+            while (p < end && *p != ',') {
+                p++;
+            }
+        }
+        if (!match) {
+            continue;
+        }
+        if (!seconds) {
+            return true;
+        }
+        if (!arg) {
+            return false;
+        }
+        if (*arg == '"') {
+            arg++;
+        }
+        return parse_delta_seconds(arg, end, seconds);
+    }
+    return false;
+}
+
+/* An IMF-fixdate (RFC 9110 section 5.6.7) as a Unix time, or -1 */
+static time_t parse_http_date(const char *value, size_t len)
+{
+    char text[64];
+    struct tm tm;
+
+    if (len == 0 || len >= sizeof(text)) {
+        return -1;
+    }
+    memcpy(text, value, len);
+    text[len] = '\0';
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(text, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end != '\0') {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+/* Seconds the response stays fresh from when it was generated, or -1
+ * when it carries no explicit lifetime */
+static long response_lifetime(const response_cache_header_t *headers, int count,
+                              const response_cache_header_t *cache_control)
+{
+    long seconds;
+
+    if (cache_control) {
+        if (find_directive(cache_control->value, cache_control->value_len, "s-maxage", &seconds) ||
+            find_directive(cache_control->value, cache_control->value_len, "max-age", &seconds)) {
+            return seconds;
+        }
+    }
+
+    const response_cache_header_t *expires = response_header(headers, count, "expires");
+    if (!expires) {
+        return -1;
+    }
+    /* An invalid Expires means already expired */
+    time_t expires_at = parse_http_date(expires->value, expires->value_len);
+    if (expires_at < 0) {
+        return 0;
+    }
+    const response_cache_header_t *date = response_header(headers, count, "date");
+    time_t date_at = date ? parse_http_date(date->value, date->value_len) : -1;
+    if (date_at < 0) {
+        date_at = time(NULL);
+    }
+    return expires_at > date_at ? (long)(expires_at - date_at) : 0;
+}
+
+static bool skip_stored_header(const response_cache_header_t *h)
+{
+    if (h->name_len == 0 || h->name[0] == ':') {
+        return true;
+    }
+    if (http1_is_hop_by_hop(h->name, h->name_len)) {
+        return true;
+    }
+    /* Framing is the serving connection's; Age is recomputed per hit */
+    return (h->name_len == 14 && strncasecmp(h->name, "content-length", 14) == 0) ||
+           (h->name_len == 17 && strncasecmp(h->name, "transfer-encoding", 17) == 0) ||
+           (h->name_len == 3 && strncasecmp(h->name, "age", 3) == 0);
+}
+
+static unsigned long hash_bytes(unsigned long hash, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/* "GET\0authority\0path" */
+static int build_key(const HttpRequest *req, char *out, size_t out_size, size_t *key_len)
+{
+    const char *authority = request_header(req, "host");
+    int len = snprintf(out, out_size, "%s%c%s%c%s", req->method, '\0',
+                       authority ? authority : "", '\0', req->path);
+    if (len < 0 || (size_t)len >= out_size) {
+        return -1;
+    }
+    *key_len = (size_t)len;
+    return 0;
+}
+
+/* What the request allows: a lookup, a store, or neither */
+static void request_policy(const HttpRequest *req, bool *lookup, bool *store)
+{
+    *lookup = false;
+    *store = false;
+    if (!req || !req->method || !req->path || strcmp(req->method, "GET") != 0 ||
+        request_header(req, "authorization")) {
+        return;
+    }
+
+    const char *cache_control = request_header(req, "cache-control");
+    if (cache_control) {
+        size_t len = strlen(cache_control);
+        if (find_directive(cache_control, len, "no-store", NULL)) {
+            return;
+        }
+        *store = true;
+        *lookup = !find_directive(cache_control, len, "no-cache", NULL);
+        return;
+    }
+    const char *pragma = request_header(req, "pragma");
+    *store = true;
+    *lookup = !(pragma && find_directive(pragma, strlen(pragma), "no-cache", NULL));
+}
+
+static bool vary_matches(const response_cache_entry_t *entry, const HttpRequest *req)
+{
+    for (int i = 0; i < entry->vary_count; i++) {
+        const char *value = request_header(req, entry->vary[i].name);
+        size_t len = value ? strlen(value) : 0;
+        if (len != entry->vary[i].value_len || (len > 0 && memcmp(value, entry->vary[i].value, len) != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Two entries for the same key that vary on the same request values */
+static bool same_variant(const response_cache_entry_t *a, const response_cache_entry_t *b)
+{
+    if (a->vary_count != b->vary_count) {
+        return false;
+    }
+    for (int i = 0; i < a->vary_count; i++) {
+        if (a->vary[i].name_len != b->vary[i].name_len ||
+            strncasecmp(a->vary[i].name, b->vary[i].name, a->vary[i].name_len) != 0 ||
+            a->vary[i].value_len != b->vary[i].value_len ||
+            memcmp(a->vary[i].value, b->vary[i].value, a->vary[i].value_len) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static response_cache_shard_t *shard_for(response_cache_t *cache, unsigned long hash)
+{
+    return &cache->shards[hash % (unsigned long)cache->shard_count];
+}
+
+static response_cache_entry_t **bucket_for(response_cache_t *cache, response_cache_shard_t *shard,
+                                           unsigned long hash)
+{
+    return &shard->buckets[(hash / (unsigned long)cache->shard_count) % RESPONSE_CACHE_BUCKETS_PER_SHARD];
+}
+
+static void lru_unlink(response_cache_shard_t *shard, response_cache_entry_t *entry)
+{
+    response_cache_entry_t **head = entry->protected_segment ? &shard->protected_head : &shard->probation;
+    response_cache_entry_t **tail = entry->protected_segment ? &shard->protected_tail : &shard->probation_tail;
+
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        *head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        *tail = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+    if (entry->protected_segment) {
+        shard->protected_bytes -= entry->size;
+    } else {
+        shard->probation_bytes -= entry->size;
+    }
+}
+
+static void lru_push(response_cache_shard_t *shard, response_cache_entry_t *entry, bool protected_segment)
+{
+    response_cache_entry_t **head = protected_segment ? &shard->protected_head : &shard->probation;
+    response_cache_entry_t **tail = protected_segment ? &shard->protected_tail : &shard->probation_tail;
+
+    entry->protected_segment = protected_segment;
+    entry->prev = NULL;
+    entry->next = *head;
+    if (*head) {
+        (*head)->prev = entry;
+    } else {
+        *tail = entry;
+    }
+    *head = entry;
+    if (protected_segment) {
+        shard->protected_bytes += entry->size;
+    } else {
+        shard->probation_bytes += entry->size;
+    }
+}
+
+/* Takes the entry out of the table and its segment. The shard's reference
+ * passes to the caller. */
+static void shard_remove(response_cache_t *cache, response_cache_shard_t *shard, response_cache_entry_t *entry)
+{
+    response_cache_entry_t **link = bucket_for(cache, shard, entry->hash);
+    while (*link && *link != entry) {
+        link = &(*link)->chain;
+    }
+    if (*link) {
+        *link = entry->chain;
+    }
+    entry->chain = NULL;
+    lru_unlink(shard, entry);
+}
+
+/* Evicts until the shard fits its budget; evicted entries are chained on
+ * '*evicted' to be released outside the lock */
+static void shard_trim(response_cache_t *cache, response_cache_shard_t *shard, response_cache_entry_t **evicted)
+{
+    while (shard->probation_bytes + shard->protected_bytes > shard->capacity) {
+        response_cache_entry_t *victim = shard->probation_tail ? shard->probation_tail : shard->protected_tail;
+        if (!victim) {
+            break;
+        }
+        shard_remove(cache, shard, victim);
+        victim->chain = *evicted;
+        *evicted = victim;
+        atomic_fetch_add(&cache->evictions, 1);
+    }
+}
+
+static void release_chain(response_cache_entry_t *entry)
+{
+    while (entry) {
+        response_cache_entry_t *next = entry->chain;
+        response_cache_release(entry);
+        entry = next;
+    }
+}
+
+/* A hit earns the entry a place in the protected segment; what no longer
+ * fits there goes back on probation */
+static void promote(response_cache_shard_t *shard, response_cache_entry_t *entry)
+{
+    lru_unlink(shard, entry);
+    lru_push(shard, entry, true);
+
+    size_t protected_capacity = shard->capacity / 100 * RESPONSE_CACHE_PROTECTED_PERCENT;
+    while (shard->protected_bytes > protected_capacity && shard->protected_tail != entry) {
+        response_cache_entry_t *demoted = shard->protected_tail;
+        lru_unlink(shard, demoted);
+        lru_push(shard, demoted, false);
+    }
+}
+
+response_cache_t *response_cache_create(size_t max_bytes, int shards, size_t max_entry_size)
+{
+    if (max_bytes == 0 || shards <= 0 || shards > RESPONSE_CACHE_MAX_SHARDS) {
+        log_message(LOG_LEVEL_ERROR, "Invalid response cache size or shard count");
+        return NULL;
+    }
+
+    response_cache_t *cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate response cache");
+        return NULL;
+    }
+    cache->shards = calloc((size_t)shards, sizeof(*cache->shards));
+    if (!cache->shards) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate response cache shards");
+        free(cache);
+        return NULL;
+    }
+    cache->shard_count = shards;
+    cache->max_entry_size = max_entry_size;
+    for (int i = 0; i < shards; i++) {
+        pthread_mutex_init(&cache->shards[i].lock, NULL);
+        cache->shards[i].capacity = max_bytes / (size_t)shards;
+    }
+    return cache;
+}
+
+/* Puts a disk tier of 'size' bytes at 'path' behind the memory tier. It
+ * takes bodies up to 'max_object_size', beyond the memory entry limit. */
+int response_cache_enable_disk(response_cache_t *cache, const char *path, size_t size, size_t slab_size,
+                               size_t max_object_size)
+{
+    cache->disk = disk_cache_create(path, size, slab_size, max_object_size);
+    return cache->disk ? 0 : -1;
+}
+
+void response_cache_destroy(response_cache_t *cache)
+{
+    if (!cache) {
+        return;
+    }
+    /* The writer's last releases may land flights on the shards */
+    disk_cache_destroy(cache->disk);
+    for (int i = 0; i < cache->shard_count; i++) {
+        response_cache_shard_t *shard = &cache->shards[i];
+        response_cache_entry_t *lists[2] = {shard->probation, shard->protected_head};
+        for (int l = 0; l < 2; l++) {
+            response_cache_entry_t *entry = lists[l];
+            while (entry) {
+                response_cache_entry_t *next = entry->next;
+                response_cache_release(entry);
+                entry = next;
+            }
+        }
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache->shards);
+    free(cache);
+}
+
+static long stale_window(long seconds)
+{
+    return seconds > 0 ? seconds : 0;
+}
+
+/* Seconds an entry is kept after it expired */
+static long retention(const response_cache_entry_t *entry)
+{
+    long kept = stale_window(entry->stale_while_revalidate);
+    return stale_window(entry->stale_if_error) > kept ? stale_window(entry->stale_if_error) : kept;
+}
+
+static bool request_matches(const response_cache_entry_t *entry, const void *req)
+{
+    return vary_matches(entry, req);
+}
+
+/* The memory entry stored for the key and request, fresh or still within
+ * a stale window, with a reference for the caller. One past both windows
+ * is taken out and chained on '*evicted'. */
+static response_cache_entry_t *find_memory_entry(response_cache_t *cache, response_cache_shard_t *shard,
+                                                 unsigned long hash, const char *key, size_t key_len,
+                                                 const HttpRequest *req, time_t now,
+                                                 response_cache_entry_t **evicted)
+{
+    for (response_cache_entry_t *entry = *bucket_for(cache, shard, hash); entry; entry = entry->chain) {
+        if (entry->hash != hash || entry->key_len != key_len || memcmp(entry->key, key, key_len) != 0 ||
+            !vary_matches(entry, req)) {
+            continue;
+        }
+        if (now >= entry->expires_at + retention(entry)) {
+            shard_remove(cache, shard, entry);
+            entry->chain = *evicted;
+            *evicted = entry;
+            break;
+        }
+        promote(shard, entry);
+        atomic_fetch_add(&entry->refs, 1);
+        return entry;
+    }
+    return NULL;
+}
+
+/* Like find_memory_entry(), or else from the disk tier. Called with the
+ * shard lock held, which is dropped around the disk read so that other
+ * keys of the shard are not held up behind it; as a fill may have been
+ * committed meanwhile, the memory tier is looked at again before a disk
+ * entry is returned. Releasing a found entry never takes a shard lock. */
+static response_cache_entry_t *find_entry(response_cache_t *cache, response_cache_shard_t *shard,
+                                          unsigned long hash, const char *key, size_t key_len,
+                                          const HttpRequest *req, response_cache_entry_t **evicted)
+{
+    time_t now = now_seconds();
+
+    response_cache_entry_t *entry = find_memory_entry(cache, shard, hash, key, key_len, req, now, evicted);
+    if (entry || !cache->disk) {
+        return entry;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    response_cache_entry_t *stored = disk_cache_lookup(cache->disk, hash, key, key_len, request_matches, req);
+    if (stored && now >= stored->expires_at + retention(stored)) {
+        response_cache_release(stored);
+        stored = NULL;
+    }
+    pthread_mutex_lock(&shard->lock);
+
+    entry = find_memory_entry(cache, shard, hash, key, key_len, req, now, evicted);
+    if (entry) {
+        response_cache_release(stored);
+        return entry;
+    }
+    return stored;
+}
+
+static response_cache_flight_t *find_flight(response_cache_shard_t *shard, unsigned long hash,
+                                            const char *key, size_t key_len)
+{
+    for (response_cache_flight_t *flight = shard->flights; flight; flight = flight->next) {
+        if (flight->hash == hash && flight->key_len == key_len && memcmp(flight->key, key, key_len) == 0) {
+            return flight;
+        }
+    }
+    return NULL;
+}
+
+static response_cache_flight_t *start_flight(response_cache_shard_t *shard, unsigned long hash,
+                                             const char *key, size_t key_len)
+{
+    response_cache_flight_t *flight = calloc(1, sizeof(*flight) + key_len);
+    if (!flight) {
+        return NULL;
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&flight->landed_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    flight->key = (char *)(flight + 1);
+    memcpy(flight->key, key, key_len);
+    flight->key_len = key_len;
+    flight->hash = hash;
+    flight->leader = pthread_self();
+    flight->shard = shard;
+    flight->next = shard->flights;
+    shard->flights = flight;
+    return flight;
+}
+
+static void free_flight(response_cache_flight_t *flight)
+{
+    pthread_cond_destroy(&flight->landed_cond);
+    free(flight);
+}
+
+/* Waits, with the shard locked, until the flight lands or 'wait_ms'
+ * passes. Returns whether it landed. */
+static bool wait_for_flight(response_cache_shard_t *shard, response_cache_flight_t *flight, int wait_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += wait_ms / 1000;
+    deadline.tv_nsec += (long)(wait_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    int rc = 0;
+    flight->waiters++;
+    while (!flight->landed && rc == 0) {
+        rc = pthread_cond_timedwait(&flight->landed_cond, &shard->lock, &deadline);
+    }
+    flight->waiters--;
+
+    bool landed = flight->landed;
+    if (landed && flight->waiters == 0) {
+        free_flight(flight);
+    }
+    return landed;
+}
+
+/* A fresh entry for the request, with a reference for the caller, or NULL
+ * on a miss */
+response_cache_entry_t *response_cache_lookup(response_cache_t *cache, const HttpRequest *req)
+{
+    return response_cache_lookup_coalesced(cache, req, 0, NULL);
+}
+
+/* Like response_cache_lookup(), but concurrent misses for one key share a
+ * backend fetch. The first miss sets '*flight': the caller fetches, and
+ * lands the flight by attaching it to the entry it fills, or with
+ * response_cache_land() when there is nothing to store. Later misses wait
+ * up to 'wait_ms' for it and then look again; if the leader's response
+ * was not stored (or does not match their Vary), they fetch on their own.
+ * A request never waits on a flight its own thread leads, as that thread
+ * also serves the leader's connection.
+ *
+ * An entry within its stale-while-revalidate window is returned as a hit;
+ * when no refresh is under way yet, '*flight' is set as well and the
+ * caller refetches the response after serving the stale one. */
+response_cache_entry_t *response_cache_lookup_coalesced(response_cache_t *cache, const HttpRequest *req,
+                                                        int wait_ms, response_cache_flight_t **flight)
+{
+    char key[HTTP1_CLIENT_HEAD_BUFFER_SIZE];
+    size_t key_len;
+    bool lookup, store;
+
+    if (flight) {
+        *flight = NULL;
+    }
+    if (!cache) {
+        return NULL;
+    }
+    request_policy(req, &lookup, &store);
+    if (!lookup || build_key(req, key, sizeof(key), &key_len) != 0) {
+        return NULL;
+    }
+
+    unsigned long hash = hash_bytes(FNV_OFFSET_BASIS, key, key_len);
+    response_cache_shard_t *shard = shard_for(cache, hash);
+    response_cache_entry_t *evicted = NULL;
+    bool waited = false;
+
+    time_t now = now_seconds();
+    bool stale = false;
+
+    pthread_mutex_lock(&shard->lock);
+    response_cache_entry_t *found = find_entry(cache, shard, hash, key, key_len, req, &evicted);
+    if (found && now >= found->expires_at) {
+        /* Past the revalidation window it only serves in place of errors */
+        stale = now < found->expires_at + stale_window(found->stale_while_revalidate);
+        if (!stale) {
+            response_cache_release(found);
+            found = NULL;
+        } else if (flight && store && !find_flight(shard, hash, key, key_len)) {
+            *flight = start_flight(shard, hash, key, key_len);
+        }
+    }
+    if (!found && flight && store) {
+        response_cache_flight_t *current = find_flight(shard, hash, key, key_len);
+        if (!current) {
+            *flight = start_flight(shard, hash, key, key_len);
+        } else if (wait_ms > 0 && !pthread_equal(current->leader, pthread_self()) &&
+                   wait_for_flight(shard, current, wait_ms)) {
+            found = find_entry(cache, shard, hash, key, key_len, req, &evicted);
+            if (found && now_seconds() >= found->expires_at) {
+                response_cache_release(found);
+                found = NULL;
+            }
+            waited = found != NULL;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    release_chain(evicted);
+    atomic_fetch_add(found ? &cache->hits : &cache->misses, 1);
+    if (found && found->disk_record) {
+        atomic_fetch_add(&cache->disk_hits, 1);
+    }
+    if (waited) {
+        atomic_fetch_add(&cache->coalesced, 1);
+    }
+    if (stale) {
+        atomic_fetch_add(&cache->stale, 1);
+    }
+    return found;
+}
+
+/* An entry to answer with when the backend failed: fresh, or stale within
+ * its stale-if-error window. NULL otherwise. */
+response_cache_entry_t *response_cache_lookup_stale(response_cache_t *cache, const HttpRequest *req)
+{
+    char key[HTTP1_CLIENT_HEAD_BUFFER_SIZE];
+    size_t key_len;
+    bool lookup, store;
+
+    if (!cache) {
+        return NULL;
+    }
+    request_policy(req, &lookup, &store);
+    if (!lookup || build_key(req, key, sizeof(key), &key_len) != 0) {
+        return NULL;
+    }
+
+    unsigned long hash = hash_bytes(FNV_OFFSET_BASIS, key, key_len);
+    response_cache_shard_t *shard = shard_for(cache, hash);
+    response_cache_entry_t *evicted = NULL;
+    time_t now = now_seconds();
+
+    pthread_mutex_lock(&shard->lock);
+    response_cache_entry_t *found = find_entry(cache, shard, hash, key, key_len, req, &evicted);
+    if (found && now >= found->expires_at + stale_window(found->stale_if_error)) {
+        response_cache_release(found);
+        found = NULL;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    release_chain(evicted);
+    if (found && now >= found->expires_at) {
+        atomic_fetch_add(&cache->stale, 1);
+    }
+    return found;
+}
+
+bool response_cache_is_stale(const response_cache_entry_t *entry)
+{
+    return now_seconds() >= entry->expires_at;
+}
+
+/* The flight lands when 'fill' is committed or dropped */
+void response_cache_attach_flight(response_cache_entry_t *fill, response_cache_flight_t *flight)
+{
+    fill->flight = flight;
+}
+
+/* Wakes the requests waiting on a flight; they look the key up again */
+void response_cache_land(response_cache_flight_t *flight)
+{
+    if (!flight) {
+        return;
+    }
+
+    response_cache_shard_t *shard = flight->shard;
+    pthread_mutex_lock(&shard->lock);
+    response_cache_flight_t **link = &shard->flights;
+    while (*link && *link != flight) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = flight->next;
+    }
+    flight->landed = true;
+    pthread_cond_broadcast(&flight->landed_cond);
+    bool unused = flight->waiters == 0;
+    pthread_mutex_unlock(&shard->lock);
+
+    if (unused) {
+        free_flight(flight);
+    }
+}
+
+/* Seconds since the backend generated the response, for the Age header */
+long response_cache_age(const response_cache_entry_t *entry)
+{
+    return entry->initial_age + (long)(now_seconds() - entry->stored_at);
+}
+
+void response_cache_release(response_cache_entry_t *entry)
+{
+    if (!entry || atomic_fetch_sub(&entry->refs, 1) != 1) {
+        return;
+    }
+    response_cache_land(entry->flight);
+    if (entry->disk_record) {
+        disk_cache_unpin(entry->disk_record);
+    } else {
+        free(entry->body);
+    }
+    free(entry->blob);
+    free(entry);
+}
+
+/* Starts storing a response the backend is answering 'req' with. Returns
+ * NULL when the request or the response may not be cached; otherwise the
+ * body follows with response_cache_append() and the entry goes live with
+ * response_cache_commit(). A positive 'ttl_override_seconds' replaces the
+ * lifetime the response declares, or gives it one. */
+response_cache_entry_t *response_cache_begin(response_cache_t *cache, const HttpRequest *req,
+                                             int status, const response_cache_header_t *headers,
+                                             int header_count, int ttl_override_seconds)
+{
+    char key[HTTP1_CLIENT_HEAD_BUFFER_SIZE];
+    size_t key_len;
+    bool lookup, store;
+
+    if (!cache) {
+        return NULL;
+    }
+    request_policy(req, &lookup, &store);
+    const char *reason = status_reason(status);
+    if (!store || !reason || build_key(req, key, sizeof(key), &key_len) != 0) {
+        return NULL;
+    }
+
+    const response_cache_header_t *cache_control = response_header(headers, header_count, "cache-control");
+    if (cache_control &&
+        (find_directive(cache_control->value, cache_control->value_len, "no-store", NULL) ||
+         find_directive(cache_control->value, cache_control->value_len, "no-cache", NULL) ||
+         find_directive(cache_control->value, cache_control->value_len, "private", NULL))) {
+        return NULL;
+    }
+    if (response_header(headers, header_count, "set-cookie")) {
+        return NULL;
+    }
+
+    /* The stale windows; -1 leaves them to the route */
+    long while_revalidate = -1;
+    long if_error = -1;
+    if (cache_control) {
+        if (find_directive(cache_control->value, cache_control->value_len, "must-revalidate", NULL) ||
+            find_directive(cache_control->value, cache_control->value_len, "proxy-revalidate", NULL)) {
+            while_revalidate = 0;
+            if_error = 0;
+        } else {
+            find_directive(cache_control->value, cache_control->value_len, "stale-while-revalidate",
+                           &while_revalidate);
+            find_directive(cache_control->value, cache_control->value_len, "stale-if-error", &if_error);
+        }
+    }
+
+    long lifetime = ttl_override_seconds > 0 ? ttl_override_seconds
+                                             : response_lifetime(headers, header_count, cache_control);
+    long initial_age = 0;
+    const response_cache_header_t *age = response_header(headers, header_count, "age");
+    if (age && ttl_override_seconds <= 0 &&
+        !parse_delta_seconds(age->value, age->value + age->value_len, &initial_age)) {
+        initial_age = 0;
+    }
+    if (lifetime <= initial_age) {
+        return NULL;
+    }
+
+    /* Vary names the request headers a stored response is only good for */
+    const char *vary_names[RESPONSE_CACHE_MAX_VARY];
+    size_t vary_lens[RESPONSE_CACHE_MAX_VARY];
+    int vary_count = 0;
+    const response_cache_header_t *vary = response_header(headers, header_count, "vary");
+    if (vary) {
+        const char *end = vary->value + vary->value_len;
+        for (const char *p = vary->value; p < end;) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+                p++;
+            }
+            const char *name = p;
+            while (p < end && *p != ',' && *p != ' ' && *p != '\t') {
+                p++;
+            }
+            if (p == name) {
+                continue;
+            }
+            if ((p - name == 1 && *name == '*') || vary_count == RESPONSE_CACHE_MAX_VARY) {
+                return NULL;
+            }
+            vary_names[vary_count] = name;
+            vary_lens[vary_count++] = (size_t)(p - name);
+        }
+    }
+
+    /* One allocation for the key, the headers kept and the varied values */
+    size_t blob_size = key_len + 1;
+    size_t arrays_size;
+    int kept = 0;
+    for (int i = 0; i < header_count; i++) {
+        if (!skip_stored_header(&headers[i])) {
+            blob_size += headers[i].name_len + headers[i].value_len + 2;
+            kept++;
+        }
+    }
+    if (kept > RESPONSE_CACHE_MAX_HEADERS) {
+        return NULL;
+    }
+    const char *vary_values[RESPONSE_CACHE_MAX_VARY];
+    size_t vary_value_lens[RESPONSE_CACHE_MAX_VARY];
+    for (int i = 0; i < vary_count; i++) {
+        char name[64];
+        if (vary_lens[i] >= sizeof(name)) {
+            return NULL;
+        }
+        memcpy(name, vary_names[i], vary_lens[i]);
+        name[vary_lens[i]] = '\0';
+        vary_values[i] = request_header(req, name);
+        vary_value_lens[i] = vary_values[i] ? strlen(vary_values[i]) : 0;
+        blob_size += vary_lens[i] + vary_value_lens[i] + 2;
+    }
+    arrays_size = (size_t)(kept + vary_count) * sizeof(response_cache_header_t);
+    blob_size += arrays_size;
+
+    response_cache_entry_t *entry = calloc(1, sizeof(*entry));
+    char *blob = malloc(blob_size);
+    if (!entry || !blob) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate response cache entry");
+        free(entry);
+        free(blob);
+        return NULL;
+    }
+    atomic_init(&entry->refs, 1);
+    entry->blob = blob;
+    entry->headers = (response_cache_header_t *)blob;
+    entry->vary = entry->headers + kept;
+    blob += arrays_size;
+    entry->hash = hash_bytes(FNV_OFFSET_BASIS, key, key_len);
+    entry->key = blob;
+    entry->key_len = key_len;
+    memcpy(blob, key, key_len + 1);
+    blob += key_len + 1;
+
+    for (int i = 0; i < header_count; i++) {
+        const response_cache_header_t *h = &headers[i];
+        if (skip_stored_header(h)) {
+            continue;
+        }
+        response_cache_header_t *stored = &entry->headers[entry->header_count++];
+        for (size_t c = 0; c < h->name_len; c++) {
+            blob[c] = (char)tolower((unsigned char)h->name[c]);
+        }
+        blob[h->name_len] = '\0';
+        stored->name = blob;
+        stored->name_len = h->name_len;
+        blob += h->name_len + 1;
+        memcpy(blob, h->value, h->value_len);
+        blob[h->value_len] = '\0';
+        stored->value = blob;
+        stored->value_len = h->value_len;
+        blob += h->value_len + 1;
+    }
+    for (int i = 0; i < vary_count; i++) {
+        response_cache_header_t *stored = &entry->vary[entry->vary_count++];
+        memcpy(blob, vary_names[i], vary_lens[i]);
+        blob[vary_lens[i]] = '\0';
+        stored->name = blob;
+        stored->name_len = vary_lens[i];
+        blob += vary_lens[i] + 1;
+        if (vary_value_lens[i] > 0) {
+            memcpy(blob, vary_values[i], vary_value_lens[i]);
+        }
+        blob[vary_value_lens[i]] = '\0';
+        stored->value = blob;
+        stored->value_len = vary_value_lens[i];
+        blob += vary_value_lens[i] + 1;
+    }
+
+    entry->status = status;
+    entry->reason = reason;
+    entry->stored_at = now_seconds();
+    entry->initial_age = initial_age;
+    entry->expires_at = entry->stored_at + lifetime - initial_age;
+    entry->stale_while_revalidate = while_revalidate;
+    entry->stale_if_error = if_error;
+    entry->max_body = cache->max_entry_size;
+    if (cache->disk && cache->disk->max_object_size > entry->max_body) {
+        entry->max_body = cache->disk->max_object_size;
+    }
+    entry->size = sizeof(*entry) + blob_size;
+    return entry;
+}
+
+/* The route's stale windows, for those the response did not set */
+void response_cache_default_stale(response_cache_entry_t *entry, long while_revalidate_seconds,
+                                  long if_error_seconds)
+{
+    if (entry->stale_while_revalidate < 0) {
+        entry->stale_while_revalidate = while_revalidate_seconds;
+    }
+    if (entry->stale_if_error < 0) {
+        entry->stale_if_error = if_error_seconds;
+    }
+}
+
+/* Adds body bytes; -1 once the body outgrows the entry size limit */
+int response_cache_append(response_cache_entry_t *entry, const void *data, size_t len)
+{
+    if (entry->body_len + len > entry->max_body) {
+        return -1;
+    }
+    if (entry->body_len + len > entry->body_cap) {
+        size_t cap = entry->body_cap ? entry->body_cap : BODY_INITIAL_CAPACITY;
+        while (cap < entry->body_len + len) {
+            cap *= 2;
+        }
+        if (cap > entry->max_body) {
+            cap = entry->max_body;
+        }
+        char *body = realloc(entry->body, cap);
+        if (!body) {
+            return -1;
+        }
+        entry->body = body;
+        entry->body_cap = cap;
+    }
+    memcpy(entry->body + entry->body_len, data, len);
+    entry->body_len += len;
+    return 0;
+}
+
+/* Publishes a complete entry, replacing the variant stored before it. The
+ * caller's reference passes to the cache. */
+void response_cache_commit(response_cache_t *cache, response_cache_entry_t *entry)
+{
+    if (!cache || !entry) {
+        return;
+    }
+
+    entry->size += entry->body_cap;
+    response_cache_shard_t *shard = shard_for(cache, entry->hash);
+    if (entry->body_len > cache->max_entry_size || entry->size > shard->capacity) {
+        /* Only the disk tier takes it. Its writer holds the last reference,
+         * so waiters are woken once the entry can be found there. */
+        if (cache->disk) {
+            disk_cache_store(cache->disk, entry);
+        }
+        response_cache_release(entry);
+        return;
+    }
+    response_cache_flight_t *flight = entry->flight;
+    entry->flight = NULL;
+
+    response_cache_entry_t *replaced = NULL;
+    response_cache_entry_t *evicted = NULL;
+    pthread_mutex_lock(&shard->lock);
+    for (response_cache_entry_t *old = *bucket_for(cache, shard, entry->hash); old; old = old->chain) {
+        if (old->hash == entry->hash && old->key_len == entry->key_len &&
+            memcmp(old->key, entry->key, entry->key_len) == 0 && same_variant(old, entry)) {
+            shard_remove(cache, shard, old);
+            replaced = old;
+            break;
+        }
+    }
+    response_cache_entry_t **bucket = bucket_for(cache, shard, entry->hash);
+    entry->chain = *bucket;
+    *bucket = entry;
+    lru_push(shard, entry, false);
+    shard_trim(cache, shard, &evicted);
+    pthread_mutex_unlock(&shard->lock);
+
+    /* Waiters look up once the entry is live */
+    response_cache_land(flight);
+    /* What memory had to let go of may still be served from disk */
+    if (cache->disk) {
+        time_t now = now_seconds();
+        for (response_cache_entry_t *victim = evicted; victim; victim = victim->chain) {
+            if (now < victim->expires_at + retention(victim)) {
+                disk_cache_store(cache->disk, victim);
+            }
+        }
+    }
+    release_chain(evicted);
+    response_cache_release(replaced);
+    atomic_fetch_add(&cache->stores, 1);
+}
+
+void response_cache_get_stats(response_cache_t *cache, response_cache_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (!cache) {
+        return;
+    }
+    stats->hits = atomic_load(&cache->hits);
+    stats->misses = atomic_load(&cache->misses);
+    stats->stores = atomic_load(&cache->stores);
+    stats->evictions = atomic_load(&cache->evictions);
+    stats->coalesced = atomic_load(&cache->coalesced);
+    stats->stale = atomic_load(&cache->stale);
+    stats->disk_hits = atomic_load(&cache->disk_hits);
+    if (cache->disk) {
+        stats->disk_writes = atomic_load(&cache->disk->writes);
+        stats->disk_dropped = atomic_load(&cache->disk->dropped);
+    }
+    for (int i = 0; i < cache->shard_count; i++) {
+        response_cache_shard_t *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        for (response_cache_entry_t *e = shard->probation; e; e = e->next) {
+            stats->entries++;
+        }
+        for (response_cache_entry_t *e = shard->protected_head; e; e = e->next) {
+            stats->entries++;
+        }
+        stats->bytes += (long)(shard->probation_bytes + shard->protected_bytes);
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
@@ -12,16 +12,34 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include "router.h"
 
-#define HEADER_BUFFER_SIZE 256
+/* Must hold the status line plus every security/CORS header appended below */
+#define HEADER_BUFFER_SIZE 1024
 #define FILEPATH_BUFFER_SIZE 512
 #define IP_BUFFER_SIZE 64
 #define CIRCUIT_BREAKER_ERROR_BODY "{\"error\":\"Service temporarily unavailable\"}"
-#define CIRCUIT_BREAKER_ERROR_LEN 38
+#define CIRCUIT_BREAKER_ERROR_LEN (sizeof(CIRCUIT_BREAKER_ERROR_BODY) - 1)
+#define POOL_EXHAUSTED_ERROR_BODY "{\"error\":\"Backend busy, retry later\"}"
+#define POOL_EXHAUSTED_ERROR_LEN (sizeof(POOL_EXHAUSTED_ERROR_BODY) - 1)
+#define CONCURRENCY_LIMIT_ERROR_BODY "{\"error\":\"Backend overloaded, retry later\"}"
+#define CONCURRENCY_LIMIT_ERROR_LEN (sizeof(CONCURRENCY_LIMIT_ERROR_BODY) - 1)
+/* How often a background cache refresh checks a stalled backend stream */
+#define CACHE_REFRESH_POLL_MS 100
+/* Background cache refreshes running at once; stale hits past it wait */
+#define CACHE_REFRESH_MAX_THREADS 16
+/* Turn length while a request and its hedge wait on different connections */
+#define ROUTER_HEDGE_POLL_MS 5
 #include "log.h"
 #include "config.h"
 #include "backend_pool.h"
@@ -30,8 +48,19 @@
 #include "http2_client.h"
 #include "metrics.h"
 #include "http_status.h"
+#include "uring_io.h"
+#include "upstream.h"
+#include "resolver.h"
+#include "http1_client.h"
+#include "tunnel.h"
+#include "websocket.h"
+#include "proxy_stream.h"
+#include "response_cache.h"
 
 static int ssl_write_all(SSL *ssl, const char *buf, size_t len);
+static Route *find_reverse_proxy_route(HttpRequest *req, ServerConfig *config);
+static void start_cache_refresh(Route *route, const HttpRequest *req, response_cache_flight_t *flight,
+                                bool http2);
 
 typedef enum {
     STATIC_LOOKUP_ERROR = -1,
@@ -159,7 +188,7 @@ static int ssl_write_all(SSL *ssl, const char *buf, size_t len)
     return 0;
 }
 
-#define SECURITY_HEADERS_BUFFER_SIZE 1024
+#define SECURITY_HEADERS_BUFFER_SIZE HEADER_BUFFER_SIZE
 
 static int add_security_headers_to_buffer(char *buffer, size_t *len, SecurityHeadersConfig *config)
 {
@@ -475,6 +504,49 @@ static int has_matching_proxy_route(HttpRequest *req, ServerConfig *config)
     return 0;
 }
 
+/* Fallback for callers without a worker ring (e.g. unit tests) */
+static int send_static_body_read(SSL *ssl, int fd)
+{
+    char filebuf[BUFFER_SIZE];
+    ssize_t bytes;
+    while ((bytes = read(fd, filebuf, sizeof(filebuf))) > 0)
+    {
+        if (ssl_write_all(ssl, filebuf, (size_t)bytes) != 0)
+            return -1;
+    }
+    return bytes < 0 ? -1 : 0;
+}
+
+/* Streams the file body through the worker's registered file buffer, so no
+ * per-request copy buffer lives on the worker stack. Files needing several
+ * reads are registered in the ring's fixed-file table first; for a single
+ * read the extra update would cost more than the fget/fput it saves. */
+static int send_static_body(SSL *ssl, int fd, off_t filesize)
+{
+    uring_worker_t *worker = uring_worker_current();
+    if (!worker)
+        return send_static_body_read(ssl, fd);
+
+    int fixed_index = -1;
+    if (filesize > URING_IO_FILE_BUF_SIZE)
+        fixed_index = uring_worker_install_fd(worker, fd);
+    bool fixed = fixed_index >= 0;
+    int read_fd = fixed ? fixed_index : fd;
+
+    off_t offset = 0;
+    const char *data;
+    ssize_t bytes;
+    while ((bytes = uring_worker_read_file(worker, read_fd, fixed, offset, &data)) > 0)
+    {
+        if (ssl_write_all(ssl, data, (size_t)bytes) != 0)
+            break;
+        offset += bytes;
+    }
+    if (fixed)
+        uring_worker_close_fixed(worker, fixed_index);
+    return bytes == 0 ? 0 : -1;
+}
+
 /* serve_static_tls()
  *
  * If the HTTP request's path starts with a static route, constructs the full file path,
@@ -531,129 +603,641 @@ int serve_static_tls(HttpRequest *req, ServerConfig *config, SSL *ssl)
         return -1;
     }
 
-    char filebuf[BUFFER_SIZE];
-    ssize_t bytes;
-    while ((bytes = read(fd, filebuf, sizeof(filebuf))) > 0)
+    int ret = send_static_body(ssl, fd, filesize);
+    close(fd);
+    return ret;
+}
+
+/* proxy_bidirectional_tls()
+ *
+ * Tunnels a TLS client to a backend socket, moving data in both directions
+ * concurrently until either side closes or the tunnel goes idle.
+ */
+int proxy_bidirectional_tls(SSL *ssl, int backend_fd)
+{
+    return tunnel_relay(ssl, backend_fd, TUNNEL_DEFAULT_IDLE_TIMEOUT_MS, NULL);
+}
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+    size_t sent = 0;
+
+    while (sent < len)
     {
-        if (ssl_write_all(ssl, filebuf, (size_t)bytes) != 0)
-        {
-            close(fd);
+        ssize_t n = send(fd, buf + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        sent += (size_t)n;
+    }
+    return 0;
+}
+
+/* Sends the request body: the part already read with the head, then the
+ * rest from the client. '*streamed' is set once client bytes were read, as
+ * the request can no longer be retried after that. Returns 0, -1 when the
+ * upstream write fails, ROUTE_CLOSE_CONNECTION when the client's body is
+ * unusable. */
+static int relay_request_body(SSL *ssl, int fd, http1_body_t *body,
+                              const char *buffered, size_t buffered_len, bool *streamed)
+{
+    char buf[HTTP1_CLIENT_IO_BUFFER_SIZE];
+    ssize_t n = http1_body_consume(body, buffered, buffered_len);
+
+    if (n < 0)
+        return ROUTE_CLOSE_CONNECTION;
+    if (n > 0 && send_all(fd, buffered, (size_t)n) != 0)
+        return -1;
+
+    while (!body->done)
+    {
+        int r = SSL_read(ssl, buf, sizeof(buf));
+        if (r <= 0)
+            return ROUTE_CLOSE_CONNECTION;
+        *streamed = true;
+        n = http1_body_consume(body, buf, (size_t)r);
+        if (n < 0)
+            return ROUTE_CLOSE_CONNECTION;
+        if (send_all(fd, buf, (size_t)n) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Writes one body piece to the client, as a chunk when the proxy frames an
+ * until-close body itself */
+static int write_body_piece(SSL *ssl, const char *data, size_t len, bool chunk)
+{
+    char framed[HTTP1_CLIENT_IO_BUFFER_SIZE + 32];
+
+    if (len == 0)
+        return 0;
+    if (!chunk)
+        return ssl_write_all(ssl, data, len);
+
+    int prefix = snprintf(framed, sizeof(framed), "%zx\r\n", len);
+    if (len > HTTP1_CLIENT_IO_BUFFER_SIZE)
+    {
+        /* Too big to frame in one write; same chunk, three writes */
+        if (ssl_write_all(ssl, framed, (size_t)prefix) != 0 || ssl_write_all(ssl, data, len) != 0)
             return -1;
+        return ssl_write_all(ssl, "\r\n", 2);
+    }
+    memcpy(framed + prefix, data, len);
+    memcpy(framed + prefix + len, "\r\n", 2);
+    return ssl_write_all(ssl, framed, (size_t)prefix + len + 2);
+}
+
+/* The header lines of a response head, for the response cache. Returns
+ * the count, or -1 when there are more than 'max'. */
+static int collect_response_headers(const char *head, size_t head_len,
+                                    response_cache_header_t *out, int max)
+{
+    const char *end = head + head_len;
+    const char *line = memchr(head, '\n', head_len);
+    int count = 0;
+
+    for (line = line ? line + 1 : end; line < end - 2;)
+    {
+        const char *eol = memchr(line, '\r', (size_t)(end - line));
+        const char *colon = memchr(line, ':', (size_t)(eol - line));
+        if (colon)
+        {
+            if (count == max)
+                return -1;
+            const char *value = colon + 1;
+            const char *value_end = eol;
+            while (value < value_end && (*value == ' ' || *value == '\t'))
+                value++;
+            while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+                value_end--;
+            out[count++] = (response_cache_header_t){line, (size_t)(colon - line),
+                                                     value, (size_t)(value_end - value)};
         }
+        line = eol + 2;
     }
-    if (bytes < 0)
+    return count;
+}
+
+/* Starts storing a relayed response when the route caches. Chunked bodies
+ * are relayed with their framing, so only delimited ones are stored. The
+ * fill takes over '*flight' when there is one. */
+static response_cache_entry_t *start_h1_cache_fill(Route *route, const HttpRequest *req,
+                                                   const char *head, const http1_response_head_t *parsed,
+                                                   response_cache_flight_t **flight)
+{
+    response_cache_header_t headers[RESPONSE_CACHE_MAX_HEADERS];
+
+    if (!route || !route->response_cache || parsed->body.kind == HTTP1_BODY_CHUNKED)
+        return NULL;
+    int count = collect_response_headers(head, parsed->head_len, headers, RESPONSE_CACHE_MAX_HEADERS);
+    if (count < 0)
+        return NULL;
+    response_cache_entry_t *fill = response_cache_begin(route->response_cache, req, parsed->status,
+                                                        headers, count, route->cache.ttl_seconds);
+    if (fill)
+        response_cache_default_stale(fill, route->cache.stale_while_revalidate_seconds,
+                                     route->cache.stale_if_error_seconds);
+    if (fill && flight)
     {
-        close(fd);
-        return -1;
+        response_cache_attach_flight(fill, *flight);
+        *flight = NULL;
     }
-    close(fd);
+    return fill;
+}
+
+/* Answers from a response cache entry. Returns -1 when nothing was sent
+ * because the stored headers do not fit a head. */
+static int send_cached_response_http1(SSL *ssl, const response_cache_entry_t *entry)
+{
+    char head[HTTP1_CLIENT_HEAD_BUFFER_SIZE];
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\n", entry->status, entry->reason);
+    size_t len = (size_t)n;
+
+    for (int i = 0; i < entry->header_count; i++)
+    {
+        n = snprintf(head + len, sizeof(head) - len, "%s: %s\r\n",
+                     entry->headers[i].name, entry->headers[i].value);
+        if (n < 0 || (size_t)n >= sizeof(head) - len)
+            return -1;
+        len += (size_t)n;
+    }
+    n = snprintf(head + len, sizeof(head) - len, "Age: %ld\r\nContent-Length: %zu\r\n\r\n",
+                 response_cache_age(entry), entry->body_len);
+    if (n < 0 || (size_t)n >= sizeof(head) - len)
+        return -1;
+    len += (size_t)n;
+
+    if (ssl_write_all(ssl, head, len) != 0)
+        return ROUTE_CLOSE_CONNECTION;
+    if (entry->body_len > 0 && ssl_write_all(ssl, entry->body, entry->body_len) != 0)
+        return ROUTE_CLOSE_CONNECTION;
     return 0;
 }
 
-/* proxy_bidirectional_tls()
- *
- * Implements a bidirectional forwarding loop between a TLS client and a backend server.
- * Data from the client is read with SSL_read() and forwarded to the backend via write(),
- * while data from the backend is read with read() and forwarded to the client using SSL_write().
- */
-int proxy_bidirectional_tls(SSL *ssl, int backend_fd)
+/* Statuses a stale entry may stand in for (RFC 5861 section 4) */
+static bool is_backend_error(int status)
+{
+    return status == 500 || status == 502 || status == 503 || status == 504;
+}
+
+/* Answers from an entry that may stand in for a failed backend. Returns
+ * -1 when there is none. */
+static int send_stale_response_http1(SSL *ssl, Route *route, const HttpRequest *req)
 {
-    int done = 0;
-    char buf[BUFFER_SIZE];
-    while (!done)
+    if (!route || !route->response_cache)
+        return -1;
+    response_cache_entry_t *stale = response_cache_lookup_stale(route->response_cache, req);
+    if (!stale)
+        return -1;
+    log_message(LOG_LEVEL_INFO, "Backend failed, answering %s from the cache [id=%s]",
+                req->path, req->request_id);
+    int result = send_cached_response_http1(ssl, stale);
+    response_cache_release(stale);
+    return result;
+}
+
+/* Relays one response from 'fd' to the client. Returns 0 when complete,
+ * -1 when the upstream failed before anything reached the client (the
+ * caller may retry or answer 502), ROUTE_CLOSE_CONNECTION when the response
+ * broke off part way. '*reusable' tells whether 'fd' can serve another
+ * request. '*continue_sent' tracks whether the client already got a 100
+ * Continue; a second one from the backend is dropped. Callers that asked
+ * for an upgrade pass 'upgraded': a 101 is then
+ * relayed unchanged, with any bytes after it, and sets '*upgraded'. With a
+ * caching 'route', a cacheable response is stored as it goes through, and
+ * the requests waiting on 'flight' are handed to it; a backend error is
+ * answered from a stale entry when one may stand in for it. */
+static int relay_response(SSL *ssl, int fd, const HttpRequest *req, Route *route,
+                          response_cache_flight_t **flight, bool *continue_sent, bool *reusable,
+                          bool *upgraded)
+{
+    const char *method = req->method;
+    char buf[HTTP1_CLIENT_HEAD_BUFFER_SIZE];
+    char head_out[HTTP1_CLIENT_HEAD_BUFFER_SIZE + 64];
+    http1_response_head_t head;
+    size_t have = 0;
+    bool sent = false;
+
+    *reusable = false;
+    for (;;)
     {
-        /* Read from backend (plain) */
-        int n = read(backend_fd, buf, sizeof(buf));
-        if (n > 0)
+        int parsed = http1_parse_response_head(buf, have, method, &head);
+        if (parsed < 0)
+            return sent ? ROUTE_CLOSE_CONNECTION : -1;
+        if (parsed == 0)
+        {
+            if (have == sizeof(buf))
+                return sent ? ROUTE_CLOSE_CONNECTION : -1;
+            ssize_t n = recv(fd, buf + have, sizeof(buf) - have, 0);
+            if (n <= 0)
+                return sent ? ROUTE_CLOSE_CONNECTION : -1;
+            have += (size_t)n;
+            continue;
+        }
+        if (head.status >= 100 && head.status < 200)
         {
-            if (ssl_write_all(ssl, buf, (size_t)n) != 0)
+            /* Interim responses pass through; 101 only when an upgrade was asked for */
+            if (head.status == 101)
+            {
+                if (!upgraded)
+                    return sent ? ROUTE_CLOSE_CONNECTION : -1;
+                /* The client checks the handshake headers, so nothing is rewritten */
+                if (ssl_write_all(ssl, buf, have) != 0)
+                    return ROUTE_CLOSE_CONNECTION;
+                *upgraded = true;
+                return 0;
+            }
+            if (head.status != 100 || !continue_sent || !*continue_sent)
             {
-                done = 1;
+                int len = http1_rewrite_response_head(buf, head.head_len, false, head_out, sizeof(head_out));
+                if (len < 0 || ssl_write_all(ssl, head_out, (size_t)len) != 0)
+                    return ROUTE_CLOSE_CONNECTION;
+                sent = true;
+                if (head.status == 100 && continue_sent)
+                    *continue_sent = true;
             }
+            have -= head.head_len;
+            memmove(buf, buf + head.head_len, have);
+            continue;
         }
-        else if (n < 0)
+        break;
+    }
+
+    /* The backend's body is left unread, so 'fd' is not reused */
+    if (is_backend_error(head.status))
+    {
+        int result = send_stale_response_http1(ssl, route, req);
+        if (result != -1)
+            return result;
+    }
+
+    /* HTTP/1.1 clients get until-close bodies re-framed as chunked, so their
+     * connection stays open for the next request */
+    bool chunk = head.body.kind == HTTP1_BODY_UNTIL_CLOSE;
+    int len = http1_rewrite_response_head(buf, head.head_len, chunk, head_out, sizeof(head_out));
+    if (len < 0)
+        return sent ? ROUTE_CLOSE_CONNECTION : -1;
+    if (ssl_write_all(ssl, head_out, (size_t)len) != 0)
+        return ROUTE_CLOSE_CONNECTION;
+
+    response_cache_entry_t *fill = start_h1_cache_fill(route, req, buf, &head, flight);
+    bool trailing_bytes = false;
+    const char *piece = buf + head.head_len;
+    size_t piece_len = have - head.head_len;
+    for (;;)
+    {
+        ssize_t body_len = http1_body_consume(&head.body, piece, piece_len);
+        if (body_len < 0 || write_body_piece(ssl, piece, (size_t)body_len, chunk) != 0)
+            goto broken;
+        if (fill && response_cache_append(fill, piece, (size_t)body_len) != 0)
         {
-            done = 1;
+            response_cache_release(fill);
+            fill = NULL;
         }
-        /* Read from client (TLS) */
-        n = SSL_read(ssl, buf, sizeof(buf));
-        if (n > 0)
+        if ((size_t)body_len < piece_len)
+            trailing_bytes = true;
+        if (head.body.done)
+            break;
+
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n == 0 && head.body.kind == HTTP1_BODY_UNTIL_CLOSE)
         {
-            int sent = 0;
-            while (sent < n)
-            {
-                int s = send(backend_fd, buf + sent, n - sent, 0);
-                if (s <= 0)
-                {
-                    done = 1;
-                    break;
-                }
-                sent += s;
-            }
+            if (ssl_write_all(ssl, "0\r\n\r\n", 5) != 0)
+                goto broken;
+            break;
         }
-        else if (n < 0)
+        if (n <= 0)
+            goto broken;
+        piece = buf;
+        piece_len = (size_t)n;
+    }
+
+    if (fill)
+        response_cache_commit(route->response_cache, fill);
+    *reusable = head.keep_alive && !trailing_bytes;
+    return 0;
+
+broken:
+    response_cache_release(fill);
+    return ROUTE_CLOSE_CONNECTION;
+}
+
+/* Reads a response into the cache without relaying it, for a background
+ * refresh. Returns like relay_response(); a response that cannot be
+ * stored is not read to its end. */
+static int store_response_http1(int fd, const HttpRequest *req, Route *route,
+                                response_cache_flight_t **flight, bool *reusable)
+{
+    char buf[HTTP1_CLIENT_HEAD_BUFFER_SIZE];
+    http1_response_head_t head;
+    size_t have = 0;
+    int parsed;
+
+    *reusable = false;
+    while ((parsed = http1_parse_response_head(buf, have, req->method, &head)) >= 0)
+    {
+        if (parsed > 0 && (head.status >= 200 || head.status == 101))
+            break;
+        if (parsed > 0)
         {
-            done = 1;
+            /* Interim responses have no one to go to */
+            have -= head.head_len;
+            memmove(buf, buf + head.head_len, have);
+            continue;
         }
+        if (have == sizeof(buf))
+            return -1;
+        ssize_t n = recv(fd, buf + have, sizeof(buf) - have, 0);
+        if (n <= 0)
+            return -1;
+        have += (size_t)n;
     }
+    if (parsed < 0)
+        return -1;
+
+    response_cache_entry_t *fill = start_h1_cache_fill(route, req, buf, &head, flight);
+    if (!fill)
+        return ROUTE_CLOSE_CONNECTION;
+    bool trailing_bytes = false;
+    const char *piece = buf + head.head_len;
+    size_t piece_len = have - head.head_len;
+    for (;;)
+    {
+        ssize_t body_len = http1_body_consume(&head.body, piece, piece_len);
+        if (body_len < 0 || response_cache_append(fill, piece, (size_t)body_len) != 0)
+            goto broken;
+        if ((size_t)body_len < piece_len)
+            trailing_bytes = true;
+        if (head.body.done)
+            break;
+
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n == 0 && head.body.kind == HTTP1_BODY_UNTIL_CLOSE)
+            break;
+        if (n <= 0)
+            goto broken;
+        piece = buf;
+        piece_len = (size_t)n;
+    }
+
+    response_cache_commit(route->response_cache, fill);
+    *reusable = head.keep_alive && !trailing_bytes;
     return 0;
+
+broken:
+    response_cache_release(fill);
+    return ROUTE_CLOSE_CONNECTION;
+}
+
+static bool expects_continue(const HttpRequest *req)
+{
+    for (int i = 0; i < req->header_count; i++)
+    {
+        if (strcasecmp(req->headers[i].field, "Expect") == 0)
+            return strcasecmp(req->headers[i].value, "100-continue") == 0;
+    }
+    return false;
+}
+
+/* One request/response exchange over a pooled connection. A reused
+ * connection the backend closed meanwhile fails before any response byte;
+ * the request is then sent once more on a fresh connection, unless body
+ * bytes were already consumed from the client. */
+static int proxy_exchange_http1(HttpRequest *req, const char *raw_request, size_t req_len,
+                                Route *route, http1_pool_t *pool, ServerConfig *config, SSL *ssl)
+{
+    char head[HTTP1_CLIENT_HEAD_BUFFER_SIZE];
+    http1_body_t request_body;
+    int head_len = http1_build_request_head(req, pool->authority, NULL, head, sizeof(head), &request_body);
+    if (head_len < 0)
+    {
+        send_simple_response_with_config(ssl, "HTTP/1.1 400 Bad Request", NULL, NULL, req, config);
+        return ROUTE_CLOSE_CONNECTION;
+    }
+
+    /* Identical misses wait for one fetch instead of each taking a connection */
+    response_cache_flight_t *flight = NULL;
+    if (route->response_cache && request_body.kind == HTTP1_BODY_NONE)
+    {
+        response_cache_entry_t *hit = response_cache_lookup_coalesced(route->response_cache, req,
+                                                                      route->cache.coalesce_timeout_ms,
+                                                                      &flight);
+        int result = hit ? send_cached_response_http1(ssl, hit) : -1;
+        response_cache_release(hit);
+        if (result != -1)
+        {
+            /* A stale hit: the first one refreshes the entry after answering */
+            if (flight)
+                start_cache_refresh(route, req, flight, false);
+            return result;
+        }
+    }
+
+    const char *buffered = NULL;
+    size_t buffered_len = 0;
+    if (req->head_len > 0 && req->head_len <= req_len)
+    {
+        buffered = raw_request + req->head_len;
+        buffered_len = req_len - req->head_len;
+    }
+    /* The client waits for 100 Continue before sending a body not yet read */
+    http1_body_t probe = request_body;
+    bool send_continue = expects_continue(req) &&
+                         !(http1_body_consume(&probe, buffered, buffered_len) >= 0 && probe.done);
+    bool continue_sent = false;
+    bool streamed = false;
+
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        bool reused = false;
+        int fd = http1_pool_acquire(pool, &reused);
+        if (fd < 0)
+            break;
+
+        http1_body_t body = request_body;
+        int result = send_all(fd, head, (size_t)head_len);
+        if (result == 0 && send_continue)
+        {
+            send_continue = false;
+            continue_sent = true;
+            if (ssl_write_all(ssl, "HTTP/1.1 100 Continue\r\n\r\n", 25) != 0)
+                result = ROUTE_CLOSE_CONNECTION;
+        }
+        if (result == 0)
+            result = relay_request_body(ssl, fd, &body, buffered, buffered_len, &streamed);
+
+        bool reusable = false;
+        if (result == 0)
+            result = relay_response(ssl, fd, req, route, &flight, &continue_sent, &reusable, NULL);
+        http1_pool_release(pool, fd, result == 0 && reusable);
+
+        if (result == 0 || result == ROUTE_CLOSE_CONNECTION)
+        {
+            response_cache_land(flight);
+            return result;
+        }
+        if (!reused || streamed)
+            break;
+        log_message(LOG_LEVEL_DEBUG, "Stale keep-alive connection to %s, retrying", pool->authority);
+    }
+
+    response_cache_land(flight);
+    log_message(LOG_LEVEL_ERROR, "HTTP/1.1 backend %s failed [id=%s]", pool->authority, req->request_id);
+    if (!streamed)
+    {
+        int result = send_stale_response_http1(ssl, route, req);
+        if (result != -1)
+            return result;
+    }
+    if (send_simple_response_with_config(ssl, "HTTP/1.1 502 Bad Gateway", NULL, NULL, req, config) != 0)
+        return ROUTE_CLOSE_CONNECTION;
+    return streamed ? ROUTE_CLOSE_CONNECTION : 0;
+}
+
+/* A WebSocket upgrade gets a backend connection of its own. Once the
+ * backend answers 101, bytes the client sent after its request head follow
+ * the handshake and both connections become a tunnel until either side
+ * closes or nothing moves for the route's idle timeout. A backend that
+ * declines answers like any other request. */
+static int proxy_upgrade_http1(HttpRequest *req, const char *raw_request, size_t req_len,
+                               Route *route, http1_pool_t *pool, ServerConfig *config, SSL *ssl)
+{
+    char head[HTTP1_CLIENT_HEAD_BUFFER_SIZE];
+    http1_body_t request_body;
+    int head_len = http1_build_request_head(req, pool->authority, "websocket", head, sizeof(head),
+                                            &request_body);
+    if (head_len < 0 || request_body.kind != HTTP1_BODY_NONE)
+    {
+        send_simple_response_with_config(ssl, "HTTP/1.1 400 Bad Request", NULL, NULL, req, config);
+        return ROUTE_CLOSE_CONNECTION;
+    }
+
+    const char *early = NULL;
+    size_t early_len = 0;
+    if (req->head_len > 0 && req->head_len <= req_len)
+    {
+        early = raw_request + req->head_len;
+        early_len = req_len - req->head_len;
+    }
+
+    bool reusable = false;
+    bool upgraded = false;
+    int fd = http1_pool_connect(pool);
+    int result = fd < 0 ? -1 : send_all(fd, head, (size_t)head_len);
+    if (result == 0)
+        result = relay_response(ssl, fd, req, NULL, NULL, NULL, &reusable, &upgraded);
+
+    if (result == 0 && upgraded)
+    {
+        tunnel_stats_t stats = {0};
+        if (early_len == 0 || send_all(fd, early, early_len) == 0)
+            tunnel_relay(ssl, fd, route->websocket_idle_timeout_seconds * 1000, &stats);
+        log_message(LOG_LEVEL_INFO, "WebSocket to %s closed: %llu bytes up, %llu bytes down%s [id=%s]",
+                    pool->authority, stats.bytes_to_backend, stats.bytes_to_client,
+                    stats.idle_timeout ? " (idle timeout)" : "", req->request_id);
+        close(fd);
+        return ROUTE_CLOSE_CONNECTION;
+    }
+    if (fd >= 0)
+        close(fd);
+    if (result == 0)
+        return early_len > 0 ? ROUTE_CLOSE_CONNECTION : 0;
+    if (result == ROUTE_CLOSE_CONNECTION)
+        return result;
+
+    log_message(LOG_LEVEL_ERROR, "WebSocket backend %s failed [id=%s]", pool->authority, req->request_id);
+    if (send_simple_response_with_config(ssl, "HTTP/1.1 502 Bad Gateway", NULL, NULL, req, config) != 0)
+        return ROUTE_CLOSE_CONNECTION;
+    return early_len > 0 ? ROUTE_CLOSE_CONNECTION : 0;
+}
+
+/* The route's keep-alive pool. Routes set up without one (no startup
+ * resolution) get a temporary pool that keeps nothing; '*temporary' tells
+ * the caller to destroy it. */
+static http1_pool_t *route_h1_pool(Route *route, bool *temporary)
+{
+    *temporary = false;
+    if (route->h1_pool)
+        return route->h1_pool;
+
+    resolver_endpoint_t *endpoint = route->endpoint;
+    if (!endpoint)
+    {
+        char host[256];
+        int port;
+        if (parse_backend_url(route->backend, host, sizeof(host), &port) != 0)
+            return NULL;
+        endpoint = resolver_get_endpoint(host, port);
+    }
+    http1_pool_t *pool = http1_pool_create(endpoint, route->backend, 0, 0);
+    *temporary = pool != NULL;
+    return pool;
 }
 
 /* proxy_request_tls()
  *
- * Forwards the entire HTTP request to a backend for reverse proxy functionality.
- * Then activates proxy_bidirectional_tls() to forward data bidirectionally.
+ * Forwards an HTTP/1.1 request to the route's backend over a keep-alive
+ * connection from the route's pool, and relays the response with its
+ * framing so the client connection stays usable. WebSocket upgrades are
+ * tunnelled when the route allows them. Routes with a response cache
+ * answer fresh hits without contacting the backend, and stale ones while
+ * the backend fails. Returns -1 when no reverse proxy route matches.
  */
 int proxy_request_tls(HttpRequest *req, const char *raw_request, size_t req_len, ServerConfig *config, SSL *ssl)
 {
     if (!req || !req->path || !raw_request || !config || !ssl)
         return -1;
 
-    for (int i = 0; i < config->route_count; i++)
-    {
-        if (strcmp(config->routes[i].technology, "reverse_proxy") == 0)
-        {
-            size_t prefix_len = strlen(config->routes[i].path);
-            if (strlen(req->path) < prefix_len)
-                continue;
-            if (strncmp(req->path, config->routes[i].path, prefix_len) == 0)
-            {
-                char ip[IP_BUFFER_SIZE];
-                int port;
-                if (sscanf(config->routes[i].backend, "%63[^:]:%d", ip, &port) != 2)
-                    return -1;
-                int backend_fd = socket(AF_INET, SOCK_STREAM, 0);
-                if (backend_fd < 0)
-                    return -1;
-                struct sockaddr_in backend_addr;
-                memset(&backend_addr, 0, sizeof(backend_addr));
-                backend_addr.sin_family = AF_INET;
-                backend_addr.sin_port = htons(port);
-                if (inet_pton(AF_INET, ip, &backend_addr.sin_addr) <= 0)
-                {
-                    close(backend_fd);
-                    return -1;
-                }
-                if (connect(backend_fd, (struct sockaddr *)&backend_addr, sizeof(backend_addr)) < 0)
-                {
-                    close(backend_fd);
-                    return -1;
-                }
-                size_t sent = 0;
-                while (sent < req_len)
-                {
-                    ssize_t n = send(backend_fd, raw_request + sent, req_len - sent, 0);
-                    if (n <= 0)
-                        break;
-                    sent += (size_t)n;
-                }
-                proxy_bidirectional_tls(ssl, backend_fd);
-                close(backend_fd);
-                return 0;
-            }
-        }
-    }
-    return -1;
+    Route *route = find_reverse_proxy_route(req, config);
+    if (!route)
+        return -1;
+
+    bool temporary;
+    http1_pool_t *pool = route_h1_pool(route, &temporary);
+    if (!pool)
+        return -1;
+
+    int result;
+    if (route->websocket_enabled && req->method && strcmp(req->method, "GET") == 0 &&
+        http1_request_upgrades_to(req, "websocket"))
+        result = proxy_upgrade_http1(req, raw_request, req_len, route, pool, config, ssl);
+    else
+        result = proxy_exchange_http1(req, raw_request, req_len, route, pool, config, ssl);
+
+    if (temporary)
+        http1_pool_destroy(pool);
+    return result;
+}
+
+/* route_websocket_h2()
+ *
+ * Bootstraps an RFC 8441 extended CONNECT for a WebSocket: finds the
+ * reverse proxy route for the path and upgrades a backend connection of the
+ * stream's own. Returns the status for the CONNECT response; with 200,
+ * '*out' is the stream to bridge.
+ */
+int route_websocket_h2(HttpRequest *req, ServerConfig *config, websocket_stream_t **out)
+{
+    *out = NULL;
+    if (!req || !req->path || !config)
+        return HTTP_STATUS_BAD_REQUEST;
+
+    Route *route = find_reverse_proxy_route(req, config);
+    if (!route)
+        return HTTP_STATUS_NOT_FOUND;
+    if (!route->websocket_enabled)
+        return HTTP_STATUS_NOT_IMPLEMENTED;
+
+    bool temporary;
+    http1_pool_t *pool = route_h1_pool(route, &temporary);
+    if (!pool)
+        return HTTP_STATUS_BAD_GATEWAY;
+    int status = websocket_stream_open(out, pool, req, route->websocket_idle_timeout_seconds * 1000);
+    if (temporary)
+        http1_pool_destroy(pool);
+    return status;
 }
 
 static void set_h2_response(Http2Response *h2resp, int status, const char *body, size_t body_len,
@@ -667,73 +1251,377 @@ static void set_h2_response(Http2Response *h2resp, int status, const char *body,
     h2_response_finalize(h2resp);
 }
 
-static int proxy_to_backend_pooled(HttpRequest *req, Route *route, 
-                                    Http2Response *h2resp, const char *body, size_t body_len)
+/* A response relayed from an HTTP/2 backend: only the status is ours, the
+ * headers and body are the backend stream's (see proxy_stream_t) */
+static void set_h2_proxied_response(Http2Response *h2resp, int status, http2_client_t *client,
+                                    http2_stream_t *stream, backend_conn_t *conn)
+{
+    h2_response_init(h2resp);
+    h2_response_set_status(h2resp, status, NULL);
+    h2resp->content_type[0] = '\0';
+    h2resp->upstream = proxy_stream_create(client, stream, conn);
+}
+
+/* A hit: the status is set here, the stored headers and body go out from
+ * the entry, which the response keeps a reference to */
+static void set_h2_cached_response(Http2Response *h2resp, response_cache_entry_t *entry)
+{
+    h2_response_init(h2resp);
+    h2_response_set_status(h2resp, entry->status, entry->reason);
+    h2resp->content_type[0] = '\0';
+    h2resp->cached = entry;
+}
+
+/* Lets the body of a cacheable backend response be stored as it is
+ * relayed. Requests waiting on 'flight' are woken once it was stored, or
+ * right away when it cannot be. */
+static void start_h2_cache_fill(Route *route, HttpRequest *req, proxy_stream_t *upstream, int status,
+                                response_cache_flight_t *flight)
 {
+    http2_stream_t *stream = upstream->stream;
+    response_cache_header_t headers[HTTP2_CLIENT_MAX_HEADERS];
+
+    for (size_t i = 0; i < stream->response_header_count; i++) {
+        headers[i] = (response_cache_header_t){
+            (const char *)stream->response_headers[i].name, stream->response_headers[i].namelen,
+            (const char *)stream->response_headers[i].value, stream->response_headers[i].valuelen
+        };
+    }
+    upstream->cache = route->response_cache;
+    upstream->fill = response_cache_begin(route->response_cache, req, status, headers,
+                                          (int)stream->response_header_count, route->cache.ttl_seconds);
+    if (!upstream->fill) {
+        response_cache_land(flight);
+        return;
+    }
+    response_cache_default_stale(upstream->fill, route->cache.stale_while_revalidate_seconds,
+                                 route->cache.stale_if_error_seconds);
+    response_cache_attach_flight(upstream->fill, flight);
+}
+
+static long elapsed_us_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/* The Maglev key: the configured header's value, or the path without it */
+static const char *cluster_hash_key(HttpRequest *req, RouteCluster *cluster, size_t *len)
+{
+    if (cluster->hash_header[0] != '\0') {
+        for (int i = 0; i < req->header_count; i++) {
+            if (req->headers[i].field && req->headers[i].value &&
+                strcasecmp(req->headers[i].field, cluster->hash_header) == 0) {
+                *len = strlen(req->headers[i].value);
+                return req->headers[i].value;
+            }
+        }
+    }
+    *len = strlen(req->path);
+    return req->path;
+}
+
+/* One request sent to one cluster endpoint, until its response headers
+ * are in */
+typedef struct {
+    upstream_endpoint_t *endpoint;
     backend_conn_t *conn;
-    int status;
-    const char *resp_body;
-    size_t resp_len;
+    http2_stream_t *stream;
+    struct timespec start;
+} upstream_attempt_t;
+
+/* Results of send_attempt() */
+#define ATTEMPT_SENT 0
+#define ATTEMPT_FAILED (-1)
+#define ATTEMPT_BREAKER_OPEN 1
+#define ATTEMPT_POOL_EXHAUSTED 2
+#define ATTEMPT_SHED 3
+
+/* Methods a retry or hedge may send twice (RFC 9110 section 9.2.2) */
+static bool is_idempotent_method(const char *method)
+{
+    static const char *const idempotent[] = {"GET", "HEAD", "OPTIONS", "TRACE", "PUT", "DELETE"};
+
+    for (size_t i = 0; method && i < sizeof(idempotent) / sizeof(idempotent[0]); i++) {
+        if (strcmp(method, idempotent[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    if (!backend_pool_circuit_breaker_allow_request(route->pool)) {
+/* Takes a stream slot on the endpoint and sends the request. On anything
+ * but ATTEMPT_SENT nothing is held, but the endpoint is still picked. */
+static int send_attempt(HttpRequest *req, upstream_attempt_t *attempt, const char *body, size_t body_len)
+{
+    upstream_endpoint_t *endpoint = attempt->endpoint;
+    backend_pool_t *pool = endpoint->pool;
+    backend_acquire_result_t acquired;
+
+    clock_gettime(CLOCK_MONOTONIC, &attempt->start);
+    if (upstream_endpoint_over_limit(endpoint)) {
+        log_message(LOG_LEVEL_WARN, "Concurrency limit reached, shedding request to %s",
+                   endpoint->name);
+        return ATTEMPT_SHED;
+    }
+    if (!backend_pool_circuit_breaker_allow_request(pool)) {
         log_message(LOG_LEVEL_WARN, "Circuit breaker OPEN, rejecting request to %s",
-                   route->backend);
-        set_h2_response(h2resp, HTTP_STATUS_SERVICE_UNAVAILABLE, 
-                       CIRCUIT_BREAKER_ERROR_BODY, CIRCUIT_BREAKER_ERROR_LEN,
-                       &route->security_headers, &route->cors);
-        return -1;
+                   endpoint->name);
+        return ATTEMPT_BREAKER_OPEN;
     }
     
-    conn = backend_pool_acquire(route->pool);
-    if (!conn) {
-        log_message(LOG_LEVEL_ERROR, "Failed to acquire connection from pool");
-        backend_pool_circuit_breaker_record_failure(route->pool);
-        return -1;
+    attempt->conn = backend_pool_acquire_timed(pool, pool->acquire_timeout_ms, &acquired);
+    if (!attempt->conn && acquired == BACKEND_ACQUIRE_EXHAUSTED) {
+        /* Saturation is not a backend failure; keep it out of the breaker */
+        backend_pool_circuit_breaker_cancel_request(pool);
+        return ATTEMPT_POOL_EXHAUSTED;
+    }
+    if (!attempt->conn) {
+        log_message(LOG_LEVEL_ERROR, "Failed to acquire connection from pool for %s",
+                   endpoint->name);
+        backend_pool_circuit_breaker_record_failure(pool);
+        return ATTEMPT_FAILED;
     }
     
-    log_message(LOG_LEVEL_INFO, "HTTP/2 proxy: forwarding %s %s via pooled connection", 
-                req->method, req->path);
+    attempt->stream = calloc(1, sizeof(*attempt->stream));
+    if (!attempt->stream) {
+        backend_pool_circuit_breaker_cancel_request(pool);
+        backend_pool_release(attempt->conn);
+        return ATTEMPT_FAILED;
+    }
+    
+    log_message(LOG_LEVEL_INFO, "HTTP/2 proxy: forwarding %s %s to %s via pooled connection", 
+                req->method, req->path, endpoint->name);
     
-    status = http2_client_send_request(&conn->client, req->method, req->path, 
-                                       route->backend, body, body_len);
-    if (status < 0) {
+    if (backend_pool_connect(attempt->conn) != 0 ||
+        http2_client_submit(&attempt->conn->client, attempt->stream, req->method, req->path,
+                            endpoint->name, body, body_len) < 0) {
         log_message(LOG_LEVEL_ERROR, "Failed to send HTTP/2 request");
+        http2_client_release(&attempt->conn->client, attempt->stream);
+        free(attempt->stream);
+        backend_pool_mark_failure(attempt->conn);
+        backend_pool_circuit_breaker_record_failure(pool);
+        backend_pool_release(attempt->conn);
+        return ATTEMPT_FAILED;
+    }
+    return ATTEMPT_SENT;
+}
+
+/* Ends a sent attempt that will not answer the client. A failed one counts
+ * against its endpoint; a hedge that lost the race is cancelled with
+ * RST_STREAM and counts for nothing. */
+static void drop_attempt(upstream_attempt_t *attempt, bool failed)
+{
+    backend_conn_t *conn = attempt->conn;
+
+    http2_client_release(&conn->client, attempt->stream);
+    free(attempt->stream);
+    if (failed) {
         backend_pool_mark_failure(conn);
-        backend_pool_circuit_breaker_record_failure(route->pool);
-        backend_pool_release(conn);
-        return -1;
+        backend_pool_circuit_breaker_record_failure(conn->pool);
+    } else {
+        backend_pool_circuit_breaker_cancel_request(conn->pool);
+    }
+    backend_pool_release(conn);
+    upstream_endpoint_release(attempt->endpoint, elapsed_us_since(&attempt->start),
+                              failed ? UPSTREAM_STATUS_FAILED : UPSTREAM_STATUS_NOT_SENT);
+}
+
+/* Waits for the first of two attempts to get its response headers, the
+ * second sent once the first has had 'hedge_ms' to answer. Returns the
+ * winner, with 'status' set, after the other was dropped; NULL when both
+ * failed. */
+static upstream_attempt_t *await_hedged(HttpRequest *req, Route *route, upstream_attempt_t attempts[2],
+                                        long hedge_ms, const char *key, size_t key_len,
+                                        const char *body, size_t body_len, int *status)
+{
+    upstream_cluster_t *cluster = route->cluster;
+    bool live[2] = {true, false};
+
+    *status = http2_client_poll_headers(&attempts[0].conn->client, attempts[0].stream, (int)hedge_ms);
+    if (*status > 0) {
+        return &attempts[0];
+    }
+    if (*status < 0) {
+        drop_attempt(&attempts[0], true);
+        return NULL;
+    }
+
+    if (upstream_cluster_take_retry(cluster)) {
+        attempts[1].endpoint = upstream_cluster_pick_other(cluster, key, key_len, attempts[0].endpoint);
+        int sent = send_attempt(req, &attempts[1], body, body_len);
+        if (sent == ATTEMPT_SENT) {
+            log_message(LOG_LEVEL_INFO, "HTTP/2 proxy: no response from %s after %ld ms, hedging to %s",
+                        attempts[0].endpoint->name, hedge_ms, attempts[1].endpoint->name);
+            atomic_fetch_add(&cluster->total_hedges, 1);
+            live[1] = true;
+        } else {
+            upstream_endpoint_release(attempts[1].endpoint, elapsed_us_since(&attempts[1].start),
+                                      sent == ATTEMPT_FAILED ? UPSTREAM_STATUS_FAILED : UPSTREAM_STATUS_NOT_SENT);
+        }
+    }
+
+    /* Take turns on the two connections until one answers */
+    long remaining_ms;
+    while ((live[0] || live[1]) &&
+           (remaining_ms = HTTP2_CLIENT_RESPONSE_TIMEOUT_MS - elapsed_us_since(&attempts[0].start) / 1000) > 0) {
+        int slice = live[0] && live[1] && remaining_ms > ROUTER_HEDGE_POLL_MS ? ROUTER_HEDGE_POLL_MS :
+                    (int)remaining_ms;
+        for (int i = 0; i < 2; i++) {
+            if (!live[i]) {
+                continue;
+            }
+            *status = http2_client_poll_headers(&attempts[i].conn->client, attempts[i].stream, slice);
+            if (*status > 0) {
+                if (live[1 - i]) {
+                    drop_attempt(&attempts[1 - i], false);
+                }
+                return &attempts[i];
+            }
+            if (*status < 0) {
+                drop_attempt(&attempts[i], true);
+                live[i] = false;
+            }
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (live[i]) {
+            log_message(LOG_LEVEL_ERROR, "HTTP/2 proxy: no response from %s", attempts[i].endpoint->name);
+            drop_attempt(&attempts[i], true);
+        }
+    }
+    return NULL;
+}
+
+/* Sends the request to 'endpoint', hedged to a second endpoint when the
+ * route allows it, and sets the response from whichever answers. The
+ * endpoints end up released, or attached to the proxied response. */
+static int proxy_to_endpoint(HttpRequest *req, Route *route, upstream_endpoint_t *endpoint, bool hedge,
+                             const char *key, size_t key_len, Http2Response *h2resp,
+                             const char *body, size_t body_len)
+{
+    upstream_attempt_t attempts[2] = {{.endpoint = endpoint}, {0}};
+    upstream_attempt_t *winner = &attempts[0];
+    int status;
+
+    int sent = send_attempt(req, &attempts[0], body, body_len);
+    if (sent != ATTEMPT_SENT) {
+        /* Without a body to relay, a 0 is the concurrency limit, the
+         * circuit breaker or the pool answering in the backend's place */
+        upstream_endpoint_release(endpoint, elapsed_us_since(&attempts[0].start),
+                                  sent == ATTEMPT_FAILED ? UPSTREAM_STATUS_FAILED : UPSTREAM_STATUS_NOT_SENT);
+        if (sent == ATTEMPT_FAILED) {
+            return -1;
+        }
+        if (sent == ATTEMPT_BREAKER_OPEN) {
+            set_h2_response(h2resp, HTTP_STATUS_SERVICE_UNAVAILABLE,
+                            CIRCUIT_BREAKER_ERROR_BODY, CIRCUIT_BREAKER_ERROR_LEN,
+                            &route->security_headers, &route->cors);
+        } else if (sent == ATTEMPT_SHED) {
+            set_h2_response(h2resp, HTTP_STATUS_SERVICE_UNAVAILABLE,
+                            CONCURRENCY_LIMIT_ERROR_BODY, CONCURRENCY_LIMIT_ERROR_LEN,
+                            &route->security_headers, &route->cors);
+        } else {
+            set_h2_response(h2resp, HTTP_STATUS_SERVICE_UNAVAILABLE,
+                            POOL_EXHAUSTED_ERROR_BODY, POOL_EXHAUSTED_ERROR_LEN,
+                            &route->security_headers, &route->cors);
+        }
+        return 0;
+    }
+
+    long hedge_ms = hedge ? upstream_cluster_hedge_delay_ms(route->cluster) : 0;
+    if (hedge_ms > 0 && hedge_ms < HTTP2_CLIENT_RESPONSE_TIMEOUT_MS) {
+        winner = await_hedged(req, route, attempts, hedge_ms, key, key_len, body, body_len, &status);
+        if (!winner) {
+            return -1;
+        }
+    } else {
+        status = http2_client_await_headers(&attempts[0].conn->client, attempts[0].stream,
+                                            HTTP2_CLIENT_RESPONSE_TIMEOUT_MS);
+        if (status <= 0) {
+            log_message(LOG_LEVEL_ERROR, "Failed to receive HTTP/2 response");
+            drop_attempt(&attempts[0], true);
+            return -1;
+        }
     }
     
-    status = http2_client_recv_response(&conn->client);
-    if (status <= 0) {
-        log_message(LOG_LEVEL_ERROR, "Failed to receive HTTP/2 response");
-        backend_pool_mark_failure(conn);
-        backend_pool_circuit_breaker_record_failure(route->pool);
-        backend_pool_release(conn);
+    /* The body follows as it arrives; the slot is settled once it has */
+    set_h2_proxied_response(h2resp, status, &winner->conn->client, winner->stream, winner->conn);
+    if (!h2resp->upstream) {
+        drop_attempt(winner, true);
         return -1;
     }
+    /* Released with the stream, after the body was relayed */
+    h2resp->upstream->endpoint = winner->endpoint;
+    h2resp->upstream->latency_us = elapsed_us_since(&winner->start);
     
-    resp_body = http2_client_get_response_body(&conn->client);
-    resp_len = http2_client_get_response_length(&conn->client);
-    
-    set_h2_response(h2resp, status, resp_body, resp_len,
-                    &route->security_headers, &route->cors);
-    
-    log_message(LOG_LEVEL_INFO, "HTTP/2 proxy: received response status=%d, length=%zu", 
-                status, resp_len);
-    
-    backend_pool_mark_success(conn);
-    backend_pool_circuit_breaker_record_success(route->pool);
-    backend_pool_release(conn);
+    log_message(LOG_LEVEL_INFO, "HTTP/2 proxy: received response status=%d, streaming body", status);
     return 0;
 }
 
+/* Whether an attempt's outcome is worth another try elsewhere: no
+ * response, a gateway error, or a local refusal another endpoint may not
+ * give */
+static bool should_retry(int rc, const Http2Response *h2resp, const upstream_cluster_t *cluster)
+{
+    if (rc != 0) {
+        return true;
+    }
+    if (h2resp->upstream) {
+        int status = h2resp->status_code;
+        return status == 502 || status == 503 || status == 504;
+    }
+    return cluster->count > 1;
+}
+
+static int proxy_to_cluster(HttpRequest *req, Route *route, 
+                            Http2Response *h2resp, const char *body, size_t body_len)
+{
+    upstream_cluster_t *cluster = route->cluster;
+    size_t key_len;
+    const char *key = cluster_hash_key(req, cluster, &key_len);
+    bool retryable = cluster->retry.enabled && is_idempotent_method(req->method);
+    upstream_endpoint_t *previous = NULL;
+
+    if (cluster->retry.enabled) {
+        upstream_cluster_earn_retry(cluster);
+    }
+
+    for (int attempt = 0;; attempt++) {
+        upstream_endpoint_t *endpoint = previous ? upstream_cluster_pick_other(cluster, key, key_len, previous)
+                                                 : upstream_cluster_pick(cluster, key, key_len);
+        if (!endpoint) {
+            return -1;
+        }
+
+        int rc = proxy_to_endpoint(req, route, endpoint, retryable && cluster->retry.hedge, key, key_len,
+                                   h2resp, body, body_len);
+        if (!retryable || attempt >= cluster->retry.max_retries || !should_retry(rc, h2resp, cluster) ||
+            !upstream_cluster_take_retry(cluster)) {
+            return rc;
+        }
+
+        log_message(LOG_LEVEL_INFO, "HTTP/2 proxy: retrying %s %s after %s from %s", req->method, req->path,
+                    rc != 0 ? "a failure" : "a 5xx", endpoint->name);
+        atomic_fetch_add(&cluster->total_retries, 1);
+        if (rc == 0 && h2resp->upstream) {
+            /* The 5xx counts against the endpoint like any other failure */
+            h2resp->upstream->failed = true;
+            proxy_stream_close(h2resp->upstream);
+            h2resp->upstream = NULL;
+        }
+        previous = endpoint;
+    }
+}
+
 static int proxy_to_backend_direct(HttpRequest *req, Route *route, 
                                     Http2Response *h2resp, const char *body, size_t body_len)
 {
     char ip[IP_BUFFER_SIZE];
     int port;
-    if (sscanf(route->backend, "%63[^:]:%d", ip, &port) != 2) {
+    if (parse_backend_url(route->backend, ip, sizeof(ip), &port) != 0) {
         log_message(LOG_LEVEL_ERROR, "Invalid backend address: %s", route->backend);
         return -1;
     }
@@ -745,51 +1633,54 @@ static int proxy_to_backend_direct(HttpRequest *req, Route *route,
         .host = {0},
         .port = port,
         .tls_enabled = route->tls_enabled,
-        .tls_verify = route->tls_verify
+        .tls_verify = route->tls_verify,
+        .endpoint = route->endpoint
     };
     strncpy(backend_config.host, ip, sizeof(backend_config.host) - 1);
     
-    http2_client_t client;
+    /* Owned by the proxy stream once the response headers are in */
+    http2_client_t *client = malloc(sizeof(*client));
+    http2_stream_t *stream = calloc(1, sizeof(*stream));
     int status;
-    const char *resp_body;
-    size_t resp_len;
 
-    if (http2_client_init(&client, &backend_config) != 0) {
+    if (!client || !stream || http2_client_init(client, &backend_config) != 0) {
         log_message(LOG_LEVEL_ERROR, "Failed to initialize HTTP/2 client");
+        free(client);
+        free(stream);
         return -1;
     }
     
-    if (http2_client_connect(&client, &backend_config) != 0) {
+    if (http2_client_connect(client, &backend_config) != 0) {
         log_message(LOG_LEVEL_ERROR, "Failed to connect to HTTP/2 backend %s:%d", ip, port);
-        http2_client_cleanup(&client);
-        return -1;
+        goto fail;
     }
     
-    if (http2_client_send_request(&client, req->method, req->path, 
-                                   ip, body, body_len) < 0) {
+    if (http2_client_submit(client, stream, req->method, req->path, ip, body, body_len) < 0) {
         log_message(LOG_LEVEL_ERROR, "Failed to send HTTP/2 request");
-        http2_client_cleanup(&client);
-        return -1;
+        goto fail;
     }
     
-    status = http2_client_recv_response(&client);
+    status = http2_client_await_headers(client, stream, HTTP2_CLIENT_RESPONSE_TIMEOUT_MS);
     if (status <= 0) {
         log_message(LOG_LEVEL_ERROR, "Failed to receive HTTP/2 response");
-        http2_client_cleanup(&client);
-        return -1;
+        http2_client_release(client, stream);
+        goto fail;
     }
     
-    resp_body = http2_client_get_response_body(&client);
-    resp_len = http2_client_get_response_length(&client);
-    
-    set_h2_response(h2resp, status, resp_body, resp_len,
-                    &route->security_headers, &route->cors);
-    
-    log_message(LOG_LEVEL_INFO, "HTTP/2 proxy: received response status=%d, length=%zu", 
-                status, resp_len);
+    set_h2_proxied_response(h2resp, status, client, stream, NULL);
+    if (!h2resp->upstream) {
+        http2_client_release(client, stream);
+        goto fail;
+    }
     
-    http2_client_cleanup(&client);
+    log_message(LOG_LEVEL_INFO, "HTTP/2 proxy: received response status=%d, streaming body", status);
     return 0;
+
+fail:
+    http2_client_cleanup(client);
+    free(client);
+    free(stream);
+    return -1;
 }
 
 static Route* find_reverse_proxy_route(HttpRequest *req, ServerConfig *config)
@@ -806,10 +1697,204 @@ static Route* find_reverse_proxy_route(HttpRequest *req, ServerConfig *config)
     return NULL;
 }
 
+/* A background refetch of a stale entry. The request is copied, as the
+ * client's is gone by the time the refetch runs. */
+typedef struct {
+    HttpRequest req;
+    Route *route;
+    response_cache_flight_t *flight;    /* landed once the entry was replaced, or not */
+    bool http2;
+    char strings[];
+} cache_refresh_t;
+
+static size_t string_size(const char *s)
+{
+    return s ? strlen(s) + 1 : 0;
+}
+
+static const char *copy_string(char **cursor, const char *s)
+{
+    if (!s) {
+        return NULL;
+    }
+    size_t size = strlen(s) + 1;
+    char *copy = memcpy(*cursor, s, size);
+    *cursor += size;
+    return copy;
+}
+
+static void refresh_http1(cache_refresh_t *job)
+{
+    char head[HTTP1_CLIENT_HEAD_BUFFER_SIZE];
+    http1_body_t request_body;
+    bool temporary;
+    http1_pool_t *pool = route_h1_pool(job->route, &temporary);
+
+    if (!pool) {
+        return;
+    }
+    int head_len = http1_build_request_head(&job->req, pool->authority, NULL, head, sizeof(head),
+                                            &request_body);
+    for (int attempt = 0; head_len >= 0 && attempt < 2; attempt++) {
+        bool reused = false;
+        bool reusable = false;
+        int fd = http1_pool_acquire(pool, &reused);
+        if (fd < 0) {
+            break;
+        }
+        int result = send_all(fd, head, (size_t)head_len);
+        if (result == 0) {
+            result = store_response_http1(fd, &job->req, job->route, &job->flight, &reusable);
+        }
+        http1_pool_release(pool, fd, result == 0 && reusable);
+        /* Only a reused connection the backend closed meanwhile is retried */
+        if (result != -1 || !reused) {
+            break;
+        }
+    }
+    if (temporary) {
+        http1_pool_destroy(pool);
+    }
+}
+
+static void refresh_http2(cache_refresh_t *job)
+{
+    Http2Response resp;
+    uint8_t buf[HTTP1_CLIENT_IO_BUFFER_SIZE];
+
+    h2_response_init(&resp);
+    int rc = job->route->cluster ? proxy_to_cluster(&job->req, job->route, &resp, NULL, 0)
+                                 : proxy_to_backend_direct(&job->req, job->route, &resp, NULL, 0);
+    if (rc != 0 || !resp.upstream) {
+        return;
+    }
+
+    proxy_stream_t *ps = resp.upstream;
+    start_h2_cache_fill(job->route, &job->req, ps, resp.status_code, job->flight);
+    job->flight = NULL;
+    /* Reading commits the entry at the end of the body */
+    while (ps->fill) {
+        ssize_t n = proxy_stream_read(ps, buf, sizeof(buf));
+        if (n == HTTP2_CLIENT_AGAIN) {
+            if (proxy_stream_idle(ps, HTTP2_CLIENT_RESPONSE_TIMEOUT_MS)) {
+                break;
+            }
+            struct pollfd pfd = {.fd = proxy_stream_fd(ps), .events = POLLIN};
+            poll(&pfd, 1, CACHE_REFRESH_POLL_MS);
+        } else if (n <= 0) {
+            break;
+        }
+    }
+    proxy_stream_close(ps);
+}
+
+/* Live refresh threads, which use routes, caches and pools that shutdown
+ * tears down. Once 'refresh_closed' is set no new one starts. */
+static pthread_mutex_t refresh_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t refresh_idle = PTHREAD_COND_INITIALIZER;
+static int refresh_threads;
+static bool refresh_closed;
+
+static void refresh_thread_gone(void)
+{
+    pthread_mutex_lock(&refresh_lock);
+    if (--refresh_threads == 0) {
+        pthread_cond_broadcast(&refresh_idle);
+    }
+    pthread_mutex_unlock(&refresh_lock);
+}
+
+static void *cache_refresh_thread(void *arg)
+{
+    cache_refresh_t *job = arg;
+
+    log_message(LOG_LEVEL_DEBUG, "Refreshing stale cache entry for %s", job->req.path);
+    if (job->http2) {
+        refresh_http2(job);
+    } else {
+        refresh_http1(job);
+    }
+    response_cache_land(job->flight);
+    free(job);
+    refresh_thread_gone();
+    return NULL;
+}
+
+/* Refetches a stale entry on a thread of its own while the stale response
+ * is served. 'flight' keeps other stale hits from starting another. With
+ * CACHE_REFRESH_MAX_THREADS running, or during shutdown, the entry is left
+ * for a later stale hit to refresh. */
+static void start_cache_refresh(Route *route, const HttpRequest *req, response_cache_flight_t *flight,
+                                bool http2)
+{
+    pthread_mutex_lock(&refresh_lock);
+    bool admitted = !refresh_closed && refresh_threads < CACHE_REFRESH_MAX_THREADS;
+    if (admitted) {
+        refresh_threads++;
+    }
+    pthread_mutex_unlock(&refresh_lock);
+    if (!admitted) {
+        log_message(LOG_LEVEL_DEBUG, "Deferring cache refresh for %s", req->path);
+        response_cache_land(flight);
+        return;
+    }
+
+    size_t size = string_size(req->method) + string_size(req->path) + string_size(req->version);
+    for (int i = 0; i < req->header_count; i++) {
+        size += string_size(req->headers[i].field) + string_size(req->headers[i].value);
+    }
+
+    cache_refresh_t *job = malloc(sizeof(*job) + size);
+    if (!job) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate cache refresh for %s", req->path);
+        response_cache_land(flight);
+        refresh_thread_gone();
+        return;
+    }
+    job->req = *req;
+    job->route = route;
+    job->flight = flight;
+    job->http2 = http2;
+    char *cursor = job->strings;
+    job->req.method = copy_string(&cursor, req->method);
+    job->req.path = copy_string(&cursor, req->path);
+    job->req.version = copy_string(&cursor, req->version);
+    for (int i = 0; i < req->header_count; i++) {
+        job->req.headers[i].field = copy_string(&cursor, req->headers[i].field);
+        job->req.headers[i].value = copy_string(&cursor, req->headers[i].value);
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, cache_refresh_thread, job) != 0) {
+        log_message(LOG_LEVEL_WARN, "Failed to start cache refresh for %s", req->path);
+        response_cache_land(flight);
+        free(job);
+        refresh_thread_gone();
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/* Stops new cache refreshes and waits for the running ones to finish */
+void router_shutdown(void)
+{
+    pthread_mutex_lock(&refresh_lock);
+    refresh_closed = true;
+    while (refresh_threads > 0) {
+        pthread_cond_wait(&refresh_idle, &refresh_lock);
+    }
+    pthread_mutex_unlock(&refresh_lock);
+}
+
 /* proxy_request_http2()
  *
  * HTTP/2 reverse proxy - forwards request to backend using HTTP/2 client.
- * Uses connection pool for connection reuse when available.
+ * Balances across the route's upstream cluster when one was created,
+ * reusing each endpoint's pooled connections. Routes with a response cache
+ * answer fresh hits without contacting the backend, and stale ones while
+ * the backend fails or its circuit breaker is open.
  */
 static int proxy_request_http2(HttpRequest *req, ServerConfig *config, 
                                 Http2Response *h2resp, const char *body, size_t body_len)
@@ -823,11 +1908,52 @@ static int proxy_request_http2(HttpRequest *req, ServerConfig *config,
         return -1;
     }
     
-    if (matched_route->pool) {
-        return proxy_to_backend_pooled(req, matched_route, h2resp, body, body_len);
+    /* Identical misses wait for one fetch instead of each taking a connection */
+    response_cache_flight_t *flight = NULL;
+    if (matched_route->response_cache) {
+        response_cache_entry_t *hit = response_cache_lookup_coalesced(matched_route->response_cache, req,
+                                                                      matched_route->cache.coalesce_timeout_ms,
+                                                                      &flight);
+        if (hit) {
+            log_message(LOG_LEVEL_DEBUG, "HTTP/2 proxy: cache hit for %s", req->path);
+            set_h2_cached_response(h2resp, hit);
+            /* A stale hit: the first one refreshes the entry in the background */
+            if (flight) {
+                start_cache_refresh(matched_route, req, flight, true);
+            }
+            return 0;
+        }
+    }
+
+    int rc;
+    if (matched_route->cluster) {
+        rc = proxy_to_cluster(req, matched_route, h2resp, body, body_len);
     } else {
-        return proxy_to_backend_direct(req, matched_route, h2resp, body, body_len);
+        rc = proxy_to_backend_direct(req, matched_route, h2resp, body, body_len);
+    }
+
+    /* A failed backend, or an open circuit breaker's 503, is answered from
+     * a stale entry when one may stand in for it */
+    if (matched_route->response_cache && (rc != 0 || is_backend_error(h2resp->status_code))) {
+        response_cache_entry_t *stale = response_cache_lookup_stale(matched_route->response_cache, req);
+        if (stale) {
+            log_message(LOG_LEVEL_INFO, "HTTP/2 proxy: backend failed, answering %s from the cache",
+                        req->path);
+            if (rc == 0 && h2resp->upstream) {
+                /* The 5xx still counts against the backend behind the stale copy */
+                h2resp->upstream->failed = true;
+                proxy_stream_close(h2resp->upstream);
+            }
+            set_h2_cached_response(h2resp, stale);
+            response_cache_land(flight);
+            return 0;
+        }
     }
+    if (rc == 0 && h2resp->upstream && matched_route->response_cache)
+        start_h2_cache_fill(matched_route, req, h2resp->upstream, h2resp->status_code, flight);
+    else
+        response_cache_land(flight);
+    return rc;
 }
 
 /* route_request_tls()
@@ -874,7 +2000,7 @@ int route_request_tls(HttpRequest *req, const char *raw, size_t raw_len, ServerC
                 if (proxy_request_http2(req, config, h2resp, NULL, 0) == 0) {
                     return 0;
                 }
-                return populate_http2_response(h2resp, "", HTTP_STATUS_NOT_IMPLEMENTED, "Not Implemented", "text/plain");
+                return populate_http2_response(h2resp, "", HTTP_STATUS_BAD_GATEWAY, "Bad Gateway", "text/plain");
             }
         }
         return populate_http2_response(h2resp, "", HTTP_STATUS_NOT_FOUND, "Not Found", "text/plain");
@@ -886,8 +2012,9 @@ int route_request_tls(HttpRequest *req, const char *raw, size_t raw_len, ServerC
 
     if (serve_static_tls(req, config, ssl) == 0)
         return 0;
-    if (proxy_request_tls(req, raw, raw_len, config, ssl) == 0)
-        return 0;
+    int proxy_result = proxy_request_tls(req, raw, raw_len, config, ssl);
+    if (proxy_result == 0 || proxy_result == ROUTE_CLOSE_CONNECTION)
+        return proxy_result;
 
     if (send_simple_response_with_config(ssl, "HTTP/1.1 404 Not Found", NULL, NULL, req, config) != 0)
         return -1;
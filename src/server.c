@@ -27,6 +27,11 @@
 #include "http2_response.h"
 #include "uuid.h"
 #include "ip_limiter.h"
+#include "cpu_affinity.h"
+#include "uring_io.h"
+#include "websocket.h"
+#include "proxy_stream.h"
+#include "response_cache.h"
 
 #ifndef DEBUG_H2
 #define DEBUG_H2 0
@@ -49,6 +54,8 @@
 #define NS_PER_MS 1000000
 #define US_PER_MS 1000
 
+#define CLIENT_IO_TIMEOUT_MS 5000
+
 typedef struct {
     SSL *ssl;
     ServerConfig *config;
@@ -58,8 +65,23 @@ typedef struct {
     int request_count;
     struct timeval request_start;
     int request_timeout_ms;
+    const char *client_addr;            /* X-Forwarded-For on requests relayed over HTTP/1.1 */
+    websocket_stream_t *websockets;     /* RFC 8441 streams bridged to backends */
+    proxy_stream_t *proxied;            /* responses whose body is still being relayed */
+    uring_poll_target_t *poll_targets;  /* client first, then each bridged or proxied backend */
+    struct pollfd *pollfds;
+    int poll_capacity;
 } H2IO;
 
+/* Client socket as seen by the connection handlers: an index into the worker
+ * ring's fixed-file table when the socket could be registered, otherwise a
+ * plain fd (no worker ring, or a kernel without sparse file tables). */
+typedef struct {
+    uring_worker_t *worker;
+    int fd;
+    bool fixed;
+} ClientConn;
+
 static int find_header_end(const char *buf, size_t len)
 {
     if (len < 4)
@@ -73,6 +95,29 @@ static int find_header_end(const char *buf, size_t len)
     return -1;
 }
 
+/* Copies a request header into the stream's HttpRequest. Headers past
+ * MAX_HEADERS are dropped, as the HTTP/1.1 parser does. */
+static int store_stream_header(StreamData *data, const uint8_t *name, size_t namelen,
+                               const uint8_t *value, size_t valuelen)
+{
+    if (data->req.header_count >= MAX_HEADERS)
+        return 0;
+
+    char *field = strndup((const char *)name, namelen);
+    char *field_value = strndup((const char *)value, valuelen);
+    if (!field || !field_value)
+    {
+        free(field);
+        free(field_value);
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate HTTP/2 header");
+        return -1;
+    }
+    data->req.headers[data->req.header_count].field = field;
+    data->req.headers[data->req.header_count].value = field_value;
+    data->req.header_count++;
+    return 0;
+}
+
 /* Callback invoked for each header received in an HTTP/2 frame */
 static int on_header_callback(nghttp2_session *session,
                               const nghttp2_frame *frame,
@@ -111,6 +156,8 @@ static int on_header_callback(nghttp2_session *session,
                 return NGHTTP2_ERR_CALLBACK_FAILURE;
             }
             generate_uuid(data->req.request_id);
+            if (io && io->client_addr)
+                snprintf(data->req.client_addr, sizeof(data->req.client_addr), "%s", io->client_addr);
             nghttp2_session_set_stream_user_data(session, frame->hd.stream_id, data);
         }
         if (namelen >= 1 && name[0] == ':')
@@ -137,11 +184,25 @@ static int on_header_callback(nghttp2_session *session,
             }
             else if (strncmp((const char *)name, ":scheme", namelen) == 0)
                 ; /* ignore scheme */
+            else if (namelen == 9 && memcmp(name, ":protocol", 9) == 0)
+            {
+                free(data->protocol);
+                data->protocol = strndup((const char *)value, valuelen);
+                if (!data->protocol)
+                {
+                    log_message(LOG_LEVEL_ERROR, "Failed to allocate HTTP/2 protocol");
+                    return NGHTTP2_ERR_CALLBACK_FAILURE;
+                }
+            }
             else if (strncmp((const char *)name, ":authority", namelen) == 0)
             {
-                /* authority not currently used by routing */
+                /* Kept as Host for requests relayed over HTTP/1.1 */
+                if (store_stream_header(data, (const uint8_t *)"host", 4, value, valuelen) != 0)
+                    return NGHTTP2_ERR_CALLBACK_FAILURE;
             }
         }
+        else if (store_stream_header(data, name, namelen, value, valuelen) != 0)
+            return NGHTTP2_ERR_CALLBACK_FAILURE;
     }
     return 0;
 }
@@ -178,6 +239,167 @@ static ssize_t http2_body_read_callback(
     return to_copy;
 }
 
+/* Backend bytes of a bridged WebSocket become DATA frames; the stream is
+ * deferred while the backend has nothing and resumed by the connection loop */
+static ssize_t websocket_read_callback(
+    nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+    uint32_t *data_flags, nghttp2_data_source *source, void *user_data)
+{
+    (void)session;
+    (void)stream_id;
+    (void)user_data;
+    websocket_stream_t *ws = source->ptr;
+    if (websocket_stream_pull(ws) < 0)
+        return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+    size_t n = websocket_stream_take(ws, buf, length);
+    if (n > 0)
+        return (ssize_t)n;
+    if (ws->backend_eof)
+    {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        return 0;
+    }
+    return NGHTTP2_ERR_DEFERRED;
+}
+
+/* A proxied body goes out as the backend delivers it; the stream is
+ * deferred while nothing is buffered and resumed by the connection loop */
+static ssize_t proxy_body_read_callback(
+    nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+    uint32_t *data_flags, nghttp2_data_source *source, void *user_data)
+{
+    (void)session;
+    (void)stream_id;
+    (void)user_data;
+    proxy_stream_t *upstream = source->ptr;
+    ssize_t n = proxy_stream_read(upstream, buf, length);
+    if (n > 0)
+        return n;
+    if (n == 0)
+    {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        return 0;
+    }
+    if (n == HTTP2_CLIENT_AGAIN)
+    {
+        upstream->waiting = true;
+        return NGHTTP2_ERR_DEFERRED;
+    }
+    return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+}
+
+/* Answers a request whose backend response is still arriving, with the
+ * backend's status and headers. The client stream is tracked so the
+ * connection loop can wait on the backend. */
+static int submit_proxied_response(nghttp2_session *session, H2IO *io, int32_t stream_id,
+                                   StreamData *data)
+{
+    proxy_stream_t *upstream = data->resp->upstream;
+    http2_stream_t *backend = upstream->stream;
+    nghttp2_nv headers[1 + HTTP2_CLIENT_MAX_HEADERS];
+
+    /* The captured entries are already filtered and lowercase */
+    headers[0] = MAKE_NV(":status", data->resp->status_code_str);
+    memcpy(headers + 1, backend->response_headers, backend->response_header_count * sizeof(nghttp2_nv));
+
+    nghttp2_data_provider data_prd;
+    data_prd.source.ptr = upstream;
+    data_prd.read_callback = proxy_body_read_callback;
+    int rv = nghttp2_submit_response(session, stream_id, headers, 1 + backend->response_header_count,
+                                     &data_prd);
+    if (rv != 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "nghttp2_submit_response failed: %s", nghttp2_strerror(rv));
+        proxy_stream_close(upstream);
+        data->resp->upstream = NULL;
+        return rv;
+    }
+    upstream->stream_id = stream_id;
+    upstream->next = io->proxied;
+    io->proxied = upstream;
+    return 0;
+}
+
+static ssize_t cached_body_read_callback(
+    nghttp2_session *session, int32_t stream_id, uint8_t *buf, size_t length,
+    uint32_t *data_flags, nghttp2_data_source *source, void *user_data)
+{
+    (void)session;
+    (void)stream_id;
+    (void)user_data;
+    StreamData *data = source->ptr;
+    response_cache_entry_t *entry = data->resp->cached;
+    size_t remaining = entry->body_len - data->resp_sent;
+    size_t to_copy = remaining < length ? remaining : length;
+    if (to_copy > 0)
+    {
+        memcpy(buf, entry->body + data->resp_sent, to_copy);
+        data->resp_sent += to_copy;
+    }
+    if (data->resp_sent >= entry->body_len)
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    return (ssize_t)to_copy;
+}
+
+/* Answers a request from a response cache entry, with the stored headers
+ * and an Age for how long ago the backend produced it */
+static int submit_cached_response(nghttp2_session *session, int32_t stream_id, StreamData *data)
+{
+    response_cache_entry_t *entry = data->resp->cached;
+    nghttp2_nv headers[3 + RESPONSE_CACHE_MAX_HEADERS];
+    char age[24];
+    size_t count = 0;
+
+    headers[count++] = MAKE_NV(":status", data->resp->status_code_str);
+    for (int i = 0; i < entry->header_count; i++)
+        headers[count++] = (nghttp2_nv){(uint8_t *)entry->headers[i].name, (uint8_t *)entry->headers[i].value,
+                                        entry->headers[i].name_len, entry->headers[i].value_len,
+                                        NGHTTP2_NV_FLAG_NONE};
+    snprintf(age, sizeof(age), "%ld", response_cache_age(entry));
+    snprintf(data->resp->content_length_str, sizeof(data->resp->content_length_str), "%zu", entry->body_len);
+    headers[count++] = MAKE_NV("age", age);
+    headers[count++] = MAKE_NV("content-length", data->resp->content_length_str);
+
+    nghttp2_data_provider data_prd;
+    data_prd.source.ptr = data;
+    data_prd.read_callback = cached_body_read_callback;
+    int rv = nghttp2_submit_response(session, stream_id, headers, count, &data_prd);
+    if (rv != 0)
+        log_message(LOG_LEVEL_ERROR, "nghttp2_submit_response failed: %s", nghttp2_strerror(rv));
+    return rv;
+}
+
+/* Answers an extended CONNECT the backend accepted. The stream stays open
+ * in both directions until either side ends it. */
+static void submit_websocket_response(nghttp2_session *session, H2IO *io, int32_t stream_id,
+                                      StreamData *data)
+{
+    websocket_stream_t *ws = data->ws;
+    nghttp2_nv headers[3];
+    size_t count = 0;
+
+    headers[count++] = MAKE_NV(":status", "200");
+    if (ws->protocol[0] != '\0')
+        headers[count++] = MAKE_NV("sec-websocket-protocol", ws->protocol);
+    if (ws->extensions[0] != '\0')
+        headers[count++] = MAKE_NV("sec-websocket-extensions", ws->extensions);
+
+    nghttp2_data_provider data_prd;
+    data_prd.source.ptr = ws;
+    data_prd.read_callback = websocket_read_callback;
+    int rv = nghttp2_submit_response(session, stream_id, headers, count, &data_prd);
+    if (rv != 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "nghttp2_submit_response failed: %s", nghttp2_strerror(rv));
+        nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_INTERNAL_ERROR);
+        return;
+    }
+    ws->stream_id = stream_id;
+    ws->next = io->websockets;
+    io->websockets = ws;
+    log_message(LOG_LEVEL_INFO, "WebSocket opened on HTTP/2 stream %d for %s", stream_id, data->req.path);
+}
+
 /* Callback invoked when a complete frame is received */
 static int on_frame_recv_callback(nghttp2_session *session, const nghttp2_frame *frame, void *user_data)
 {
@@ -208,7 +430,17 @@ static int on_frame_recv_callback(nghttp2_session *session, const nghttp2_frame
                 return 0;
             }
             data->resp_sent = 0;
-            if (route_request_tls(&data->req, raw_request, strlen(raw_request), config, NULL, data->resp) != 0 &&
+            if (data->protocol && data->req.method && strcmp(data->req.method, "CONNECT") == 0)
+            {
+                int status = route_websocket_h2(&data->req, config, &data->ws);
+                if (data->ws)
+                {
+                    submit_websocket_response(session, io, frame->hd.stream_id, data);
+                    return 0;
+                }
+                data->resp->status_code = status;
+            }
+            else if (route_request_tls(&data->req, raw_request, strlen(raw_request), config, NULL, data->resp) != 0 &&
                 data->resp->status_code == 0) {
                 data->resp->status_code = 500;
                 snprintf(data->resp->status_text, sizeof(data->resp->status_text), "Internal Server Error");
@@ -220,6 +452,26 @@ static int on_frame_recv_callback(nghttp2_session *session, const nghttp2_frame
                 data->resp->status_code = 200;
             snprintf(data->resp->status_code_str, sizeof(data->resp->status_code_str),
                      "%d", data->resp->status_code);
+            if (data->resp->upstream)
+            {
+                if (submit_proxied_response(session, io, frame->hd.stream_id, data) == 0)
+                {
+                    int send_rv = nghttp2_session_send(session);
+                    if (send_rv < 0 && send_rv != NGHTTP2_ERR_WOULDBLOCK)
+                        log_message(LOG_LEVEL_ERROR, "nghttp2_session_send failed: %s", nghttp2_strerror(send_rv));
+                }
+                return 0;
+            }
+            if (data->resp->cached)
+            {
+                if (submit_cached_response(session, frame->hd.stream_id, data) == 0)
+                {
+                    int send_rv = nghttp2_session_send(session);
+                    if (send_rv < 0 && send_rv != NGHTTP2_ERR_WOULDBLOCK)
+                        log_message(LOG_LEVEL_ERROR, "nghttp2_session_send failed: %s", nghttp2_strerror(send_rv));
+                }
+                return 0;
+            }
             snprintf(data->resp->content_length_str, sizeof(data->resp->content_length_str),
                      "%zu", data->resp->body_len);
             data->resp->headers[0] = MAKE_NV(":status", data->resp->status_code_str);
@@ -245,6 +497,42 @@ static int on_frame_recv_callback(nghttp2_session *session, const nghttp2_frame
             }
         }
     }
+    /* The client finished sending on a bridged WebSocket */
+    if ((frame->hd.type == NGHTTP2_DATA || frame->hd.type == NGHTTP2_HEADERS) &&
+        (frame->hd.flags & NGHTTP2_FLAG_END_STREAM))
+    {
+        StreamData *data = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+        if (data && data->ws)
+            websocket_stream_shutdown(data->ws);
+    }
+    return 0;
+}
+
+/* DATA on a bridged WebSocket goes to its backend; other request bodies
+ * are not forwarded. Window updates are manual: a WebSocket's bytes are
+ * only credited back to the client once its backend took them, so a slow
+ * backend holds up its own stream and never the worker. */
+static int on_data_chunk_recv_callback(nghttp2_session *session, uint8_t flags, int32_t stream_id,
+                                       const uint8_t *chunk, size_t len, void *user_data)
+{
+    (void)flags;
+    (void)user_data;
+    StreamData *data = nghttp2_session_get_stream_user_data(session, stream_id);
+    if (!data || !data->ws)
+    {
+        nghttp2_session_consume(session, stream_id, len);
+        return 0;
+    }
+    ssize_t sent = websocket_stream_write(data->ws, chunk, len);
+    if (sent < 0)
+    {
+        nghttp2_session_consume(session, stream_id, len);
+        nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, stream_id, NGHTTP2_CONNECT_ERROR);
+    }
+    else if (sent > 0)
+    {
+        nghttp2_session_consume(session, stream_id, (size_t)sent);
+    }
     return 0;
 }
 
@@ -253,15 +541,48 @@ static int on_stream_close_callback(nghttp2_session *session, int32_t stream_id,
                                     uint32_t error_code, void *user_data)
 {
     (void)error_code;
-    (void)user_data;
+    H2IO *io = (H2IO *)user_data;
     StreamData *data = nghttp2_session_get_stream_user_data(session, stream_id);
     if (data)
     {
+        if (data->ws)
+        {
+            websocket_stream_t **link = &io->websockets;
+            while (*link && *link != data->ws)
+                link = &(*link)->next;
+            if (*link)
+                *link = data->ws->next;
+            /* Bytes the backend never took still count against the connection window */
+            if (data->ws->out_len > 0)
+                nghttp2_session_consume_connection(session, data->ws->out_len);
+            websocket_stream_close(data->ws);
+            /* Timeouts apply again once the last tunnel is gone */
+            if (!io->websockets)
+                gettimeofday(&io->request_start, NULL);
+        }
+        if (data->resp && data->resp->upstream)
+        {
+            proxy_stream_t **link = &io->proxied;
+            while (*link && *link != data->resp->upstream)
+                link = &(*link)->next;
+            if (*link)
+                *link = data->resp->upstream->next;
+            proxy_stream_close(data->resp->upstream);
+            if (!io->proxied)
+                gettimeofday(&io->request_start, NULL);
+        }
+        for (int i = 0; i < data->req.header_count; i++)
+        {
+            free((void *)data->req.headers[i].field);
+            free((void *)data->req.headers[i].value);
+        }
+        free(data->protocol);
         free((void *)data->req.method);
         free((void *)data->req.path);
         free((void *)data->req.version);
         if (data->resp)
         {
+            response_cache_release(data->resp->cached);
             free(data->resp);
         }
         free(data);
@@ -386,7 +707,19 @@ static int initialize_server(ServerConfig *config, ThreadPool **out_pool)
     size_t max_threads = config->max_connections > 0 ? (size_t)config->max_connections : 32;
     size_t initial_threads = max_threads < THREAD_POOL_MIN_THREADS ? max_threads : THREAD_POOL_MIN_THREADS;
     
-    *out_pool = thread_pool_create(initial_threads, max_threads);
+    const CPUAffinityConfig *affinity = &config->cpu_affinity;
+    int worker_cpus[MAX_AFFINITY_CPUS];
+    int worker_cpu_count = 0;
+    if (affinity->enabled && affinity->worker_cpu_count > 0) {
+        memcpy(worker_cpus, affinity->worker_cpu_list, sizeof(int) * (size_t)affinity->worker_cpu_count);
+        worker_cpu_count = cpu_affinity_filter_available(worker_cpus, affinity->worker_cpu_count);
+    }
+    if (worker_cpu_count > 0) {
+        *out_pool = thread_pool_create_pinned(initial_threads, max_threads,
+                                              worker_cpus, (size_t)worker_cpu_count);
+    } else {
+        *out_pool = thread_pool_create(initial_threads, max_threads);
+    }
     if (!*out_pool) {
         log_message(LOG_LEVEL_ERROR, "Failed to create thread pool");
         close(g_server_fd);
@@ -397,6 +730,17 @@ static int initialize_server(ServerConfig *config, ThreadPool **out_pool)
         return -1;
     }
     
+    /* Pin the acceptor only after the pool exists so workers never inherit its mask */
+    if (affinity->enabled && affinity->acceptor_cpu >= 0 &&
+        cpu_affinity_pin_thread(pthread_self(), affinity->acceptor_cpu) == 0) {
+        cpu_affinity_bind_ring(&global_ring);
+        log_message(LOG_LEVEL_INFO, "Acceptor pinned to CPU %d", affinity->acceptor_cpu);
+    }
+    if (worker_cpu_count > 0) {
+        log_message(LOG_LEVEL_INFO, "Workers pinned round-robin to %d CPUs (%s)",
+                    worker_cpu_count, affinity->worker_cpus);
+    }
+    
     log_message(LOG_LEVEL_INFO, "Server initialized on port %d (max_connections=%zu)", 
                 config->port, max_threads);
     return 0;
@@ -646,8 +990,33 @@ void handle_signal(int sig)
     }
 }
 
-static void handle_http2_connection(SSL *ssl, int client_fd, ServerConfig *config, struct io_uring *ring);
-static void handle_http1_connection(SSL *ssl, int client_fd, ServerConfig *config);
+static void handle_http2_connection(SSL *ssl, ClientConn *conn, ServerConfig *config,
+                                    const char *client_addr);
+static void handle_http1_connection(SSL *ssl, ServerConfig *config, const char *client_addr);
+
+/* Waits for 'events' on the client socket. Returns revents, 0 on timeout, -1 on error. */
+static int client_conn_poll(ClientConn *conn, short events, int timeout_ms)
+{
+    if (conn->worker)
+        return uring_worker_poll(conn->worker, conn->fd, conn->fixed, events, timeout_ms);
+
+    struct pollfd pfd = {.fd = conn->fd, .events = events};
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0) {
+        log_message(LOG_LEVEL_ERROR, "poll failed: %s", strerror(errno));
+        return -1;
+    }
+    return ret == 0 ? 0 : pfd.revents;
+}
+
+static void client_conn_close(ClientConn *conn)
+{
+    if (conn->fixed)
+        uring_worker_close_fixed(conn->worker, conn->fd);
+    else
+        close(conn->fd);
+    conn->fd = -1;
+}
 
 /* Callback for nghttp2 to send data via SSL */
 static ssize_t send_callback(nghttp2_session *session, const uint8_t *data,
@@ -719,8 +1088,8 @@ static ssize_t recv_callback(nghttp2_session *session, uint8_t *buf, size_t leng
     return ret;
 }
 
-/* Nonblocking TLS handshake using thread-local io_uring with instrumentation */
-static int perform_nonblocking_ssl_accept(SSL *ssl, int client_fd, struct io_uring *ring)
+/* Nonblocking TLS handshake, waiting on the worker ring with instrumentation */
+static int perform_nonblocking_ssl_accept(SSL *ssl, ClientConn *conn)
 {
     int ret;
     struct timeval start, end;
@@ -743,28 +1112,13 @@ static int perform_nonblocking_ssl_accept(SSL *ssl, int client_fd, struct io_uri
                 return -1;
             }
             
-            int poll_flags = (err == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT;
-            struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
-            if (!sqe)
-            {
-                log_message(LOG_LEVEL_ERROR, "Failed to get SQE during handshake");
-                return -1;
-            }
-            io_uring_prep_poll_add(sqe, client_fd, poll_flags);
-            int submit_ret = io_uring_submit(ring);
-            if (submit_ret < 0)
+            short poll_flags = (err == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT;
+            int remaining_ms = (int)(timeout_ms - elapsed_ms);
+            if (client_conn_poll(conn, poll_flags, remaining_ms > 0 ? remaining_ms : 1) < 0)
             {
-                log_io_uring_error("io_uring_submit failed during handshake", submit_ret);
+                log_message(LOG_LEVEL_ERROR, "Poll failed during handshake");
                 return -1;
             }
-            struct io_uring_cqe *cqe;
-            int wait_ret = io_uring_wait_cqe(ring, &cqe);
-            if (wait_ret < 0)
-            {
-                log_io_uring_error("io_uring_wait_cqe failed during handshake", wait_ret);
-                return -1;
-            }
-            io_uring_cqe_seen(ring, cqe);
         }
         else
         {
@@ -796,10 +1150,13 @@ static nghttp2_session *h2_session_init(nghttp2_session_callbacks **out_callback
     nghttp2_session_callbacks_set_on_header_callback(*out_callbacks, on_header_callback);
     nghttp2_session_callbacks_set_on_frame_recv_callback(*out_callbacks, on_frame_recv_callback);
     nghttp2_session_callbacks_set_on_stream_close_callback(*out_callbacks, on_stream_close_callback);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(*out_callbacks, on_data_chunk_recv_callback);
     
     if (nghttp2_option_new(&options) == 0) {
         nghttp2_option_set_peer_max_concurrent_streams(options,
             (uint32_t)config->http2.max_concurrent_streams);
+        /* on_data_chunk_recv_callback() consumes what it has handled */
+        nghttp2_option_set_no_auto_window_update(options, 1);
     }
     
     if (nghttp2_session_server_new2(&session, *out_callbacks, io, options) != 0) {
@@ -818,9 +1175,25 @@ static nghttp2_session *h2_session_init(nghttp2_session_callbacks **out_callback
     return session;
 }
 
-static int h2_session_send_initial_settings(nghttp2_session *session)
+/* Extended CONNECT is advertised when a route can bridge WebSockets */
+static bool websocket_routes_configured(const ServerConfig *config)
+{
+    for (int i = 0; i < config->route_count; i++) {
+        if (config->routes[i].websocket_enabled &&
+            strcmp(config->routes[i].technology, "reverse_proxy") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int h2_session_send_initial_settings(nghttp2_session *session, const ServerConfig *config)
 {
-    int rv = nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, NULL, 0);
+    nghttp2_settings_entry settings[] = {
+        {NGHTTP2_SETTINGS_ENABLE_CONNECT_PROTOCOL, 1}
+    };
+    size_t settings_count = websocket_routes_configured(config) ? 1 : 0;
+    int rv = nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, settings, settings_count);
     if (rv < 0) {
         log_message(LOG_LEVEL_ERROR, "Failed to send initial SETTINGS frame: %s", nghttp2_strerror(rv));
         return -1;
@@ -835,12 +1208,140 @@ static int h2_session_send_initial_settings(nghttp2_session *session)
     return 0;
 }
 
+/* Waits on the client socket and on the backend of every bridged WebSocket
+ * or proxied body that has nothing pending. Returns the client's revents,
+ * 0 when only backends are ready or on timeout, -1 on error. */
+static int h2_poll(ClientConn *conn, H2IO *io, short events, int timeout_ms)
+{
+    if (!io->websockets && !io->proxied)
+        return client_conn_poll(conn, events, timeout_ms);
+
+    int count = 1;
+    for (websocket_stream_t *ws = io->websockets; ws; ws = ws->next)
+        count++;
+    for (proxy_stream_t *ps = io->proxied; ps; ps = ps->next)
+        count++;
+    if (count > io->poll_capacity) {
+        uring_poll_target_t *targets = realloc(io->poll_targets, sizeof(*targets) * (size_t)count);
+        if (targets)
+            io->poll_targets = targets;
+        struct pollfd *pfds = realloc(io->pollfds, sizeof(*pfds) * (size_t)count);
+        if (pfds)
+            io->pollfds = pfds;
+        if (!targets || !pfds) {
+            log_message(LOG_LEVEL_ERROR, "Failed to allocate HTTP/2 poll set");
+            return -1;
+        }
+        io->poll_capacity = count;
+    }
+
+    uring_poll_target_t *targets = io->poll_targets;
+    targets[0] = (uring_poll_target_t){.fd = conn->fd, .fixed = conn->fixed, .events = events};
+    int i = 1;
+    for (websocket_stream_t *ws = io->websockets; ws; ws = ws->next, i++) {
+        bool waiting = ws->len == 0 && !ws->backend_eof;
+        short ws_events = (short)((waiting ? POLLIN : 0) | (ws->out_len > 0 ? POLLOUT : 0));
+        targets[i] = (uring_poll_target_t){.fd = ws->fd, .events = ws_events};
+    }
+    /* The backend connection may be shared; another stream's waiter can
+     * read our bytes for us, which the next loop turn picks up */
+    for (proxy_stream_t *ps = io->proxied; ps; ps = ps->next, i++)
+        targets[i] = (uring_poll_target_t){.fd = proxy_stream_fd(ps), .events = ps->waiting ? POLLIN : 0};
+
+    if (conn->worker) {
+        if (uring_worker_poll_many(conn->worker, targets, count, timeout_ms) < 0)
+            return -1;
+        return targets[0].revents;
+    }
+
+    for (i = 0; i < count; i++) {
+        io->pollfds[i].fd = targets[i].events ? targets[i].fd : -1;
+        io->pollfds[i].events = targets[i].events;
+        io->pollfds[i].revents = 0;
+    }
+    if (poll(io->pollfds, (nfds_t)count, timeout_ms) < 0 && errno != EINTR) {
+        log_message(LOG_LEVEL_ERROR, "poll failed: %s", strerror(errno));
+        return -1;
+    }
+    return io->pollfds[0].revents;
+}
+
+/* Moves what the backends of bridged WebSockets sent onto their streams,
+ * passes queued client bytes on to backends that have room again, and
+ * resets the ones idle past their route's timeout */
+static void h2_service_websockets(nghttp2_session *session, H2IO *io)
+{
+    bool queued = false;
+
+    for (websocket_stream_t *ws = io->websockets; ws; ws = ws->next) {
+        ssize_t flushed = websocket_stream_flush(ws);
+        if (flushed > 0) {
+            /* Window updates for what the backend took */
+            nghttp2_session_consume(session, ws->stream_id, (size_t)flushed);
+            queued = true;
+        } else if (flushed < 0) {
+            nghttp2_session_consume(session, ws->stream_id, ws->out_len);
+            ws->out_len = 0;
+            nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, ws->stream_id, NGHTTP2_CONNECT_ERROR);
+            queued = true;
+            continue;
+        }
+        int pulled = websocket_stream_pull(ws);
+        if (pulled != 0) {
+            /* Errors surface through the read callback, which resets the stream */
+            nghttp2_session_resume_data(session, ws->stream_id);
+            queued = true;
+        } else if (websocket_stream_idle(ws)) {
+            log_message(LOG_LEVEL_INFO, "WebSocket on HTTP/2 stream %d idle, closing", ws->stream_id);
+            nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, ws->stream_id, NGHTTP2_CANCEL);
+            queued = true;
+        }
+    }
+    if (queued) {
+        int rv = nghttp2_session_send(session);
+        if (rv < 0 && rv != NGHTTP2_ERR_WOULDBLOCK)
+            log_message(LOG_LEVEL_ERROR, "nghttp2_session_send error: %s", nghttp2_strerror(rv));
+    }
+}
+
+/* Resumes proxied bodies the backend has delivered more of, and resets
+ * the ones whose backend stalled */
+static void h2_service_proxied(nghttp2_session *session, H2IO *io)
+{
+    bool queued = false;
+
+    for (proxy_stream_t *ps = io->proxied; ps; ps = ps->next) {
+        if (!ps->waiting)
+            continue;
+        if (proxy_stream_ready(ps)) {
+            ps->waiting = false;
+            nghttp2_session_resume_data(session, ps->stream_id);
+            queued = true;
+        } else if (proxy_stream_idle(ps, HTTP2_CLIENT_RESPONSE_TIMEOUT_MS)) {
+            log_message(LOG_LEVEL_WARN, "Backend stalled on proxied HTTP/2 stream %d, resetting",
+                        ps->stream_id);
+            ps->failed = true;
+            nghttp2_submit_rst_stream(session, NGHTTP2_FLAG_NONE, ps->stream_id, NGHTTP2_INTERNAL_ERROR);
+            queued = true;
+        }
+    }
+    if (queued) {
+        int rv = nghttp2_session_send(session);
+        if (rv < 0 && rv != NGHTTP2_ERR_WOULDBLOCK)
+            log_message(LOG_LEVEL_ERROR, "nghttp2_session_send error: %s", nghttp2_strerror(rv));
+    }
+}
+
 /* HTTP/2 connection handler using thread-local io_uring */
-static void handle_http2_connection(SSL *ssl, int client_fd, ServerConfig *config, struct io_uring *ring)
+static void handle_http2_connection(SSL *ssl, ClientConn *conn, ServerConfig *config,
+                                    const char *client_addr)
 {
-    (void)ring;
-    int flags = fcntl(client_fd, F_GETFL, 0);
-    fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
+    /* A fixed-file socket has no fd to flip; the BIO uses MSG_DONTWAIT instead */
+    if (!conn->fixed) {
+        int flags = fcntl(conn->fd, F_GETFL, 0);
+        fcntl(conn->fd, F_SETFL, flags | O_NONBLOCK);
+    }
+    uring_bio_set_nonblocking(SSL_get_rbio(ssl), true);
     
     nghttp2_session_callbacks *callbacks = NULL;
     H2IO io = {
@@ -851,6 +1352,7 @@ static void handle_http2_connection(SSL *ssl, int client_fd, ServerConfig *confi
         .total_read = 0,
         .request_count = 0,
         .request_timeout_ms = config->request_timeout_ms,
+        .client_addr = client_addr,
     };
     
     nghttp2_session *session = h2_session_init(&callbacks, &io, config);
@@ -858,7 +1360,7 @@ static void handle_http2_connection(SSL *ssl, int client_fd, ServerConfig *confi
         return;
     }
     
-    if (h2_session_send_initial_settings(session) != 0) {
+    if (h2_session_send_initial_settings(session, config) != 0) {
         nghttp2_session_del(session);
         nghttp2_session_callbacks_del(callbacks);
         return;
@@ -872,6 +1374,11 @@ static void handle_http2_connection(SSL *ssl, int client_fd, ServerConfig *confi
     {
         time_t now = time(NULL);
         
+        /* Bridged WebSockets and relayed bodies keep the connection open;
+         * they time out on their own */
+        if (io.websockets || io.proxied)
+            last_activity = now;
+        
         if (now - last_activity > config->http2.keepalive_timeout) {
             log_message(LOG_LEVEL_INFO, "HTTP/2 connection timeout: idle %lds (max %ds)",
                         (long)(now - last_activity), config->http2.keepalive_timeout);
@@ -888,7 +1395,8 @@ static void handle_http2_connection(SSL *ssl, int client_fd, ServerConfig *confi
         gettimeofday(&tv_now, NULL);
         int elapsed_ms = (int)((tv_now.tv_sec - io.request_start.tv_sec) * 1000 +
                                (tv_now.tv_usec - io.request_start.tv_usec) / 1000);
-        if (io.request_count > 0 && elapsed_ms > io.request_timeout_ms) {
+        if (!io.websockets && !io.proxied && io.request_count > 0 &&
+            elapsed_ms > io.request_timeout_ms) {
             log_message(LOG_LEVEL_WARN, "HTTP/2 request timeout: %dms exceeded (limit %dms)",
                         elapsed_ms, io.request_timeout_ms);
             metrics_increment_request_timeouts();
@@ -908,22 +1416,23 @@ static void handle_http2_connection(SSL *ssl, int client_fd, ServerConfig *confi
                nghttp2_session_want_read(session), nghttp2_session_want_write(session),
                io.want_read, io.want_write, events);
         
-        struct pollfd pfd = {.fd = client_fd, .events = events};
-        int pret = poll(&pfd, 1, H2_POLL_TIMEOUT_MS);
-        if (pret < 0) {
-            log_message(LOG_LEVEL_ERROR, "poll failed: %s", strerror(errno));
+        int revents = h2_poll(conn, &io, events, H2_POLL_TIMEOUT_MS);
+        if (revents < 0)
             break;
-        }
-        if (pret == 0) continue;
+        if (io.websockets)
+            h2_service_websockets(session, &io);
+        if (io.proxied)
+            h2_service_proxied(session, &io);
+        if (revents == 0) continue;
         
-        if (pfd.revents & H2_POLL_ERROR_EVENTS) {
-            log_message(LOG_LEVEL_ERROR, "poll error/hangup: revents=%d", pfd.revents);
+        if (revents & H2_POLL_ERROR_EVENTS) {
+            log_message(LOG_LEVEL_ERROR, "poll error/hangup: revents=%d", revents);
             break;
         }
         
-        H2_LOG("h2 loop: revents=0x%x", pfd.revents);
+        H2_LOG("h2 loop: revents=0x%x", revents);
 
-        if (pfd.revents & POLLIN) {
+        if (revents & POLLIN) {
             rv = nghttp2_session_recv(session);
             if (rv < 0) {
                 if (rv == NGHTTP2_ERR_EOF) {
@@ -938,7 +1447,7 @@ static void handle_http2_connection(SSL *ssl, int client_fd, ServerConfig *confi
             }
         }
         
-        if (pfd.revents & POLLOUT) {
+        if (revents & POLLOUT) {
             rv = nghttp2_session_send(session);
             if (rv < 0 && rv != NGHTTP2_ERR_WOULDBLOCK) {
                 log_message(LOG_LEVEL_ERROR, "nghttp2_session_send error: %s", nghttp2_strerror(rv));
@@ -954,8 +1463,21 @@ static void handle_http2_connection(SSL *ssl, int client_fd, ServerConfig *confi
     log_message(LOG_LEVEL_INFO, "HTTP/2 session ended: duration=%lds requests=%d",
                 (long)conn_duration, io.request_count);
     
+    /* nghttp2_session_del() does not report the streams still open */
+    while (io.websockets) {
+        websocket_stream_t *ws = io.websockets;
+        io.websockets = ws->next;
+        websocket_stream_close(ws);
+    }
+    while (io.proxied) {
+        proxy_stream_t *ps = io.proxied;
+        io.proxied = ps->next;
+        proxy_stream_close(ps);
+    }
     nghttp2_session_del(session);
     nghttp2_session_callbacks_del(callbacks);
+    free(io.poll_targets);
+    free(io.pollfds);
 }
 
 #define SERVER_SECURITY_HEADERS_BUFFER_SIZE 512
@@ -981,9 +1503,8 @@ static void add_global_security_headers(char *buffer, size_t *len, SecurityHeade
 }
 
 /* HTTP/1.1 connection handler - synchronous SSL I/O with keep-alive */
-static void handle_http1_connection(SSL *ssl, int client_fd, ServerConfig *config)
+static void handle_http1_connection(SSL *ssl, ServerConfig *config, const char *client_addr)
 {
-    (void)client_fd;
     struct timeval request_start;
     int timeout_ms = config->request_timeout_ms;
 
@@ -1000,7 +1521,7 @@ static void handle_http1_connection(SSL *ssl, int client_fd, ServerConfig *confi
                              BUFFER_SIZE - 1 - total_read);
             if (n <= 0) {
                 // client closed connection or SSL error
-                goto shutdown_and_close;
+                return;
             }
             total_read += n;
             
@@ -1026,7 +1547,7 @@ static void handle_http1_connection(SSL *ssl, int client_fd, ServerConfig *confi
                         SSL_write(ssl, timeout_response, current_len + 2);
                     }
                 }
-                goto shutdown_and_close;
+                return;
             }
             
             header_end = find_header_end(buffer, (size_t)total_read);
@@ -1047,7 +1568,7 @@ static void handle_http1_connection(SSL *ssl, int client_fd, ServerConfig *confi
                     SSL_write(ssl, too_large, current_len + 2);
                 }
             }
-            goto shutdown_and_close;
+            return;
         }
 
         // 2) Parse the request
@@ -1066,13 +1587,14 @@ static void handle_http1_connection(SSL *ssl, int client_fd, ServerConfig *confi
                 }
             }
             // malformed request → close connection
-            goto shutdown_and_close;
+            return;
         }
 
+        snprintf(req.client_addr, sizeof(req.client_addr), "%s", client_addr);
         log_message(LOG_LEVEL_INFO, "Valid HTTP request received [id=%s]. Routing...", req.request_id);
 
         // 3) Route & send response (static, proxy, etc.)
-        route_request_tls(&req, buffer, total_read, config, ssl, NULL);
+        int route_result = route_request_tls(&req, buffer, total_read, config, ssl, NULL);
         
         struct timeval request_end;
         gettimeofday(&request_end, NULL);
@@ -1080,44 +1602,32 @@ static void handle_http1_connection(SSL *ssl, int client_fd, ServerConfig *confi
                                   (request_end.tv_usec - request_start.tv_usec) / (double)US_PER_MS;
         metrics_increment_request(req.method, req.path, 200);
         metrics_record_request_duration(request_duration);
+        if (route_result == ROUTE_CLOSE_CONNECTION)
+            return;
 
         // 4) Loop back to read the next request
         //    (do NOT shutdown/close here)
     }
-
-shutdown_and_close:
-    SSL_shutdown(ssl);
-    close(client_fd);
+    // handle_client() owns SSL_shutdown() and the socket
 }
 
-/* Worker task: uses thread-local io_uring for per-connection I/O */
+/* Worker task: uses the worker's persistent io_uring for per-connection I/O */
 void client_task(void *arg)
 {
     ClientTaskData *data = (ClientTaskData *)arg;
-    static __thread struct io_uring *local_ring = NULL;
-    if (!local_ring)
+    uring_worker_t *worker = uring_worker_get(data->config->cpu_affinity.enabled);
+    if (!worker)
     {
-        local_ring = malloc(sizeof(struct io_uring));
-        if (!local_ring || io_uring_queue_init(QUEUE_DEPTH, local_ring, 0) < 0)
-        {
-            log_message(LOG_LEVEL_ERROR, "Failed to initialize thread-local io_uring");
-            if (local_ring)
-            {
-                free(local_ring);
-                local_ring = NULL;
-            }
-            ip_limiter_decrement(&g_ip_limiter, data->client_ip);
-            close(data->client_fd);
-            free(data);
-            atomic_fetch_sub(&g_shutdown_ctx.in_flight_requests, 1);
-            metrics_set_active_connections(atomic_load(&g_shutdown_ctx.in_flight_requests));
-            return;
-        }
+        log_message(LOG_LEVEL_ERROR, "Failed to initialize thread-local io_uring");
+        ip_limiter_decrement(&g_ip_limiter, data->client_ip);
+        close(data->client_fd);
+        free(data);
+        atomic_fetch_sub(&g_shutdown_ctx.in_flight_requests, 1);
+        metrics_set_active_connections(atomic_load(&g_shutdown_ctx.in_flight_requests));
+        return;
     }
-    handle_client(data->client_fd, data->config, local_ring);
-    io_uring_queue_exit(local_ring);
-    free(local_ring);
-    local_ring = NULL;
+    handle_client(data->client_fd, data->config);
+    uring_worker_drain(worker);
     ip_limiter_decrement(&g_ip_limiter, data->client_ip);
     free(data);
     atomic_fetch_sub(&g_shutdown_ctx.in_flight_requests, 1);
@@ -1125,45 +1635,87 @@ void client_task(void *arg)
 }
 
 /* Main per-connection handler; performs nonblocking TLS handshake before dispatching via ALPN */
-void handle_client(int client_fd, ServerConfig *config, struct io_uring *ring)
+void handle_client(int client_fd, ServerConfig *config)
 {
     struct timeval timeout;
-    timeout.tv_sec = 5;
+    timeout.tv_sec = CLIENT_IO_TIMEOUT_MS / 1000;
     timeout.tv_usec = 0;
     setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
     setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    /* Peer address for X-Forwarded-For; the fd may leave the process table below */
+    char client_addr[HTTP_CLIENT_ADDR_LEN] = "";
+    struct sockaddr_storage peer;
+    socklen_t peer_len = sizeof(peer);
+    if (getpeername(client_fd, (struct sockaddr *)&peer, &peer_len) == 0)
+    {
+        if (peer.ss_family == AF_INET)
+            inet_ntop(AF_INET, &((struct sockaddr_in *)&peer)->sin_addr, client_addr, sizeof(client_addr));
+        else if (peer.ss_family == AF_INET6)
+            inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&peer)->sin6_addr, client_addr, sizeof(client_addr));
+    }
+
+    /* On a worker the socket moves into the ring's fixed-file table and
+     * leaves the process fd table for the rest of the connection. */
+    ClientConn conn = {.worker = uring_worker_current(), .fd = client_fd, .fixed = false};
+    int fixed_index = uring_worker_install_fd(conn.worker, client_fd);
+    if (fixed_index >= 0)
+    {
+        close(client_fd);
+        conn.fd = fixed_index;
+        conn.fixed = true;
+    }
+
     SSL *ssl = SSL_new(ssl_ctx);
     if (!ssl)
     {
-        close(client_fd);
+        client_conn_close(&conn);
         return;
     }
-    SSL_set_fd(ssl, client_fd);
+    /* Socket I/O goes through the worker ring when there is one; io_uring
+     * ignores SO_RCVTIMEO/SO_SNDTIMEO, so the BIO applies linked timeouts. */
+    BIO *bio = conn.worker ? uring_bio_new(conn.worker, conn.fd, conn.fixed) : NULL;
+    if (bio)
+    {
+        uring_bio_set_timeout(bio, config->tls_handshake_timeout_ms);
+        SSL_set_bio(ssl, bio, bio);
+    }
+    else if (conn.fixed)
+    {
+        SSL_free(ssl);
+        client_conn_close(&conn);
+        return;
+    }
+    else
+    {
+        SSL_set_fd(ssl, conn.fd);
+    }
     SSL_set_app_data(ssl, config);
-    if (perform_nonblocking_ssl_accept(ssl, client_fd, ring) <= 0)
+    if (perform_nonblocking_ssl_accept(ssl, &conn) <= 0)
     {
         log_message(LOG_LEVEL_ERROR, "Nonblocking SSL handshake failed");
         metrics_increment_tls_handshake(0);
         SSL_free(ssl);
-        close(client_fd);
+        client_conn_close(&conn);
         return;
     }
+    uring_bio_set_timeout(bio, CLIENT_IO_TIMEOUT_MS);
     const unsigned char *alpn_proto = NULL;
     unsigned int alpn_len = 0;
     SSL_get0_alpn_selected(ssl, &alpn_proto, &alpn_len);
     if (alpn_len == 2 && memcmp(alpn_proto, "h2", 2) == 0)
     {
         log_message(LOG_LEVEL_INFO, "Negotiated HTTP/2");
-        handle_http2_connection(ssl, client_fd, config, ring);
+        handle_http2_connection(ssl, &conn, config, client_addr);
     }
     else
     {
         log_message(LOG_LEVEL_INFO, "Negotiated HTTP/1.1");
-        handle_http1_connection(ssl, client_fd, config);
+        handle_http1_connection(ssl, config, client_addr);
     }
     SSL_shutdown(ssl);
     SSL_free(ssl);
-    close(client_fd);
+    client_conn_close(&conn);
 }
 
 /* Main server accept loop using a global io_uring instance */
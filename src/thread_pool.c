@@ -1,267 +1,521 @@
+/* thread_pool.c - Work-stealing thread pool
+ *
+ * Tasks submitted from outside the pool (the acceptor) go through a bounded
+ * MPMC injection queue; tasks submitted from inside a worker go to that
+ * worker's Chase-Lev deque. Idle workers steal from their peers' deques and
+ * park on a futex, so the submit path never takes a lock unless the pool has
+ * to grow.
+ *
+ * Workers are started with their CPU affinity already set (pinned round-robin
+ * to the configured CPU list, or to the mask of the thread that created the
+ * pool), so their stacks and everything they first-touch land on the local
+ * NUMA node.
+ */
 #include "thread_pool.h"
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
-#define TASK_QUEUE_INITIAL_CAPACITY 256
-#define THREAD_IDLE_TIMEOUT 5 // Idle timeout in seconds
+#define THREAD_IDLE_TIMEOUT 5        // Idle timeout in seconds
+#define INJECT_QUEUE_CAPACITY 4096   // Must be a power of two
+#define WORKER_DEQUE_CAPACITY 256    // Must be a power of two
+#define CACHE_LINE_SIZE 64
 
+// Slot of the injection queue (Vyukov bounded MPMC queue).
 typedef struct {
+    _Atomic size_t sequence;
     Task task;
-    char padding[64 - sizeof(Task)];
-} CacheAlignedTask;
+} InjectCell;
 
 typedef struct {
-    CacheAlignedTask *tasks;
-    size_t capacity;
-    volatile size_t count;
-    volatile size_t front;
-    volatile size_t rear;
-    char padding[64];
-} TaskQueue;
+    InjectCell *cells;
+    size_t mask;
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t enqueue_pos;
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t dequeue_pos;
+} InjectQueue;
+
+// Deque entries are read concurrently by thieves, so both fields are atomic.
+typedef struct {
+    _Atomic(void (*)(void *)) function;
+    _Atomic(void *) arg;
+} DequeSlot;
+
+// Chase-Lev deque: the owner pushes and pops at the bottom, thieves steal from the top.
+typedef struct {
+    DequeSlot *slots;
+    _Alignas(CACHE_LINE_SIZE) _Atomic long top;
+    _Alignas(CACHE_LINE_SIZE) _Atomic long bottom;
+} WorkerDeque;
 
 typedef struct {
     struct ThreadPool *pool;
     size_t index;
-} WorkerArg;
+    WorkerDeque deque;
+    pthread_t thread;
+    bool joinable;          // Thread has been created and not joined yet.
+} WorkerSlot;
 
 // The ThreadPool structure.
 struct ThreadPool {
-    pthread_mutex_t lock;   // Mutex to protect the pool and queue.
-    pthread_cond_t cond;    // Condition variable to signal new tasks.
-    TaskQueue queue;        // Task queue.
-    pthread_t *threads;     // Array of worker thread IDs.
-    WorkerArg *worker_args; // Worker thread arguments.
-    size_t num_threads;     // Current number of worker threads.
-    size_t threads_created; // Total threads created (upper bound for joins).
-    size_t min_threads;     // Minimum number of worker threads.
-    size_t max_threads;     // Maximum number of worker threads.
-    size_t *free_indices;   // Stack of reusable thread slots.
-    size_t free_count;      // Number of reusable slots.
-    bool shutdown;          // Flag to signal shutdown.
+    InjectQueue inject;             // Tasks submitted from outside the pool.
+    WorkerSlot *workers;            // Per-slot worker state (max_threads entries).
+    size_t min_threads;             // Minimum number of worker threads.
+    size_t max_threads;             // Maximum number of worker threads.
+    _Atomic size_t threads_created; // Slots ever used (upper bound for steals and joins).
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t num_threads; // Current number of worker threads.
+    _Atomic size_t active;          // Workers currently running a task.
+    _Atomic size_t queued;          // Tasks submitted but not yet started.
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t wake_seq; // Futex word for parked workers.
+    _Atomic size_t sleepers;        // Workers parked (or about to park) on wake_seq.
+    _Atomic bool shutdown;          // Flag to signal shutdown.
+    int *cpus;                      // CPUs workers are pinned to (round-robin), or NULL.
+    size_t cpu_count;               // Number of entries in cpus.
+    cpu_set_t default_mask;         // Affinity of the creating thread, used when cpus is NULL.
+    bool has_default_mask;          // Whether default_mask could be read.
+    pthread_mutex_t lock;           // Protects thread creation, retirement and free_indices.
+    size_t *free_indices;           // Stack of reusable thread slots.
+    size_t free_count;              // Number of reusable slots.
 };
 
-// Initializes the task queue.
-static bool task_queue_init(TaskQueue *queue) {
-    queue->capacity = TASK_QUEUE_INITIAL_CAPACITY;
-    queue->tasks = malloc(queue->capacity * sizeof(CacheAlignedTask));
-    queue->count = 0;
-    queue->front = 0;
-    queue->rear = 0;
-    return queue->tasks != NULL;
+// Worker slot of the calling thread, NULL outside the pool.
+static __thread WorkerSlot *current_worker = NULL;
+
+static void futex_wait(_Atomic uint32_t *addr, uint32_t expected, const struct timespec *timeout) {
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *addr, int count) {
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
 }
 
-// Destroys the task queue.
-static void task_queue_destroy(TaskQueue *queue) {
-    free(queue->tasks);
+static bool inject_queue_init(InjectQueue *queue, size_t capacity) {
+    queue->cells = malloc(capacity * sizeof(InjectCell));
+    if (!queue->cells)
+        return false;
+    for (size_t i = 0; i < capacity; i++)
+        atomic_init(&queue->cells[i].sequence, i);
+    queue->mask = capacity - 1;
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+    return true;
+}
+
+static void inject_queue_destroy(InjectQueue *queue) {
+    free(queue->cells);
 }
 
-// Pushes a task onto the task queue; returns true on success.
-static bool task_queue_push(TaskQueue *queue, Task task) {
-    if (queue->count == queue->capacity) {
-        size_t new_capacity = queue->capacity * 2;
-        CacheAlignedTask *new_tasks = malloc(new_capacity * sizeof(CacheAlignedTask));
-        if (!new_tasks) return false;
+// Pushes a task onto the injection queue; returns false if the queue is full.
+static bool inject_queue_push(InjectQueue *queue, Task task) {
+    size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        InjectCell *cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->task = task;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
 
-        if (queue->front > 0) {
-            for (size_t i = 0; i < queue->count; i++) {
-                new_tasks[i].task = queue->tasks[(queue->front + i) % queue->capacity].task;
+// Pops a task from the injection queue; returns true if a task was retrieved.
+static bool inject_queue_pop(InjectQueue *queue, Task *task) {
+    size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        InjectCell *cell = &queue->cells[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                *task = cell->task;
+                atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+                return true;
             }
-            queue->front = 0;
-            queue->rear = queue->count;
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
         }
-        free(queue->tasks);
-        queue->tasks = new_tasks;
-        queue->capacity = new_capacity;
     }
+}
+
+static bool worker_deque_init(WorkerDeque *deque) {
+    deque->slots = calloc(WORKER_DEQUE_CAPACITY, sizeof(DequeSlot));
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    return deque->slots != NULL;
+}
+
+// Owner-only push; returns false if the deque is full.
+static bool worker_deque_push(WorkerDeque *deque, Task task) {
+    long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (b - t >= WORKER_DEQUE_CAPACITY)
+        return false;
+    DequeSlot *slot = &deque->slots[b & (WORKER_DEQUE_CAPACITY - 1)];
+    atomic_store_explicit(&slot->function, task.function, memory_order_relaxed);
+    atomic_store_explicit(&slot->arg, task.arg, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    return true;
+}
 
-    queue->tasks[queue->rear].task = task;
-    queue->rear = (queue->rear + 1) % queue->capacity;
-    queue->count++;
+// Owner-only pop from the bottom (LIFO).
+static bool worker_deque_pop(WorkerDeque *deque, Task *task) {
+    long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        return false;
+    }
+    DequeSlot *slot = &deque->slots[b & (WORKER_DEQUE_CAPACITY - 1)];
+    task->function = atomic_load_explicit(&slot->function, memory_order_relaxed);
+    task->arg = atomic_load_explicit(&slot->arg, memory_order_relaxed);
+    if (t == b) {
+        // Last entry: race against thieves for it.
+        bool won = atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                                                           memory_order_seq_cst,
+                                                           memory_order_relaxed);
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        return won;
+    }
     return true;
 }
 
-// Pops a task from the task queue; returns true if a task was retrieved.
-static bool task_queue_pop(TaskQueue *queue, Task *task) {
-    if (queue->count == 0) return false;
-    
-    *task = queue->tasks[queue->front].task;
-    queue->front = (queue->front + 1) % queue->capacity;
-    queue->count--;
+// Steals the oldest entry from another worker's deque (FIFO).
+static bool worker_deque_steal(WorkerDeque *deque, Task *task) {
+    long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (t >= b)
+        return false;
+    DequeSlot *slot = &deque->slots[t & (WORKER_DEQUE_CAPACITY - 1)];
+    task->function = atomic_load_explicit(&slot->function, memory_order_relaxed);
+    task->arg = atomic_load_explicit(&slot->arg, memory_order_relaxed);
+    return atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                                                   memory_order_seq_cst,
+                                                   memory_order_relaxed);
+}
+
+// Looks for work: own deque first, then the injection queue, then peers.
+static bool find_task(ThreadPool *pool, WorkerSlot *self, Task *task) {
+    if (worker_deque_pop(&self->deque, task))
+        return true;
+    if (inject_queue_pop(&pool->inject, task))
+        return true;
+
+    size_t created = atomic_load_explicit(&pool->threads_created, memory_order_acquire);
+    for (size_t i = 1; i < created; i++) {
+        WorkerSlot *victim = &pool->workers[(self->index + i) % created];
+        if (victim->deque.slots && worker_deque_steal(&victim->deque, task))
+            return true;
+    }
+    return false;
+}
+
+static void wake_one(ThreadPool *pool) {
+    atomic_fetch_add(&pool->wake_seq, 1);
+    if (atomic_load(&pool->sleepers) > 0)
+        futex_wake(&pool->wake_seq, 1);
+}
+
+static void wake_all(ThreadPool *pool) {
+    atomic_fetch_add(&pool->wake_seq, 1);
+    futex_wake(&pool->wake_seq, INT_MAX);
+}
+
+static void run_task(ThreadPool *pool, Task *task) {
+    atomic_fetch_add(&pool->active, 1);
+    atomic_fetch_sub(&pool->queued, 1);
+    task->function(task->arg);
+    atomic_fetch_sub(&pool->active, 1);
+}
+
+static void *worker_thread(void *arg);
+
+// Starts a worker in a free slot. Caller must hold pool->lock.
+static bool spawn_worker_locked(ThreadPool *pool) {
+    size_t created = atomic_load(&pool->threads_created);
+    size_t index;
+    if (pool->free_count > 0)
+        index = pool->free_indices[--pool->free_count];
+    else if (created < pool->max_threads)
+        index = created;
+    else
+        return false;
+
+    WorkerSlot *slot = &pool->workers[index];
+    if (!slot->deque.slots && !worker_deque_init(&slot->deque)) {
+        if (index != created)
+            pool->free_indices[pool->free_count++] = index;
+        return false;
+    }
+    // A reused slot belongs to a retired thread that has already left its loop.
+    if (slot->joinable) {
+        pthread_join(slot->thread, NULL);
+        slot->joinable = false;
+    }
+
+    // Set affinity at creation time: a worker spawned from the acceptor would
+    // otherwise inherit the acceptor's pinning.
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (pool->cpu_count > 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(pool->cpus[index % pool->cpu_count], &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    } else if (pool->has_default_mask) {
+        pthread_attr_setaffinity_np(&attr, sizeof(pool->default_mask), &pool->default_mask);
+    }
+
+    atomic_fetch_add(&pool->num_threads, 1);
+    int rc = pthread_create(&slot->thread, &attr, worker_thread, slot);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        atomic_fetch_sub(&pool->num_threads, 1);
+        if (index != created)
+            pool->free_indices[pool->free_count++] = index;
+        return false;
+    }
+    slot->joinable = true;
+    if (index == created)
+        atomic_store_explicit(&pool->threads_created, created + 1, memory_order_release);
     return true;
 }
 
-static void mark_thread_exit(ThreadPool *pool, size_t index) {
-    if (pool->free_count < pool->max_threads) {
-        pool->free_indices[pool->free_count++] = index;
+// Retires an idle worker if the pool is above min_threads and no work is pending.
+static bool try_retire_worker(ThreadPool *pool, WorkerSlot *self) {
+    pthread_mutex_lock(&pool->lock);
+    if (atomic_load(&pool->num_threads) <= pool->min_threads) {
+        pthread_mutex_unlock(&pool->lock);
+        return false;
+    }
+    atomic_fetch_sub(&pool->num_threads, 1);
+    // Pairs with the growth check in thread_pool_add_task(): either the submitter
+    // sees the lower thread count and spawns, or we see its task and stay.
+    if (atomic_load(&pool->queued) > 0) {
+        atomic_fetch_add(&pool->num_threads, 1);
+        pthread_mutex_unlock(&pool->lock);
+        return false;
     }
-    if (pool->num_threads > 0) {
-        pool->num_threads--;
+    pool->free_indices[pool->free_count++] = self->index;
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+static void idle_deadline_reset(struct timespec *deadline) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += THREAD_IDLE_TIMEOUT;
+}
+
+// Returns the time left until 'deadline', or false if it has already passed.
+static bool idle_time_left(const struct timespec *deadline, struct timespec *left) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    left->tv_sec = deadline->tv_sec - now.tv_sec;
+    left->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (left->tv_nsec < 0) {
+        left->tv_sec--;
+        left->tv_nsec += 1000000000L;
     }
+    return left->tv_sec >= 0;
 }
 
-// Worker thread function. Each thread waits for tasks and executes them.
+// Worker thread function. Each thread runs local, injected or stolen tasks and
+// parks on the pool futex when there is nothing to do.
 static void *worker_thread(void *arg) {
-    WorkerArg *warg = (WorkerArg *)arg;
-    ThreadPool *pool = warg->pool;
-    size_t index = warg->index;
+    WorkerSlot *self = (WorkerSlot *)arg;
+    ThreadPool *pool = self->pool;
+    struct timespec deadline;
     Task task;
-    while (1) {
-        pthread_mutex_lock(&pool->lock);
-        // Wait for a task if the queue is empty.
-        while (pool->queue.count == 0 && !pool->shutdown) {
-            // Wait with a timeout to allow dynamic thread reduction.
-            struct timespec ts;
-            clock_gettime(CLOCK_REALTIME, &ts);
-            ts.tv_sec += THREAD_IDLE_TIMEOUT;
-            int ret = pthread_cond_timedwait(&pool->cond, &pool->lock, &ts);
-            // If timed out and still no task, consider exiting.
-            if (ret == ETIMEDOUT && pool->queue.count == 0) {
-                if (pool->num_threads > pool->min_threads) {
-                    mark_thread_exit(pool, index);
-                    pthread_mutex_unlock(&pool->lock);
-                    pthread_exit(NULL);
-                }
-            }
+
+    current_worker = self;
+    idle_deadline_reset(&deadline);
+    while (!atomic_load(&pool->shutdown)) {
+        if (find_task(pool, self, &task)) {
+            run_task(pool, &task);
+            idle_deadline_reset(&deadline);
+            continue;
         }
-        // If shutdown has been signaled, exit the thread.
-        if (pool->shutdown) {
-            mark_thread_exit(pool, index);
-            pthread_mutex_unlock(&pool->lock);
-            pthread_exit(NULL);
+
+        // Announce that we are going to sleep, then look once more: a submitter
+        // either sees us in 'sleepers' and wakes us, or we see its task here.
+        atomic_fetch_add(&pool->sleepers, 1);
+        uint32_t seq = atomic_load(&pool->wake_seq);
+        if (atomic_load(&pool->shutdown)) {
+            atomic_fetch_sub(&pool->sleepers, 1);
+            break;
         }
-        // Retrieve the next task from the queue.
-        bool has_task = task_queue_pop(&pool->queue, &task);
-        pthread_mutex_unlock(&pool->lock);
-        if (has_task) {
-            // Execute the task.
-            task.function(task.arg);
+        if (find_task(pool, self, &task)) {
+            atomic_fetch_sub(&pool->sleepers, 1);
+            run_task(pool, &task);
+            idle_deadline_reset(&deadline);
+            continue;
+        }
+        struct timespec left;
+        bool timed_out = !idle_time_left(&deadline, &left);
+        if (!timed_out)
+            futex_wait(&pool->wake_seq, seq, &left);
+        atomic_fetch_sub(&pool->sleepers, 1);
+
+        // Wait with a timeout to allow dynamic thread reduction.
+        if (timed_out || !idle_time_left(&deadline, &left)) {
+            if (try_retire_worker(pool, self))
+                break;
+            idle_deadline_reset(&deadline);
         }
     }
+    current_worker = NULL;
     return NULL;
 }
 
+static void thread_pool_free(ThreadPool *pool) {
+    for (size_t i = 0; i < pool->max_threads; i++)
+        free(pool->workers[i].deque.slots);
+    free(pool->workers);
+    free(pool->free_indices);
+    free(pool->cpus);
+    inject_queue_destroy(&pool->inject);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
 // Creates a new thread pool with dynamic resizing capabilities.
 ThreadPool *thread_pool_create(size_t min_threads, size_t max_threads) {
-    ThreadPool *pool = malloc(sizeof(ThreadPool));
-    if (!pool)
-        return NULL;
-    if (max_threads == 0) {
-        free(pool);
+    return thread_pool_create_pinned(min_threads, max_threads, NULL, 0);
+}
+
+// Creates a thread pool whose workers are pinned round-robin to 'cpus'.
+ThreadPool *thread_pool_create_pinned(size_t min_threads, size_t max_threads,
+                                      const int *cpus, size_t cpu_count) {
+    if (max_threads == 0)
         return NULL;
-    }
     if (min_threads == 0)
         min_threads = 1;
     if (min_threads > max_threads)
         min_threads = max_threads;
+
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (!pool)
+        return NULL;
     pool->min_threads = min_threads;
     pool->max_threads = max_threads;
-    pool->num_threads = min_threads;
-    pool->threads_created = 0;
-    pool->shutdown = false;
+    atomic_init(&pool->threads_created, 0);
+    atomic_init(&pool->num_threads, 0);
+    atomic_init(&pool->active, 0);
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->wake_seq, 0);
+    atomic_init(&pool->sleepers, 0);
+    atomic_init(&pool->shutdown, false);
     pthread_mutex_init(&pool->lock, NULL);
-    pthread_cond_init(&pool->cond, NULL);
-    if (!task_queue_init(&pool->queue)) {
+    if (!inject_queue_init(&pool->inject, INJECT_QUEUE_CAPACITY)) {
         pthread_mutex_destroy(&pool->lock);
-        pthread_cond_destroy(&pool->cond);
         free(pool);
         return NULL;
     }
-    pool->threads = malloc(max_threads * sizeof(pthread_t));
-    pool->worker_args = malloc(max_threads * sizeof(WorkerArg));
+    pool->workers = calloc(max_threads, sizeof(WorkerSlot));
     pool->free_indices = malloc(max_threads * sizeof(size_t));
     pool->free_count = 0;
-    if (!pool->threads || !pool->worker_args || !pool->free_indices) {
-        free(pool->threads);
-        free(pool->worker_args);
-        free(pool->free_indices);
-        task_queue_destroy(&pool->queue);
-        pthread_mutex_destroy(&pool->lock);
-        pthread_cond_destroy(&pool->cond);
-        free(pool);
+    if (cpus && cpu_count > 0) {
+        pool->cpus = malloc(cpu_count * sizeof(int));
+        if (pool->cpus) {
+            memcpy(pool->cpus, cpus, cpu_count * sizeof(int));
+            pool->cpu_count = cpu_count;
+        }
+    } else {
+        CPU_ZERO(&pool->default_mask);
+        pool->has_default_mask = pthread_getaffinity_np(pthread_self(), sizeof(pool->default_mask),
+                                                        &pool->default_mask) == 0;
+    }
+    if (!pool->workers || !pool->free_indices || (cpu_count > 0 && cpus && !pool->cpus)) {
+        free(pool->workers);
+        pool->workers = NULL;
+        pool->max_threads = 0;
+        thread_pool_free(pool);
         return NULL;
     }
+    for (size_t i = 0; i < max_threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+    }
+
     // Create the initial minimum number of worker threads.
+    pthread_mutex_lock(&pool->lock);
     for (size_t i = 0; i < min_threads; i++) {
-        pool->worker_args[i].pool = pool;
-        pool->worker_args[i].index = i;
-        if (pthread_create(&pool->threads[i], NULL, worker_thread, &pool->worker_args[i]) != 0) {
-            pool->shutdown = true;
-            pthread_cond_broadcast(&pool->cond);
-            for (size_t j = 0; j < pool->threads_created; j++)
-                pthread_join(pool->threads[j], NULL);
-            free(pool->threads);
-            free(pool->worker_args);
-            free(pool->free_indices);
-            task_queue_destroy(&pool->queue);
-            pthread_mutex_destroy(&pool->lock);
-            pthread_cond_destroy(&pool->cond);
-            free(pool);
+        if (!spawn_worker_locked(pool)) {
+            pthread_mutex_unlock(&pool->lock);
+            thread_pool_destroy(pool);
             return NULL;
         }
-        pool->threads_created++;
     }
+    pthread_mutex_unlock(&pool->lock);
     return pool;
 }
 
-// Adds a task to the thread pool. If the task queue length exceeds the current number
-// of threads and we have not reached max_threads, a new thread is spawned.
+// Adds a task to the thread pool. If more tasks are waiting than there are idle
+// workers and we have not reached max_threads, a new thread is spawned.
 bool thread_pool_add_task(ThreadPool *pool, void (*function)(void *), void *arg) {
-    pthread_mutex_lock(&pool->lock);
-    
-    if (pool->shutdown) {
-        pthread_mutex_unlock(&pool->lock);
+    if (atomic_load(&pool->shutdown))
         return false;
-    }
 
     Task task = {function, arg};
-    if (!task_queue_push(&pool->queue, task)) {
-        pthread_mutex_unlock(&pool->lock);
+    WorkerSlot *self = current_worker;
+    atomic_fetch_add(&pool->queued, 1);
+    bool pushed = self && self->pool == pool && worker_deque_push(&self->deque, task);
+    if (!pushed && !inject_queue_push(&pool->inject, task)) {
+        atomic_fetch_sub(&pool->queued, 1);
         return false;
     }
 
-    if (pool->queue.count > pool->num_threads && pool->num_threads < pool->max_threads) {
-        size_t index;
-        if (pool->free_count > 0) {
-            index = pool->free_indices[--pool->free_count];
-        } else {
-            if (pool->threads_created >= pool->max_threads) {
-                index = pool->max_threads;
-            } else {
-                index = pool->threads_created++;
-            }
-        }
-        if (index < pool->max_threads) {
-            pool->worker_args[index].pool = pool;
-            pool->worker_args[index].index = index;
-            if (pthread_create(&pool->threads[index], NULL, worker_thread, &pool->worker_args[index]) == 0) {
-                pool->num_threads++;
-            }
-        }
+    size_t threads = atomic_load(&pool->num_threads);
+    if (threads < pool->max_threads &&
+        atomic_load(&pool->queued) + atomic_load(&pool->active) > threads) {
+        pthread_mutex_lock(&pool->lock);
+        threads = atomic_load(&pool->num_threads);
+        if (!atomic_load(&pool->shutdown) && threads < pool->max_threads &&
+            atomic_load(&pool->queued) + atomic_load(&pool->active) > threads)
+            spawn_worker_locked(pool);
+        pthread_mutex_unlock(&pool->lock);
     }
 
-    pthread_cond_signal(&pool->cond);
-    pthread_mutex_unlock(&pool->lock);
+    wake_one(pool);
     return true;
 }
 
 // Destroys the thread pool by signaling shutdown and joining all threads.
 void thread_pool_destroy(ThreadPool *pool) {
     pthread_mutex_lock(&pool->lock);
-    pool->shutdown = true;
-    pthread_cond_broadcast(&pool->cond);
+    atomic_store(&pool->shutdown, true);
     pthread_mutex_unlock(&pool->lock);
-    // Join all threads that were created.
-    for (size_t i = 0; i < pool->threads_created; i++) {
-        pthread_join(pool->threads[i], NULL);
+    wake_all(pool);
+
+    size_t created = atomic_load(&pool->threads_created);
+    for (size_t i = 0; i < created; i++) {
+        if (pool->workers[i].joinable) {
+            pthread_join(pool->workers[i].thread, NULL);
+            pool->workers[i].joinable = false;
+        }
     }
-    free(pool->threads);
-    free(pool->worker_args);
-    free(pool->free_indices);
-    task_queue_destroy(&pool->queue);
-    pthread_mutex_destroy(&pool->lock);
-    pthread_cond_destroy(&pool->cond);
-    free(pool);
+    thread_pool_free(pool);
 }
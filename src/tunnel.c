@@ -0,0 +1,253 @@
+/* tunnel.c - Full-duplex relay for upgraded and tunnelled connections
+ *
+ * Both sockets are switched to non-blocking mode and each direction owns a
+ * fixed buffer. A direction reads only once its buffer has been written out
+ * completely, so a slow reader on one side stalls its writer on the other
+ * (backpressure) without holding up the opposite direction. When neither
+ * direction can move, the loop waits for the sockets it is blocked on:
+ * through the worker's io_uring when the client is on an io_uring BIO (its
+ * socket may only exist in the ring's fixed-file table), with poll()
+ * otherwise.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "tunnel.h"
+#include "uring_io.h"
+#include "log.h"
+
+typedef struct {
+    char data[TUNNEL_BUFFER_SIZE];
+    size_t off;
+    size_t len;
+} tunnel_buf_t;
+
+typedef enum {
+    PUMP_IDLE = 0,      /* blocked, waiting for the events requested */
+    PUMP_PROGRESS,      /* moved bytes, may move more */
+    PUMP_EOF,           /* the source side closed and everything was delivered */
+    PUMP_ERROR          /* a side failed; the tunnel ends */
+} pump_result_t;
+
+typedef struct {
+    SSL *ssl;
+    int backend_fd;
+    tunnel_buf_t up;                    /* client to backend */
+    tunnel_buf_t down;                  /* backend to client */
+    bool client_eof;
+    bool backend_eof;
+    short client_events;
+    short backend_events;
+    tunnel_stats_t stats;
+} tunnel_t;
+
+/* Client to backend */
+static pump_result_t pump_up(tunnel_t *t)
+{
+    pump_result_t result = PUMP_IDLE;
+
+    for (int burst = 0; burst < TUNNEL_MAX_BURST; burst++) {
+        if (t->up.len == 0) {
+            if (t->client_eof) {
+                return PUMP_EOF;
+            }
+            int n = SSL_read(t->ssl, t->up.data, sizeof(t->up.data));
+            if (n <= 0) {
+                switch (SSL_get_error(t->ssl, n)) {
+                case SSL_ERROR_WANT_READ:
+                    t->client_events |= POLLIN;
+                    return result;
+                case SSL_ERROR_WANT_WRITE:
+                    t->client_events |= POLLOUT;
+                    return result;
+                case SSL_ERROR_ZERO_RETURN:
+                    /* close_notify: the client is done sending */
+                    t->client_eof = true;
+                    return PUMP_EOF;
+                default:
+                    return PUMP_ERROR;
+                }
+            }
+            t->up.off = 0;
+            t->up.len = (size_t)n;
+            result = PUMP_PROGRESS;
+        }
+
+        ssize_t sent = send(t->backend_fd, t->up.data + t->up.off, t->up.len,
+                            MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                t->backend_events |= POLLOUT;
+                return result;
+            }
+            return PUMP_ERROR;
+        }
+        t->up.off += (size_t)sent;
+        t->up.len -= (size_t)sent;
+        t->stats.bytes_to_backend += (unsigned long long)sent;
+        result = PUMP_PROGRESS;
+    }
+    return result;
+}
+
+/* Backend to client */
+static pump_result_t pump_down(tunnel_t *t)
+{
+    pump_result_t result = PUMP_IDLE;
+
+    for (int burst = 0; burst < TUNNEL_MAX_BURST; burst++) {
+        if (t->down.len == 0) {
+            if (t->backend_eof) {
+                return PUMP_EOF;
+            }
+            ssize_t n = recv(t->backend_fd, t->down.data, sizeof(t->down.data), MSG_DONTWAIT);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    t->backend_events |= POLLIN;
+                    return result;
+                }
+                return PUMP_ERROR;
+            }
+            if (n == 0) {
+                t->backend_eof = true;
+                return PUMP_EOF;
+            }
+            t->down.off = 0;
+            t->down.len = (size_t)n;
+            result = PUMP_PROGRESS;
+        }
+
+        /* A retried SSL_write gets the same buffer and length back */
+        int written = SSL_write(t->ssl, t->down.data + t->down.off, (int)t->down.len);
+        if (written <= 0) {
+            switch (SSL_get_error(t->ssl, written)) {
+            case SSL_ERROR_WANT_WRITE:
+                t->client_events |= POLLOUT;
+                return result;
+            case SSL_ERROR_WANT_READ:
+                t->client_events |= POLLIN;
+                return result;
+            default:
+                return PUMP_ERROR;
+            }
+        }
+        t->down.off += (size_t)written;
+        t->down.len -= (size_t)written;
+        t->stats.bytes_to_client += (unsigned long long)written;
+        result = PUMP_PROGRESS;
+    }
+    return result;
+}
+
+/* Returns the number of ready sockets, 0 on timeout, -1 on error */
+static int wait_for_sockets(tunnel_t *t, uring_worker_t *worker, int client_fd, bool fixed,
+                            int timeout_ms)
+{
+    if (worker) {
+        uring_poll_target_t targets[2] = {
+            {.fd = client_fd, .fixed = fixed, .events = t->client_events},
+            {.fd = t->backend_fd, .fixed = false, .events = t->backend_events}
+        };
+        return uring_worker_poll_many(worker, targets, 2, timeout_ms);
+    }
+
+    struct pollfd pfds[2] = {
+        {.fd = t->client_events ? client_fd : -1, .events = t->client_events},
+        {.fd = t->backend_events ? t->backend_fd : -1, .events = t->backend_events}
+    };
+    int ret;
+    do {
+        ret = poll(pfds, 2, timeout_ms > 0 ? timeout_ms : -1);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+int tunnel_relay(SSL *ssl, int backend_fd, int idle_timeout_ms, tunnel_stats_t *stats)
+{
+    if (!ssl || backend_fd < 0) {
+        return -1;
+    }
+
+    BIO *bio = SSL_get_rbio(ssl);
+    uring_worker_t *worker = NULL;
+    int client_fd = -1;
+    bool fixed = false;
+    if (uring_bio_get_socket(bio, &worker, &client_fd, &fixed) != 0) {
+        worker = NULL;
+        client_fd = SSL_get_fd(ssl);
+    }
+    if (client_fd < 0) {
+        log_message(LOG_LEVEL_ERROR, "Tunnel needs a socket-backed TLS connection");
+        return -1;
+    }
+
+    tunnel_t *t = calloc(1, sizeof(*t));
+    if (!t) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate tunnel buffers");
+        return -1;
+    }
+    t->ssl = ssl;
+    t->backend_fd = backend_fd;
+
+    /* A fixed-file socket has no fd to flip; the BIO uses MSG_DONTWAIT instead */
+    int backend_flags = fcntl(backend_fd, F_GETFL, 0);
+    fcntl(backend_fd, F_SETFL, backend_flags | O_NONBLOCK);
+    int client_flags = fixed ? -1 : fcntl(client_fd, F_GETFL, 0);
+    if (client_flags >= 0) {
+        fcntl(client_fd, F_SETFL, client_flags | O_NONBLOCK);
+    }
+    uring_bio_set_nonblocking(bio, true);
+
+    bool half_closed = false;
+    for (;;) {
+        t->client_events = 0;
+        t->backend_events = 0;
+
+        pump_result_t up = pump_up(t);
+        pump_result_t down = pump_down(t);
+        if (up == PUMP_ERROR || down == PUMP_ERROR || down == PUMP_EOF) {
+            /* TLS cannot half-close, so the backend closing ends the tunnel */
+            break;
+        }
+        if (up == PUMP_EOF && !half_closed) {
+            shutdown(backend_fd, SHUT_WR);
+            half_closed = true;
+        }
+        if (up == PUMP_PROGRESS || down == PUMP_PROGRESS) {
+            continue;
+        }
+        if (t->client_events == 0 && t->backend_events == 0) {
+            break;
+        }
+
+        int ready = wait_for_sockets(t, worker, client_fd, fixed, idle_timeout_ms);
+        if (ready == 0) {
+            t->stats.idle_timeout = true;
+            break;
+        }
+        if (ready < 0) {
+            break;
+        }
+    }
+
+    uring_bio_set_nonblocking(bio, false);
+    if (client_flags >= 0) {
+        fcntl(client_fd, F_SETFL, client_flags);
+    }
+    fcntl(backend_fd, F_SETFL, backend_flags);
+
+    log_message(LOG_LEVEL_DEBUG, "Tunnel closed: %llu bytes up, %llu bytes down%s",
+                t->stats.bytes_to_backend, t->stats.bytes_to_client,
+                t->stats.idle_timeout ? " (idle timeout)" : "");
+    if (stats) {
+        *stats = t->stats;
+    }
+    free(t);
+    return 0;
+}
@@ -0,0 +1,768 @@
+/* upstream.c - Upstream clusters and load balancing
+ *
+ * A reverse proxy route forwards to a cluster of endpoints, each with its
+ * own connection pool, health checker and circuit breaker. Every request
+ * picks one endpoint with the route's policy:
+ *   - round_robin:   rotate through the endpoints
+ *   - least_request: fewest outstanding requests (full scan)
+ *   - p2c:           fewer outstanding of two random endpoints
+ *   - ewma:          two random endpoints, lower latency EWMA x load
+ *   - maglev:        consistent hash of a request key, for affinity
+ * Endpoints failing health checks or behind an open circuit breaker are
+ * skipped while any other endpoint is available.
+ *
+ * With outlier detection, the responses themselves also take endpoints
+ * out of rotation (ejection), with no probes involved:
+ *   - a run of consecutive 5xx or failed exchanges, as it happens
+ *   - an error rate over 'failure_percent' within an interval
+ *   - a p95 latency over 'latency_factor' times the cluster median, so
+ *     slow endpoints go as well as failing ones
+ * Interval statistics are swept by whichever release comes due first. An
+ * ejection lasts the base time multiplied by the ejections in a row, and
+ * no more of the cluster is ejected than 'max_ejection_percent' allows.
+ *
+ * With a concurrency limit, each endpoint admits only so many requests in
+ * flight, and the limit follows the backend's response times (gradient2):
+ * while the recent average holds near the long-term baseline it grows
+ * into spare capacity, and once queueing at the backend raises it the
+ * limit shrinks in proportion. Requests over the limit are shed with a
+ * 503 before they take a connection.
+ *
+ * With a retry policy, idempotent requests that fail are resent to another
+ * endpoint, and slow ones may be hedged. Both spend a token bucket that
+ * every request tops up by 'budget_percent' of a retry, so at most that
+ * share of the traffic is sent twice, plus a burst while it is quiet.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "upstream.h"
+#include "log.h"
+
+#define MAGLEV_EMPTY_SLOT 0xFF
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+#define MAGLEV_OFFSET_SEED 0x9e3779b97f4a7c15ULL
+#define MAGLEV_SKIP_SEED 0xc2b2ae3d27d4eb4fULL
+
+static __thread uint64_t rng_state = 0;
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static uint64_t hash_bytes(const void *data, size_t len, uint64_t seed)
+{
+    const unsigned char *bytes = data;
+    uint64_t hash = FNV_OFFSET_BASIS ^ seed;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    /* FNV alone spreads short, similar keys poorly over a prime modulus */
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static uint32_t random_below(uint32_t bound)
+{
+    if (rng_state == 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        rng_state = hash_bytes(&ts, sizeof(ts), (uint64_t)(uintptr_t)&rng_state) | 1;
+    }
+    /* xorshift64* */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)(((rng_state * 0x2545f4914f6cdd1dULL) >> 32) % bound);
+}
+
+static int build_maglev_table(upstream_cluster_t *cluster)
+{
+    uint64_t offset[MAX_ROUTE_BACKENDS];
+    uint64_t skip[MAX_ROUTE_BACKENDS];
+    uint64_t next[MAX_ROUTE_BACKENDS];
+    int n = cluster->count;
+
+    if (!cluster->maglev_table) {
+        cluster->maglev_table = malloc(UPSTREAM_MAGLEV_TABLE_SIZE);
+        if (!cluster->maglev_table) {
+            log_message(LOG_LEVEL_ERROR, "Failed to allocate Maglev table");
+            return -1;
+        }
+    }
+    memset(cluster->maglev_table, MAGLEV_EMPTY_SLOT, UPSTREAM_MAGLEV_TABLE_SIZE);
+
+    for (int i = 0; i < n; i++) {
+        const char *name = cluster->endpoints[i].name;
+        offset[i] = hash_bytes(name, strlen(name), MAGLEV_OFFSET_SEED) % UPSTREAM_MAGLEV_TABLE_SIZE;
+        skip[i] = hash_bytes(name, strlen(name), MAGLEV_SKIP_SEED) % (UPSTREAM_MAGLEV_TABLE_SIZE - 1) + 1;
+        next[i] = 0;
+    }
+
+    /* Endpoints take turns claiming the next free slot of their own
+     * permutation until the table is full */
+    int filled = 0;
+    while (filled < UPSTREAM_MAGLEV_TABLE_SIZE) {
+        for (int i = 0; i < n && filled < UPSTREAM_MAGLEV_TABLE_SIZE; i++) {
+            uint64_t slot = (offset[i] + next[i] * skip[i]) % UPSTREAM_MAGLEV_TABLE_SIZE;
+            while (cluster->maglev_table[slot] != MAGLEV_EMPTY_SLOT) {
+                next[i]++;
+                slot = (offset[i] + next[i] * skip[i]) % UPSTREAM_MAGLEV_TABLE_SIZE;
+            }
+            cluster->maglev_table[slot] = (uint8_t)i;
+            next[i]++;
+            filled++;
+        }
+    }
+    return 0;
+}
+
+upstream_cluster_t *upstream_cluster_create(LoadBalancerPolicy policy, const char *hash_header)
+{
+    upstream_cluster_t *cluster = calloc(1, sizeof(*cluster));
+    if (!cluster) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate upstream cluster");
+        return NULL;
+    }
+
+    cluster->policy = policy;
+    if (hash_header) {
+        snprintf(cluster->hash_header, sizeof(cluster->hash_header), "%s", hash_header);
+    }
+    atomic_init(&cluster->rr_next, 0);
+    atomic_init(&cluster->next_sweep_ms, 0);
+    pthread_mutex_init(&cluster->eject_lock, NULL);
+    return cluster;
+}
+
+/* Takes ownership of 'pool'. Startup only: not safe against concurrent picks. */
+int upstream_cluster_add_endpoint(upstream_cluster_t *cluster, const char *name,
+                                  backend_pool_t *pool)
+{
+    if (!cluster || !name || !pool || cluster->count >= MAX_ROUTE_BACKENDS) {
+        return -1;
+    }
+
+    upstream_endpoint_t *endpoint = &cluster->endpoints[cluster->count];
+    memset(endpoint, 0, sizeof(*endpoint));
+    endpoint->cluster = cluster;
+    endpoint->pool = pool;
+    snprintf(endpoint->name, sizeof(endpoint->name), "%s", name);
+    atomic_init(&endpoint->outstanding, 0);
+    atomic_init(&endpoint->ewma_us, 0);
+    atomic_init(&endpoint->total_requests, 0);
+    atomic_init(&endpoint->concurrency_limit, 0);
+    pthread_mutex_init(&endpoint->limit_lock, NULL);
+    cluster->count++;
+
+    if (cluster->policy == LB_MAGLEV && build_maglev_table(cluster) != 0) {
+        cluster->count--;
+        return -1;
+    }
+    return 0;
+}
+
+void upstream_cluster_destroy(upstream_cluster_t *cluster)
+{
+    if (!cluster) {
+        return;
+    }
+
+    for (int i = 0; i < cluster->count; i++) {
+        backend_pool_t *pool = cluster->endpoints[i].pool;
+        backend_pool_stop_health_checker(pool);
+        backend_pool_destroy_circuit_breaker(pool);
+        backend_pool_destroy(pool);
+        pthread_mutex_destroy(&cluster->endpoints[i].limit_lock);
+    }
+    free(cluster->maglev_table);
+    pthread_mutex_destroy(&cluster->eject_lock);
+    free(cluster);
+}
+
+/* Startup only, like adding endpoints */
+void upstream_cluster_set_outlier_detection(upstream_cluster_t *cluster,
+                                            const OutlierDetectionConfig *config)
+{
+    if (!cluster || !config) {
+        return;
+    }
+    cluster->outlier = *config;
+    atomic_store(&cluster->next_sweep_ms, now_ms() + config->interval_seconds * 1000L);
+}
+
+/* Startup only. The budget starts full, so the first failures can be retried. */
+void upstream_cluster_set_retry_policy(upstream_cluster_t *cluster, const RetryPolicyConfig *config)
+{
+    if (!cluster || !config) {
+        return;
+    }
+    cluster->retry = *config;
+    atomic_store(&cluster->retry_tokens, (long)config->budget_burst * UPSTREAM_RETRY_TOKEN);
+}
+
+/* Startup only, after the endpoints were added */
+void upstream_cluster_set_concurrency_limit(upstream_cluster_t *cluster, const ConcurrencyLimitConfig *config)
+{
+    if (!cluster || !config) {
+        return;
+    }
+    cluster->concurrency = *config;
+    for (int i = 0; i < cluster->count; i++) {
+        upstream_endpoint_t *endpoint = &cluster->endpoints[i];
+        endpoint->estimated_limit = config->initial_limit;
+        endpoint->short_rtt_us = 0;
+        endpoint->long_rtt_us = 0;
+        atomic_store(&endpoint->concurrency_limit, config->enabled ? config->initial_limit : 0);
+    }
+}
+
+static bool endpoint_available(const upstream_endpoint_t *endpoint, long now)
+{
+    return atomic_load(&endpoint->ejected_until_ms) <= now && backend_pool_is_available(endpoint->pool);
+}
+
+static uint64_t endpoint_cost(upstream_endpoint_t *endpoint, bool by_latency)
+{
+    uint64_t load = (uint64_t)atomic_load(&endpoint->outstanding) + 1;
+    if (!by_latency) {
+        return load;
+    }
+    /* Endpoints without samples cost least, so new ones get measured */
+    return ((uint64_t)atomic_load(&endpoint->ewma_us) + 1) * load;
+}
+
+static int pick_round_robin(upstream_cluster_t *cluster, long now)
+{
+    unsigned int start = atomic_fetch_add(&cluster->rr_next, 1);
+
+    for (int i = 0; i < cluster->count; i++) {
+        int index = (int)((start + (unsigned int)i) % (unsigned int)cluster->count);
+        if (endpoint_available(&cluster->endpoints[index], now)) {
+            return index;
+        }
+    }
+    return (int)(start % (unsigned int)cluster->count);
+}
+
+static int pick_least_loaded(upstream_cluster_t *cluster, bool by_latency, long now)
+{
+    /* A random starting point spreads ties across endpoints */
+    int start = (int)random_below((uint32_t)cluster->count);
+    int best = -1;
+    uint64_t best_cost = UINT64_MAX;
+
+    for (int i = 0; i < cluster->count; i++) {
+        int index = (start + i) % cluster->count;
+        upstream_endpoint_t *endpoint = &cluster->endpoints[index];
+        if (!endpoint_available(endpoint, now)) {
+            continue;
+        }
+        uint64_t cost = endpoint_cost(endpoint, by_latency);
+        if (cost < best_cost) {
+            best = index;
+            best_cost = cost;
+        }
+    }
+    return best >= 0 ? best : start;
+}
+
+static int pick_two_choices(upstream_cluster_t *cluster, bool by_latency, long now)
+{
+    if (cluster->count == 1) {
+        return 0;
+    }
+
+    int a = (int)random_below((uint32_t)cluster->count);
+    int b = (int)random_below((uint32_t)cluster->count - 1);
+    if (b >= a) {
+        b++;
+    }
+
+    bool a_available = endpoint_available(&cluster->endpoints[a], now);
+    bool b_available = endpoint_available(&cluster->endpoints[b], now);
+    if (a_available && b_available) {
+        return endpoint_cost(&cluster->endpoints[b], by_latency) <
+               endpoint_cost(&cluster->endpoints[a], by_latency) ? b : a;
+    }
+    if (a_available) {
+        return a;
+    }
+    if (b_available) {
+        return b;
+    }
+    return pick_least_loaded(cluster, by_latency, now);
+}
+
+static int pick_maglev(upstream_cluster_t *cluster, const char *key, size_t key_len, long now)
+{
+    uint32_t available = 0;
+    for (int i = 0; i < cluster->count; i++) {
+        if (endpoint_available(&cluster->endpoints[i], now)) {
+            available |= 1u << i;
+        }
+    }
+
+    uint64_t slot = hash_bytes(key ? key : "", key ? key_len : 0, 0) % UPSTREAM_MAGLEV_TABLE_SIZE;
+    if (available == 0) {
+        return cluster->maglev_table[slot];
+    }
+
+    /* Keys of an unavailable endpoint walk on to the following slots, which
+     * belong to the other endpoints in proportion; other keys do not move */
+    for (;;) {
+        int index = cluster->maglev_table[slot];
+        if (available & (1u << index)) {
+            return index;
+        }
+        slot = (slot + 1) % UPSTREAM_MAGLEV_TABLE_SIZE;
+    }
+}
+
+static int pick_index(upstream_cluster_t *cluster, const char *hash_key, size_t hash_key_len, long now)
+{
+    switch (cluster->policy) {
+    case LB_LEAST_REQUEST:
+        return pick_least_loaded(cluster, false, now);
+    case LB_P2C:
+        return pick_two_choices(cluster, false, now);
+    case LB_EWMA:
+        return pick_two_choices(cluster, true, now);
+    case LB_MAGLEV:
+        return pick_maglev(cluster, hash_key, hash_key_len, now);
+    case LB_ROUND_ROBIN:
+    default:
+        return pick_round_robin(cluster, now);
+    }
+}
+
+static upstream_endpoint_t *claim(upstream_cluster_t *cluster, int index)
+{
+    upstream_endpoint_t *endpoint = &cluster->endpoints[index];
+    atomic_fetch_add(&endpoint->outstanding, 1);
+    atomic_fetch_add(&endpoint->total_requests, 1);
+    return endpoint;
+}
+
+/* Returns NULL only for an empty cluster. When no endpoint is available one
+ * is still returned, so its circuit breaker decides how the request fails.
+ * Every endpoint returned must be passed to upstream_endpoint_release(). */
+upstream_endpoint_t *upstream_cluster_pick(upstream_cluster_t *cluster,
+                                           const char *hash_key, size_t hash_key_len)
+{
+    if (!cluster || cluster->count == 0) {
+        return NULL;
+    }
+
+    /* Without outlier detection nothing is ejected, so no clock is needed */
+    long now = cluster->outlier.enabled ? now_ms() : 0;
+    return claim(cluster, pick_index(cluster, hash_key, hash_key_len, now));
+}
+
+/* For a retry or hedge: the policy's choice, unless that is 'exclude', in
+ * which case the next available endpoint after it. 'exclude' itself only
+ * comes back in a cluster of one. */
+upstream_endpoint_t *upstream_cluster_pick_other(upstream_cluster_t *cluster,
+                                                 const char *hash_key, size_t hash_key_len,
+                                                 const upstream_endpoint_t *exclude)
+{
+    if (!cluster || cluster->count == 0) {
+        return NULL;
+    }
+
+    long now = cluster->outlier.enabled ? now_ms() : 0;
+    /* Round robin steps on from 'exclude' without taking a turn, so the
+     * rotation of first attempts stays even */
+    int index = exclude && cluster->policy == LB_ROUND_ROBIN ? (int)(exclude - cluster->endpoints) :
+                pick_index(cluster, hash_key, hash_key_len, now);
+    if (cluster->count > 1 && &cluster->endpoints[index] == exclude) {
+        int excluded = index;
+        index = (excluded + 1) % cluster->count;
+        for (int i = 1; i < cluster->count; i++) {
+            int candidate = (excluded + i) % cluster->count;
+            if (endpoint_available(&cluster->endpoints[candidate], now)) {
+                index = candidate;
+                break;
+            }
+        }
+    }
+    return claim(cluster, index);
+}
+
+/* Bucket of a latency: its power of two, then the two bits below that */
+static int latency_bucket(long us)
+{
+    if (us < UPSTREAM_LATENCY_SUB_BUCKETS) {
+        return us > 0 ? (int)us : 0;
+    }
+    int log2 = 63 - __builtin_clzl((unsigned long)us);
+    int bucket = log2 * UPSTREAM_LATENCY_SUB_BUCKETS + (int)((us >> (log2 - 2)) & 3);
+    return bucket < UPSTREAM_LATENCY_BUCKETS ? bucket : UPSTREAM_LATENCY_BUCKETS - 1;
+}
+
+/* Upper bound of a bucket */
+static long bucket_limit(int bucket)
+{
+    if (bucket < UPSTREAM_LATENCY_SUB_BUCKETS) {
+        return bucket + 1;
+    }
+    int log2 = bucket / UPSTREAM_LATENCY_SUB_BUCKETS;
+    return (long)(UPSTREAM_LATENCY_SUB_BUCKETS + bucket % UPSTREAM_LATENCY_SUB_BUCKETS + 1) << (log2 - 2);
+}
+
+static long latency_percentile(const long *counts, long total)
+{
+    long rank = (total * UPSTREAM_LATENCY_PERCENTILE + 99) / 100;
+    long seen = 0;
+
+    for (int b = 0; b < UPSTREAM_LATENCY_BUCKETS; b++) {
+        seen += counts[b];
+        if (seen >= rank) {
+            return bucket_limit(b);
+        }
+    }
+    return bucket_limit(UPSTREAM_LATENCY_BUCKETS - 1);
+}
+
+/* Takes an endpoint out of rotation, unless that would eject more of the
+ * cluster than allowed or it already is */
+static bool eject(upstream_cluster_t *cluster, upstream_endpoint_t *endpoint, long now, const char *reason)
+{
+    const OutlierDetectionConfig *config = &cluster->outlier;
+    long duration_ms = 0;
+
+    pthread_mutex_lock(&cluster->eject_lock);
+    int ejected = 0;
+    for (int i = 0; i < cluster->count; i++) {
+        if (atomic_load(&cluster->endpoints[i].ejected_until_ms) > now) {
+            ejected++;
+        }
+    }
+    int allowed = cluster->count * config->max_ejection_percent / 100;
+    if (allowed < 1) {
+        allowed = 1;
+    }
+    if (atomic_load(&endpoint->ejected_until_ms) <= now && ejected < allowed && ejected + 1 < cluster->count) {
+        int streak = atomic_load(&endpoint->ejection_streak);
+        if (streak < UPSTREAM_MAX_EJECTION_MULTIPLIER) {
+            atomic_store(&endpoint->ejection_streak, ++streak);
+        }
+        duration_ms = config->base_ejection_time_seconds * 1000L * streak;
+        atomic_store(&endpoint->ejected_until_ms, now + duration_ms);
+        atomic_fetch_add(&endpoint->total_ejections, 1);
+    }
+    pthread_mutex_unlock(&cluster->eject_lock);
+
+    if (duration_ms == 0) {
+        return false;
+    }
+    log_message(LOG_LEVEL_WARN, "Outlier detection: ejected %s for %lds (%s)", endpoint->name,
+                duration_ms / 1000, reason);
+    return true;
+}
+
+static void sweep_outliers(upstream_cluster_t *cluster, long now)
+{
+    const OutlierDetectionConfig *config = &cluster->outlier;
+    long p95[MAX_ROUTE_BACKENDS];
+    long sorted[MAX_ROUTE_BACKENDS];
+    long latency[UPSTREAM_LATENCY_BUCKETS];
+    int measured = 0;
+
+    for (int i = 0; i < cluster->count; i++) {
+        upstream_endpoint_t *endpoint = &cluster->endpoints[i];
+        long requests = atomic_exchange(&endpoint->interval_requests, 0);
+        long errors = atomic_exchange(&endpoint->interval_errors, 0);
+        long timed = 0;
+        for (int b = 0; b < UPSTREAM_LATENCY_BUCKETS; b++) {
+            latency[b] = atomic_exchange(&endpoint->interval_latency[b], 0);
+            timed += latency[b];
+        }
+        p95[i] = 0;
+
+        long ejected_until = atomic_load(&endpoint->ejected_until_ms);
+        if (ejected_until > now) {
+            continue;
+        }
+        /* A whole interval back in rotation shortens the next ejection */
+        if (ejected_until + config->interval_seconds * 1000L <= now &&
+            atomic_load(&endpoint->ejection_streak) > 0) {
+            atomic_fetch_sub(&endpoint->ejection_streak, 1);
+        }
+        if (requests < config->min_requests) {
+            continue;
+        }
+        if (config->failure_percent > 0 && errors * 100 >= (long)config->failure_percent * requests) {
+            eject(cluster, endpoint, now, "error rate");
+            continue;
+        }
+        if (timed >= config->min_requests) {
+            p95[i] = latency_percentile(latency, timed);
+            sorted[measured++] = p95[i];
+        }
+    }
+
+    if (config->latency_factor <= 0 || measured < 2) {
+        return;
+    }
+    for (int i = 1; i < measured; i++) {
+        long value = sorted[i];
+        int j = i;
+        for (; j > 0 && sorted[j - 1] > value; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = value;
+    }
+    long median = sorted[(measured - 1) / 2];
+    for (int i = 0; i < cluster->count; i++) {
+        if (p95[i] > median * config->latency_factor) {
+            eject(cluster, &cluster->endpoints[i], now, "latency");
+        }
+    }
+}
+
+/* Compares the endpoints over the interval so far and starts a new one.
+ * Releases do this once per interval on their own. */
+void upstream_cluster_detect_outliers(upstream_cluster_t *cluster)
+{
+    if (!cluster || !cluster->outlier.enabled) {
+        return;
+    }
+    long now = now_ms();
+    atomic_store(&cluster->next_sweep_ms, now + cluster->outlier.interval_seconds * 1000L);
+    sweep_outliers(cluster, now);
+}
+
+bool upstream_endpoint_is_ejected(const upstream_endpoint_t *endpoint)
+{
+    return atomic_load(&endpoint->ejected_until_ms) > now_ms();
+}
+
+/* Whether a picked request would take the endpoint over its concurrency
+ * limit; it then counts as shed. The request itself is in 'outstanding'. */
+bool upstream_endpoint_over_limit(upstream_endpoint_t *endpoint)
+{
+    int limit = atomic_load(&endpoint->concurrency_limit);
+    if (limit <= 0 || atomic_load(&endpoint->outstanding) <= limit) {
+        return false;
+    }
+    atomic_fetch_add(&endpoint->total_shed, 1);
+    return true;
+}
+
+/* One gradient2 step. 'inflight' is the endpoint's load when the response
+ * came in. Releases that find another one updating skip their sample. */
+static void update_limit(upstream_endpoint_t *endpoint, long latency_us, int status, int inflight)
+{
+    const ConcurrencyLimitConfig *config = &endpoint->cluster->concurrency;
+
+    if (pthread_mutex_trylock(&endpoint->limit_lock) != 0) {
+        return;
+    }
+
+    double limit = endpoint->estimated_limit;
+    if (status == UPSTREAM_STATUS_FAILED) {
+        /* Timeouts and resets are the clearest overload signal there is */
+        limit = limit * UPSTREAM_LIMIT_BACKOFF_PERCENT / 100;
+    } else {
+        double rtt = latency_us > 0 ? (double)latency_us : 1.0;
+        if (endpoint->long_rtt_us == 0) {
+            endpoint->short_rtt_us = rtt;
+            endpoint->long_rtt_us = rtt;
+        } else {
+            endpoint->short_rtt_us += (rtt - endpoint->short_rtt_us) * 2 / (UPSTREAM_LIMIT_SHORT_WINDOW + 1);
+            endpoint->long_rtt_us += (rtt - endpoint->long_rtt_us) * 2 / (UPSTREAM_LIMIT_LONG_WINDOW + 1);
+            /* After a slow period, let the baseline come back down quickly */
+            if (endpoint->long_rtt_us > endpoint->short_rtt_us * 2) {
+                endpoint->long_rtt_us *= 0.95;
+            }
+        }
+
+        double gradient = config->rtt_tolerance_percent / 100.0 * endpoint->long_rtt_us / endpoint->short_rtt_us;
+        if (gradient > 1.0) {
+            gradient = 1.0;
+        } else if (gradient < 0.5) {
+            gradient = 0.5;
+        }
+        double target = limit * gradient + UPSTREAM_LIMIT_QUEUE_SIZE;
+        /* A limit that is not half used proves nothing about a larger one */
+        if (target > limit && inflight < limit / 2) {
+            target = limit;
+        }
+        limit += (target - limit) * config->smoothing_percent / 100;
+    }
+
+    if (limit < config->min_limit) {
+        limit = config->min_limit;
+    } else if (limit > config->max_limit) {
+        limit = config->max_limit;
+    }
+    endpoint->estimated_limit = limit;
+    atomic_store(&endpoint->concurrency_limit, (int)limit);
+    pthread_mutex_unlock(&endpoint->limit_lock);
+}
+
+/* Adds one request's share to the retry budget */
+void upstream_cluster_earn_retry(upstream_cluster_t *cluster)
+{
+    long limit = (long)cluster->retry.budget_burst * UPSTREAM_RETRY_TOKEN;
+    long share = (long)cluster->retry.budget_percent * UPSTREAM_RETRY_TOKEN / 100;
+    long tokens = atomic_load(&cluster->retry_tokens);
+    long updated;
+
+    do {
+        if (tokens >= limit) {
+            return;
+        }
+        updated = tokens + share < limit ? tokens + share : limit;
+    } while (!atomic_compare_exchange_weak(&cluster->retry_tokens, &tokens, updated));
+}
+
+/* Spends one retry; false when the budget does not allow another */
+bool upstream_cluster_take_retry(upstream_cluster_t *cluster)
+{
+    long tokens = atomic_load(&cluster->retry_tokens);
+
+    do {
+        if (tokens < UPSTREAM_RETRY_TOKEN) {
+            atomic_fetch_add(&cluster->retries_throttled, 1);
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&cluster->retry_tokens, &tokens, tokens - UPSTREAM_RETRY_TOKEN));
+    return true;
+}
+
+/* How long a request waits for response headers before it is hedged:
+ * the configured delay, or else the p95 of recent responses. 0 = do not
+ * hedge (not enabled, or too few responses seen yet). */
+long upstream_cluster_hedge_delay_ms(upstream_cluster_t *cluster)
+{
+    if (!cluster->retry.enabled || !cluster->retry.hedge) {
+        return 0;
+    }
+    if (cluster->retry.hedge_delay_ms > 0) {
+        return cluster->retry.hedge_delay_ms;
+    }
+    long delay_us = atomic_load(&cluster->hedge_delay_us);
+    return delay_us > 0 ? (delay_us + 999) / 1000 : 0;
+}
+
+static void record_hedge_latency(upstream_cluster_t *cluster, long latency_us)
+{
+    long counts[UPSTREAM_LATENCY_BUCKETS];
+    long total = 0;
+
+    atomic_fetch_add(&cluster->latency[latency_bucket(latency_us)], 1);
+    long samples = atomic_fetch_add(&cluster->latency_samples, 1) + 1;
+    if (samples % UPSTREAM_HEDGE_REFRESH_SAMPLES != 0) {
+        return;
+    }
+
+    /* Whoever lands on the multiple refreshes; concurrent samples may be
+     * missed by this pass, which an estimate can live with */
+    for (int b = 0; b < UPSTREAM_LATENCY_BUCKETS; b++) {
+        counts[b] = atomic_load(&cluster->latency[b]);
+        total += counts[b];
+    }
+    if (total > 0) {
+        atomic_store(&cluster->hedge_delay_us, latency_percentile(counts, total));
+    }
+    if (samples >= UPSTREAM_HEDGE_WINDOW_SAMPLES) {
+        for (int b = 0; b < UPSTREAM_LATENCY_BUCKETS; b++) {
+            atomic_fetch_sub(&cluster->latency[b], counts[b] / 2);
+        }
+        atomic_fetch_sub(&cluster->latency_samples, samples / 2);
+    }
+}
+
+static void record_outcome(upstream_cluster_t *cluster, upstream_endpoint_t *endpoint,
+                           long latency_us, int status)
+{
+    const OutlierDetectionConfig *config = &cluster->outlier;
+    long now = now_ms();
+
+    atomic_fetch_add(&endpoint->interval_requests, 1);
+    if (status != UPSTREAM_STATUS_FAILED) {
+        atomic_fetch_add(&endpoint->interval_latency[latency_bucket(latency_us)], 1);
+    }
+    if (status == UPSTREAM_STATUS_FAILED || status >= 500) {
+        atomic_fetch_add(&endpoint->interval_errors, 1);
+        int run = atomic_fetch_add(&endpoint->consecutive_5xx, 1) + 1;
+        if (config->consecutive_5xx > 0 && run >= config->consecutive_5xx) {
+            atomic_store(&endpoint->consecutive_5xx, 0);
+            eject(cluster, endpoint, now, "consecutive 5xx");
+        }
+    } else {
+        atomic_store(&endpoint->consecutive_5xx, 0);
+    }
+
+    long due = atomic_load(&cluster->next_sweep_ms);
+    if (now >= due &&
+        atomic_compare_exchange_strong(&cluster->next_sweep_ms, &due,
+                                       now + config->interval_seconds * 1000L)) {
+        sweep_outliers(cluster, now);
+    }
+}
+
+/* 'status' is the backend's HTTP status, or UPSTREAM_STATUS_FAILED or
+ * UPSTREAM_STATUS_NOT_SENT */
+void upstream_endpoint_release(upstream_endpoint_t *endpoint, long latency_us, int status)
+{
+    if (!endpoint) {
+        return;
+    }
+
+    int inflight = atomic_fetch_sub(&endpoint->outstanding, 1);
+    if (status == UPSTREAM_STATUS_NOT_SENT) {
+        return;
+    }
+    if (endpoint->cluster && endpoint->cluster->concurrency.enabled) {
+        update_limit(endpoint, latency_us, status, inflight);
+    }
+
+    long sample = latency_us > 0 ? latency_us : 1;
+    if (status == UPSTREAM_STATUS_FAILED && sample < UPSTREAM_EWMA_FAILURE_PENALTY_US) {
+        sample = UPSTREAM_EWMA_FAILURE_PENALTY_US;
+    }
+
+    long old = atomic_load(&endpoint->ewma_us);
+    long updated;
+    do {
+        updated = old == 0 ? sample : old + (sample - old) / (1L << UPSTREAM_EWMA_SHIFT);
+        if (updated < 1) {
+            updated = 1;
+        }
+    } while (!atomic_compare_exchange_weak(&endpoint->ewma_us, &old, updated));
+
+    upstream_cluster_t *cluster = endpoint->cluster;
+    if (cluster && cluster->outlier.enabled) {
+        record_outcome(cluster, endpoint, latency_us, status);
+    }
+    if (cluster && cluster->retry.enabled && cluster->retry.hedge && cluster->retry.hedge_delay_ms == 0 &&
+        status != UPSTREAM_STATUS_FAILED) {
+        record_hedge_latency(cluster, latency_us > 0 ? latency_us : 1);
+    }
+}
+
+const char *upstream_lb_policy_name(LoadBalancerPolicy policy)
+{
+    switch (policy) {
+    case LB_LEAST_REQUEST: return "least_request";
+    case LB_P2C:           return "p2c";
+    case LB_EWMA:          return "ewma";
+    case LB_MAGLEV:        return "maglev";
+    case LB_ROUND_ROBIN:
+    default:               return "round_robin";
+    }
+}
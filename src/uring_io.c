@@ -0,0 +1,686 @@
+/* uring_io.c - Per-worker io_uring context and the OpenSSL socket BIO built on it
+ *
+ * Every worker thread owns one ring for its whole lifetime. Next to the ring
+ * it registers a small group of provided receive buffers: socket reads are
+ * submitted with IOSQE_BUFFER_SELECT, so the kernel only picks a buffer once
+ * data has actually arrived and the BIO hands it back as soon as OpenSSL has
+ * consumed it. A registered buffer is used for static file reads
+ * (IORING_OP_READ_FIXED), which saves pinning the pages on every read.
+ *
+ * Each ring also has a sparse fixed-file table. Client sockets are moved
+ * into it when the worker picks them up, so every later operation skips the
+ * fget/fput on the process fd table (IOSQE_FIXED_FILE).
+ */
+#include "uring_io.h"
+#include "server.h"
+#include "cpu_affinity.h"
+#include "log.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define MS_PER_SEC 1000
+#define NS_PER_MS 1000000
+
+/* user_data tags for the operations issued by this module */
+enum {
+    URING_TAG_RECV = 1,
+    URING_TAG_SEND,
+    URING_TAG_FILE_READ,
+    URING_TAG_FILES_UPDATE,
+    URING_TAG_CLOSE,
+    URING_TAG_POLL,
+    URING_TAG_LINK_TIMEOUT,
+    URING_TAG_TIMEOUT,
+    URING_TAG_CANCEL,
+    URING_TAG_POLL_MANY,                /* + target index */
+};
+
+typedef struct {
+    uring_worker_t *worker;
+    int fd;
+    bool fixed;
+    int timeout_ms;
+    bool nonblocking;
+    bool eof;
+    /* Provided buffer currently holding undelivered bytes (held_bid >= 0) */
+    int held_bid;
+    size_t held_off;
+    size_t held_len;
+} uring_bio_t;
+
+static pthread_key_t uring_worker_key;
+static pthread_once_t uring_worker_key_once = PTHREAD_ONCE_INIT;
+static __thread uring_worker_t *current_worker = NULL;
+
+static BIO_METHOD *uring_bio_method = NULL;
+static int uring_bio_type = 0;
+static pthread_once_t uring_bio_method_once = PTHREAD_ONCE_INIT;
+
+static void uring_worker_destroy(void *arg)
+{
+    uring_worker_t *worker = (uring_worker_t *)arg;
+
+    if (worker->buf_ring)
+        io_uring_free_buf_ring(&worker->ring, worker->buf_ring,
+                               URING_IO_RECV_BUF_COUNT, URING_IO_BUF_GROUP);
+    io_uring_queue_exit(&worker->ring);
+    free(worker->recv_bufs);
+    free(worker->file_buf);
+    free(worker);
+    current_worker = NULL;
+}
+
+static void uring_worker_key_create(void)
+{
+    pthread_key_create(&uring_worker_key, uring_worker_destroy);
+}
+
+/* Only the owning worker ever touches its ring, so ask for the cheapest
+ * completion mode the kernel supports: DEFER_TASKRUN (6.1+), then
+ * COOP_TASKRUN (5.19+), then the default IPI-driven task work. */
+static int uring_worker_ring_init(struct io_uring *ring)
+{
+    static const unsigned setup_flags[] = {
+#ifdef IORING_SETUP_DEFER_TASKRUN
+        IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+#endif
+#ifdef IORING_SETUP_COOP_TASKRUN
+        IORING_SETUP_COOP_TASKRUN,
+#endif
+        0,
+    };
+    int ret = -EINVAL;
+
+    for (size_t i = 0; i < sizeof(setup_flags) / sizeof(setup_flags[0]); i++) {
+        ret = io_uring_queue_init(QUEUE_DEPTH, ring, setup_flags[i]);
+        if (ret == 0) {
+            log_message(LOG_LEVEL_DEBUG, "Worker io_uring ready (setup flags 0x%x)", setup_flags[i]);
+            break;
+        }
+        if (ret != -EINVAL)
+            return ret;
+    }
+    if (ret != 0)
+        return ret;
+
+    /* Registered ring fd skips the fdget/fdput on every io_uring_enter() */
+    ret = io_uring_register_ring_fd(ring);
+    if (ret < 0)
+        log_message(LOG_LEVEL_DEBUG, "io_uring_register_ring_fd unavailable: %s", strerror(-ret));
+    return 0;
+}
+
+static void uring_worker_recycle(uring_worker_t *worker, unsigned short bid)
+{
+    io_uring_buf_ring_add(worker->buf_ring,
+                          worker->recv_bufs + (size_t)bid * URING_IO_RECV_BUF_SIZE,
+                          URING_IO_RECV_BUF_SIZE, bid,
+                          io_uring_buf_ring_mask(URING_IO_RECV_BUF_COUNT), 0);
+    io_uring_buf_ring_advance(worker->buf_ring, 1);
+}
+
+/* Everything here is optional: without a provided buffer ring (< 5.19)
+ * reads land directly in OpenSSL's buffer, without a sparse table (< 5.19)
+ * sockets stay plain fds, and without registration file reads use plain
+ * IORING_OP_READ. */
+static void uring_worker_setup_buffers(uring_worker_t *worker)
+{
+    int ret = 0;
+
+    worker->recv_bufs = malloc((size_t)URING_IO_RECV_BUF_COUNT * URING_IO_RECV_BUF_SIZE);
+    if (worker->recv_bufs) {
+        worker->buf_ring = io_uring_setup_buf_ring(&worker->ring, URING_IO_RECV_BUF_COUNT,
+                                                   URING_IO_BUF_GROUP, 0, &ret);
+        if (!worker->buf_ring) {
+            log_message(LOG_LEVEL_DEBUG, "Provided buffer ring unavailable: %s", strerror(-ret));
+            free(worker->recv_bufs);
+            worker->recv_bufs = NULL;
+        } else {
+            for (unsigned short bid = 0; bid < URING_IO_RECV_BUF_COUNT; bid++)
+                uring_worker_recycle(worker, bid);
+        }
+    }
+
+    ret = io_uring_register_files_sparse(&worker->ring, URING_IO_FIXED_FILES);
+    if (ret == 0)
+        worker->fixed_files = true;
+    else
+        log_message(LOG_LEVEL_DEBUG, "Sparse fixed-file table unavailable: %s", strerror(-ret));
+
+    worker->file_buf = malloc(URING_IO_FILE_BUF_SIZE);
+    if (worker->file_buf) {
+        struct iovec iov = {.iov_base = worker->file_buf, .iov_len = URING_IO_FILE_BUF_SIZE};
+        ret = io_uring_register_buffers(&worker->ring, &iov, 1);
+        if (ret == 0)
+            worker->file_buf_registered = true;
+        else
+            log_message(LOG_LEVEL_DEBUG, "io_uring_register_buffers unavailable: %s", strerror(-ret));
+    }
+}
+
+uring_worker_t *uring_worker_get(bool bind_cpu)
+{
+    if (current_worker)
+        return current_worker;
+
+    pthread_once(&uring_worker_key_once, uring_worker_key_create);
+    uring_worker_t *worker = calloc(1, sizeof(uring_worker_t));
+    if (!worker)
+        return NULL;
+    int ret = uring_worker_ring_init(&worker->ring);
+    if (ret != 0) {
+        log_message(LOG_LEVEL_ERROR, "io_uring_queue_init (worker) failed: %s", strerror(-ret));
+        free(worker);
+        return NULL;
+    }
+    if (bind_cpu)
+        cpu_affinity_bind_ring(&worker->ring);
+    uring_worker_setup_buffers(worker);
+
+    pthread_setspecific(uring_worker_key, worker);
+    current_worker = worker;
+    return worker;
+}
+
+uring_worker_t *uring_worker_current(void)
+{
+    return current_worker;
+}
+
+void uring_worker_drain(uring_worker_t *worker)
+{
+    struct io_uring_cqe *cqe;
+    while (io_uring_peek_cqe(&worker->ring, &cqe) == 0)
+        io_uring_cqe_seen(&worker->ring, cqe);
+}
+
+/* Submits the prepared SQE (plus a linked timeout when timeout_ms > 0) and
+ * waits for its completion. The timeout CQE is reaped as well so nothing
+ * from this call is left on the ring. Returns the operation's cqe->res, with
+ * -ETIMEDOUT when the timeout fired. */
+static int uring_worker_submit_wait(uring_worker_t *worker, struct io_uring_sqe *sqe,
+                                    uint64_t tag, int timeout_ms, unsigned *cqe_flags)
+{
+    struct io_uring *ring = &worker->ring;
+    struct __kernel_timespec ts;
+    int pending = 1;
+    int res = -EIO;
+    bool linked = false;
+    bool timed_out = false;
+
+    io_uring_sqe_set_data64(sqe, tag);
+    if (timeout_ms > 0) {
+        struct io_uring_sqe *tsqe;
+
+        sqe->flags |= IOSQE_IO_LINK;
+        tsqe = io_uring_get_sqe(ring);
+        if (!tsqe) {
+            sqe->flags &= (unsigned char)~IOSQE_IO_LINK;
+        } else {
+            ts.tv_sec = timeout_ms / MS_PER_SEC;
+            ts.tv_nsec = (long long)(timeout_ms % MS_PER_SEC) * NS_PER_MS;
+            io_uring_prep_link_timeout(tsqe, &ts, 0);
+            io_uring_sqe_set_data64(tsqe, URING_TAG_LINK_TIMEOUT);
+            linked = true;
+            pending = 2;
+        }
+    }
+
+    int ret = io_uring_submit(ring);
+    if (ret < 0)
+        return ret;
+
+    while (pending > 0) {
+        struct io_uring_cqe *cqe;
+
+        ret = io_uring_wait_cqe(ring, &cqe);
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0)
+            return ret;
+        uint64_t data = io_uring_cqe_get_data64(cqe);
+        if (data == tag) {
+            res = cqe->res;
+            if (cqe_flags)
+                *cqe_flags = cqe->flags;
+            pending--;
+        } else if (data == URING_TAG_LINK_TIMEOUT && linked) {
+            timed_out = (cqe->res == -ETIME);
+            pending--;
+        }
+        io_uring_cqe_seen(ring, cqe);
+    }
+
+    if (timed_out && res == -ECANCELED)
+        return -ETIMEDOUT;
+    return res;
+}
+
+int uring_worker_install_fd(uring_worker_t *worker, int fd)
+{
+    if (!worker || !worker->fixed_files || fd < 0)
+        return -1;
+
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&worker->ring);
+    if (!sqe)
+        return -1;
+    /* With IORING_FILE_INDEX_ALLOC the kernel writes the chosen slot back into 'slot' */
+    int slot = fd;
+    io_uring_prep_files_update(sqe, &slot, 1, (int)IORING_FILE_INDEX_ALLOC);
+    int res = uring_worker_submit_wait(worker, sqe, URING_TAG_FILES_UPDATE, 0, NULL);
+    if (res != 1) {
+        log_message(LOG_LEVEL_DEBUG, "Fixed-file install failed: %s",
+                    strerror(res < 0 ? -res : ENFILE));
+        return -1;
+    }
+    return slot;
+}
+
+void uring_worker_close_fixed(uring_worker_t *worker, int index)
+{
+    if (!worker || index < 0)
+        return;
+
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&worker->ring);
+    if (!sqe)
+        return;
+    io_uring_prep_close_direct(sqe, (unsigned)index);
+    int res = uring_worker_submit_wait(worker, sqe, URING_TAG_CLOSE, 0, NULL);
+    if (res < 0)
+        log_message(LOG_LEVEL_WARN, "Closing fixed file %d failed: %s", index, strerror(-res));
+}
+
+int uring_worker_poll(uring_worker_t *worker, int fd, bool fixed, short events, int timeout_ms)
+{
+    if (!worker)
+        return -1;
+
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&worker->ring);
+    if (!sqe)
+        return -1;
+    io_uring_prep_poll_add(sqe, fd, (unsigned)events);
+    if (fixed)
+        sqe->flags |= IOSQE_FIXED_FILE;
+    int res = uring_worker_submit_wait(worker, sqe, URING_TAG_POLL, timeout_ms, NULL);
+    if (res == -ETIMEDOUT)
+        return 0;
+    if (res < 0) {
+        log_message(LOG_LEVEL_ERROR, "io_uring poll failed: %s", strerror(-res));
+        return -1;
+    }
+    return res;
+}
+
+int uring_worker_poll_many(uring_worker_t *worker, uring_poll_target_t *targets, int count,
+                           int timeout_ms)
+{
+    if (!worker || !targets || count <= 0)
+        return -1;
+
+    struct io_uring *ring = &worker->ring;
+    struct __kernel_timespec ts;
+    bool armed[count];
+    int pending = 0, ready = 0;
+    bool timer = false, timed_out = false, failed = false;
+
+    for (int i = 0; i < count; i++) {
+        targets[i].revents = 0;
+        armed[i] = false;
+        if (targets[i].events == 0)
+            continue;
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+        if (!sqe) {
+            failed = true;
+            break;
+        }
+        io_uring_prep_poll_add(sqe, targets[i].fd, (unsigned)targets[i].events);
+        if (targets[i].fixed)
+            sqe->flags |= IOSQE_FIXED_FILE;
+        io_uring_sqe_set_data64(sqe, URING_TAG_POLL_MANY + (uint64_t)i);
+        armed[i] = true;
+        pending++;
+    }
+    if (!failed && timeout_ms > 0) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+        if (sqe) {
+            ts.tv_sec = timeout_ms / MS_PER_SEC;
+            ts.tv_nsec = (long long)(timeout_ms % MS_PER_SEC) * NS_PER_MS;
+            io_uring_prep_timeout(sqe, &ts, 0, 0);
+            io_uring_sqe_set_data64(sqe, URING_TAG_TIMEOUT);
+            timer = true;
+            pending++;
+        }
+    }
+    if (io_uring_submit(ring) < 0)
+        return -1;
+
+    /* Wait for the first event, then cancel whatever is still armed and
+     * reap until every operation issued here has completed */
+    bool cancel = failed, cancelled = false;
+    while (pending > 0) {
+        if (cancel && !cancelled) {
+            struct io_uring_sqe *sqe;
+            for (int i = 0; i < count; i++) {
+                if (!armed[i] || !(sqe = io_uring_get_sqe(ring)))
+                    continue;
+                io_uring_prep_cancel64(sqe, URING_TAG_POLL_MANY + (uint64_t)i, 0);
+                io_uring_sqe_set_data64(sqe, URING_TAG_CANCEL);
+                pending++;
+            }
+            if (timer && (sqe = io_uring_get_sqe(ring))) {
+                io_uring_prep_timeout_remove(sqe, URING_TAG_TIMEOUT, 0);
+                io_uring_sqe_set_data64(sqe, URING_TAG_CANCEL);
+                pending++;
+            }
+            io_uring_submit(ring);
+            cancelled = true;
+        }
+
+        struct io_uring_cqe *cqe;
+        int ret = io_uring_wait_cqe(ring, &cqe);
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0)
+            return -1;
+        uint64_t data = io_uring_cqe_get_data64(cqe);
+        if (data >= URING_TAG_POLL_MANY && data < URING_TAG_POLL_MANY + (uint64_t)count) {
+            int i = (int)(data - URING_TAG_POLL_MANY);
+            if (armed[i]) {
+                armed[i] = false;
+                pending--;
+                if (cqe->res > 0 || (cqe->res < 0 && cqe->res != -ECANCELED)) {
+                    targets[i].revents = cqe->res > 0 ? (short)cqe->res : POLLERR;
+                    ready++;
+                }
+            }
+        } else if (data == URING_TAG_TIMEOUT && timer) {
+            timer = false;
+            pending--;
+            timed_out = cqe->res == -ETIME;
+        } else if (data == URING_TAG_CANCEL) {
+            pending--;
+        }
+        io_uring_cqe_seen(ring, cqe);
+
+        if (ready > 0 || timed_out)
+            cancel = true;
+    }
+
+    if (failed) {
+        log_message(LOG_LEVEL_ERROR, "io_uring submission queue full");
+        return -1;
+    }
+    return ready;
+}
+
+ssize_t uring_worker_read_file(uring_worker_t *worker, int fd, bool fixed, off_t offset, const char **data)
+{
+    if (!worker || !worker->file_buf || !data)
+        return -1;
+
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&worker->ring);
+    if (!sqe)
+        return -1;
+    if (worker->file_buf_registered)
+        io_uring_prep_read_fixed(sqe, fd, worker->file_buf, URING_IO_FILE_BUF_SIZE,
+                                 (uint64_t)offset, 0);
+    else
+        io_uring_prep_read(sqe, fd, worker->file_buf, URING_IO_FILE_BUF_SIZE, (uint64_t)offset);
+    if (fixed)
+        sqe->flags |= IOSQE_FIXED_FILE;
+
+    int res = uring_worker_submit_wait(worker, sqe, URING_TAG_FILE_READ, 0, NULL);
+    if (res < 0) {
+        log_message(LOG_LEVEL_ERROR, "io_uring file read failed: %s", strerror(-res));
+        return -1;
+    }
+    *data = (const char *)worker->file_buf;
+    return res;
+}
+
+static void uring_bio_release(uring_bio_t *ub)
+{
+    if (ub->held_bid >= 0) {
+        uring_worker_recycle(ub->worker, (unsigned short)ub->held_bid);
+        ub->held_bid = -1;
+        ub->held_off = 0;
+        ub->held_len = 0;
+    }
+}
+
+static int uring_bio_timeout(const uring_bio_t *ub)
+{
+    return ub->nonblocking ? 0 : ub->timeout_ms;
+}
+
+static int uring_bio_recv(uring_bio_t *ub, char *out, int outl, bool select_buffer, unsigned *cqe_flags)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ub->worker->ring);
+    int flags = ub->nonblocking ? MSG_DONTWAIT : 0;
+
+    if (!sqe)
+        return -EBUSY;
+    if (select_buffer) {
+        io_uring_prep_recv(sqe, ub->fd, NULL, URING_IO_RECV_BUF_SIZE, flags);
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_IO_BUF_GROUP;
+    } else {
+        io_uring_prep_recv(sqe, ub->fd, out, (size_t)outl, flags);
+    }
+    if (ub->fixed)
+        sqe->flags |= IOSQE_FIXED_FILE;
+    return uring_worker_submit_wait(ub->worker, sqe, URING_TAG_RECV, uring_bio_timeout(ub), cqe_flags);
+}
+
+static int uring_bio_read(BIO *bio, char *out, int outl)
+{
+    uring_bio_t *ub = BIO_get_data(bio);
+
+    BIO_clear_retry_flags(bio);
+    if (!ub || !out || outl <= 0)
+        return 0;
+
+    if (ub->held_bid < 0) {
+        unsigned cqe_flags = 0;
+        int res;
+
+        if (ub->worker->buf_ring) {
+            res = uring_bio_recv(ub, out, outl, true, &cqe_flags);
+            if (res > 0 && (cqe_flags & IORING_CQE_F_BUFFER)) {
+                ub->held_bid = (int)(cqe_flags >> IORING_CQE_BUFFER_SHIFT);
+                ub->held_off = 0;
+                ub->held_len = (size_t)res;
+            } else if (cqe_flags & IORING_CQE_F_BUFFER) {
+                uring_worker_recycle(ub->worker, (unsigned short)(cqe_flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+            /* Every provided buffer is in use: read straight into OpenSSL's buffer */
+            if (res == -ENOBUFS)
+                res = uring_bio_recv(ub, out, outl, false, NULL);
+            else if (res > 0)
+                res = 0;
+            if (res > 0)
+                return res;
+            if (ub->held_bid < 0 && res == 0)
+                goto eof;
+        } else {
+            res = uring_bio_recv(ub, out, outl, false, NULL);
+            if (res > 0)
+                return res;
+            if (res == 0)
+                goto eof;
+        }
+
+        if (ub->held_bid < 0) {
+            if (res == -EAGAIN) {
+                BIO_set_retry_read(bio);
+            } else {
+                errno = -res;
+                if (res != -ETIMEDOUT)
+                    log_message(LOG_LEVEL_DEBUG, "io_uring recv failed: %s", strerror(-res));
+            }
+            return -1;
+        }
+    }
+
+    size_t n = ub->held_len - ub->held_off;
+    if (n > (size_t)outl)
+        n = (size_t)outl;
+    memcpy(out, ub->worker->recv_bufs + (size_t)ub->held_bid * URING_IO_RECV_BUF_SIZE + ub->held_off, n);
+    ub->held_off += n;
+    if (ub->held_off == ub->held_len)
+        uring_bio_release(ub);
+    return (int)n;
+
+eof:
+    ub->eof = true;
+    return 0;
+}
+
+static int uring_bio_write(BIO *bio, const char *in, int inl)
+{
+    uring_bio_t *ub = BIO_get_data(bio);
+
+    BIO_clear_retry_flags(bio);
+    if (!ub || !in || inl <= 0)
+        return 0;
+
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ub->worker->ring);
+    if (!sqe) {
+        errno = EBUSY;
+        return -1;
+    }
+    /* MSG_NOSIGNAL: a peer reset must not raise SIGPIPE in the worker */
+    io_uring_prep_send(sqe, ub->fd, in, (size_t)inl,
+                       MSG_NOSIGNAL | (ub->nonblocking ? MSG_DONTWAIT : 0));
+    if (ub->fixed)
+        sqe->flags |= IOSQE_FIXED_FILE;
+    int res = uring_worker_submit_wait(ub->worker, sqe, URING_TAG_SEND, uring_bio_timeout(ub), NULL);
+    if (res >= 0)
+        return res;
+    if (res == -EAGAIN) {
+        BIO_set_retry_write(bio);
+    } else {
+        errno = -res;
+        if (res != -ETIMEDOUT && res != -EPIPE && res != -ECONNRESET)
+            log_message(LOG_LEVEL_DEBUG, "io_uring send failed: %s", strerror(-res));
+    }
+    return -1;
+}
+
+static long uring_bio_ctrl(BIO *bio, int cmd, long num, void *ptr)
+{
+    uring_bio_t *ub = BIO_get_data(bio);
+    (void)num;
+
+    if (!ub)
+        return 0;
+    switch (cmd) {
+    case BIO_CTRL_FLUSH:
+        return 1;
+    case BIO_CTRL_EOF:
+        return ub->eof ? 1 : 0;
+    case BIO_CTRL_PENDING:
+        return (long)(ub->held_bid >= 0 ? ub->held_len - ub->held_off : 0);
+    case BIO_C_GET_FD:
+        /* A fixed index is meaningless outside the ring */
+        if (ptr)
+            *(int *)ptr = ub->fixed ? -1 : ub->fd;
+        return ub->fixed ? -1 : ub->fd;
+    default:
+        return 0;
+    }
+}
+
+static int uring_bio_destroy(BIO *bio)
+{
+    uring_bio_t *ub = BIO_get_data(bio);
+
+    if (ub) {
+        uring_bio_release(ub);
+        free(ub);
+        BIO_set_data(bio, NULL);
+    }
+    BIO_set_init(bio, 0);
+    return 1;
+}
+
+static void uring_bio_method_create(void)
+{
+    int type = BIO_get_new_index() | BIO_TYPE_SOURCE_SINK;
+    BIO_METHOD *method = BIO_meth_new(type, "io_uring socket");
+    if (!method)
+        return;
+    BIO_meth_set_write(method, uring_bio_write);
+    BIO_meth_set_read(method, uring_bio_read);
+    BIO_meth_set_ctrl(method, uring_bio_ctrl);
+    BIO_meth_set_destroy(method, uring_bio_destroy);
+    uring_bio_type = type;
+    uring_bio_method = method;
+}
+
+BIO *uring_bio_new(uring_worker_t *worker, int fd, bool fixed)
+{
+    if (!worker || fd < 0)
+        return NULL;
+
+    pthread_once(&uring_bio_method_once, uring_bio_method_create);
+    if (!uring_bio_method)
+        return NULL;
+
+    uring_bio_t *ub = calloc(1, sizeof(uring_bio_t));
+    if (!ub)
+        return NULL;
+    ub->worker = worker;
+    ub->fd = fd;
+    ub->fixed = fixed;
+    ub->held_bid = -1;
+
+    BIO *bio = BIO_new(uring_bio_method);
+    if (!bio) {
+        free(ub);
+        return NULL;
+    }
+    BIO_set_data(bio, ub);
+    BIO_set_init(bio, 1);
+    return bio;
+}
+
+static uring_bio_t *uring_bio_data(BIO *bio)
+{
+    if (!bio || !uring_bio_method || BIO_method_type(bio) != uring_bio_type)
+        return NULL;
+    return BIO_get_data(bio);
+}
+
+void uring_bio_set_timeout(BIO *bio, int timeout_ms)
+{
+    uring_bio_t *ub = uring_bio_data(bio);
+    if (ub)
+        ub->timeout_ms = timeout_ms > 0 ? timeout_ms : 0;
+}
+
+int uring_bio_get_socket(BIO *bio, uring_worker_t **worker, int *fd, bool *fixed)
+{
+    uring_bio_t *ub = uring_bio_data(bio);
+    if (!ub)
+        return -1;
+    if (worker)
+        *worker = ub->worker;
+    if (fd)
+        *fd = ub->fd;
+    if (fixed)
+        *fixed = ub->fixed;
+    return 0;
+}
+
+void uring_bio_set_nonblocking(BIO *bio, bool nonblocking)
+{
+    uring_bio_t *ub = uring_bio_data(bio);
+    if (ub)
+        ub->nonblocking = nonblocking;
+}
@@ -0,0 +1,347 @@
+/* websocket.c - WebSocket bootstrapping for HTTP/2 clients (RFC 8441)
+ *
+ * An HTTP/2 client opens a WebSocket with an extended CONNECT request
+ * (:method CONNECT, :protocol websocket) and then carries the WebSocket
+ * frames in DATA frames of that stream. Backends speak the HTTP/1.1
+ * upgrade handshake instead, so each such stream gets its own backend
+ * connection: the CONNECT is translated into a GET with a fresh
+ * Sec-WebSocket-Key, the backend's 101 is checked against that key, and
+ * afterwards bytes are copied between the stream and the socket unchanged.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include "websocket.h"
+#include "http_status.h"
+#include "log.h"
+
+/* RFC 6455 section 1.3 */
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WEBSOCKET_VERSION "13"
+
+int websocket_generate_key(char key[WEBSOCKET_KEY_SIZE])
+{
+    unsigned char nonce[16];
+
+    if (RAND_bytes(nonce, sizeof(nonce)) != 1) {
+        log_message(LOG_LEVEL_ERROR, "Failed to generate a WebSocket key");
+        return -1;
+    }
+    EVP_EncodeBlock((unsigned char *)key, nonce, sizeof(nonce));
+    return 0;
+}
+
+/* The Sec-WebSocket-Accept value a backend must answer 'key' with */
+int websocket_accept_key(const char *key, char accept[WEBSOCKET_ACCEPT_SIZE])
+{
+    char input[64 + sizeof(WEBSOCKET_GUID)];
+    unsigned char digest[SHA_DIGEST_LENGTH];
+
+    int len = snprintf(input, sizeof(input), "%s%s", key, WEBSOCKET_GUID);
+    if (len < 0 || (size_t)len >= sizeof(input)) {
+        return -1;
+    }
+    SHA1((const unsigned char *)input, (size_t)len, digest);
+    EVP_EncodeBlock((unsigned char *)accept, digest, sizeof(digest));
+    return 0;
+}
+
+static void touch(websocket_stream_t *ws)
+{
+    clock_gettime(CLOCK_MONOTONIC, &ws->last_activity);
+}
+
+static void copy_header(const char *head, size_t head_len, const char *name, char *out, size_t out_size)
+{
+    size_t len = 0;
+    const char *value = http1_response_header(head, head_len, name, &len);
+
+    if (value && len < out_size) {
+        memcpy(out, value, len);
+        out[len] = '\0';
+    }
+}
+
+static int send_head(int fd, const char *buf, size_t len)
+{
+    size_t sent = 0;
+
+    while (sent < len) {
+        ssize_t n = send(fd, buf + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        sent += (size_t)n;
+    }
+    return 0;
+}
+
+/* The upstream request: the CONNECT's headers on a GET, with a key of our
+ * own since RFC 8441 streams carry none */
+static int build_upgrade_head(const HttpRequest *req, const char *authority, const char *key,
+                              char *out, size_t out_size)
+{
+    HttpRequest get = *req;
+    bool has_version = false;
+    http1_body_t body;
+
+    get.method = "GET";
+    get.header_count = 0;
+    for (int i = 0; i < req->header_count; i++) {
+        if (strcasecmp(req->headers[i].field, "Sec-WebSocket-Key") == 0) {
+            continue;
+        }
+        if (strcasecmp(req->headers[i].field, "Sec-WebSocket-Version") == 0) {
+            has_version = true;
+        }
+        get.headers[get.header_count++] = req->headers[i];
+    }
+    if (get.header_count + 2 > MAX_HEADERS) {
+        return -1;
+    }
+    get.headers[get.header_count++] = (HttpHeader){"Sec-WebSocket-Key", key};
+    if (!has_version) {
+        get.headers[get.header_count++] = (HttpHeader){"Sec-WebSocket-Version", WEBSOCKET_VERSION};
+    }
+    return http1_build_request_head(&get, authority, "websocket", out, out_size, &body);
+}
+
+/* Opens a backend connection for an extended CONNECT request and performs
+ * the HTTP/1.1 upgrade. Returns 200 with '*out' set once the backend
+ * switched protocols, otherwise the status to answer the CONNECT with: the
+ * backend's own error status, or 502 when it could not be reached or
+ * answered the handshake wrongly. */
+int websocket_stream_open(websocket_stream_t **out, http1_pool_t *pool, const HttpRequest *req,
+                          int idle_timeout_ms)
+{
+    char key[WEBSOCKET_KEY_SIZE];
+    char expected[WEBSOCKET_ACCEPT_SIZE];
+    char head[HTTP1_CLIENT_HEAD_BUFFER_SIZE];
+    http1_response_head_t response;
+
+    *out = NULL;
+    if (websocket_generate_key(key) != 0 || websocket_accept_key(key, expected) != 0) {
+        return HTTP_STATUS_INTERNAL_ERROR;
+    }
+    int head_len = build_upgrade_head(req, pool->authority, key, head, sizeof(head));
+    if (head_len < 0) {
+        return HTTP_STATUS_BAD_REQUEST;
+    }
+
+    websocket_stream_t *ws = calloc(1, sizeof(*ws));
+    if (!ws) {
+        log_message(LOG_LEVEL_ERROR, "Failed to allocate WebSocket stream");
+        return HTTP_STATUS_INTERNAL_ERROR;
+    }
+    ws->idle_timeout_ms = idle_timeout_ms;
+    ws->fd = http1_pool_connect(pool);
+    if (ws->fd < 0 || send_head(ws->fd, head, (size_t)head_len) != 0) {
+        goto bad_gateway;
+    }
+
+    /* The connection is still blocking, bounded by the response timeout */
+    int parsed = 0;
+    while ((parsed = http1_parse_response_head(ws->buf, ws->len, "GET", &response)) == 0) {
+        if (ws->len == sizeof(ws->buf)) {
+            goto bad_gateway;
+        }
+        ssize_t n = recv(ws->fd, ws->buf + ws->len, sizeof(ws->buf) - ws->len, 0);
+        if (n <= 0) {
+            goto bad_gateway;
+        }
+        ws->len += (size_t)n;
+    }
+    if (parsed < 0) {
+        goto bad_gateway;
+    }
+    if (response.status != HTTP_STATUS_SWITCHING_PROTOCOLS) {
+        log_message(LOG_LEVEL_INFO, "Backend %s declined the WebSocket upgrade with %d",
+                    pool->authority, response.status);
+        websocket_stream_close(ws);
+        return response.status >= HTTP_STATUS_CLIENT_ERROR_MIN ? response.status : HTTP_STATUS_BAD_GATEWAY;
+    }
+
+    size_t accept_len = 0;
+    const char *accept = http1_response_header(ws->buf, response.head_len, "Sec-WebSocket-Accept",
+                                               &accept_len);
+    if (!accept || accept_len != strlen(expected) || memcmp(accept, expected, accept_len) != 0) {
+        log_message(LOG_LEVEL_WARN, "Backend %s sent a wrong Sec-WebSocket-Accept", pool->authority);
+        goto bad_gateway;
+    }
+    copy_header(ws->buf, response.head_len, "Sec-WebSocket-Protocol", ws->protocol, sizeof(ws->protocol));
+    copy_header(ws->buf, response.head_len, "Sec-WebSocket-Extensions", ws->extensions,
+                sizeof(ws->extensions));
+
+    /* Frames the backend sent right after the 101 go out first */
+    ws->len -= response.head_len;
+    memmove(ws->buf, ws->buf + response.head_len, ws->len);
+    fcntl(ws->fd, F_SETFL, fcntl(ws->fd, F_GETFL, 0) | O_NONBLOCK);
+    touch(ws);
+    *out = ws;
+    return HTTP_STATUS_OK;
+
+bad_gateway:
+    websocket_stream_close(ws);
+    return HTTP_STATUS_BAD_GATEWAY;
+}
+
+/* Reads from the backend when nothing is pending, without blocking.
+ * Returns 1 when there are bytes to send or the backend closed, 0 when
+ * there is nothing yet, -1 when the connection failed. */
+int websocket_stream_pull(websocket_stream_t *ws)
+{
+    if (ws->len > 0 || ws->backend_eof) {
+        return 1;
+    }
+
+    ssize_t n = recv(ws->fd, ws->buf, sizeof(ws->buf), MSG_DONTWAIT);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    if (n == 0) {
+        ws->backend_eof = true;
+    }
+    ws->off = 0;
+    ws->len = (size_t)n;
+    touch(ws);
+    return 1;
+}
+
+/* Moves up to 'len' pending backend bytes to 'out' */
+size_t websocket_stream_take(websocket_stream_t *ws, uint8_t *out, size_t len)
+{
+    size_t n = ws->len < len ? ws->len : len;
+
+    memcpy(out, ws->buf + ws->off, n);
+    ws->off += n;
+    ws->len -= n;
+    return n;
+}
+
+/* Sends as much of 'data' as the backend takes without blocking. Returns
+ * the bytes sent, or -1 when the connection failed. */
+static ssize_t send_some(websocket_stream_t *ws, const uint8_t *data, size_t len)
+{
+    size_t sent = 0;
+
+    while (sent < len) {
+        ssize_t n = send(ws->fd, data + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n >= 0) {
+            sent += (size_t)n;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        break;
+    }
+    if (sent > 0) {
+        touch(ws);
+    }
+    return (ssize_t)sent;
+}
+
+/* Passes client stream data on to the backend without blocking; what the
+ * backend does not take now is queued for websocket_stream_flush().
+ * Returns the bytes the backend took now, -1 when the connection failed. */
+ssize_t websocket_stream_write(websocket_stream_t *ws, const uint8_t *data, size_t len)
+{
+    ssize_t sent = 0;
+
+    if (ws->out_len == 0) {
+        sent = send_some(ws, data, len);
+        if (sent < 0) {
+            return -1;
+        }
+    }
+
+    size_t rest = len - (size_t)sent;
+    if (rest > 0) {
+        if (ws->out_len + rest > ws->out_cap) {
+            size_t cap = ws->out_cap ? ws->out_cap : TUNNEL_BUFFER_SIZE;
+            while (cap < ws->out_len + rest) {
+                cap *= 2;
+            }
+            uint8_t *grown = realloc(ws->out, cap);
+            if (!grown) {
+                return -1;
+            }
+            ws->out = grown;
+            ws->out_cap = cap;
+        }
+        memcpy(ws->out + ws->out_len, data + sent, rest);
+        ws->out_len += rest;
+    }
+    return sent;
+}
+
+/* Sends queued client bytes once the backend has room. Returns the bytes
+ * sent, -1 when the connection failed. */
+ssize_t websocket_stream_flush(websocket_stream_t *ws)
+{
+    if (ws->out_len == 0) {
+        return 0;
+    }
+
+    ssize_t sent = send_some(ws, ws->out, ws->out_len);
+    if (sent <= 0) {
+        return sent;
+    }
+    ws->out_len -= (size_t)sent;
+    memmove(ws->out, ws->out + sent, ws->out_len);
+    if (ws->out_len == 0 && ws->shutdown_pending) {
+        shutdown(ws->fd, SHUT_WR);
+        ws->shutdown_pending = false;
+    }
+    return sent;
+}
+
+/* The client ended its side: half-close the backend once it has all bytes */
+void websocket_stream_shutdown(websocket_stream_t *ws)
+{
+    if (ws->out_len > 0) {
+        ws->shutdown_pending = true;
+        return;
+    }
+    shutdown(ws->fd, SHUT_WR);
+}
+
+bool websocket_stream_idle(const websocket_stream_t *ws)
+{
+    if (ws->idle_timeout_ms <= 0) {
+        return false;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long idle_ms = (now.tv_sec - ws->last_activity.tv_sec) * 1000L +
+                   (now.tv_nsec - ws->last_activity.tv_nsec) / 1000000L;
+    return idle_ms >= ws->idle_timeout_ms;
+}
+
+void websocket_stream_close(websocket_stream_t *ws)
+{
+    if (!ws) {
+        return;
+    }
+    if (ws->fd >= 0) {
+        close(ws->fd);
+    }
+    free(ws->out);
+    free(ws);
+}
@@ -3,10 +3,15 @@
 
 #include <criterion/criterion.h>
 #include <criterion/logging.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <time.h>
 
 #include "backend_pool.h"
+#include "proxy_stream.h"
 #include "config.h"
 #include "log.h"
 
@@ -126,6 +131,135 @@ Test(backend_pool, pool_exhaustion)
     backend_pool_destroy(pool);
 }
 
+Test(backend_pool, idle_connections_are_reused_lifo)
+{
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", 8080, false, false, 3);
+    cr_assert_not_null(pool, "Pool should be created");
+    
+    backend_conn_t *conn1 = backend_pool_acquire(pool);
+    backend_conn_t *conn2 = backend_pool_acquire(pool);
+    cr_assert_neq(conn1, conn2, "Unconnected connections take one stream each");
+    
+    backend_pool_release(conn1);
+    backend_conn_t *conn3 = backend_pool_acquire(pool);
+    cr_assert_eq(conn3, conn1, "Most recently released connection should be reused first");
+    
+    backend_pool_release(conn2);
+    backend_pool_release(conn3);
+    cr_assert_eq(backend_pool_get_stream_count(pool), 0, "No streams after release");
+    cr_assert_eq(atomic_load(&pool->idle_count), 3, "All connections idle again");
+    
+    backend_pool_destroy(pool);
+}
+
+Test(backend_pool, elastic_pool_grows_to_max)
+{
+    backend_pool_config_t config = {
+        .size = 3, .min_size = 1, .acquire_timeout_ms = 0, .idle_timeout_seconds = 60
+    };
+    backend_pool_t *pool = backend_pool_create_with_config("127.0.0.1", 8080, false, false, &config);
+    cr_assert_not_null(pool, "Pool should be created");
+    cr_assert_eq(backend_pool_get_size(pool), 1, "Only min_size connections up front");
+    
+    backend_conn_t *conns[3];
+    for (int i = 0; i < 3; i++) {
+        conns[i] = backend_pool_acquire(pool);
+        cr_assert_not_null(conns[i], "Acquire %d should grow the pool", i);
+    }
+    cr_assert_eq(backend_pool_get_size(pool), 3, "Pool should grow to max_size");
+    
+    backend_acquire_result_t result;
+    cr_assert_null(backend_pool_acquire_timed(pool, 0, &result));
+    cr_assert_eq(result, BACKEND_ACQUIRE_EXHAUSTED, "Full pool should report exhaustion");
+    cr_assert_eq(backend_pool_get_exhausted_total(pool), 1);
+    
+    for (int i = 0; i < 3; i++) {
+        backend_pool_release(conns[i]);
+    }
+    cr_assert_eq(atomic_load(&pool->idle_count), 3, "Grown connections stay in the pool");
+    
+    backend_pool_destroy(pool);
+}
+
+Test(backend_pool, acquire_waits_until_deadline)
+{
+    backend_pool_config_t config = {
+        .size = 1, .min_size = 1, .acquire_timeout_ms = 50, .idle_timeout_seconds = 60
+    };
+    backend_pool_t *pool = backend_pool_create_with_config("127.0.0.1", 8080, false, false, &config);
+    cr_assert_not_null(pool, "Pool should be created");
+    
+    backend_conn_t *held = backend_pool_acquire(pool);
+    cr_assert_not_null(held);
+    
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    backend_acquire_result_t result;
+    cr_assert_null(backend_pool_acquire_timed(pool, 50, &result));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long waited_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    
+    cr_assert_eq(result, BACKEND_ACQUIRE_EXHAUSTED);
+    cr_assert_geq(waited_ms, 45, "Acquire should wait for the deadline");
+    cr_assert_lt(waited_ms, 1000, "Acquire should not wait past the deadline");
+    cr_assert_eq(backend_pool_get_waiter_count(pool), 0, "Timed out waiter leaves the queue");
+    
+    backend_pool_release(held);
+    backend_pool_destroy(pool);
+}
+
+typedef struct {
+    backend_pool_t *pool;
+    backend_conn_t *conn;
+    int order;
+} waiter_job_t;
+
+static _Atomic int served_order;
+
+static void *waiting_acquire(void *arg)
+{
+    waiter_job_t *job = arg;
+    job->conn = backend_pool_acquire_timed(job->pool, 5000, NULL);
+    job->order = atomic_fetch_add(&served_order, 1);
+    return NULL;
+}
+
+Test(backend_pool, released_slot_goes_to_first_waiter)
+{
+    backend_pool_config_t config = {
+        .size = 1, .min_size = 1, .acquire_timeout_ms = 5000, .idle_timeout_seconds = 60
+    };
+    backend_pool_t *pool = backend_pool_create_with_config("127.0.0.1", 8080, false, false, &config);
+    cr_assert_not_null(pool, "Pool should be created");
+    atomic_store(&served_order, 0);
+    
+    backend_conn_t *held = backend_pool_acquire(pool);
+    cr_assert_not_null(held);
+    
+    waiter_job_t jobs[2] = {{.pool = pool}, {.pool = pool}};
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++) {
+        cr_assert_eq(pthread_create(&threads[i], NULL, waiting_acquire, &jobs[i]), 0);
+        while (backend_pool_get_waiter_count(pool) < i + 1) {
+            usleep(1000);
+        }
+    }
+    
+    backend_pool_release(held);
+    pthread_join(threads[0], NULL);
+    cr_assert_eq(jobs[0].conn, held, "First waiter should get the released slot");
+    cr_assert_eq(backend_pool_get_waiter_count(pool), 1, "Second waiter still queued");
+    
+    backend_pool_release(jobs[0].conn);
+    pthread_join(threads[1], NULL);
+    cr_assert_eq(jobs[1].conn, held, "Second waiter served next");
+    cr_assert_lt(jobs[0].order, jobs[1].order, "Waiters served in FIFO order");
+    
+    backend_pool_release(jobs[1].conn);
+    cr_assert_eq(backend_pool_get_stream_count(pool), 0);
+    backend_pool_destroy(pool);
+}
+
 TestSuite(circuit_breaker, .init = setup_logging, .fini = teardown_logging);
 
 Test(circuit_breaker, init_and_destroy)
@@ -320,6 +454,172 @@ Test(circuit_breaker, disabled_circuit_breaker)
     backend_pool_destroy(pool);
 }
 
+Test(circuit_breaker, error_rate_opens_after_minimum_volume)
+{
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", 8080, false, false, 2);
+    cr_assert_not_null(pool, "Pool should be created");
+    
+    circuit_breaker_config_t config = {
+        .enabled = true,
+        .failure_threshold = 100,
+        .recovery_timeout_seconds = 10,
+        .failure_percent = 50,
+        .minimum_requests = 10,
+        .window_seconds = 1
+    };
+    cr_assert_eq(backend_pool_init_circuit_breaker(pool, &config), 0);
+    
+    /* Half of them failing, but too few to judge */
+    for (int i = 0; i < 4; i++) {
+        backend_pool_circuit_breaker_record_success(pool);
+        backend_pool_circuit_breaker_record_failure(pool);
+    }
+    cr_assert_eq(backend_pool_circuit_breaker_get_state(pool), CIRCUIT_BREAKER_CLOSED);
+    
+    /* Requests slide out of the window */
+    long requests;
+    long failures;
+    backend_pool_circuit_breaker_get_window(pool, &requests, &failures);
+    cr_assert_eq(requests, 8);
+    cr_assert_eq(failures, 4);
+    usleep(1200 * 1000);
+    backend_pool_circuit_breaker_get_window(pool, &requests, &failures);
+    cr_assert_eq(requests, 0);
+    
+    for (int i = 0; i < 5; i++) {
+        backend_pool_circuit_breaker_record_success(pool);
+        cr_assert_eq(backend_pool_circuit_breaker_get_state(pool), CIRCUIT_BREAKER_CLOSED);
+        backend_pool_circuit_breaker_record_failure(pool);
+    }
+    cr_assert_eq(backend_pool_circuit_breaker_get_state(pool), CIRCUIT_BREAKER_OPEN,
+                 "5 of 10 failed: at the error rate");
+    cr_assert_eq(backend_pool_circuit_breaker_get_total_opens(pool), 1);
+    
+    backend_pool_destroy_circuit_breaker(pool);
+    backend_pool_destroy(pool);
+}
+
+Test(circuit_breaker, half_open_admits_limited_probes)
+{
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", 8080, false, false, 2);
+    cr_assert_not_null(pool, "Pool should be created");
+    
+    circuit_breaker_config_t config = {
+        .enabled = true,
+        .failure_threshold = 1,
+        .recovery_timeout_seconds = 1,
+        .success_threshold = 3,
+        .half_open_max_requests = 2
+    };
+    cr_assert_eq(backend_pool_init_circuit_breaker(pool, &config), 0);
+    backend_pool_circuit_breaker_record_failure(pool);
+    sleep(2);
+    
+    cr_assert(backend_pool_is_available(pool));
+    cr_assert(backend_pool_circuit_breaker_allow_request(pool));
+    cr_assert(backend_pool_circuit_breaker_allow_request(pool));
+    cr_assert_not(backend_pool_circuit_breaker_allow_request(pool), "Both probe slots are taken");
+    cr_assert_not(backend_pool_is_available(pool));
+    
+    /* A probe that is answered frees its slot; one never sent frees it too */
+    backend_pool_circuit_breaker_record_success(pool);
+    cr_assert(backend_pool_circuit_breaker_allow_request(pool));
+    backend_pool_circuit_breaker_cancel_request(pool);
+    cr_assert(backend_pool_circuit_breaker_allow_request(pool));
+    cr_assert_not(backend_pool_circuit_breaker_allow_request(pool));
+    
+    backend_pool_circuit_breaker_record_success(pool);
+    cr_assert_eq(backend_pool_circuit_breaker_get_state(pool), CIRCUIT_BREAKER_HALF_OPEN,
+                 "2 of 3 successes");
+    backend_pool_circuit_breaker_record_success(pool);
+    cr_assert_eq(backend_pool_circuit_breaker_get_state(pool), CIRCUIT_BREAKER_CLOSED);
+    cr_assert_eq(backend_pool_circuit_breaker_get_total_closes(pool), 1);
+    
+    /* The failures from before do not count against it again */
+    long requests;
+    long failures;
+    backend_pool_circuit_breaker_get_window(pool, &requests, &failures);
+    cr_assert_eq(failures, 0);
+    
+    backend_pool_destroy_circuit_breaker(pool);
+    backend_pool_destroy(pool);
+}
+
+Test(circuit_breaker, cancelled_probe_returns_its_slot)
+{
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", 8080, false, false, 2);
+    cr_assert_not_null(pool, "Pool should be created");
+    
+    circuit_breaker_config_t config = {
+        .enabled = true,
+        .failure_threshold = 1,
+        .recovery_timeout_seconds = 1,
+        .success_threshold = 1,
+        .half_open_max_requests = 1
+    };
+    cr_assert_eq(backend_pool_init_circuit_breaker(pool, &config), 0);
+    backend_pool_circuit_breaker_record_failure(pool);
+    sleep(2);
+    
+    /* A probe whose client went away before the body ended */
+    cr_assert(backend_pool_circuit_breaker_allow_request(pool));
+    cr_assert_not(backend_pool_circuit_breaker_allow_request(pool), "The probe slot is taken");
+    backend_conn_t *conn = backend_pool_acquire(pool);
+    cr_assert_not_null(conn);
+    http2_stream_t *stream = calloc(1, sizeof(*stream));
+    proxy_stream_t *ps = proxy_stream_create(&conn->client, stream, conn);
+    cr_assert_not_null(ps);
+    proxy_stream_close(ps);
+    
+    cr_assert_eq(backend_pool_circuit_breaker_get_state(pool), CIRCUIT_BREAKER_HALF_OPEN);
+    cr_assert(backend_pool_circuit_breaker_allow_request(pool), "The slot came back");
+    
+    backend_pool_destroy_circuit_breaker(pool);
+    backend_pool_destroy(pool);
+}
+
+static void *record_failures(void *arg)
+{
+    backend_pool_t *pool = arg;
+    for (int i = 0; i < 1000; i++) {
+        backend_pool_circuit_breaker_record_failure(pool);
+    }
+    return NULL;
+}
+
+Test(circuit_breaker, concurrent_failures_open_once)
+{
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", 8080, false, false, 2);
+    cr_assert_not_null(pool, "Pool should be created");
+    
+    circuit_breaker_config_t config = {
+        .enabled = true,
+        .failure_threshold = 1,
+        .recovery_timeout_seconds = 60,
+        .failure_percent = 50,
+        .minimum_requests = 1
+    };
+    cr_assert_eq(backend_pool_init_circuit_breaker(pool, &config), 0);
+    
+    pthread_t threads[8];
+    for (int i = 0; i < 8; i++) {
+        cr_assert_eq(pthread_create(&threads[i], NULL, record_failures, pool), 0);
+    }
+    for (int i = 0; i < 8; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    
+    cr_assert_eq(backend_pool_circuit_breaker_get_state(pool), CIRCUIT_BREAKER_OPEN);
+    cr_assert_eq(backend_pool_circuit_breaker_get_total_opens(pool), 1, "Opened exactly once");
+    long requests;
+    long failures;
+    backend_pool_circuit_breaker_get_window(pool, &requests, &failures);
+    cr_assert_eq(failures, 8000, "Every failure is counted across the stripes");
+    
+    backend_pool_destroy_circuit_breaker(pool);
+    backend_pool_destroy(pool);
+}
+
 TestSuite(health_checker, .init = setup_logging, .fini = teardown_logging);
 
 Test(health_checker, config_defaults)
@@ -378,3 +678,80 @@ Test(backend_pool_metrics, metrics_update)
     backend_pool_release(conn);
     backend_pool_destroy(pool);
 }
+
+/* A pool that opens no connections of its own, checked every 'interval' */
+static backend_pool_t *create_checked_pool(int port, int interval, int timeout, int unhealthy_threshold)
+{
+    backend_pool_config_t pool_config = {.size = 2, .min_size = 0, .acquire_timeout_ms = 100};
+    backend_pool_t *pool = backend_pool_create_with_config("127.0.0.1", port, true, false, &pool_config);
+    cr_assert_not_null(pool);
+
+    health_check_config_t config = {.enabled = true, .path = "/health", .interval_seconds = interval,
+                                    .timeout_seconds = timeout, .unhealthy_threshold = unhealthy_threshold,
+                                    .healthy_threshold = 1};
+    cr_assert_eq(backend_pool_start_health_checker(pool, &config), 0);
+    return pool;
+}
+
+static bool wait_for_health(backend_pool_t *pool, backend_health_t health, int timeout_ms)
+{
+    for (int waited = 0; waited < timeout_ms; waited += 10) {
+        if (backend_pool_get_overall_health(pool) == health) {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+static long elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000L + (now.tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+Test(health_checker, refused_backend_marked_unhealthy)
+{
+    /* A port nothing listens on */
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    cr_assert_eq(bind(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    close(fd);
+
+    backend_pool_t *pool = create_checked_pool(ntohs(addr.sin_port), 1, 1, 2);
+    cr_assert(wait_for_health(pool, BACKEND_HEALTH_UNHEALTHY, 5000),
+              "Two refused checks should mark the backend unhealthy");
+    cr_assert_geq(atomic_load(&pool->health_checker.failed_checks), 2);
+    cr_assert_eq(backend_pool_get_size(pool), 0, "Checks never open pool connections");
+    cr_assert_eq(backend_pool_get_stream_count(pool), 0);
+    cr_assert_not(backend_pool_is_available(pool));
+
+    backend_pool_destroy(pool);
+}
+
+Test(health_checker, silent_backend_times_out)
+{
+    /* Connections complete in the backlog, but nothing ever answers */
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    cr_assert_eq(bind(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    cr_assert_eq(listen(fd, 8), 0);
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    backend_pool_t *pool = create_checked_pool(ntohs(addr.sin_port), 5, 1, 1);
+    cr_assert(wait_for_health(pool, BACKEND_HEALTH_UNHEALTHY, 3000),
+              "The check should fail after its 1 s timeout");
+    cr_assert_geq(elapsed_ms(&start), 1000);
+
+    /* Stopping does not wait for the next check, 5 s away */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    backend_pool_destroy(pool);
+    cr_assert_lt(elapsed_ms(&start), 500);
+    close(fd);
+}
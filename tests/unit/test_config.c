@@ -471,3 +471,305 @@ Test(config, parse_routes_with_document_root_resolution)
     rmdir(temp_dir);
     unlink(temp_filename);
 }
+
+Test(config, parse_cpu_affinity_settings)
+{
+    const char *temp_filename = "temp_config_affinity.yaml";
+
+    write_config_file(
+        temp_filename,
+        "ssl:\n"
+        "  certificate: certs/dev.crt\n"
+        "  private_key: certs/dev.key\n"
+        "cpu_affinity:\n"
+        "  enabled: true\n"
+        "  worker_cpus: \"2-4,8\"\n"
+        "  acceptor_cpu: 0\n"
+        "  logger_cpu: 1\n");
+
+    ServerConfig config;
+    int ret = load_config(&config, temp_filename);
+    cr_assert_eq(ret, 0, "Config with cpu_affinity should load");
+    cr_assert(config.cpu_affinity.enabled);
+    cr_assert_eq(config.cpu_affinity.worker_cpu_count, 4);
+    cr_assert_eq(config.cpu_affinity.worker_cpu_list[0], 2);
+    cr_assert_eq(config.cpu_affinity.worker_cpu_list[2], 4);
+    cr_assert_eq(config.cpu_affinity.worker_cpu_list[3], 8);
+    cr_assert_eq(config.cpu_affinity.acceptor_cpu, 0);
+    cr_assert_eq(config.cpu_affinity.logger_cpu, 1);
+    cr_assert_eq(config.cpu_affinity.metrics_cpu, -1, "Unset CPUs should default to unpinned");
+
+    unlink(temp_filename);
+}
+
+Test(config, reject_invalid_worker_cpu_list)
+{
+    const char *temp_filename = "temp_config_affinity_bad.yaml";
+
+    write_config_file(
+        temp_filename,
+        "ssl:\n"
+        "  certificate: certs/dev.crt\n"
+        "  private_key: certs/dev.key\n"
+        "cpu_affinity:\n"
+        "  enabled: true\n"
+        "  worker_cpus: \"4-2\"\n");
+
+    ServerConfig config;
+    cr_assert_eq(load_config(&config, temp_filename), -1,
+                 "Descending CPU range should be rejected");
+    unlink(temp_filename);
+}
+
+Test(config, parse_connection_pool_sizing)
+{
+    const char *temp_filename = "temp_config_pool.yaml";
+
+    write_config_file(
+        temp_filename,
+        "ssl:\n"
+        "  certificate: certs/dev.crt\n"
+        "  private_key: certs/dev.key\n"
+        "routes:\n"
+        "  - path: /api/\n"
+        "    technology: reverse_proxy\n"
+        "    backend: 127.0.0.1:8081\n"
+        "    connection_pool:\n"
+        "      min_size: 2\n"
+        "      max_size: 64\n"
+        "      acquire_timeout_ms: 250\n"
+        "  - path: /legacy/\n"
+        "    technology: reverse_proxy\n"
+        "    backend: 127.0.0.1:8082\n"
+        "    connection_pool:\n"
+        "      size: 5\n");
+
+    ServerConfig config;
+    cr_assert_eq(load_config(&config, temp_filename), 0, "Config with pool sizing should load");
+    cr_assert_eq(config.routes[0].connection_pool.min_size, 2);
+    cr_assert_eq(config.routes[0].connection_pool.size, 64);
+    cr_assert_eq(config.routes[0].connection_pool.acquire_timeout_ms, 250);
+    cr_assert_eq(config.routes[1].connection_pool.size, 5, "size is an alias for max_size");
+    cr_assert_eq(config.routes[1].connection_pool.min_size, BACKEND_POOL_DEFAULT_MIN_SIZE);
+    cr_assert_eq(config.routes[1].connection_pool.acquire_timeout_ms,
+                 BACKEND_POOL_DEFAULT_ACQUIRE_TIMEOUT_MS);
+
+    unlink(temp_filename);
+}
+
+Test(config, reject_pool_min_above_max)
+{
+    const char *temp_filename = "temp_config_pool_bad.yaml";
+
+    write_config_file(
+        temp_filename,
+        "ssl:\n"
+        "  certificate: certs/dev.crt\n"
+        "  private_key: certs/dev.key\n"
+        "routes:\n"
+        "  - path: /api/\n"
+        "    technology: reverse_proxy\n"
+        "    backend: 127.0.0.1:8081\n"
+        "    connection_pool:\n"
+        "      min_size: 8\n"
+        "      max_size: 4\n");
+
+    ServerConfig config;
+    cr_assert_eq(load_config(&config, temp_filename), -1,
+                 "min_size above max_size should be rejected");
+    unlink(temp_filename);
+}
+
+Test(config, parse_upstream_cluster)
+{
+    const char *temp_filename = "temp_config_cluster.yaml";
+
+    write_config_file(
+        temp_filename,
+        "ssl:\n"
+        "  certificate: certs/dev.crt\n"
+        "  private_key: certs/dev.key\n"
+        "routes:\n"
+        "  - path: /api/\n"
+        "    technology: reverse_proxy\n"
+        "    backends:\n"
+        "      - 10.0.0.1:8443\n"
+        "      - 10.0.0.2:8443\n"
+        "      - 10.0.0.3:8443\n"
+        "    load_balancer: maglev\n"
+        "    hash_header: X-Session-Id\n"
+        "    websocket_enabled: false\n"
+        "    websocket_idle_timeout_seconds: 15\n"
+        "    outlier_detection:\n"
+        "      enabled: true\n"
+        "      consecutive_5xx: 3\n"
+        "      max_ejection_percent: 34\n"
+        "      latency_factor: 0\n"
+        "    retry:\n"
+        "      enabled: true\n"
+        "      max_retries: 2\n"
+        "      budget_percent: 10\n"
+        "      hedge: true\n"
+        "    circuit_breaker:\n"
+        "      enabled: true\n"
+        "      failure_percent: 25\n"
+        "      half_open_max_requests: 3\n"
+        "    concurrency_limit:\n"
+        "      enabled: true\n"
+        "      min_limit: 50\n"
+        "      max_limit: 400\n"
+        "  - path: /legacy/\n"
+        "    technology: reverse_proxy\n"
+        "    backend: 127.0.0.1:8082\n");
+
+    ServerConfig config;
+    cr_assert_eq(load_config(&config, temp_filename), 0, "Config with backends should load");
+    cr_assert_eq(config.routes[0].backend_count, 3);
+    cr_assert_str_eq(config.routes[0].backends[2], "10.0.0.3:8443");
+    cr_assert_str_eq(config.routes[0].backend, "10.0.0.1:8443", "backend is the first endpoint");
+    cr_assert_eq(config.routes[0].load_balancer, LB_MAGLEV);
+    cr_assert_str_eq(config.routes[0].hash_header, "X-Session-Id");
+    cr_assert_eq(config.routes[1].backend_count, 1, "A single backend is a one-endpoint cluster");
+    cr_assert_str_eq(config.routes[1].backends[0], "127.0.0.1:8082");
+    cr_assert_eq(config.routes[1].load_balancer, LB_ROUND_ROBIN);
+    cr_assert_not(config.routes[0].websocket_enabled);
+    cr_assert_eq(config.routes[0].websocket_idle_timeout_seconds, 15);
+    cr_assert(config.routes[1].websocket_enabled, "WebSockets are proxied by default");
+    cr_assert_eq(config.routes[1].websocket_idle_timeout_seconds, 60);
+    cr_assert(config.routes[0].outlier_detection.enabled);
+    cr_assert_eq(config.routes[0].outlier_detection.consecutive_5xx, 3);
+    cr_assert_eq(config.routes[0].outlier_detection.max_ejection_percent, 34);
+    cr_assert_eq(config.routes[0].outlier_detection.latency_factor, 0);
+    cr_assert_eq(config.routes[0].outlier_detection.base_ejection_time_seconds, OUTLIER_DEFAULT_EJECTION_SEC);
+    cr_assert_not(config.routes[1].outlier_detection.enabled, "Outlier detection is opt-in");
+    cr_assert(config.routes[0].retry.enabled);
+    cr_assert_eq(config.routes[0].retry.max_retries, 2);
+    cr_assert_eq(config.routes[0].retry.budget_percent, 10);
+    cr_assert_eq(config.routes[0].retry.budget_burst, RETRY_DEFAULT_BUDGET_BURST);
+    cr_assert(config.routes[0].retry.hedge);
+    cr_assert_eq(config.routes[0].retry.hedge_delay_ms, 0, "Hedge after the p95 by default");
+    cr_assert_not(config.routes[1].retry.enabled, "Retries are opt-in");
+    cr_assert(config.routes[0].concurrency_limit.enabled);
+    cr_assert_eq(config.routes[0].concurrency_limit.min_limit, 50);
+    cr_assert_eq(config.routes[0].concurrency_limit.max_limit, 400);
+    cr_assert_eq(config.routes[0].concurrency_limit.initial_limit, 50, "The initial limit is kept within the range");
+    cr_assert_eq(config.routes[0].concurrency_limit.rtt_tolerance_percent,
+                 CONCURRENCY_DEFAULT_RTT_TOLERANCE_PERCENT);
+    cr_assert_not(config.routes[1].concurrency_limit.enabled, "Concurrency limits are opt-in");
+    cr_assert(config.routes[0].circuit_breaker.enabled);
+    cr_assert_eq(config.routes[0].circuit_breaker.failure_percent, 25);
+    cr_assert_eq(config.routes[0].circuit_breaker.half_open_max_requests, 3);
+    cr_assert_eq(config.routes[0].circuit_breaker.minimum_requests, CIRCUIT_BREAKER_DEFAULT_MIN_REQUESTS);
+    cr_assert_eq(config.routes[0].circuit_breaker.success_threshold, CIRCUIT_BREAKER_DEFAULT_SUCCESS_THRESHOLD);
+    cr_assert_eq(config.routes[1].circuit_breaker.failure_threshold, CIRCUIT_BREAKER_DEFAULT_FAILURE_THRESHOLD);
+
+    unlink(temp_filename);
+}
+
+Test(config, parse_response_cache_settings)
+{
+    const char *temp_filename = "temp_config_response_cache.yaml";
+
+    write_config_file(
+        temp_filename,
+        "ssl:\n"
+        "  certificate: certs/dev.crt\n"
+        "  private_key: certs/dev.key\n"
+        "response_cache:\n"
+        "  max_size_mb: 256\n"
+        "  shards: 32\n"
+        "  max_entry_size_kb: 512\n"
+        "  disk_path: /var/cache/emme/responses\n"
+        "  disk_size_mb: 4096\n"
+        "  disk_max_object_mb: 256\n"
+        "routes:\n"
+        "  - path: /api/\n"
+        "    technology: reverse_proxy\n"
+        "    backend: 127.0.0.1:8081\n"
+        "    cache:\n"
+        "      enabled: true\n"
+        "      ttl_seconds: 5\n"
+        "      coalesce_timeout_ms: 250\n"
+        "      stale_while_revalidate_seconds: 30\n"
+        "      stale_if_error_seconds: 86400\n"
+        "  - path: /legacy/\n"
+        "    technology: reverse_proxy\n"
+        "    backend: 127.0.0.1:8082\n");
+
+    ServerConfig config;
+    cr_assert_eq(load_config(&config, temp_filename), 0, "Config with a response cache should load");
+    cr_assert_eq(config.response_cache.max_size_mb, 256);
+    cr_assert_eq(config.response_cache.shards, 32);
+    cr_assert_eq(config.response_cache.max_entry_size_kb, 512);
+    cr_assert_str_eq(config.response_cache.disk_path, "/var/cache/emme/responses");
+    cr_assert_eq(config.response_cache.disk_size_mb, 4096);
+    cr_assert_eq(config.response_cache.disk_slab_kb, RESPONSE_CACHE_CONFIG_DEFAULT_DISK_SLAB_KB);
+    cr_assert_eq(config.response_cache.disk_max_object_mb, 256);
+    cr_assert(config.routes[0].cache.enabled);
+    cr_assert_eq(config.routes[0].cache.ttl_seconds, 5);
+    cr_assert_eq(config.routes[0].cache.coalesce_timeout_ms, 250);
+    cr_assert_eq(config.routes[0].cache.stale_while_revalidate_seconds, 30);
+    cr_assert_eq(config.routes[0].cache.stale_if_error_seconds, 86400);
+    cr_assert_not(config.routes[1].cache.enabled, "Routes do not cache by default");
+    cr_assert_eq(config.routes[1].cache.coalesce_timeout_ms, RESPONSE_CACHE_CONFIG_DEFAULT_COALESCE_MS);
+    cr_assert_eq(config.routes[1].cache.stale_if_error_seconds, 0, "Stale entries are not served by default");
+    unlink(temp_filename);
+
+    write_config_file(
+        temp_filename,
+        "ssl:\n"
+        "  certificate: certs/dev.crt\n"
+        "  private_key: certs/dev.key\n"
+        "response_cache:\n"
+        "  shards: 1000\n");
+    cr_assert_eq(load_config(&config, temp_filename), -1, "Shard count out of range");
+    unlink(temp_filename);
+}
+
+Test(config, reject_unknown_load_balancer)
+{
+    const char *temp_filename = "temp_config_cluster_bad.yaml";
+
+    write_config_file(
+        temp_filename,
+        "ssl:\n"
+        "  certificate: certs/dev.crt\n"
+        "  private_key: certs/dev.key\n"
+        "routes:\n"
+        "  - path: /api/\n"
+        "    technology: reverse_proxy\n"
+        "    backends:\n"
+        "      - 10.0.0.1:8443\n"
+        "      - not-an-address\n");
+
+    ServerConfig config;
+    cr_assert_eq(load_config(&config, temp_filename), -1, "Malformed endpoint should be rejected");
+
+    write_config_file(
+        temp_filename,
+        "ssl:\n"
+        "  certificate: certs/dev.crt\n"
+        "  private_key: certs/dev.key\n"
+        "routes:\n"
+        "  - path: /api/\n"
+        "    technology: reverse_proxy\n"
+        "    backend: 10.0.0.1:8443\n"
+        "    load_balancer: random\n");
+
+    cr_assert_eq(load_config(&config, temp_filename), -1, "Unknown policy should be rejected");
+    unlink(temp_filename);
+}
+
+Test(config, parse_bracketed_ipv6_backend)
+{
+    char host[256];
+    int port;
+
+    cr_assert_eq(parse_backend_url("[::1]:8443", host, sizeof(host), &port), 0);
+    cr_assert_str_eq(host, "::1");
+    cr_assert_eq(port, 8443);
+    cr_assert_eq(parse_backend_url("api.internal:443", host, sizeof(host), &port), 0);
+    cr_assert_str_eq(host, "api.internal");
+    cr_assert_eq(parse_backend_url("[::1]8443", host, sizeof(host), &port), -1);
+    cr_assert_eq(parse_backend_url("::1:8443", host, sizeof(host), &port), -1);
+}
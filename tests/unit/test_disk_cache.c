@@ -0,0 +1,189 @@
+// tests/unit/test_disk_cache.c
+// Unit tests for the disk tier behind the response cache
+
+#include <criterion/criterion.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "response_cache.h"
+
+#define HEADER(NAME, VALUE) (response_cache_header_t){NAME, sizeof(NAME) - 1, VALUE, sizeof(VALUE) - 1}
+
+static void make_request(HttpRequest *req, const char *path)
+{
+    memset(req, 0, sizeof(*req));
+    req->method = "GET";
+    req->path = path;
+    req->headers[req->header_count++] = (HttpHeader){"Host", "api.example"};
+}
+
+/* A cache with a disk tier in a fresh temporary file, named in 'path' */
+static response_cache_t *create_tiered(char *path, size_t memory, size_t max_entry, size_t disk_size,
+                                       size_t slab_size, size_t max_object)
+{
+    strcpy(path, "/tmp/emme_disk_cache_XXXXXX");
+    int fd = mkstemp(path);
+    cr_assert_geq(fd, 0);
+    close(fd);
+
+    response_cache_t *cache = response_cache_create(memory, 1, max_entry);
+    cr_assert_not_null(cache);
+    cr_assert_eq(response_cache_enable_disk(cache, path, disk_size, slab_size, max_object), 0);
+    return cache;
+}
+
+static void store_body(response_cache_t *cache, const HttpRequest *req, const char *body, size_t len)
+{
+    response_cache_header_t headers[] = {
+        HEADER("Content-Type", "text/csv"),
+        HEADER("Cache-Control", "max-age=60"),
+    };
+    response_cache_entry_t *entry = response_cache_begin(cache, req, 200, headers, 2, 0);
+    cr_assert_not_null(entry);
+    cr_assert_eq(response_cache_append(entry, body, len), 0);
+    response_cache_commit(cache, entry);
+}
+
+static bool cached(response_cache_t *cache, const HttpRequest *req)
+{
+    response_cache_entry_t *entry = response_cache_lookup(cache, req);
+    response_cache_release(entry);
+    return entry != NULL;
+}
+
+Test(disk_cache, large_objects_are_served_from_disk)
+{
+    char path[64];
+    response_cache_t *cache = create_tiered(path, 64 * 1024, 1024, 1024 * 1024, 4096, 256 * 1024);
+    HttpRequest req;
+    make_request(&req, "/api/export.csv");
+
+    size_t len = 100 * 1024;
+    char *body = malloc(len);
+    for (size_t i = 0; i < len; i++) {
+        body[i] = (char)('a' + i % 26);
+    }
+    store_body(cache, &req, body, len);
+    disk_cache_flush(cache->disk);
+
+    response_cache_entry_t *hit = response_cache_lookup(cache, &req);
+    cr_assert_not_null(hit, "A body over the memory entry limit is found on disk");
+    cr_assert_not_null(hit->disk_record);
+    cr_assert_eq(hit->status, 200);
+    cr_assert_eq(hit->header_count, 2);
+    cr_assert_str_eq(hit->headers[0].name, "content-type");
+    cr_assert_str_eq(hit->headers[0].value, "text/csv");
+    cr_assert_eq(hit->body_len, len);
+    cr_assert_eq(memcmp(hit->body, body, len), 0);
+    response_cache_release(hit);
+
+    /* Bodies over the disk object limit are not stored at all */
+    HttpRequest huge;
+    make_request(&huge, "/api/huge.csv");
+    response_cache_header_t headers[] = {HEADER("Cache-Control", "max-age=60")};
+    response_cache_entry_t *entry = response_cache_begin(cache, &huge, 200, headers, 1, 0);
+    cr_assert_eq(response_cache_append(entry, body, len), 0);
+    cr_assert_eq(response_cache_append(entry, body, len), 0);
+    cr_assert_eq(response_cache_append(entry, body, len), -1);
+    response_cache_release(entry);
+
+    response_cache_stats_t stats;
+    response_cache_get_stats(cache, &stats);
+    cr_assert_eq(stats.disk_hits, 1);
+    cr_assert_eq(stats.disk_writes, 1);
+    cr_assert_eq(stats.entries, 0, "Memory holds none of it");
+
+    free(body);
+    response_cache_destroy(cache);
+    unlink(path);
+}
+
+Test(disk_cache, memory_evictions_are_demoted_to_disk)
+{
+    char path[64];
+    response_cache_t *cache = create_tiered(path, 8 * 1024, 2048, 1024 * 1024, 4096, 64 * 1024);
+    char body[1024];
+    memset(body, 'e', sizeof(body));
+
+    char paths[16][32];
+    for (int i = 0; i < 16; i++) {
+        HttpRequest req;
+        snprintf(paths[i], sizeof(paths[i]), "/api/page/%d", i);
+        make_request(&req, paths[i]);
+        store_body(cache, &req, body, sizeof(body));
+    }
+    disk_cache_flush(cache->disk);
+
+    response_cache_stats_t stats;
+    response_cache_get_stats(cache, &stats);
+    cr_assert_gt(stats.evictions, 0);
+    cr_assert_eq(stats.disk_writes, stats.evictions, "Every evicted entry was still fresh");
+
+    HttpRequest first;
+    make_request(&first, paths[0]);
+    response_cache_entry_t *hit = response_cache_lookup(cache, &first);
+    cr_assert_not_null(hit, "Evicted from memory, found on disk");
+    cr_assert_not_null(hit->disk_record);
+    cr_assert_eq(hit->body_len, sizeof(body));
+    cr_assert_eq(memcmp(hit->body, body, sizeof(body)), 0);
+    response_cache_release(hit);
+
+    response_cache_destroy(cache);
+    unlink(path);
+}
+
+Test(disk_cache, ring_overwrites_oldest_records_but_not_served_ones)
+{
+    /* 16 slabs of 4 KB; each 8 KB body takes 3 of them, so 5 fit */
+    char path[64];
+    response_cache_t *cache = create_tiered(path, 64 * 1024, 1024, 64 * 1024, 4096, 16 * 1024);
+    char body[8 * 1024];
+    memset(body, 'r', sizeof(body));
+
+    char paths[8][32];
+    HttpRequest reqs[8];
+    for (int i = 0; i < 8; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/api/blob/%d", i);
+        make_request(&reqs[i], paths[i]);
+    }
+    for (int i = 0; i < 5; i++) {
+        store_body(cache, &reqs[i], body, sizeof(body));
+    }
+    disk_cache_flush(cache->disk);
+    for (int i = 0; i < 5; i++) {
+        cr_assert(cached(cache, &reqs[i]));
+    }
+
+    /* The sixth wraps around over the oldest */
+    store_body(cache, &reqs[5], body, sizeof(body));
+    disk_cache_flush(cache->disk);
+    cr_assert_not(cached(cache, &reqs[0]));
+    cr_assert(cached(cache, &reqs[1]));
+    cr_assert(cached(cache, &reqs[5]));
+
+    /* The next slabs hold a response being served, so the write is dropped */
+    response_cache_entry_t *served = response_cache_lookup(cache, &reqs[1]);
+    cr_assert_not_null(served);
+    store_body(cache, &reqs[6], body, sizeof(body));
+    disk_cache_flush(cache->disk);
+    cr_assert_not(cached(cache, &reqs[6]));
+    cr_assert_eq(memcmp(served->body, body, sizeof(body)), 0);
+    response_cache_release(served);
+
+    store_body(cache, &reqs[7], body, sizeof(body));
+    disk_cache_flush(cache->disk);
+    cr_assert(cached(cache, &reqs[7]));
+    cr_assert_not(cached(cache, &reqs[1]));
+
+    response_cache_stats_t stats;
+    response_cache_get_stats(cache, &stats);
+    cr_assert_eq(stats.disk_writes, 7);
+    cr_assert_eq(stats.disk_dropped, 1);
+    cr_assert_eq(atomic_load(&cache->disk->evictions), 2);
+
+    response_cache_destroy(cache);
+    unlink(path);
+}
@@ -0,0 +1,296 @@
+// tests/unit/test_http1_client.c
+// Unit tests for the keep-alive HTTP/1.1 upstream client
+
+#include <criterion/criterion.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "http1_client.h"
+#include "http_parser.h"
+#include "resolver.h"
+
+static int listen_loopback(int *port)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(bind(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    cr_assert_eq(listen(fd, 4), 0);
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+Test(http1_client, chunked_body_ends_at_last_chunk)
+{
+    const char *body = "4\r\nWiki\r\n5;ext=1\r\npedia\r\n0\r\nX-Trailer: yes\r\n\r\n";
+    const char *next = "HTTP/1.1 200 OK\r\n";
+    char stream[256];
+    snprintf(stream, sizeof(stream), "%s%s", body, next);
+
+    /* Byte by byte, as if every read returned one byte */
+    http1_body_t framing;
+    http1_body_init(&framing, HTTP1_BODY_CHUNKED, 0);
+    size_t consumed = 0;
+    for (size_t i = 0; i < strlen(stream) && !framing.done; i++) {
+        ssize_t n = http1_body_consume(&framing, stream + i, 1);
+        cr_assert_geq(n, 0);
+        consumed += (size_t)n;
+    }
+    cr_assert(framing.done);
+    cr_assert_eq(consumed, strlen(body));
+
+    /* In one read, the following message is left alone */
+    http1_body_init(&framing, HTTP1_BODY_CHUNKED, 0);
+    cr_assert_eq(http1_body_consume(&framing, stream, strlen(stream)), (ssize_t)strlen(body));
+    cr_assert(framing.done);
+
+    http1_body_init(&framing, HTTP1_BODY_CHUNKED, 0);
+    cr_assert_eq(http1_body_consume(&framing, "4\r\nWikiX\r\n", 10), -1, "Chunk longer than its size");
+    http1_body_init(&framing, HTTP1_BODY_CHUNKED, 0);
+    cr_assert_eq(http1_body_consume(&framing, "zz\r\n", 4), -1, "Size is not hex");
+
+    http1_body_init(&framing, HTTP1_BODY_LENGTH, 5);
+    cr_assert_eq(http1_body_consume(&framing, "abc", 3), 3);
+    cr_assert_not(framing.done);
+    cr_assert_eq(http1_body_consume(&framing, "deGET", 5), 2);
+    cr_assert(framing.done);
+}
+
+Test(http1_client, request_head_is_rewritten_for_upstream)
+{
+    char raw[] = "POST /api/items HTTP/1.1\r\n"
+                 "Host: example.com\r\n"
+                 "Connection: keep-alive, X-Secret\r\n"
+                 "X-Secret: hop\r\n"
+                 "Keep-Alive: timeout=5\r\n"
+                 "Upgrade: websocket\r\n"
+                 "X-Forwarded-For: 198.51.100.7\r\n"
+                 "Expect: 100-continue\r\n"
+                 "Content-Length: 11\r\n"
+                 "Accept: */*\r\n"
+                 "\r\n"
+                 "hello";
+    HttpRequest req;
+    memset(&req, 0, sizeof(req));
+    cr_assert_eq(parse_http_request(raw, sizeof(raw) - 1, &req), 0);
+    cr_assert_str_eq(raw + req.head_len, "hello", "Body starts after the head");
+    snprintf(req.client_addr, sizeof(req.client_addr), "203.0.113.9");
+
+    char head[HTTP1_CLIENT_HEAD_BUFFER_SIZE];
+    http1_body_t body;
+    int len = http1_build_request_head(&req, "10.0.0.5:8080", NULL, head, sizeof(head), &body);
+    cr_assert_gt(len, 0);
+    cr_assert_eq((size_t)len, strlen(head));
+
+    cr_assert(strncmp(head, "POST /api/items HTTP/1.1\r\n", 26) == 0);
+    cr_assert_not_null(strstr(head, "\r\nHost: 10.0.0.5:8080\r\n"));
+    cr_assert_not_null(strstr(head, "\r\nX-Forwarded-For: 198.51.100.7, 203.0.113.9\r\n"));
+    cr_assert_not_null(strstr(head, "\r\nX-Forwarded-Host: example.com\r\n"));
+    cr_assert_not_null(strstr(head, "\r\nX-Forwarded-Proto: https\r\n"));
+    cr_assert_not_null(strstr(head, "\r\nConnection: keep-alive\r\n\r\n"));
+    cr_assert_not_null(strstr(head, "\r\nContent-Length: 11\r\n"));
+    cr_assert_not_null(strstr(head, "\r\nAccept: */*\r\n"));
+    cr_assert_null(strstr(head, "X-Secret"), "Headers named by Connection are hop-by-hop");
+    cr_assert_null(strstr(head, "Keep-Alive"));
+    cr_assert_null(strstr(head, "Upgrade"));
+    cr_assert_null(strstr(head, "Expect"));
+
+    cr_assert_eq(body.kind, HTTP1_BODY_LENGTH);
+    cr_assert_eq(body.remaining, 11);
+
+    char chunked[] = "PUT /x HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\nContent-Length: 3\r\n\r\n";
+    memset(&req, 0, sizeof(req));
+    cr_assert_eq(parse_http_request(chunked, sizeof(chunked) - 1, &req), 0);
+    len = http1_build_request_head(&req, "backend:80", NULL, head, sizeof(head), &body);
+    cr_assert_gt(len, 0);
+    cr_assert_eq(body.kind, HTTP1_BODY_CHUNKED);
+    cr_assert_null(strstr(head, "Content-Length"), "A length next to chunked framing is dropped");
+
+    char conflicting[] = "PUT /x HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\n";
+    memset(&req, 0, sizeof(req));
+    cr_assert_eq(parse_http_request(conflicting, sizeof(conflicting) - 1, &req), 0);
+    cr_assert_eq(http1_build_request_head(&req, "backend:80", NULL, head, sizeof(head), &body), -1);
+}
+
+Test(http1_client, upgrade_request_keeps_handshake)
+{
+    char raw[] = "GET /chat HTTP/1.1\r\n"
+                 "Host: example.com\r\n"
+                 "Connection: keep-alive, Upgrade\r\n"
+                 "Upgrade: websocket\r\n"
+                 "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                 "Sec-WebSocket-Version: 13\r\n"
+                 "\r\n";
+    HttpRequest req;
+    memset(&req, 0, sizeof(req));
+    cr_assert_eq(parse_http_request(raw, sizeof(raw) - 1, &req), 0);
+    cr_assert(http1_request_upgrades_to(&req, "websocket"));
+    cr_assert_not(http1_request_upgrades_to(&req, "h2c"));
+
+    char head[HTTP1_CLIENT_HEAD_BUFFER_SIZE];
+    http1_body_t body;
+    int len = http1_build_request_head(&req, "10.0.0.5:8080", "websocket", head, sizeof(head), &body);
+    cr_assert_gt(len, 0);
+    cr_assert_not_null(strstr(head, "\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"));
+    cr_assert_not_null(strstr(head, "\r\nUpgrade: websocket\r\nConnection: upgrade\r\n\r\n"));
+    cr_assert_null(strstr(head, "keep-alive"));
+    cr_assert_eq(body.kind, HTTP1_BODY_NONE);
+
+    char no_token[] = "GET /chat HTTP/1.1\r\nConnection: keep-alive\r\nUpgrade: websocket\r\n\r\n";
+    memset(&req, 0, sizeof(req));
+    cr_assert_eq(parse_http_request(no_token, sizeof(no_token) - 1, &req), 0);
+    cr_assert_not(http1_request_upgrades_to(&req, "websocket"),
+                  "Upgrade counts only when Connection lists it");
+
+    const char *response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                           "Sec-WebSocket-Accept:  s3pPLMBiTxaQ9kYGzzhZRbK+xOo= \r\n\r\n";
+    size_t value_len = 0;
+    const char *value = http1_response_header(response, strlen(response), "sec-websocket-accept",
+                                              &value_len);
+    cr_assert_not_null(value);
+    cr_assert_eq(value_len, 28);
+    cr_assert(strncmp(value, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=", value_len) == 0);
+    cr_assert_null(http1_response_header(response, strlen(response), "Sec-WebSocket-Protocol",
+                                         &value_len));
+}
+
+Test(http1_client, response_framing_and_keep_alive)
+{
+    const char *length = "HTTP/1.1 200 OK\r\nContent-Length: 42\r\n\r\n";
+    const char *chunked = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nContent-Length: 9\r\n\r\n";
+    const char *closing = "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 1\r\n\r\n";
+    const char *legacy = "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n\r\n";
+    const char *legacy_ka = "HTTP/1.0 200 OK\r\nConnection: Keep-Alive\r\nContent-Length: 0\r\n\r\n";
+    const char *no_content = "HTTP/1.1 204 No Content\r\n\r\n";
+    http1_response_head_t head;
+
+    cr_assert_eq(http1_parse_response_head(length, strlen(length) - 2, "GET", &head), 0,
+                 "Incomplete head needs more bytes");
+
+    cr_assert_eq(http1_parse_response_head(length, strlen(length), "GET", &head), 1);
+    cr_assert_eq(head.status, 200);
+    cr_assert_eq(head.head_len, strlen(length));
+    cr_assert_eq(head.body.kind, HTTP1_BODY_LENGTH);
+    cr_assert_eq(head.body.remaining, 42);
+    cr_assert(head.keep_alive);
+
+    cr_assert_eq(http1_parse_response_head(length, strlen(length), "HEAD", &head), 1);
+    cr_assert(head.body.done, "HEAD responses have no body");
+
+    cr_assert_eq(http1_parse_response_head(chunked, strlen(chunked), "GET", &head), 1);
+    cr_assert_eq(head.body.kind, HTTP1_BODY_CHUNKED, "Chunked framing wins over the length");
+
+    cr_assert_eq(http1_parse_response_head(closing, strlen(closing), "GET", &head), 1);
+    cr_assert_not(head.keep_alive);
+
+    cr_assert_eq(http1_parse_response_head(legacy, strlen(legacy), "GET", &head), 1);
+    cr_assert_eq(head.body.kind, HTTP1_BODY_UNTIL_CLOSE);
+    cr_assert_not(head.keep_alive);
+
+    cr_assert_eq(http1_parse_response_head(legacy_ka, strlen(legacy_ka), "GET", &head), 1);
+    cr_assert(head.keep_alive);
+    cr_assert(head.body.done);
+
+    cr_assert_eq(http1_parse_response_head(no_content, strlen(no_content), "GET", &head), 1);
+    cr_assert(head.body.done);
+    cr_assert(head.keep_alive);
+
+    cr_assert_eq(http1_parse_response_head("SSH-2.0-OpenSSH\r\n\r\n", 19, "GET", &head), -1);
+
+    /* The client sees HTTP/1.1 without the upstream's connection headers */
+    char out[512];
+    const char *upstream = "HTTP/1.0 200 OK\r\nConnection: close, X-Hop\r\nX-Hop: 1\r\n"
+                           "Server: backend\r\n\r\n";
+    int len = http1_rewrite_response_head(upstream, strlen(upstream), true, out, sizeof(out));
+    cr_assert_gt(len, 0);
+    cr_assert_str_eq(out, "HTTP/1.1 200 OK\r\nServer: backend\r\nTransfer-Encoding: chunked\r\n\r\n");
+}
+
+Test(http1_client, bare_line_endings_and_folding_are_rejected)
+{
+    const char *bare_lf = "HTTP/1.1 200 OK\r\nX-Note: a\nContent-Length: 0\r\nContent-Length: 5\r\n\r\n";
+    const char *bare_cr = "HTTP/1.1 200 OK\r\nX-Note: a\rContent-Length: 0\r\n\r\n";
+    const char *folded = "HTTP/1.1 200 OK\r\nX-Note: a\r\n Content-Length: 0\r\nContent-Length: 5\r\n\r\n";
+    const char *tab_folded = "HTTP/1.1 200 OK\r\nX-Note: a\r\n\tb\r\n\r\n";
+    const char *cases[] = {bare_lf, bare_cr, folded, tab_folded};
+    http1_response_head_t head;
+    char out[512];
+    size_t value_len;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        size_t len = strlen(cases[i]);
+        cr_assert_eq(http1_parse_response_head(cases[i], len, "GET", &head), -1, "case %zu", i);
+        cr_assert_null(http1_response_header(cases[i], len, "X-Note", &value_len), "case %zu", i);
+        cr_assert_eq(http1_rewrite_response_head(cases[i], len, false, out, sizeof(out)), -1,
+                     "case %zu", i);
+    }
+}
+
+Test(http1_client, chunked_framing_drops_a_conflicting_length)
+{
+    const char *upstream = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n"
+                           "Server: backend\r\n\r\n";
+    http1_response_head_t head;
+    char out[512];
+
+    cr_assert_eq(http1_parse_response_head(upstream, strlen(upstream), "GET", &head), 1);
+    cr_assert_eq(head.body.kind, HTTP1_BODY_CHUNKED);
+
+    /* The client must not see a length the body is not framed by */
+    int len = http1_rewrite_response_head(upstream, strlen(upstream), false, out, sizeof(out));
+    cr_assert_gt(len, 0);
+    cr_assert_str_eq(out, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nServer: backend\r\n\r\n");
+
+    const char *length_only = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n";
+    len = http1_rewrite_response_head(length_only, strlen(length_only), false, out, sizeof(out));
+    cr_assert_gt(len, 0);
+    cr_assert_str_eq(out, length_only);
+}
+
+Test(http1_client, pool_reuses_idle_connections)
+{
+    int port;
+    int listen_fd = listen_loopback(&port);
+    char authority[32];
+    snprintf(authority, sizeof(authority), "127.0.0.1:%d", port);
+    http1_pool_t *pool = http1_pool_create(resolver_get_endpoint("127.0.0.1", port),
+                                           authority, 2, 60);
+    cr_assert_not_null(pool);
+
+    bool reused = true;
+    int fd = http1_pool_acquire(pool, &reused);
+    cr_assert_geq(fd, 0);
+    cr_assert_not(reused);
+    int peer = accept(listen_fd, NULL, NULL);
+    cr_assert_geq(peer, 0);
+
+    http1_pool_release(pool, fd, true);
+    cr_assert_eq(pool->idle_count, 1);
+    int again = http1_pool_acquire(pool, &reused);
+    cr_assert_eq(again, fd, "The idle connection is handed out again");
+    cr_assert(reused);
+    cr_assert_eq(atomic_load(&pool->connects), 1);
+
+    /* A connection the backend closed while idle is not handed out */
+    http1_pool_release(pool, again, true);
+    close(peer);
+    usleep(20000);
+    int fresh = http1_pool_acquire(pool, &reused);
+    cr_assert_geq(fresh, 0);
+    cr_assert_not(reused);
+    cr_assert_eq(atomic_load(&pool->connects), 2);
+
+    /* Connections that cannot be reused are closed, not pooled */
+    http1_pool_release(pool, fresh, false);
+    cr_assert_eq(pool->idle_count, 0);
+
+    http1_pool_destroy(pool);
+    close(listen_fd);
+    resolver_shutdown();
+}
@@ -0,0 +1,677 @@
+// tests/unit/test_http2_client.c
+// Stream multiplexing over pooled HTTP/2 backend connections
+
+#include <criterion/criterion.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <nghttp2/nghttp2.h>
+#include <openssl/ssl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "backend_pool.h"
+#include "config.h"
+#include "response_cache.h"
+#include "router.h"
+#include "upstream.h"
+
+#define BACKEND_MAX_STREAMS 8
+#define MAX_PENDING 16
+
+#define BIG_PREFIX "/big/"
+#define STATUS_PREFIX "/status/"
+
+#define BACKEND_NV(NAME, VALUE) \
+    {(uint8_t *)(NAME), (uint8_t *)(VALUE), sizeof(NAME) - 1, sizeof(VALUE) - 1, NGHTTP2_NV_FLAG_NONE}
+
+/* Minimal TLS h2 backend. It answers each request with its :path, or with
+ * a "/big/<bytes>" path that many bytes of a pattern, but only once 'batch'
+ * requests are open at the same time. A "/status/<code>" path gets that
+ * status. */
+typedef struct {
+    int listen_fd;
+    int port;
+    pthread_t thread;
+    _Atomic int batch;
+    _Atomic int accepted;
+    _Atomic bool stop;
+    SSL *ssl;
+    int32_t pending[MAX_PENDING];
+    int pending_count;
+} test_backend_t;
+
+static ssize_t backend_send(nghttp2_session *session, const uint8_t *data, size_t length,
+                            int flags, void *user_data)
+{
+    test_backend_t *backend = user_data;
+    (void)session;
+    (void)flags;
+    int n = SSL_write(backend->ssl, data, (int)length);
+    return n > 0 ? n : NGHTTP2_ERR_CALLBACK_FAILURE;
+}
+
+typedef struct {
+    char path[64];
+    size_t size;
+    size_t sent;
+} backend_stream_t;
+
+static uint8_t big_body_byte(size_t offset)
+{
+    return (uint8_t)('a' + offset % 26);
+}
+
+static ssize_t backend_read_body(nghttp2_session *session, int32_t stream_id, uint8_t *buf,
+                                 size_t length, uint32_t *data_flags,
+                                 nghttp2_data_source *source, void *user_data)
+{
+    (void)session;
+    (void)stream_id;
+    (void)user_data;
+    backend_stream_t *bs = source->ptr;
+    bool big = strncmp(bs->path, BIG_PREFIX, strlen(BIG_PREFIX)) == 0;
+    size_t len = bs->size - bs->sent;
+    if (len > length) len = length;
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = big ? big_body_byte(bs->sent + i) : (uint8_t)bs->path[bs->sent + i];
+    }
+    bs->sent += len;
+    if (bs->sent == bs->size) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    return (ssize_t)len;
+}
+
+static int backend_on_header(nghttp2_session *session, const nghttp2_frame *frame,
+                             const uint8_t *name, size_t namelen, const uint8_t *value,
+                             size_t valuelen, uint8_t flags, void *user_data)
+{
+    (void)flags;
+    (void)user_data;
+    if (namelen == 5 && memcmp(name, ":path", 5) == 0) {
+        backend_stream_t *bs = calloc(1, sizeof(*bs));
+        snprintf(bs->path, sizeof(bs->path), "%.*s", (int)valuelen, (const char *)value);
+        bs->size = strncmp(bs->path, BIG_PREFIX, strlen(BIG_PREFIX)) == 0 ?
+                   strtoul(bs->path + strlen(BIG_PREFIX), NULL, 10) : strlen(bs->path);
+        nghttp2_session_set_stream_user_data(session, frame->hd.stream_id, bs);
+    }
+    return 0;
+}
+
+static int backend_on_frame_recv(nghttp2_session *session, const nghttp2_frame *frame,
+                                 void *user_data)
+{
+    test_backend_t *backend = user_data;
+    if (frame->hd.type != NGHTTP2_HEADERS || !(frame->hd.flags & NGHTTP2_FLAG_END_STREAM)) {
+        return 0;
+    }
+
+    backend->pending[backend->pending_count++] = frame->hd.stream_id;
+    if (backend->pending_count < atomic_load(&backend->batch)) {
+        return 0;
+    }
+
+    nghttp2_nv hdrs[] = {
+        BACKEND_NV(":status", "200"),
+    };
+    /* "/headers" gets Early Hints, then a response with a hop-by-hop header */
+    nghttp2_nv hints[] = {
+        BACKEND_NV(":status", "103"),
+        BACKEND_NV("link", "</style.css>; rel=preload"),
+    };
+    nghttp2_nv rich[] = {
+        BACKEND_NV(":status", "203"),
+        BACKEND_NV("content-type", "text/csv"),
+        BACKEND_NV("cache-control", "public, max-age=600"),
+        BACKEND_NV("proxy-authenticate", "Basic"),
+        BACKEND_NV("set-cookie", "a=1"),
+        BACKEND_NV("set-cookie", "b=2"),
+    };
+    for (int i = 0; i < backend->pending_count; i++) {
+        nghttp2_data_provider prd = {0};
+        backend_stream_t *bs = nghttp2_session_get_stream_user_data(session, backend->pending[i]);
+        prd.source.ptr = bs;
+        prd.read_callback = backend_read_body;
+        if (strncmp(bs->path, STATUS_PREFIX, strlen(STATUS_PREFIX)) == 0) {
+            const char *code = bs->path + strlen(STATUS_PREFIX);
+            nghttp2_nv status[] = {
+                {(uint8_t *)":status", (uint8_t *)code, sizeof(":status") - 1, strlen(code), NGHTTP2_NV_FLAG_NONE},
+            };
+            nghttp2_submit_response(session, backend->pending[i], status, 1, &prd);
+        } else if (strcmp(bs->path, "/headers") == 0) {
+            nghttp2_submit_headers(session, NGHTTP2_FLAG_NONE, backend->pending[i], NULL, hints, 2, NULL);
+            nghttp2_submit_response(session, backend->pending[i], rich, 6, &prd);
+        } else {
+            nghttp2_submit_response(session, backend->pending[i], hdrs, 1, &prd);
+        }
+    }
+    backend->pending_count = 0;
+    return 0;
+}
+
+static int backend_on_stream_close(nghttp2_session *session, int32_t stream_id,
+                                   uint32_t error_code, void *user_data)
+{
+    (void)error_code;
+    (void)user_data;
+    free(nghttp2_session_get_stream_user_data(session, stream_id));
+    return 0;
+}
+
+static int backend_select_alpn(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                               const unsigned char *in, unsigned int inlen, void *arg)
+{
+    (void)ssl;
+    (void)arg;
+    if (nghttp2_select_next_protocol((unsigned char **)out, outlen, in, inlen) != 1) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static void serve_connection(test_backend_t *backend, SSL_CTX *ctx, int fd)
+{
+    backend->ssl = SSL_new(ctx);
+    SSL_set_fd(backend->ssl, fd);
+    if (SSL_accept(backend->ssl) != 1) {
+        SSL_free(backend->ssl);
+        return;
+    }
+
+    nghttp2_session_callbacks *cbs;
+    nghttp2_session *session;
+    nghttp2_session_callbacks_new(&cbs);
+    nghttp2_session_callbacks_set_send_callback(cbs, backend_send);
+    nghttp2_session_callbacks_set_on_header_callback(cbs, backend_on_header);
+    nghttp2_session_callbacks_set_on_frame_recv_callback(cbs, backend_on_frame_recv);
+    nghttp2_session_callbacks_set_on_stream_close_callback(cbs, backend_on_stream_close);
+    nghttp2_session_server_new(&session, cbs, backend);
+    nghttp2_session_callbacks_del(cbs);
+
+    nghttp2_settings_entry settings[] = {
+        {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, BACKEND_MAX_STREAMS},
+    };
+    nghttp2_submit_settings(session, NGHTTP2_FLAG_NONE, settings, 1);
+
+    uint8_t buf[16384];
+    while (!atomic_load(&backend->stop)) {
+        if (nghttp2_session_send(session) != 0) break;
+        if (SSL_pending(backend->ssl) == 0) {
+            struct pollfd pfd = {.fd = fd, .events = POLLIN};
+            if (poll(&pfd, 1, 50) <= 0) continue;
+        }
+        int n = SSL_read(backend->ssl, buf, sizeof(buf));
+        if (n <= 0 || nghttp2_session_mem_recv(session, buf, (size_t)n) < 0) break;
+    }
+
+    nghttp2_session_del(session);
+    SSL_free(backend->ssl);
+}
+
+static void *backend_thread(void *arg)
+{
+    test_backend_t *backend = arg;
+    /* Health probes hang up as soon as they have their answer */
+    sigset_t pipe_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, NULL);
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_use_certificate_file(ctx, "certs/dev.crt", SSL_FILETYPE_PEM);
+    SSL_CTX_use_PrivateKey_file(ctx, "certs/dev.key", SSL_FILETYPE_PEM);
+    SSL_CTX_set_alpn_select_cb(ctx, backend_select_alpn, NULL);
+
+    while (!atomic_load(&backend->stop)) {
+        struct pollfd pfd = {.fd = backend->listen_fd, .events = POLLIN};
+        if (poll(&pfd, 1, 50) <= 0) continue;
+        int fd = accept(backend->listen_fd, NULL, NULL);
+        if (fd < 0) continue;
+        atomic_fetch_add(&backend->accepted, 1);
+        serve_connection(backend, ctx, fd);
+        close(fd);
+    }
+
+    SSL_CTX_free(ctx);
+    return NULL;
+}
+
+static void backend_start(test_backend_t *backend)
+{
+    memset(backend, 0, sizeof(*backend));
+    atomic_store(&backend->batch, 1);
+
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    backend->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    cr_assert_geq(backend->listen_fd, 0);
+    cr_assert_eq(bind(backend->listen_fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    cr_assert_eq(listen(backend->listen_fd, 8), 0);
+    getsockname(backend->listen_fd, (struct sockaddr *)&addr, &len);
+    backend->port = ntohs(addr.sin_port);
+
+    cr_assert_eq(pthread_create(&backend->thread, NULL, backend_thread, backend), 0);
+}
+
+static void backend_stop(test_backend_t *backend)
+{
+    atomic_store(&backend->stop, true);
+    pthread_join(backend->thread, NULL);
+    close(backend->listen_fd);
+}
+
+/* Runs one request through a pool stream slot; returns the status. The
+ * body, when asked for, is read into 'body' and NUL-terminated. */
+static int pooled_get(backend_pool_t *pool, const char *path, http2_stream_t *stream,
+                      char *body, size_t body_size)
+{
+    backend_conn_t *conn = backend_pool_acquire(pool);
+    if (!conn) return -1;
+
+    int status = -1;
+    memset(stream, 0, sizeof(*stream));
+    if (backend_pool_connect(conn) == 0 &&
+        http2_client_submit(&conn->client, stream, "GET", path, "backend", NULL, 0) > 0) {
+        status = http2_client_await(&conn->client, stream, 5000);
+    }
+    if (body) {
+        ssize_t n = http2_client_read(&conn->client, stream, (uint8_t *)body, body_size - 1);
+        body[n > 0 ? n : 0] = '\0';
+    }
+    http2_client_release(&conn->client, stream);
+    backend_pool_release(conn);
+    return status;
+}
+
+typedef struct {
+    backend_pool_t *pool;
+    char path[32];
+    int status;
+    char body[64];
+    http2_stream_t stream;
+} request_job_t;
+
+static void *request_thread(void *arg)
+{
+    request_job_t *job = arg;
+    job->status = pooled_get(job->pool, job->path, &job->stream, job->body, sizeof(job->body));
+    return NULL;
+}
+
+Test(http2_client, concurrent_streams_share_one_connection)
+{
+    test_backend_t backend;
+    backend_start(&backend);
+
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", backend.port, true, false, 2);
+    cr_assert_not_null(pool);
+
+    /* The first request connects and learns the peer's stream limit */
+    http2_stream_t *warmup = malloc(sizeof(*warmup));
+    char body[64];
+    cr_assert_eq(pooled_get(pool, "/warmup", warmup, body, sizeof(body)), 200);
+    cr_assert_eq(warmup->response_received, 7);
+    cr_assert_str_eq(body, "/warmup");
+    free(warmup);
+
+    /* The backend holds every response until all four streams are open,
+     * so this only completes if they run concurrently */
+    enum { JOBS = 4 };
+    atomic_store(&backend.batch, JOBS);
+    request_job_t *jobs = calloc(JOBS, sizeof(*jobs));
+    pthread_t threads[JOBS];
+    for (int i = 0; i < JOBS; i++) {
+        jobs[i].pool = pool;
+        snprintf(jobs[i].path, sizeof(jobs[i].path), "/stream/%d", i);
+        cr_assert_eq(pthread_create(&threads[i], NULL, request_thread, &jobs[i]), 0);
+        /* Let the first request claim the idle connection before the rest pile on */
+        while (i == 0 && backend_pool_get_stream_count(pool) == 0) {
+            usleep(1000);
+        }
+    }
+    for (int i = 0; i < JOBS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < JOBS; i++) {
+        cr_assert_eq(jobs[i].status, 200, "stream %d status", i);
+        cr_assert_str_eq(jobs[i].body, jobs[i].path, "stream %d got another stream's body", i);
+    }
+    cr_assert_eq(atomic_load(&backend.accepted), 1, "All streams should share one connection");
+    cr_assert_eq(backend_pool_get_stream_count(pool), 0);
+    cr_assert_eq(backend_pool_get_active_count(pool), 0);
+
+    free(jobs);
+    backend_pool_destroy(pool);
+    backend_stop(&backend);
+}
+
+Test(http2_client, large_response_streams_within_window)
+{
+    test_backend_t backend;
+    backend_start(&backend);
+
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", backend.port, true, false, 1);
+    cr_assert_not_null(pool);
+    backend_conn_t *conn = backend_pool_acquire(pool);
+    cr_assert_not_null(conn);
+    cr_assert_eq(backend_pool_connect(conn), 0);
+
+    enum { BIG_SIZE = 1024 * 1024 };
+    char path[32];
+    snprintf(path, sizeof(path), BIG_PREFIX "%d", BIG_SIZE);
+    http2_stream_t *big = calloc(1, sizeof(*big));
+    http2_stream_t *small = calloc(1, sizeof(*small));
+    cr_assert_gt(http2_client_submit(&conn->client, big, "GET", path, "backend", NULL, 0), 0);
+    cr_assert_eq(http2_client_await_headers(&conn->client, big, 5000), 200);
+
+    /* Driving the connection for another stream must not pull in more of
+     * the unread body than its window allows */
+    cr_assert_gt(http2_client_submit(&conn->client, small, "GET", "/small", "backend", NULL, 0), 0);
+    cr_assert_eq(http2_client_await(&conn->client, small, 5000), 200);
+    cr_assert_not(big->done, "The body cannot complete while nobody reads it");
+    cr_assert_leq(big->response_received, HTTP2_CLIENT_STREAM_WINDOW);
+
+    static uint8_t buf[16384];
+    size_t total = 0;
+    bool intact = true;
+    for (int spins = 0; spins < 5000; spins++) {
+        ssize_t n = http2_client_read(&conn->client, big, buf, sizeof(buf));
+        if (n == HTTP2_CLIENT_AGAIN) {
+            usleep(1000);
+            continue;
+        }
+        cr_assert_geq(n, 0, "Stream failed after %zu bytes", total);
+        if (n == 0) break;
+        for (ssize_t i = 0; i < n; i++) {
+            intact = intact && buf[i] == big_body_byte(total + (size_t)i);
+        }
+        total += (size_t)n;
+    }
+    cr_assert_eq(total, BIG_SIZE);
+    cr_assert(intact, "Body bytes arrived out of order");
+
+    http2_client_release(&conn->client, small);
+    http2_client_release(&conn->client, big);
+    free(small);
+    free(big);
+    backend_pool_release(conn);
+    backend_pool_destroy(pool);
+    backend_stop(&backend);
+}
+
+static const char *stream_header(const http2_stream_t *stream, const char *name, int nth)
+{
+    for (size_t i = 0; i < stream->response_header_count; i++) {
+        const nghttp2_nv *nv = &stream->response_headers[i];
+        if (nv->namelen == strlen(name) && memcmp(nv->name, name, nv->namelen) == 0 && nth-- == 0) {
+            return (const char *)nv->value;
+        }
+    }
+    return NULL;
+}
+
+Test(http2_client, response_headers_forwarded_verbatim)
+{
+    test_backend_t backend;
+    backend_start(&backend);
+
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", backend.port, true, false, 1);
+    cr_assert_not_null(pool);
+    http2_stream_t *stream = malloc(sizeof(*stream));
+
+    /* The interim 103 and its Link header give way to the final response */
+    cr_assert_eq(pooled_get(pool, "/headers", stream, NULL, 0), 203);
+    cr_assert_eq(stream->response_header_count, 4);
+    cr_assert_str_eq(stream_header(stream, "content-type", 0), "text/csv");
+    cr_assert_str_eq(stream_header(stream, "cache-control", 0), "public, max-age=600");
+    cr_assert_str_eq(stream_header(stream, "set-cookie", 0), "a=1");
+    cr_assert_str_eq(stream_header(stream, "set-cookie", 1), "b=2");
+    cr_assert_null(stream_header(stream, "proxy-authenticate", 0), "Hop-by-hop headers are dropped");
+    cr_assert_null(stream_header(stream, "link", 0));
+
+    free(stream);
+    backend_pool_destroy(pool);
+    backend_stop(&backend);
+}
+
+Test(http2_client, acquire_hands_out_peer_max_streams)
+{
+    test_backend_t backend;
+    backend_start(&backend);
+
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", backend.port, true, false, 1);
+    cr_assert_not_null(pool);
+
+    http2_stream_t *warmup = malloc(sizeof(*warmup));
+    cr_assert_eq(pooled_get(pool, "/warmup", warmup, NULL, 0), 200);
+    free(warmup);
+    cr_assert_eq(http2_client_get_max_streams(&pool->connections[0]->client), BACKEND_MAX_STREAMS);
+
+    backend_conn_t *conns[BACKEND_MAX_STREAMS];
+    for (int i = 0; i < BACKEND_MAX_STREAMS; i++) {
+        conns[i] = backend_pool_acquire(pool);
+        cr_assert_eq(conns[i], pool->connections[0], "slot %d should be on the shared connection", i);
+    }
+    cr_assert_null(backend_pool_acquire(pool), "No slots beyond SETTINGS_MAX_CONCURRENT_STREAMS");
+    cr_assert_eq(backend_pool_get_stream_count(pool), BACKEND_MAX_STREAMS);
+    cr_assert_eq(backend_pool_get_active_count(pool), 1);
+
+    for (int i = 0; i < BACKEND_MAX_STREAMS; i++) {
+        backend_pool_release(conns[i]);
+    }
+    cr_assert_eq(backend_pool_get_idle_count(pool), 1);
+
+    backend_pool_destroy(pool);
+    backend_stop(&backend);
+}
+
+Test(http2_client, failed_connection_is_refreshed_in_background)
+{
+    test_backend_t backend;
+    backend_start(&backend);
+
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", backend.port, true, false, 1);
+    cr_assert_not_null(pool);
+
+    http2_stream_t *stream = malloc(sizeof(*stream));
+    cr_assert_eq(pooled_get(pool, "/warmup", stream, NULL, 0), 200);
+
+    backend_conn_t *conn = backend_pool_acquire(pool);
+    cr_assert_not_null(conn);
+    for (int i = 0; i < BACKEND_POOL_UNHEALTHY_THRESHOLD; i++) {
+        backend_pool_mark_failure(conn);
+    }
+    backend_pool_release(conn);
+
+    /* The refresher reconnects it; acquire never does */
+    backend_conn_t *again = NULL;
+    for (int i = 0; i < 300 && !again; i++) {
+        again = backend_pool_acquire(pool);
+        if (!again) usleep(10000);
+    }
+    cr_assert_eq(again, conn);
+    cr_assert_eq(backend_pool_get_health(again), BACKEND_HEALTH_UNKNOWN);
+    cr_assert(http2_client_is_connected(&again->client), "Refreshed connection should be connected");
+    backend_pool_release(again);
+
+    cr_assert_eq(pooled_get(pool, "/after", stream, NULL, 0), 200);
+    cr_assert_eq(atomic_load(&backend.accepted), 2);
+
+    free(stream);
+    backend_pool_destroy(pool);
+    backend_stop(&backend);
+}
+
+Test(http2_client, reconnect_resumes_tls_session)
+{
+    test_backend_t backend;
+    backend_start(&backend);
+
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", backend.port, true, false, 1);
+    cr_assert_not_null(pool);
+    http2_client_tls_t *tls = pool->config.tls;
+    cr_assert_not_null(tls, "Pool should share one client TLS context");
+
+    /* The first request also reads the session tickets sent after the handshake */
+    http2_stream_t *stream = malloc(sizeof(*stream));
+    cr_assert_eq(pooled_get(pool, "/first", stream, NULL, 0), 200);
+    cr_assert_eq(atomic_load(&tls->handshakes), 1);
+    cr_assert_eq(atomic_load(&tls->resumed), 0);
+    cr_assert_not_null(tls->session, "A session ticket should have been cached");
+
+    backend_conn_t *conn = backend_pool_acquire(pool);
+    cr_assert_not_null(conn);
+    SSL_CTX *ctx = SSL_get_SSL_CTX(conn->client.ssl);
+    cr_assert_eq(ctx, tls->ctx, "Connections use the shared SSL_CTX");
+    http2_client_disconnect(&conn->client);
+    backend_pool_release(conn);
+
+    cr_assert_eq(pooled_get(pool, "/second", stream, NULL, 0), 200);
+    cr_assert_eq(atomic_load(&backend.accepted), 2);
+    cr_assert_eq(atomic_load(&tls->handshakes), 2);
+    cr_assert_eq(atomic_load(&tls->resumed), 1, "Reconnect should resume the session");
+
+    free(stream);
+    backend_pool_destroy(pool);
+    backend_stop(&backend);
+}
+
+Test(http2_client, health_checks_use_their_own_connections)
+{
+    test_backend_t backend;
+    backend_start(&backend);
+
+    backend_pool_config_t pool_config = {.size = 2, .min_size = 0, .acquire_timeout_ms = 100};
+    backend_pool_t *pool = backend_pool_create_with_config("127.0.0.1", backend.port, true, false,
+                                                           &pool_config);
+    cr_assert_not_null(pool);
+    health_check_config_t config = {.enabled = true, .path = "/health", .interval_seconds = 1,
+                                    .timeout_seconds = 1, .unhealthy_threshold = 1, .healthy_threshold = 2};
+    cr_assert_eq(backend_pool_start_health_checker(pool, &config), 0);
+
+    /* Each check connects, gets its 200 and closes again */
+    for (int i = 0; i < 400 && backend_pool_get_overall_health(pool) != BACKEND_HEALTH_HEALTHY; i++) {
+        usleep(10000);
+    }
+    cr_assert_eq(backend_pool_get_overall_health(pool), BACKEND_HEALTH_HEALTHY);
+    cr_assert_eq(atomic_load(&pool->health_checker.failed_checks), 0);
+    cr_assert_geq(atomic_load(&backend.accepted), 2, "One connection per check");
+    cr_assert_eq(backend_pool_get_size(pool), 0, "No pool connection was opened");
+
+    backend_pool_destroy(pool);
+    backend_stop(&backend);
+}
+
+Test(http2_client, health_checks_work_without_a_shared_tls_context)
+{
+    test_backend_t backend;
+    backend_start(&backend);
+
+    backend_pool_config_t pool_config = {.size = 1, .min_size = 0, .acquire_timeout_ms = 100};
+    backend_pool_t *pool = backend_pool_create_with_config("127.0.0.1", backend.port, true, false,
+                                                           &pool_config);
+    cr_assert_not_null(pool);
+    /* As when the shared context could not be built */
+    http2_client_tls_destroy(pool->config.tls);
+    pool->config.tls = NULL;
+    health_check_config_t config = {.enabled = true, .path = "/health", .interval_seconds = 1,
+                                    .timeout_seconds = 1, .unhealthy_threshold = 1, .healthy_threshold = 2};
+    cr_assert_eq(backend_pool_start_health_checker(pool, &config), 0);
+
+    for (int i = 0; i < 400 && backend_pool_get_overall_health(pool) != BACKEND_HEALTH_HEALTHY; i++) {
+        usleep(10000);
+    }
+    cr_assert_eq(backend_pool_get_overall_health(pool), BACKEND_HEALTH_HEALTHY);
+    cr_assert_eq(atomic_load(&pool->health_checker.failed_checks), 0);
+
+    backend_pool_destroy(pool);
+    backend_stop(&backend);
+}
+
+Test(http2_client, polled_stream_stays_open_until_answered)
+{
+    test_backend_t backend;
+    backend_start(&backend);
+    atomic_store(&backend.batch, 2);
+
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", backend.port, true, false, 1);
+    cr_assert_not_null(pool);
+    backend_conn_t *conn = backend_pool_acquire(pool);
+    cr_assert_not_null(conn);
+    cr_assert_eq(backend_pool_connect(conn), 0);
+
+    /* The backend holds the first request until a second one is open */
+    http2_stream_t *first = calloc(1, sizeof(*first));
+    http2_stream_t *second = calloc(1, sizeof(*second));
+    cr_assert_geq(http2_client_submit(&conn->client, first, "GET", "/first", "test", NULL, 0), 0);
+    cr_assert_eq(http2_client_poll_headers(&conn->client, first, 50), 0, "Still waiting, not cancelled");
+    cr_assert_eq(first->done, 0);
+
+    cr_assert_geq(http2_client_submit(&conn->client, second, "GET", "/second", "test", NULL, 0), 0);
+    cr_assert_eq(http2_client_poll_headers(&conn->client, first, 2000), 200);
+    cr_assert_eq(http2_client_poll_headers(&conn->client, second, 2000), 200);
+
+    http2_client_release(&conn->client, first);
+    http2_client_release(&conn->client, second);
+    free(first);
+    free(second);
+    backend_pool_release(conn);
+    backend_pool_destroy(pool);
+    backend_stop(&backend);
+}
+
+Test(http2_client, stale_copy_of_a_5xx_still_counts_against_the_breaker)
+{
+    test_backend_t backend;
+    backend_start(&backend);
+
+    backend_pool_t *pool = backend_pool_create("127.0.0.1", backend.port, true, false, 1);
+    cr_assert_not_null(pool);
+    circuit_breaker_config_t breaker = {.enabled = true, .failure_threshold = 5,
+                                        .recovery_timeout_seconds = 60};
+    cr_assert_eq(backend_pool_init_circuit_breaker(pool, &breaker), 0);
+
+    ServerConfig *config = calloc(1, sizeof(*config));
+    Route *route = &config->routes[0];
+    config->route_count = 1;
+    strcpy(route->path, STATUS_PREFIX);
+    strcpy(route->technology, "reverse_proxy");
+    route->cluster = upstream_cluster_create(LB_ROUND_ROBIN, NULL);
+    cr_assert_eq(upstream_cluster_add_endpoint(route->cluster, "127.0.0.1", pool), 0);
+    route->response_cache = response_cache_create(1024 * 1024, 1, 64 * 1024);
+
+    /* An earlier answer, expired but within its stale-if-error window */
+    HttpRequest req = {.method = "GET", .path = STATUS_PREFIX "503"};
+    req.headers[req.header_count++] = (HttpHeader){"Host", "backend"};
+    response_cache_header_t headers[] = {
+        {"Cache-Control", 13, "max-age=1, stale-if-error=60", 28},
+    };
+    response_cache_entry_t *entry = response_cache_begin(route->response_cache, &req, 200, headers, 1, 0);
+    cr_assert_not_null(entry);
+    cr_assert_eq(response_cache_append(entry, "old", 3), 0);
+    response_cache_commit(route->response_cache, entry);
+    sleep(2);
+
+    Http2Response resp = {0};
+    cr_assert_eq(route_request_tls(&req, NULL, 0, config, NULL, &resp), 0);
+    cr_assert_not_null(resp.cached, "The 503 is answered from the stale copy");
+    cr_assert_eq(resp.status_code, 200);
+    cr_assert_eq(backend_pool_circuit_breaker_get_failure_count(pool), 1,
+                 "The 503 still counts against the backend");
+    cr_assert_eq(backend_pool_get_stream_count(pool), 0);
+
+    response_cache_release(resp.cached);
+    response_cache_destroy(route->response_cache);
+    upstream_cluster_destroy(route->cluster);
+    free(config);
+    backend_stop(&backend);
+}
@@ -0,0 +1,121 @@
+// tests/unit/test_resolver.c
+// Unit tests for cached backend resolution and happy-eyeballs connect
+
+#include <criterion/criterion.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "resolver.h"
+
+static long elapsed_ms_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static int listen_loopback(int *port)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    cr_assert_geq(fd, 0);
+    cr_assert_eq(bind(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    cr_assert_eq(listen(fd, 4), 0);
+    getsockname(fd, (struct sockaddr *)&addr, &len);
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static void add_ipv4(resolver_endpoint_t *endpoint, const char *ip, int port)
+{
+    struct sockaddr_in *sin = (struct sockaddr_in *)&endpoint->addrs.addrs[endpoint->addrs.count];
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(port);
+    cr_assert_eq(inet_pton(AF_INET, ip, &sin->sin_addr), 1);
+    endpoint->addrs.addr_lens[endpoint->addrs.count++] = sizeof(*sin);
+}
+
+Test(resolver, endpoints_are_resolved_once_and_shared)
+{
+    resolver_endpoint_t *v4 = resolver_get_endpoint("127.0.0.1", 7001);
+    cr_assert_not_null(v4);
+    cr_assert(v4->numeric);
+    cr_assert_eq(resolver_get_endpoint("127.0.0.1", 7001), v4, "Same host:port, same entry");
+    cr_assert_neq(resolver_get_endpoint("127.0.0.1", 7002), v4);
+
+    resolved_addrs_t addrs;
+    cr_assert_eq(resolver_endpoint_addrs(v4, &addrs), 1);
+    cr_assert_eq(addrs.addrs[0].ss_family, AF_INET);
+    cr_assert_eq(ntohs(((struct sockaddr_in *)&addrs.addrs[0])->sin_port), 7001);
+
+    resolver_endpoint_t *v6 = resolver_get_endpoint("::1", 7001);
+    cr_assert_not_null(v6);
+    cr_assert_eq(resolver_endpoint_addrs(v6, &addrs), 1);
+    cr_assert_eq(addrs.addrs[0].ss_family, AF_INET6);
+
+    resolver_endpoint_t *named = resolver_get_endpoint("localhost", 7001);
+    cr_assert_not_null(named);
+    cr_assert_not(named->numeric);
+    cr_assert_gt(resolver_endpoint_addrs(named, &addrs), 0, "localhost should resolve");
+    cr_assert_gt(named->expires_at, time(NULL), "Hostname entries expire and are refreshed");
+
+    resolver_shutdown();
+}
+
+Test(resolver, connect_falls_back_to_next_address)
+{
+    int port;
+    int listen_fd = listen_loopback(&port);
+    resolver_endpoint_t endpoint;
+    memset(&endpoint, 0, sizeof(endpoint));
+    snprintf(endpoint.host, sizeof(endpoint.host), "test");
+    pthread_mutex_init(&endpoint.lock, NULL);
+
+    /* A non-routable address first: its attempt stalls or fails, and the
+     * loopback one is started after the attempt delay at the latest */
+    add_ipv4(&endpoint, "10.255.255.1", port);
+    add_ipv4(&endpoint, "127.0.0.1", port);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int fd = resolver_connect(&endpoint, 3000);
+    cr_assert_geq(fd, 0, "Second address should win the race");
+    cr_assert_lt(elapsed_ms_since(&start), RESOLVER_CONNECT_ATTEMPT_DELAY_MS + 500);
+
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    cr_assert_eq(getpeername(fd, (struct sockaddr *)&peer, &len), 0);
+    cr_assert_eq(peer.sin_addr.s_addr, htonl(INADDR_LOOPBACK));
+
+    close(fd);
+    close(listen_fd);
+    pthread_mutex_destroy(&endpoint.lock);
+}
+
+Test(resolver, connect_fails_fast_when_every_address_refuses)
+{
+    int port;
+    int listen_fd = listen_loopback(&port);
+    close(listen_fd);
+
+    resolver_endpoint_t endpoint;
+    memset(&endpoint, 0, sizeof(endpoint));
+    snprintf(endpoint.host, sizeof(endpoint.host), "test");
+    pthread_mutex_init(&endpoint.lock, NULL);
+    add_ipv4(&endpoint, "127.0.0.1", port);
+    add_ipv4(&endpoint, "127.0.0.1", port);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cr_assert_eq(resolver_connect(&endpoint, 3000), -1);
+    cr_assert_lt(elapsed_ms_since(&start), 1000, "Refusals start the next attempt at once");
+
+    pthread_mutex_destroy(&endpoint.lock);
+}
@@ -0,0 +1,466 @@
+// tests/unit/test_response_cache.c
+// Unit tests for the shared proxy response cache
+
+#include <criterion/criterion.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "response_cache.h"
+
+#define HEADER(NAME, VALUE) (response_cache_header_t){NAME, sizeof(NAME) - 1, VALUE, sizeof(VALUE) - 1}
+
+static void make_request(HttpRequest *req, const char *path)
+{
+    memset(req, 0, sizeof(*req));
+    req->method = "GET";
+    req->path = path;
+    req->headers[req->header_count++] = (HttpHeader){"Host", "api.example"};
+}
+
+static void add_request_header(HttpRequest *req, const char *field, const char *value)
+{
+    req->headers[req->header_count++] = (HttpHeader){field, value};
+}
+
+/* Stores 'body' as the whole response; returns whether it was cacheable */
+static bool store(response_cache_t *cache, const HttpRequest *req, const response_cache_header_t *headers,
+                  int count, int ttl, const char *body)
+{
+    response_cache_entry_t *entry = response_cache_begin(cache, req, 200, headers, count, ttl);
+    if (!entry) {
+        return false;
+    }
+    cr_assert_eq(response_cache_append(entry, body, strlen(body)), 0);
+    response_cache_commit(cache, entry);
+    return true;
+}
+
+static bool cached(response_cache_t *cache, const HttpRequest *req)
+{
+    response_cache_entry_t *entry = response_cache_lookup(cache, req);
+    response_cache_release(entry);
+    return entry != NULL;
+}
+
+typedef struct {
+    response_cache_t *cache;
+    const HttpRequest *req;
+    int wait_ms;
+    response_cache_entry_t *hit;
+    response_cache_flight_t *flight;
+    long waited_ms;
+} follower_t;
+
+static void *follow(void *arg)
+{
+    follower_t *f = arg;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    f->hit = response_cache_lookup_coalesced(f->cache, f->req, f->wait_ms, &f->flight);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    f->waited_ms = (end.tv_sec - start.tv_sec) * 1000L + (end.tv_nsec - start.tv_nsec) / 1000000L;
+    return NULL;
+}
+
+static void wait_for_waiters(response_cache_flight_t *flight, int count)
+{
+    for (;;) {
+        pthread_mutex_lock(&flight->shard->lock);
+        int waiters = flight->waiters;
+        pthread_mutex_unlock(&flight->shard->lock);
+        if (waiters == count) {
+            return;
+        }
+        usleep(1000);
+    }
+}
+
+Test(response_cache, serves_stored_response_with_filtered_headers)
+{
+    response_cache_t *cache = response_cache_create(1024 * 1024, 4, 64 * 1024);
+    cr_assert_not_null(cache);
+    HttpRequest req;
+    make_request(&req, "/api/items");
+
+    response_cache_header_t headers[] = {
+        HEADER("Content-Type", "application/json"),
+        HEADER("Cache-Control", "public, max-age=60"),
+        HEADER("Content-Length", "11"),
+        HEADER("Connection", "keep-alive"),
+        HEADER("Age", "5"),
+    };
+    cr_assert_null(response_cache_lookup(cache, &req));
+    cr_assert(store(cache, &req, headers, 5, 0, "{\"items\":1}"));
+
+    response_cache_entry_t *hit = response_cache_lookup(cache, &req);
+    cr_assert_not_null(hit);
+    cr_assert_eq(hit->status, 200);
+    cr_assert_str_eq(hit->reason, "OK");
+    cr_assert_eq(hit->body_len, 11);
+    cr_assert_eq(memcmp(hit->body, "{\"items\":1}", 11), 0);
+    cr_assert_geq(response_cache_age(hit), 5, "Age continues from the backend's");
+
+    /* Framing, hop-by-hop and Age are per connection; names are lowercase */
+    cr_assert_eq(hit->header_count, 2);
+    cr_assert_str_eq(hit->headers[0].name, "content-type");
+    cr_assert_str_eq(hit->headers[0].value, "application/json");
+    cr_assert_str_eq(hit->headers[1].name, "cache-control");
+    response_cache_release(hit);
+
+    /* Another authority or path is another resource */
+    HttpRequest other;
+    make_request(&other, "/api/items");
+    other.headers[0].value = "other.example";
+    cr_assert_not(cached(cache, &other));
+    make_request(&other, "/api/items?page=2");
+    cr_assert_not(cached(cache, &other));
+
+    response_cache_stats_t stats;
+    response_cache_get_stats(cache, &stats);
+    cr_assert_eq(stats.hits, 1);
+    cr_assert_eq(stats.misses, 3);
+    cr_assert_eq(stats.stores, 1);
+    cr_assert_eq(stats.entries, 1);
+    response_cache_destroy(cache);
+}
+
+Test(response_cache, only_stores_what_a_shared_cache_may)
+{
+    response_cache_t *cache = response_cache_create(1024 * 1024, 1, 64 * 1024);
+    HttpRequest req;
+    make_request(&req, "/api/a");
+
+    response_cache_header_t no_store[] = {HEADER("Cache-Control", "no-store, max-age=60")};
+    response_cache_header_t private_cc[] = {HEADER("Cache-Control", "private, max-age=60")};
+    response_cache_header_t no_cache[] = {HEADER("Cache-Control", "no-cache")};
+    response_cache_header_t cookie[] = {HEADER("Cache-Control", "max-age=60"), HEADER("Set-Cookie", "s=1")};
+    response_cache_header_t vary_all[] = {HEADER("Cache-Control", "max-age=60"), HEADER("Vary", "*")};
+    response_cache_header_t plain[] = {HEADER("Content-Type", "text/plain")};
+    response_cache_header_t fresh[] = {HEADER("Cache-Control", "s-maxage=30, max-age=0")};
+
+    cr_assert_not(store(cache, &req, no_store, 1, 0, "x"));
+    cr_assert_not(store(cache, &req, private_cc, 1, 0, "x"));
+    cr_assert_not(store(cache, &req, no_cache, 1, 0, "x"));
+    cr_assert_not(store(cache, &req, cookie, 2, 0, "x"));
+    cr_assert_not(store(cache, &req, vary_all, 2, 0, "x"));
+    cr_assert_not(store(cache, &req, plain, 1, 0, "x"), "No lifetime, no heuristic");
+    cr_assert_null(response_cache_begin(cache, &req, 500, fresh, 1, 0), "500 is not cacheable");
+
+    /* s-maxage wins for a shared cache; a route TTL applies without one */
+    cr_assert(store(cache, &req, fresh, 1, 0, "x"));
+    cr_assert(cached(cache, &req));
+    HttpRequest b;
+    make_request(&b, "/api/b");
+    cr_assert(store(cache, &b, plain, 1, 10, "y"));
+    cr_assert(cached(cache, &b));
+    cr_assert_not(store(cache, &b, private_cc, 1, 10, "y"), "A route TTL does not override private");
+
+    /* Credentials and request directives */
+    HttpRequest auth;
+    make_request(&auth, "/api/a");
+    add_request_header(&auth, "Authorization", "Bearer t");
+    cr_assert_not(cached(cache, &auth));
+    cr_assert_not(store(cache, &auth, fresh, 1, 0, "x"));
+
+    HttpRequest refresh;
+    make_request(&refresh, "/api/a");
+    add_request_header(&refresh, "Cache-Control", "no-cache");
+    cr_assert_not(cached(cache, &refresh), "no-cache goes to the backend");
+    cr_assert(store(cache, &refresh, fresh, 1, 0, "x2"), "and may refresh the entry");
+
+    HttpRequest no_store_req;
+    make_request(&no_store_req, "/api/a");
+    add_request_header(&no_store_req, "cache-control", "no-store");
+    cr_assert_not(cached(cache, &no_store_req));
+    cr_assert_not(store(cache, &no_store_req, fresh, 1, 0, "x"));
+
+    HttpRequest post;
+    make_request(&post, "/api/a");
+    post.method = "POST";
+    cr_assert_not(cached(cache, &post));
+    response_cache_destroy(cache);
+}
+
+Test(response_cache, vary_keeps_one_variant_per_request_value)
+{
+    response_cache_t *cache = response_cache_create(1024 * 1024, 2, 64 * 1024);
+    response_cache_header_t headers[] = {
+        HEADER("Cache-Control", "max-age=60"),
+        HEADER("Vary", "Accept-Language, Accept-Encoding"),
+    };
+    HttpRequest en, fr, none;
+    make_request(&en, "/api/greeting");
+    add_request_header(&en, "Accept-Language", "en");
+    make_request(&fr, "/api/greeting");
+    add_request_header(&fr, "accept-language", "fr");
+    make_request(&none, "/api/greeting");
+
+    cr_assert(store(cache, &en, headers, 2, 0, "hello"));
+    cr_assert_not(cached(cache, &fr));
+    cr_assert_not(cached(cache, &none));
+    cr_assert(store(cache, &fr, headers, 2, 0, "bonjour"));
+
+    response_cache_entry_t *hit = response_cache_lookup(cache, &fr);
+    cr_assert_not_null(hit);
+    cr_assert_eq(memcmp(hit->body, "bonjour", 7), 0);
+    response_cache_release(hit);
+    hit = response_cache_lookup(cache, &en);
+    cr_assert_not_null(hit);
+    cr_assert_eq(memcmp(hit->body, "hello", 5), 0);
+
+    /* A new response replaces only its own variant, and a reader keeps
+     * the entry it was given */
+    cr_assert(store(cache, &en, headers, 2, 0, "hi"));
+    cr_assert_eq(memcmp(hit->body, "hello", 5), 0);
+    response_cache_release(hit);
+
+    response_cache_stats_t stats;
+    response_cache_get_stats(cache, &stats);
+    cr_assert_eq(stats.entries, 2);
+    response_cache_destroy(cache);
+}
+
+Test(response_cache, entries_expire_after_their_lifetime)
+{
+    response_cache_t *cache = response_cache_create(1024 * 1024, 1, 64 * 1024);
+    HttpRequest req;
+    make_request(&req, "/api/clock");
+
+    response_cache_header_t stale[] = {HEADER("Cache-Control", "max-age=60"), HEADER("Age", "60")};
+    cr_assert_not(store(cache, &req, stale, 2, 0, "x"), "Already stale on arrival");
+
+    response_cache_header_t expired[] = {
+        HEADER("Date", "Tue, 15 Sep 2026 10:00:00 GMT"),
+        HEADER("Expires", "Tue, 15 Sep 2026 10:00:00 GMT"),
+    };
+    cr_assert_not(store(cache, &req, expired, 2, 0, "x"));
+    response_cache_header_t invalid[] = {HEADER("Expires", "0")};
+    cr_assert_not(store(cache, &req, invalid, 1, 0, "x"));
+
+    response_cache_header_t expires[] = {
+        HEADER("Date", "Tue, 15 Sep 2026 10:00:00 GMT"),
+        HEADER("Expires", "Tue, 15 Sep 2026 10:00:02 GMT"),
+    };
+    cr_assert(store(cache, &req, expires, 2, 0, "x"));
+    cr_assert(cached(cache, &req));
+    sleep(3);
+    cr_assert_not(cached(cache, &req));
+
+    response_cache_stats_t stats;
+    response_cache_get_stats(cache, &stats);
+    cr_assert_eq(stats.entries, 0, "A stale entry is dropped when found");
+    response_cache_destroy(cache);
+}
+
+Test(response_cache, segmented_lru_keeps_reused_entries)
+{
+    /* One shard with room for a handful of entries */
+    response_cache_t *cache = response_cache_create(32 * 1024, 1, 2048);
+    response_cache_header_t headers[] = {HEADER("Cache-Control", "max-age=60")};
+    char body[1024];
+    memset(body, 'b', sizeof(body) - 1);
+    body[sizeof(body) - 1] = '\0';
+
+    HttpRequest hot;
+    make_request(&hot, "/api/hot");
+    cr_assert(store(cache, &hot, headers, 1, 0, body));
+    cr_assert(cached(cache, &hot));
+
+    /* A scan of one-off URLs evicts from probation only */
+    char paths[64][32];
+    for (int i = 0; i < 64; i++) {
+        HttpRequest once;
+        snprintf(paths[i], sizeof(paths[i]), "/api/once/%d", i);
+        make_request(&once, paths[i]);
+        cr_assert(store(cache, &once, headers, 1, 0, body));
+    }
+    cr_assert(cached(cache, &hot));
+
+    HttpRequest first;
+    make_request(&first, paths[0]);
+    cr_assert_not(cached(cache, &first));
+
+    response_cache_stats_t stats;
+    response_cache_get_stats(cache, &stats);
+    cr_assert_gt(stats.evictions, 0);
+    cr_assert_leq(stats.bytes, 32 * 1024);
+
+    /* Bodies over the entry limit are not stored */
+    response_cache_entry_t *big = response_cache_begin(cache, &first, 200, headers, 1, 0);
+    cr_assert_not_null(big);
+    cr_assert_eq(response_cache_append(big, body, sizeof(body)), 0);
+    cr_assert_eq(response_cache_append(big, body, sizeof(body)), 0);
+    cr_assert_eq(response_cache_append(big, body, 1), -1);
+    response_cache_release(big);
+    response_cache_destroy(cache);
+}
+
+Test(response_cache, concurrent_misses_wait_for_one_fetch)
+{
+    response_cache_t *cache = response_cache_create(1024 * 1024, 4, 64 * 1024);
+    response_cache_header_t headers[] = {HEADER("Cache-Control", "max-age=60")};
+    HttpRequest req;
+    make_request(&req, "/api/report");
+
+    response_cache_flight_t *flight = NULL;
+    cr_assert_null(response_cache_lookup_coalesced(cache, &req, 5000, &flight));
+    cr_assert_not_null(flight, "The first miss leads the fetch");
+
+    /* The leader's own thread never waits on itself */
+    response_cache_flight_t *again = NULL;
+    cr_assert_null(response_cache_lookup_coalesced(cache, &req, 5000, &again));
+    cr_assert_null(again);
+
+    follower_t followers[3];
+    pthread_t threads[3];
+    for (int i = 0; i < 3; i++) {
+        followers[i] = (follower_t){.cache = cache, .req = &req, .wait_ms = 5000};
+        pthread_create(&threads[i], NULL, follow, &followers[i]);
+    }
+    wait_for_waiters(flight, 3);
+
+    response_cache_entry_t *fill = response_cache_begin(cache, &req, 200, headers, 1, 0);
+    cr_assert_not_null(fill);
+    response_cache_attach_flight(fill, flight);
+    cr_assert_eq(response_cache_append(fill, "report", 6), 0);
+    response_cache_commit(cache, fill);
+
+    for (int i = 0; i < 3; i++) {
+        pthread_join(threads[i], NULL);
+        cr_assert_not_null(followers[i].hit, "Served from the leader's response");
+        cr_assert_null(followers[i].flight);
+        cr_assert_eq(memcmp(followers[i].hit->body, "report", 6), 0);
+        response_cache_release(followers[i].hit);
+    }
+
+    response_cache_stats_t stats;
+    response_cache_get_stats(cache, &stats);
+    cr_assert_eq(stats.coalesced, 3);
+    cr_assert_eq(stats.stores, 1);
+    response_cache_destroy(cache);
+}
+
+Test(response_cache, waiters_fetch_themselves_without_a_stored_response)
+{
+    response_cache_t *cache = response_cache_create(1024 * 1024, 1, 64 * 1024);
+    response_cache_header_t private_cc[] = {HEADER("Cache-Control", "private")};
+    HttpRequest req;
+    make_request(&req, "/api/me");
+
+    /* A follower gives up after its timeout while the leader is slow */
+    response_cache_flight_t *flight = NULL;
+    cr_assert_null(response_cache_lookup_coalesced(cache, &req, 5000, &flight));
+    cr_assert_not_null(flight);
+    follower_t slow = {.cache = cache, .req = &req, .wait_ms = 50};
+    pthread_t thread;
+    pthread_create(&thread, NULL, follow, &slow);
+    pthread_join(thread, NULL);
+    cr_assert_null(slow.hit);
+    cr_assert_null(slow.flight, "The leader's flight is still in progress");
+    cr_assert_geq(slow.waited_ms, 40);
+
+    /* A response that may not be stored lands the flight right away */
+    follower_t follower = {.cache = cache, .req = &req, .wait_ms = 5000};
+    pthread_create(&thread, NULL, follow, &follower);
+    wait_for_waiters(flight, 1);
+    cr_assert_null(response_cache_begin(cache, &req, 200, private_cc, 1, 0));
+    response_cache_land(flight);
+    pthread_join(thread, NULL);
+    cr_assert_null(follower.hit);
+    cr_assert_lt(follower.waited_ms, 5000);
+
+    /* With the flight gone, the next miss leads a new one */
+    cr_assert_null(response_cache_lookup_coalesced(cache, &req, 5000, &flight));
+    cr_assert_not_null(flight);
+    response_cache_land(flight);
+
+    response_cache_stats_t stats;
+    response_cache_get_stats(cache, &stats);
+    cr_assert_eq(stats.coalesced, 0);
+    response_cache_destroy(cache);
+}
+
+/* Stores a response with a one second lifetime and the given route stale
+ * windows */
+static void store_expiring(response_cache_t *cache, const HttpRequest *req, const char *cache_control,
+                           long while_revalidate, long if_error)
+{
+    response_cache_header_t headers[] = {
+        {"Cache-Control", 13, cache_control, strlen(cache_control)},
+    };
+    response_cache_entry_t *entry = response_cache_begin(cache, req, 200, headers, 1, 0);
+    cr_assert_not_null(entry);
+    response_cache_default_stale(entry, while_revalidate, if_error);
+    cr_assert_eq(response_cache_append(entry, "old", 3), 0);
+    response_cache_commit(cache, entry);
+}
+
+Test(response_cache, stale_entries_serve_while_refreshing_or_on_error)
+{
+    response_cache_t *cache = response_cache_create(1024 * 1024, 2, 64 * 1024);
+    HttpRequest revalidate, on_error, strict, route_default, explicit_zero;
+    make_request(&revalidate, "/api/revalidate");
+    make_request(&on_error, "/api/on-error");
+    make_request(&strict, "/api/strict");
+    make_request(&route_default, "/api/route-default");
+    make_request(&explicit_zero, "/api/explicit-zero");
+
+    store_expiring(cache, &revalidate, "max-age=1, stale-while-revalidate=30", 0, 0);
+    store_expiring(cache, &on_error, "max-age=1, stale-if-error=30", 0, 0);
+    store_expiring(cache, &strict, "max-age=1, must-revalidate", 30, 30);
+    store_expiring(cache, &route_default, "max-age=1", 30, 0);
+    store_expiring(cache, &explicit_zero, "max-age=1, stale-while-revalidate=0", 30, 0);
+    sleep(2);
+
+    /* Within stale-while-revalidate: a hit, and the first one refreshes */
+    response_cache_flight_t *refresh = NULL;
+    response_cache_entry_t *hit = response_cache_lookup_coalesced(cache, &revalidate, 5000, &refresh);
+    cr_assert_not_null(hit);
+    cr_assert(response_cache_is_stale(hit));
+    cr_assert_not_null(refresh);
+    response_cache_release(hit);
+    response_cache_flight_t *second = NULL;
+    hit = response_cache_lookup_coalesced(cache, &revalidate, 5000, &second);
+    cr_assert_not_null(hit);
+    cr_assert_null(second, "Only one refresh at a time");
+    response_cache_release(hit);
+
+    response_cache_header_t fresh[] = {HEADER("Cache-Control", "max-age=60")};
+    response_cache_entry_t *fill = response_cache_begin(cache, &revalidate, 200, fresh, 1, 0);
+    response_cache_attach_flight(fill, refresh);
+    cr_assert_eq(response_cache_append(fill, "new", 3), 0);
+    response_cache_commit(cache, fill);
+    hit = response_cache_lookup(cache, &revalidate);
+    cr_assert_not(response_cache_is_stale(hit));
+    cr_assert_eq(memcmp(hit->body, "new", 3), 0);
+    response_cache_release(hit);
+
+    /* Within stale-if-error only: a miss, but it stands in for a failure */
+    response_cache_flight_t *flight = NULL;
+    cr_assert_null(response_cache_lookup_coalesced(cache, &on_error, 5000, &flight));
+    cr_assert_not_null(flight);
+    response_cache_land(flight);
+    hit = response_cache_lookup_stale(cache, &on_error);
+    cr_assert_not_null(hit);
+    cr_assert_eq(memcmp(hit->body, "old", 3), 0);
+    response_cache_release(hit);
+
+    /* must-revalidate rules out both windows, even the route's */
+    cr_assert_not(cached(cache, &strict));
+    cr_assert_null(response_cache_lookup_stale(cache, &strict));
+
+    /* The route's window applies unless the response set its own */
+    cr_assert(cached(cache, &route_default));
+    cr_assert_not(cached(cache, &explicit_zero));
+    cr_assert_null(response_cache_lookup_stale(cache, &route_default), "No stale-if-error window");
+
+    response_cache_stats_t stats;
+    response_cache_get_stats(cache, &stats);
+    cr_assert_eq(stats.stale, 4);
+    response_cache_destroy(cache);
+}
@@ -2,14 +2,21 @@
 
 #include <criterion/criterion.h>
 
+#include <arpa/inet.h>
 #include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "http1_client.h"
+#include "resolver.h"
 #include "router.h"
 
 #define STATIC_DIR "temp_static_router"
@@ -506,3 +513,111 @@ Test(router_static, serves_txt_file)
     unlink(STATIC_DIR "/readme.txt");
     cleanup_static_dir();
 }
+
+/* Plain HTTP/1.1 backend: answers each request on whatever connection it
+ * arrives, counting the connections it accepted */
+typedef struct {
+    int listen_fd;
+    int requests;
+    int accepted;
+    char last_head[2048];
+} h1_backend_t;
+
+static void *h1_backend_thread(void *arg)
+{
+    h1_backend_t *backend = arg;
+    struct pollfd pfds[4] = {{.fd = backend->listen_fd, .events = POLLIN}};
+    char buf[2048];
+    size_t have[4] = {0};
+    int served = 0, nfds = 1;
+
+    while (served < backend->requests && poll(pfds, (nfds_t)nfds, 5000) > 0) {
+        if ((pfds[0].revents & POLLIN) && nfds < 4) {
+            pfds[nfds].fd = accept(backend->listen_fd, NULL, NULL);
+            pfds[nfds].events = POLLIN;
+            have[nfds++] = 0;
+            backend->accepted++;
+        }
+        for (int i = 1; i < nfds; i++) {
+            if (!(pfds[i].revents & POLLIN)) {
+                continue;
+            }
+            ssize_t n = recv(pfds[i].fd, backend->last_head + have[i],
+                             sizeof(backend->last_head) - 1 - have[i], 0);
+            if (n <= 0) {
+                pfds[i].fd = -pfds[i].fd - 1;
+                continue;
+            }
+            have[i] += (size_t)n;
+            backend->last_head[have[i]] = '\0';
+            if (strstr(backend->last_head, "\r\n\r\n")) {
+                int len = snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\nContent-Length: 7\r\n\r\n"
+                                   "reply-%d", ++served);
+                send(pfds[i].fd, buf, (size_t)len, 0);
+                have[i] = 0;
+            }
+        }
+    }
+    usleep(50000);
+    for (int i = 1; i < nfds; i++) {
+        close(pfds[i].fd >= 0 ? pfds[i].fd : -pfds[i].fd - 1);
+    }
+    return NULL;
+}
+
+Test(router_proxy, reuses_upstream_connection_for_http1)
+{
+    h1_backend_t backend = {.requests = 2};
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addr_len = sizeof(addr);
+    backend.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    cr_assert_eq(bind(backend.listen_fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    cr_assert_eq(listen(backend.listen_fd, 4), 0);
+    getsockname(backend.listen_fd, (struct sockaddr *)&addr, &addr_len);
+    int port = ntohs(addr.sin_port);
+
+    pthread_t thread;
+    cr_assert_eq(pthread_create(&thread, NULL, h1_backend_thread, &backend), 0);
+
+    ServerConfig config = {0};
+    config.route_count = 1;
+    strcpy(config.routes[0].path, "/api");
+    strcpy(config.routes[0].technology, "reverse_proxy");
+    snprintf(config.routes[0].backend, sizeof(config.routes[0].backend), "127.0.0.1:%d", port);
+    config.routes[0].h1_pool = http1_pool_create(resolver_get_endpoint("127.0.0.1", port),
+                                                 config.routes[0].backend, 4, 60);
+    cr_assert_not_null(config.routes[0].h1_pool);
+
+    SSL *server = NULL;
+    SSL *client = NULL;
+    create_ssl_pair(&server, &client);
+
+    for (int i = 1; i <= 2; i++) {
+        char raw[] = "GET /api/items HTTP/1.1\r\nHost: example.com\r\nConnection: keep-alive\r\n\r\n";
+        HttpRequest req;
+        memset(&req, 0, sizeof(req));
+        cr_assert_eq(parse_http_request(raw, sizeof(raw) - 1, &req), 0);
+        snprintf(req.client_addr, sizeof(req.client_addr), "192.0.2.1");
+
+        cr_assert_eq(proxy_request_tls(&req, raw, sizeof(raw) - 1, &config, server), 0);
+
+        char resp[1024];
+        char expected[16];
+        snprintf(expected, sizeof(expected), "reply-%d", i);
+        cr_assert_gt(read_ssl_response(client, resp, sizeof(resp)), 0);
+        cr_assert(strncmp(resp, "HTTP/1.1 200 OK\r\n", 17) == 0);
+        cr_assert_not_null(strstr(resp, expected), "Response %d relayed: %s", i, resp);
+    }
+
+    pthread_join(thread, NULL);
+    cr_assert_eq(backend.accepted, 1, "Both requests share one upstream connection");
+    cr_assert_not_null(strstr(backend.last_head, "Host: 127.0.0.1:"));
+    cr_assert_not_null(strstr(backend.last_head, "X-Forwarded-For: 192.0.2.1\r\n"));
+    cr_assert_not_null(strstr(backend.last_head, "X-Forwarded-Host: example.com\r\n"));
+
+    http1_pool_destroy(config.routes[0].h1_pool);
+    close(backend.listen_fd);
+    SSL_free(server);
+    SSL_free(client);
+    resolver_shutdown();
+}
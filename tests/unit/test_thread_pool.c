@@ -4,6 +4,7 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <time.h>
 
 #include "thread_pool.h"
@@ -152,3 +153,84 @@ Test(thread_pool, clamps_min_threads_to_max_threads)
 
     thread_pool_destroy(pool);
 }
+
+typedef struct {
+    ThreadPool *pool;
+    CountSync *sync;
+    int children;
+} SpawnArg;
+
+static void task_spawn_children(void *arg)
+{
+    SpawnArg *spawn = (SpawnArg *)arg;
+    for (int i = 0; i < spawn->children; i++)
+        cr_assert(thread_pool_add_task(spawn->pool, task_inc, spawn->sync));
+    task_inc(spawn->sync);
+}
+
+Test(thread_pool, runs_tasks_submitted_from_workers)
+{
+    CountSync sync = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+        .completed = 0,
+        .target = 4 * 33,
+    };
+
+    ThreadPool *pool = thread_pool_create(4, 4);
+    cr_assert_not_null(pool, "pool create");
+
+    SpawnArg spawn = { .pool = pool, .sync = &sync, .children = 32 };
+    for (int i = 0; i < 4; i++)
+        cr_assert(thread_pool_add_task(pool, task_spawn_children, &spawn));
+
+    pthread_mutex_lock(&sync.lock);
+    int ok = wait_for_value(&sync.cond, &sync.lock, &sync.completed, sync.target, 2000);
+    pthread_mutex_unlock(&sync.lock);
+    cr_assert(ok, "nested tasks did not complete (%d/%d)", sync.completed, sync.target);
+
+    thread_pool_destroy(pool);
+}
+
+typedef struct {
+    ThreadPool *pool;
+    CountSync *sync;
+    int tasks;
+} ProducerArg;
+
+static void *producer_thread(void *arg)
+{
+    ProducerArg *producer = (ProducerArg *)arg;
+    for (int i = 0; i < producer->tasks; i++) {
+        while (!thread_pool_add_task(producer->pool, task_inc, producer->sync))
+            sched_yield();
+    }
+    return NULL;
+}
+
+Test(thread_pool, concurrent_producers)
+{
+    CountSync sync = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+        .completed = 0,
+        .target = 4 * 2000,
+    };
+
+    ThreadPool *pool = thread_pool_create(2, 4);
+    cr_assert_not_null(pool, "pool create");
+
+    pthread_t producers[4];
+    ProducerArg arg = { .pool = pool, .sync = &sync, .tasks = 2000 };
+    for (int i = 0; i < 4; i++)
+        cr_assert_eq(pthread_create(&producers[i], NULL, producer_thread, &arg), 0);
+    for (int i = 0; i < 4; i++)
+        pthread_join(producers[i], NULL);
+
+    pthread_mutex_lock(&sync.lock);
+    int ok = wait_for_value(&sync.cond, &sync.lock, &sync.completed, sync.target, 5000);
+    pthread_mutex_unlock(&sync.lock);
+    cr_assert(ok, "lost tasks (%d/%d)", sync.completed, sync.target);
+
+    thread_pool_destroy(pool);
+}
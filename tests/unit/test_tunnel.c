@@ -0,0 +1,243 @@
+// tests/unit/test_tunnel.c
+// Unit tests for the full-duplex client/backend tunnel
+
+#include <criterion/criterion.h>
+
+#include <fcntl.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tunnel.h"
+#include "uring_io.h"
+
+#define PAYLOAD_SIZE (512 * 1024)
+
+typedef struct {
+    SSL *server;                /* tunnel side */
+    SSL *client;
+    int server_fd;
+    int client_fd;
+    int backend_fd;             /* tunnel side of the backend socket */
+    int peer_fd;                /* the "backend" the test drives */
+    SSL_CTX *server_ctx;
+    SSL_CTX *client_ctx;
+    bool use_uring;
+    int idle_timeout_ms;
+    int result;
+    tunnel_stats_t stats;
+} tunnel_fixture_t;
+
+static void handshake(tunnel_fixture_t *f)
+{
+    bool client_done = false, server_done = false;
+    for (int i = 0; i < 10000 && (!client_done || !server_done); i++) {
+        if (!client_done) {
+            int r = SSL_do_handshake(f->client);
+            client_done = r == 1;
+            cr_assert(client_done || SSL_get_error(f->client, r) == SSL_ERROR_WANT_READ ||
+                      SSL_get_error(f->client, r) == SSL_ERROR_WANT_WRITE);
+        }
+        if (!server_done) {
+            int r = SSL_do_handshake(f->server);
+            server_done = r == 1;
+            cr_assert(server_done || SSL_get_error(f->server, r) == SSL_ERROR_WANT_READ ||
+                      SSL_get_error(f->server, r) == SSL_ERROR_WANT_WRITE);
+        }
+        usleep(100);
+    }
+    cr_assert(client_done && server_done, "handshake timeout");
+}
+
+static void setup_fixture(tunnel_fixture_t *f, bool use_uring, int idle_timeout_ms)
+{
+    int tls[2], backend[2];
+    memset(f, 0, sizeof(*f));
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, tls), 0);
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, backend), 0);
+    f->server_fd = tls[0];
+    f->client_fd = tls[1];
+    f->backend_fd = backend[0];
+    f->peer_fd = backend[1];
+    f->use_uring = use_uring;
+    f->idle_timeout_ms = idle_timeout_ms;
+
+    f->server_ctx = SSL_CTX_new(TLS_server_method());
+    cr_assert_eq(SSL_CTX_use_certificate_file(f->server_ctx, "certs/dev.crt", SSL_FILETYPE_PEM), 1);
+    cr_assert_eq(SSL_CTX_use_PrivateKey_file(f->server_ctx, "certs/dev.key", SSL_FILETYPE_PEM), 1);
+    SSL_CTX_set_mode(f->server_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+    f->client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(f->client_ctx, SSL_VERIFY_NONE, NULL);
+
+    f->server = SSL_new(f->server_ctx);
+    f->client = SSL_new(f->client_ctx);
+    fcntl(f->server_fd, F_SETFL, O_NONBLOCK);
+    fcntl(f->client_fd, F_SETFL, O_NONBLOCK);
+    SSL_set_fd(f->server, f->server_fd);
+    SSL_set_fd(f->client, f->client_fd);
+    SSL_set_accept_state(f->server);
+    SSL_set_connect_state(f->client);
+    handshake(f);
+    fcntl(f->server_fd, F_SETFL, 0);
+}
+
+static void teardown_fixture(tunnel_fixture_t *f)
+{
+    SSL_free(f->server);
+    SSL_free(f->client);
+    SSL_CTX_free(f->server_ctx);
+    SSL_CTX_free(f->client_ctx);
+    close(f->server_fd);
+    close(f->client_fd);
+    close(f->backend_fd);
+    close(f->peer_fd);
+}
+
+static void *tunnel_thread(void *arg)
+{
+    tunnel_fixture_t *f = arg;
+    if (f->use_uring) {
+        uring_worker_t *worker = uring_worker_get(false);
+        BIO *bio = uring_bio_new(worker, f->server_fd, false);
+        SSL_set_bio(f->server, bio, bio);
+    }
+    f->result = tunnel_relay(f->server, f->backend_fd, f->idle_timeout_ms, &f->stats);
+    return NULL;
+}
+
+static void *echo_thread(void *arg)
+{
+    int fd = *(int *)arg;
+    char buf[8192];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        ssize_t sent = 0;
+        while (sent < n) {
+            ssize_t w = write(fd, buf + sent, (size_t)(n - sent));
+            if (w <= 0) {
+                return NULL;
+            }
+            sent += w;
+        }
+    }
+    shutdown(fd, SHUT_WR);
+    return NULL;
+}
+
+/* Reads whatever the client SSL has within timeout_ms */
+static int client_read(SSL *client, int fd, char *buf, size_t len, int timeout_ms)
+{
+    for (;;) {
+        int n = SSL_read(client, buf, (int)len);
+        if (n > 0) {
+            return n;
+        }
+        int err = SSL_get_error(client, n);
+        if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+            return -1;
+        }
+        struct pollfd pfd = {.fd = fd, .events = err == SSL_ERROR_WANT_READ ? POLLIN : POLLOUT};
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return 0;
+        }
+    }
+}
+
+Test(tunnel, relays_both_directions_concurrently)
+{
+    tunnel_fixture_t f;
+    setup_fixture(&f, true, 5000);
+
+    pthread_t tunnel, echo;
+    cr_assert_eq(pthread_create(&tunnel, NULL, tunnel_thread, &f), 0);
+    cr_assert_eq(pthread_create(&echo, NULL, echo_thread, &f.peer_fd), 0);
+
+    /* Write the whole payload while reading the echo: a relay that moves
+     * one direction at a time stalls once the socket buffers fill up */
+    static char out[PAYLOAD_SIZE], in[PAYLOAD_SIZE];
+    for (size_t i = 0; i < sizeof(out); i++) {
+        out[i] = (char)(i * 31 + 7);
+    }
+    size_t sent = 0, received = 0;
+    time_t deadline = time(NULL) + 10;
+    while (received < sizeof(in) && time(NULL) < deadline) {
+        if (sent < sizeof(out)) {
+            size_t chunk = sizeof(out) - sent < 16384 ? sizeof(out) - sent : 16384;
+            int n = SSL_write(f.client, out + sent, (int)chunk);
+            if (n > 0) {
+                sent += (size_t)n;
+            }
+        }
+        int n = SSL_read(f.client, in + received, (int)(sizeof(in) - received));
+        if (n > 0) {
+            received += (size_t)n;
+        } else {
+            struct pollfd pfd = {.fd = f.client_fd, .events = POLLIN | (sent < sizeof(out) ? POLLOUT : 0)};
+            poll(&pfd, 1, 10);
+        }
+    }
+    cr_assert_eq(received, sizeof(in), "Echo complete (%zu of %zu bytes)", received, sizeof(in));
+    cr_assert(memcmp(in, out, sizeof(in)) == 0, "Bytes arrive intact and in order");
+
+    /* close_notify half-closes the backend; the echo side then closes */
+    SSL_shutdown(f.client);
+    pthread_join(echo, NULL);
+    pthread_join(tunnel, NULL);
+    cr_assert_eq(f.result, 0);
+    cr_assert_eq(f.stats.bytes_to_backend, PAYLOAD_SIZE);
+    cr_assert_eq(f.stats.bytes_to_client, PAYLOAD_SIZE);
+    cr_assert_not(f.stats.idle_timeout);
+    teardown_fixture(&f);
+}
+
+Test(tunnel, backend_pushes_without_client_traffic)
+{
+    tunnel_fixture_t f;
+    setup_fixture(&f, false, 5000);
+
+    pthread_t tunnel;
+    cr_assert_eq(pthread_create(&tunnel, NULL, tunnel_thread, &f), 0);
+
+    /* Server-initiated messages reach a client that never sends anything */
+    char buf[64];
+    for (int i = 0; i < 3; i++) {
+        char msg[16];
+        int len = snprintf(msg, sizeof(msg), "event-%d", i);
+        cr_assert_eq(write(f.peer_fd, msg, (size_t)len), len);
+        int n = client_read(f.client, f.client_fd, buf, sizeof(buf), 2000);
+        cr_assert_eq(n, len, "Event %d relayed", i);
+        cr_assert(memcmp(buf, msg, (size_t)len) == 0);
+    }
+
+    /* The backend closing ends the tunnel */
+    shutdown(f.peer_fd, SHUT_WR);
+    pthread_join(tunnel, NULL);
+    cr_assert_eq(f.result, 0);
+    cr_assert_not(f.stats.idle_timeout);
+    cr_assert_eq(f.stats.bytes_to_client, 21);
+    teardown_fixture(&f);
+}
+
+Test(tunnel, idle_tunnel_times_out)
+{
+    tunnel_fixture_t f;
+    setup_fixture(&f, true, 100);
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_t tunnel;
+    cr_assert_eq(pthread_create(&tunnel, NULL, tunnel_thread, &f), 0);
+    pthread_join(tunnel, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    cr_assert_eq(f.result, 0);
+    cr_assert(f.stats.idle_timeout);
+    long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    cr_assert(elapsed_ms >= 90 && elapsed_ms < 2000, "Ended after %ldms", elapsed_ms);
+    teardown_fixture(&f);
+}
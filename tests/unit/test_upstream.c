@@ -0,0 +1,476 @@
+// tests/unit/test_upstream.c
+// Unit tests for upstream clusters and load-balancing policies
+
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "upstream.h"
+#include "backend_pool.h"
+#include "config.h"
+#include "log.h"
+
+static LoggingConfig test_log_config;
+
+static void setup_logging(void)
+{
+    memset(&test_log_config, 0, sizeof(test_log_config));
+    test_log_config.level = LOG_LEVEL_ERROR;
+    test_log_config.format = LOG_FORMAT_PLAIN;
+    test_log_config.buffer_size = 16384;
+    test_log_config.rollover_size = 10485760;
+    test_log_config.rollover_daily = 1;
+    test_log_config.appender_flags = APPENDER_CONSOLE;
+    log_init(&test_log_config);
+}
+
+static void teardown_logging(void)
+{
+    log_shutdown();
+}
+
+TestSuite(upstream, .init = setup_logging, .fini = teardown_logging);
+
+/* Endpoints on unused ports; with min_size 0 no connection is ever opened */
+static upstream_cluster_t *make_cluster(LoadBalancerPolicy policy, int endpoints)
+{
+    backend_pool_config_t pool_config = {
+        .size = 1,
+        .min_size = 0,
+        .acquire_timeout_ms = 0,
+        .idle_timeout_seconds = BACKEND_POOL_IDLE_TIMEOUT_SEC
+    };
+    upstream_cluster_t *cluster = upstream_cluster_create(policy, NULL);
+    cr_assert_not_null(cluster);
+
+    for (int i = 0; i < endpoints; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "127.0.0.1:%d", 9001 + i);
+        backend_pool_t *pool = backend_pool_create_with_config("127.0.0.1", 9001 + i,
+                                                               false, false, &pool_config);
+        cr_assert_not_null(pool);
+        cr_assert_eq(upstream_cluster_add_endpoint(cluster, name, pool), 0);
+    }
+    return cluster;
+}
+
+static int pick_index(upstream_cluster_t *cluster, const char *key)
+{
+    upstream_endpoint_t *endpoint = upstream_cluster_pick(cluster, key, key ? strlen(key) : 0);
+    cr_assert_not_null(endpoint);
+    upstream_endpoint_release(endpoint, 1000, 200);
+    return (int)(endpoint - cluster->endpoints);
+}
+
+static void open_circuit_breaker(backend_pool_t *pool)
+{
+    circuit_breaker_config_t config = {
+        .enabled = true,
+        .failure_threshold = 1,
+        .recovery_timeout_seconds = 60
+    };
+    cr_assert_eq(backend_pool_init_circuit_breaker(pool, &config), 0);
+    backend_pool_circuit_breaker_record_failure(pool);
+    cr_assert_eq(backend_pool_circuit_breaker_get_state(pool), CIRCUIT_BREAKER_OPEN);
+}
+
+Test(upstream, round_robin_skips_open_breaker)
+{
+    upstream_cluster_t *cluster = make_cluster(LB_ROUND_ROBIN, 3);
+
+    for (int i = 0; i < 6; i++) {
+        cr_assert_eq(pick_index(cluster, NULL), i % 3, "Endpoints are used in turn");
+    }
+
+    open_circuit_breaker(cluster->endpoints[1].pool);
+    for (int i = 0; i < 12; i++) {
+        cr_assert_neq(pick_index(cluster, NULL), 1, "Endpoint behind an open breaker is skipped");
+    }
+
+    upstream_cluster_destroy(cluster);
+}
+
+Test(upstream, least_request_prefers_idle_endpoint)
+{
+    upstream_cluster_t *cluster = make_cluster(LB_LEAST_REQUEST, 3);
+    upstream_endpoint_t *held[3];
+
+    for (int i = 0; i < 3; i++) {
+        held[i] = upstream_cluster_pick(cluster, NULL, 0);
+        cr_assert_not_null(held[i]);
+    }
+    cr_assert(held[0] != held[1] && held[1] != held[2] && held[0] != held[2],
+              "Each outstanding request lands on a different endpoint");
+
+    upstream_endpoint_release(held[1], 1000, 200);
+    for (int i = 0; i < 5; i++) {
+        upstream_endpoint_t *endpoint = upstream_cluster_pick(cluster, NULL, 0);
+        cr_assert_eq(endpoint, held[1], "The only idle endpoint is chosen");
+        upstream_endpoint_release(endpoint, 1000, 200);
+    }
+
+    upstream_endpoint_release(held[0], 1000, 200);
+    upstream_endpoint_release(held[2], 1000, 200);
+    for (int i = 0; i < 3; i++) {
+        cr_assert_eq(atomic_load(&cluster->endpoints[i].outstanding), 0);
+    }
+    upstream_cluster_destroy(cluster);
+}
+
+Test(upstream, ewma_prefers_faster_endpoint)
+{
+    upstream_cluster_t *cluster = make_cluster(LB_EWMA, 2);
+    int fast = 0;
+
+    for (int i = 0; i < 200; i++) {
+        upstream_endpoint_t *endpoint = upstream_cluster_pick(cluster, NULL, 0);
+        cr_assert_not_null(endpoint);
+        bool is_fast = endpoint == &cluster->endpoints[0];
+        upstream_endpoint_release(endpoint, is_fast ? 1000 : 50000, 200);
+        if (i >= 100 && is_fast) {
+            fast++;
+        }
+    }
+
+    cr_assert_eq(fast, 100, "Once both are measured the faster endpoint wins (%d/100)", fast);
+    cr_assert_gt(atomic_load(&cluster->endpoints[1].ewma_us),
+                 atomic_load(&cluster->endpoints[0].ewma_us));
+    upstream_cluster_destroy(cluster);
+}
+
+Test(upstream, maglev_keeps_affinity_and_moves_few_keys)
+{
+    upstream_cluster_t *four = make_cluster(LB_MAGLEV, 4);
+    upstream_cluster_t *three = make_cluster(LB_MAGLEV, 3);
+    int per_endpoint[4] = {0};
+    int kept = 0, survivors = 0;
+
+    for (int k = 0; k < 4000; k++) {
+        char key[32];
+        snprintf(key, sizeof(key), "session-%d", k);
+        int before = pick_index(four, key);
+        cr_assert_eq(pick_index(four, key), before, "Same key, same endpoint");
+        per_endpoint[before]++;
+        if (before < 3) {
+            survivors++;
+            if (pick_index(three, key) == before) {
+                kept++;
+            }
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        cr_assert(per_endpoint[i] > 700 && per_endpoint[i] < 1300,
+                  "Keys spread evenly (endpoint %d has %d)", i, per_endpoint[i]);
+    }
+    cr_assert_gt(kept * 100, survivors * 95,
+                 "Removing an endpoint keeps other keys in place (%d/%d)", kept, survivors);
+
+    /* An endpoint behind an open breaker hands its keys to the others only */
+    int owner[400];
+    for (int k = 0; k < 400; k++) {
+        char key[32];
+        snprintf(key, sizeof(key), "session-%d", k);
+        owner[k] = pick_index(four, key);
+    }
+    open_circuit_breaker(four->endpoints[3].pool);
+    for (int k = 0; k < 400; k++) {
+        char key[32];
+        snprintf(key, sizeof(key), "session-%d", k);
+        int index = pick_index(four, key);
+        cr_assert_neq(index, 3);
+        if (owner[k] != 3) {
+            cr_assert_eq(index, owner[k], "Keys of available endpoints must not move");
+        }
+    }
+
+    upstream_cluster_destroy(four);
+    upstream_cluster_destroy(three);
+}
+
+static void enable_outlier_detection(upstream_cluster_t *cluster, int consecutive_5xx,
+                                     int max_ejection_percent)
+{
+    OutlierDetectionConfig config = {
+        .enabled = true,
+        .consecutive_5xx = consecutive_5xx,
+        .interval_seconds = 3600,
+        .base_ejection_time_seconds = 30,
+        .max_ejection_percent = max_ejection_percent,
+        .failure_percent = 50,
+        .min_requests = 10,
+        .latency_factor = 3
+    };
+    upstream_cluster_set_outlier_detection(cluster, &config);
+}
+
+/* A request to one given endpoint, as if the balancer had picked it */
+static void settle(upstream_endpoint_t *endpoint, long latency_us, int status)
+{
+    atomic_fetch_add(&endpoint->outstanding, 1);
+    upstream_endpoint_release(endpoint, latency_us, status);
+}
+
+Test(upstream, consecutive_5xx_eject_within_cap)
+{
+    upstream_cluster_t *cluster = make_cluster(LB_ROUND_ROBIN, 3);
+    enable_outlier_detection(cluster, 3, 10);
+    upstream_endpoint_t *flaky = &cluster->endpoints[1];
+
+    settle(flaky, 1000, 503);
+    settle(flaky, 1000, 503);
+    settle(flaky, 1000, 200);
+    settle(flaky, 1000, UPSTREAM_STATUS_FAILED);
+    settle(flaky, 1000, 502);
+    cr_assert_not(upstream_endpoint_is_ejected(flaky), "A success breaks the run");
+    settle(flaky, 1000, 500);
+    cr_assert(upstream_endpoint_is_ejected(flaky));
+    for (int i = 0; i < 12; i++) {
+        cr_assert_neq(pick_index(cluster, NULL), 1, "Ejected endpoint is out of rotation");
+    }
+
+    /* 10% of three still lets one go, but not a second */
+    for (int i = 0; i < 5; i++) {
+        settle(&cluster->endpoints[2], 1000, 503);
+    }
+    cr_assert_not(upstream_endpoint_is_ejected(&cluster->endpoints[2]));
+
+    /* Ejected again once back, for twice as long */
+    atomic_store(&flaky->ejected_until_ms, 0);
+    for (int i = 0; i < 3; i++) {
+        settle(flaky, 1000, 503);
+    }
+    cr_assert(upstream_endpoint_is_ejected(flaky));
+    cr_assert_eq(atomic_load(&flaky->ejection_streak), 2);
+    cr_assert_eq(atomic_load(&flaky->total_ejections), 2);
+
+    /* Requests refused locally never reached the backend */
+    atomic_store(&flaky->ejected_until_ms, 0);
+    for (int i = 0; i < 5; i++) {
+        settle(flaky, 10, UPSTREAM_STATUS_NOT_SENT);
+    }
+    cr_assert_not(upstream_endpoint_is_ejected(flaky));
+    upstream_cluster_destroy(cluster);
+}
+
+Test(upstream, error_rate_and_latency_outliers_are_ejected)
+{
+    upstream_cluster_t *cluster = make_cluster(LB_P2C, 5);
+    enable_outlier_detection(cluster, 0, 50);
+
+    for (int i = 0; i < 20; i++) {
+        settle(&cluster->endpoints[0], 1000 + i * 10, 200);
+        settle(&cluster->endpoints[1], 1000, i % 5 < 3 ? 500 : 200);
+        settle(&cluster->endpoints[2], 1200, 200);
+        settle(&cluster->endpoints[3], i < 18 ? 20000 : 1000, 200);
+        settle(&cluster->endpoints[4], 2500, 200);
+    }
+    /* Too few requests to judge */
+    for (int i = 0; i < 5; i++) {
+        settle(&cluster->endpoints[4], 1000000, UPSTREAM_STATUS_FAILED);
+    }
+    upstream_cluster_detect_outliers(cluster);
+
+    cr_assert_not(upstream_endpoint_is_ejected(&cluster->endpoints[0]));
+    cr_assert(upstream_endpoint_is_ejected(&cluster->endpoints[1]), "60% errors is over 50%");
+    cr_assert_not(upstream_endpoint_is_ejected(&cluster->endpoints[2]));
+    cr_assert(upstream_endpoint_is_ejected(&cluster->endpoints[3]), "p95 far above the median");
+    cr_assert_not(upstream_endpoint_is_ejected(&cluster->endpoints[4]),
+                  "Within the latency factor, and the cap of two is reached");
+
+    for (int i = 0; i < 50; i++) {
+        int index = pick_index(cluster, NULL);
+        cr_assert(index != 1 && index != 3, "Ejected endpoints are not picked");
+    }
+
+    /* A new interval starts from nothing */
+    upstream_cluster_detect_outliers(cluster);
+    cr_assert_eq(atomic_load(&cluster->endpoints[0].interval_requests), 0);
+    upstream_cluster_destroy(cluster);
+}
+
+static void enable_retries(upstream_cluster_t *cluster, int budget_percent, int budget_burst,
+                           int hedge_delay_ms)
+{
+    RetryPolicyConfig config = {
+        .enabled = true,
+        .max_retries = 1,
+        .budget_percent = budget_percent,
+        .budget_burst = budget_burst,
+        .hedge = true,
+        .hedge_delay_ms = hedge_delay_ms
+    };
+    upstream_cluster_set_retry_policy(cluster, &config);
+}
+
+Test(upstream, retry_budget_follows_traffic)
+{
+    upstream_cluster_t *cluster = make_cluster(LB_ROUND_ROBIN, 2);
+    enable_retries(cluster, 20, 3, 0);
+
+    /* The burst is there from the start, then it is spent */
+    for (int i = 0; i < 3; i++) {
+        cr_assert(upstream_cluster_take_retry(cluster));
+    }
+    cr_assert_not(upstream_cluster_take_retry(cluster));
+
+    /* 20%: one retry per five requests */
+    for (int i = 0; i < 4; i++) {
+        upstream_cluster_earn_retry(cluster);
+    }
+    cr_assert_not(upstream_cluster_take_retry(cluster));
+    upstream_cluster_earn_retry(cluster);
+    cr_assert(upstream_cluster_take_retry(cluster));
+    cr_assert_eq(atomic_load(&cluster->retries_throttled), 2);
+
+    /* A quiet period banks no more than the burst */
+    for (int i = 0; i < 1000; i++) {
+        upstream_cluster_earn_retry(cluster);
+    }
+    cr_assert_eq(atomic_load(&cluster->retry_tokens), 3 * UPSTREAM_RETRY_TOKEN);
+    upstream_cluster_destroy(cluster);
+}
+
+Test(upstream, retries_pick_another_endpoint)
+{
+    upstream_cluster_t *cluster = make_cluster(LB_MAGLEV, 3);
+
+    for (int i = 0; i < 20; i++) {
+        char key[16];
+        snprintf(key, sizeof(key), "user-%d", i);
+        upstream_endpoint_t *first = upstream_cluster_pick(cluster, key, strlen(key));
+        upstream_endpoint_t *retry = upstream_cluster_pick_other(cluster, key, strlen(key), first);
+        cr_assert_neq(retry, first, "A consistent hash would pick the same endpoint again");
+        upstream_endpoint_release(retry, 1000, 200);
+        upstream_endpoint_release(first, 1000, UPSTREAM_STATUS_FAILED);
+    }
+
+    /* Moving off one endpoint skips those behind an open breaker */
+    open_circuit_breaker(cluster->endpoints[1].pool);
+    upstream_endpoint_t *retry = upstream_cluster_pick_other(cluster, NULL, 0, &cluster->endpoints[0]);
+    cr_assert_eq(retry, &cluster->endpoints[2]);
+    upstream_endpoint_release(retry, 1000, 200);
+    upstream_cluster_destroy(cluster);
+
+    upstream_cluster_t *single = make_cluster(LB_ROUND_ROBIN, 1);
+    retry = upstream_cluster_pick_other(single, NULL, 0, &single->endpoints[0]);
+    cr_assert_eq(retry, &single->endpoints[0], "A cluster of one retries on its only endpoint");
+    upstream_endpoint_release(retry, 1000, 200);
+    upstream_cluster_destroy(single);
+}
+
+Test(upstream, hedge_delay_tracks_p95)
+{
+    upstream_cluster_t *cluster = make_cluster(LB_P2C, 2);
+    enable_retries(cluster, 20, 10, 0);
+    cr_assert_eq(upstream_cluster_hedge_delay_ms(cluster), 0, "No hedging before enough samples");
+
+    /* 95% answer in about 2 ms, the slowest 5% in 50 ms */
+    for (int i = 0; i < UPSTREAM_HEDGE_REFRESH_SAMPLES * 10; i++) {
+        settle(&cluster->endpoints[i % 2], i % 20 == 0 ? 50000 : 2000, 200);
+    }
+    long delay = upstream_cluster_hedge_delay_ms(cluster);
+    cr_assert(delay >= 2 && delay <= 3, "p95 is the fast majority, not the tail (got %ld ms)", delay);
+
+    /* Failures carry no latency worth hedging on */
+    for (int i = 0; i < UPSTREAM_HEDGE_REFRESH_SAMPLES * 4; i++) {
+        settle(&cluster->endpoints[0], 5000000, UPSTREAM_STATUS_FAILED);
+    }
+    cr_assert_eq(upstream_cluster_hedge_delay_ms(cluster), delay);
+
+    /* The window decays, so a slower backend moves the estimate */
+    for (int i = 0; i < UPSTREAM_HEDGE_WINDOW_SAMPLES * 2; i++) {
+        settle(&cluster->endpoints[i % 2], 40000, 200);
+    }
+    cr_assert_geq(upstream_cluster_hedge_delay_ms(cluster), 40);
+
+    /* A fixed delay overrides the estimate */
+    enable_retries(cluster, 20, 10, 250);
+    cr_assert_eq(upstream_cluster_hedge_delay_ms(cluster), 250);
+    upstream_cluster_destroy(cluster);
+}
+
+static void enable_concurrency_limit(upstream_cluster_t *cluster, int initial, int min, int max)
+{
+    ConcurrencyLimitConfig config = {
+        .enabled = true,
+        .initial_limit = initial,
+        .min_limit = min,
+        .max_limit = max,
+        .rtt_tolerance_percent = CONCURRENCY_DEFAULT_RTT_TOLERANCE_PERCENT,
+        .smoothing_percent = CONCURRENCY_DEFAULT_SMOOTHING_PERCENT
+    };
+    upstream_cluster_set_concurrency_limit(cluster, &config);
+}
+
+/* A response that came in while 'inflight' requests were outstanding */
+static void settle_loaded(upstream_endpoint_t *endpoint, long latency_us, int status, int inflight)
+{
+    atomic_store(&endpoint->outstanding, inflight);
+    upstream_endpoint_release(endpoint, latency_us, status);
+    atomic_store(&endpoint->outstanding, 0);
+}
+
+Test(upstream, concurrency_limit_follows_latency)
+{
+    upstream_cluster_t *cluster = make_cluster(LB_ROUND_ROBIN, 1);
+    upstream_endpoint_t *endpoint = &cluster->endpoints[0];
+    enable_concurrency_limit(cluster, 20, 5, 200);
+    cr_assert_eq(atomic_load(&endpoint->concurrency_limit), 20);
+
+    /* Lightly used, steady latency proves nothing about more load */
+    for (int i = 0; i < 50; i++) {
+        settle_loaded(endpoint, 2000, 200, 2);
+    }
+    cr_assert_eq(atomic_load(&endpoint->concurrency_limit), 20);
+
+    /* Used up to the limit with latency holding: it grows */
+    for (int i = 0; i < 50; i++) {
+        settle_loaded(endpoint, 2000, 200, atomic_load(&endpoint->concurrency_limit));
+    }
+    int grown = atomic_load(&endpoint->concurrency_limit);
+    cr_assert_gt(grown, 40, "got %d", grown);
+
+    /* Queueing at the backend: latency five times the baseline */
+    for (int i = 0; i < 20; i++) {
+        settle_loaded(endpoint, 10000, 200, atomic_load(&endpoint->concurrency_limit));
+    }
+    int shrunk = atomic_load(&endpoint->concurrency_limit);
+    cr_assert_lt(shrunk, grown / 2, "got %d", shrunk);
+
+    /* Failures back off down to the floor, never below it */
+    for (int i = 0; i < 100; i++) {
+        settle_loaded(endpoint, 0, UPSTREAM_STATUS_FAILED, 1);
+    }
+    cr_assert_eq(atomic_load(&endpoint->concurrency_limit), 5);
+
+    /* Requests that were never sent say nothing */
+    settle_loaded(endpoint, 0, UPSTREAM_STATUS_NOT_SENT, 5);
+    cr_assert_eq(atomic_load(&endpoint->concurrency_limit), 5);
+    upstream_cluster_destroy(cluster);
+}
+
+Test(upstream, requests_over_concurrency_limit_are_shed)
+{
+    upstream_cluster_t *cluster = make_cluster(LB_ROUND_ROBIN, 1);
+    upstream_endpoint_t *endpoint = &cluster->endpoints[0];
+    cr_assert_not(upstream_endpoint_over_limit(endpoint), "No limit unless configured");
+
+    enable_concurrency_limit(cluster, 3, 1, 10);
+    upstream_endpoint_t *picked[4];
+    for (int i = 0; i < 4; i++) {
+        picked[i] = upstream_cluster_pick(cluster, NULL, 0);
+        cr_assert_eq(picked[i], endpoint);
+    }
+    /* Each picked request counts itself; the fourth is one too many */
+    cr_assert(upstream_endpoint_over_limit(endpoint));
+    upstream_endpoint_release(picked[3], 0, UPSTREAM_STATUS_NOT_SENT);
+    cr_assert_not(upstream_endpoint_over_limit(endpoint));
+    cr_assert_eq(atomic_load(&endpoint->total_shed), 1);
+
+    for (int i = 0; i < 3; i++) {
+        upstream_endpoint_release(picked[i], 1000, 200);
+    }
+    cr_assert_eq(atomic_load(&endpoint->outstanding), 0);
+    upstream_cluster_destroy(cluster);
+}
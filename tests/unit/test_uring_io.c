@@ -0,0 +1,172 @@
+// tests/unit/test_uring_io.c
+
+#include <criterion/criterion.h>
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "uring_io.h"
+
+static long elapsed_ms_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+Test(uring_io, bio_reads_across_provided_buffer)
+{
+    int sv[2];
+    char out[16];
+    uring_worker_t *worker = uring_worker_get(false);
+    cr_assert_not_null(worker);
+    cr_assert_eq(uring_worker_current(), worker);
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+    BIO *bio = uring_bio_new(worker, sv[0], false);
+    cr_assert_not_null(bio);
+    cr_assert_eq(write(sv[1], "hello world", 11), 11);
+
+    /* A short read keeps the rest of the completion for the next call */
+    cr_assert_eq(BIO_read(bio, out, 5), 5);
+    cr_assert(memcmp(out, "hello", 5) == 0);
+    cr_assert_eq(BIO_read(bio, out, sizeof(out)), 6);
+    cr_assert(memcmp(out, " world", 6) == 0);
+
+    cr_assert_eq(BIO_write(bio, "pong", 4), 4);
+    cr_assert_eq(read(sv[1], out, sizeof(out)), 4);
+    cr_assert(memcmp(out, "pong", 4) == 0);
+
+    close(sv[1]);
+    cr_assert_eq(BIO_read(bio, out, sizeof(out)), 0, "EOF after peer close");
+    cr_assert_eq(BIO_eof(bio), 1);
+
+    BIO_free(bio);
+    close(sv[0]);
+}
+
+Test(uring_io, bio_timeout_and_nonblocking)
+{
+    int sv[2];
+    char out[16];
+    struct timespec start;
+    uring_worker_t *worker = uring_worker_get(false);
+    cr_assert_not_null(worker);
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+    BIO *bio = uring_bio_new(worker, sv[0], false);
+    cr_assert_not_null(bio);
+
+    uring_bio_set_timeout(bio, 50);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cr_assert_eq(BIO_read(bio, out, sizeof(out)), -1);
+    cr_assert_not(BIO_should_retry(bio), "Timeout must not be reported as retryable");
+    cr_assert_lt(elapsed_ms_since(&start), 1000);
+
+    uring_bio_set_nonblocking(bio, true);
+    cr_assert_eq(BIO_read(bio, out, sizeof(out)), -1);
+    cr_assert(BIO_should_retry(bio) && BIO_should_read(bio));
+
+    cr_assert_eq(write(sv[1], "x", 1), 1);
+    cr_assert_eq(BIO_read(bio, out, sizeof(out)), 1);
+
+    BIO_free(bio);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+Test(uring_io, read_file_uses_worker_buffer)
+{
+    char path[] = "/tmp/uring_io_testXXXXXX";
+    const char *data = NULL;
+    uring_worker_t *worker = uring_worker_get(false);
+    cr_assert_not_null(worker);
+
+    int fd = mkstemp(path);
+    cr_assert_geq(fd, 0);
+    unlink(path);
+    cr_assert_eq(write(fd, "0123456789", 10), 10);
+
+    cr_assert_eq(uring_worker_read_file(worker, fd, false, 4, &data), 6);
+    cr_assert_eq((const unsigned char *)data, worker->file_buf);
+    cr_assert(memcmp(data, "456789", 6) == 0);
+    cr_assert_eq(uring_worker_read_file(worker, fd, false, 10, &data), 0);
+
+    close(fd);
+}
+
+Test(uring_io, fixed_file_socket_outlives_process_fd)
+{
+    int sv[2];
+    char out[16];
+    uring_worker_t *worker = uring_worker_get(false);
+    cr_assert_not_null(worker);
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+    int index = uring_worker_install_fd(worker, sv[0]);
+    if (!worker->fixed_files) {
+        cr_assert_eq(index, -1);
+        close(sv[0]);
+        close(sv[1]);
+        return;
+    }
+    cr_assert_geq(index, 0);
+    close(sv[0]);
+
+    BIO *bio = uring_bio_new(worker, index, true);
+    cr_assert_not_null(bio);
+    cr_assert_eq(BIO_get_fd(bio, NULL), -1);
+
+    cr_assert_eq(uring_worker_poll(worker, index, true, POLLIN, 50), 0, "Nothing to read yet");
+    cr_assert_eq(write(sv[1], "ping", 4), 4);
+    cr_assert(uring_worker_poll(worker, index, true, POLLIN, 1000) & POLLIN);
+    cr_assert_eq(BIO_read(bio, out, sizeof(out)), 4);
+    cr_assert(memcmp(out, "ping", 4) == 0);
+    cr_assert_eq(BIO_write(bio, "pong", 4), 4);
+    cr_assert_eq(read(sv[1], out, sizeof(out)), 4);
+
+    BIO_free(bio);
+    uring_worker_close_fixed(worker, index);
+    cr_assert_eq(read(sv[1], out, sizeof(out)), 0, "Closing the slot releases the socket");
+    close(sv[1]);
+}
+
+Test(uring_io, poll_many_reports_first_ready_socket)
+{
+    int a[2], b[2];
+    struct timespec start;
+    uring_worker_t *worker = uring_worker_get(false);
+    cr_assert_not_null(worker);
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, a), 0);
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, b), 0);
+
+    uring_poll_target_t targets[2] = {
+        {.fd = a[0], .events = POLLIN},
+        {.fd = b[0], .events = POLLIN}
+    };
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cr_assert_eq(uring_worker_poll_many(worker, targets, 2, 50), 0, "Nothing readable yet");
+    cr_assert_lt(elapsed_ms_since(&start), 1000);
+
+    cr_assert_eq(write(b[1], "x", 1), 1);
+    cr_assert_eq(uring_worker_poll_many(worker, targets, 2, 1000), 1);
+    cr_assert_eq(targets[0].revents, 0);
+    cr_assert(targets[1].revents & POLLIN);
+
+    /* The cancelled poll on 'a' must not complete a later, unrelated wait */
+    struct io_uring_cqe *cqe;
+    cr_assert_neq(io_uring_peek_cqe(&worker->ring, &cqe), 0, "Nothing left on the ring");
+    cr_assert_eq(write(a[1], "y", 1), 1);
+    cr_assert_eq(uring_worker_poll(worker, a[0], false, POLLIN, 1000) & POLLIN, POLLIN);
+
+    close(a[0]);
+    close(a[1]);
+    close(b[0]);
+    close(b[1]);
+}
@@ -0,0 +1,393 @@
+// tests/unit/test_websocket.c
+// Unit tests for WebSocket upgrades on the HTTP/1.1 and HTTP/2 proxy paths
+
+#include <criterion/criterion.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "http1_client.h"
+#include "resolver.h"
+#include "router.h"
+#include "websocket.h"
+
+/* The example handshake of RFC 6455 section 1.3 */
+#define SAMPLE_KEY "dGhlIHNhbXBsZSBub25jZQ=="
+#define SAMPLE_ACCEPT "s3pPLMBiTxaQ9kYGzzhZRbK+xOo="
+
+typedef enum {
+    BACKEND_UPGRADE,            /* 101 with a correct accept, then echo */
+    BACKEND_WRONG_ACCEPT,
+    BACKEND_REJECT              /* 403 */
+} backend_mode_t;
+
+/* A WebSocket backend on loopback. After switching protocols it sends
+ * "hello" and echoes everything until the proxy closes its side. */
+typedef struct {
+    int listen_fd;
+    int port;
+    backend_mode_t mode;
+    char head[2048];
+} ws_backend_t;
+
+static void *ws_backend_thread(void *arg)
+{
+    ws_backend_t *backend = arg;
+    char buf[4096];
+    size_t have = 0;
+
+    int fd = accept(backend->listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return NULL;
+    }
+    while (!strstr(backend->head, "\r\n\r\n") && have < sizeof(backend->head) - 1) {
+        ssize_t n = recv(fd, backend->head + have, sizeof(backend->head) - 1 - have, 0);
+        if (n <= 0) {
+            close(fd);
+            return NULL;
+        }
+        have += (size_t)n;
+        backend->head[have] = '\0';
+    }
+
+    if (backend->mode == BACKEND_REJECT) {
+        const char *reply = "HTTP/1.1 403 Forbidden\r\nContent-Length: 0\r\n\r\n";
+        send(fd, reply, strlen(reply), 0);
+        close(fd);
+        return NULL;
+    }
+
+    char key[64] = "";
+    char accept_value[WEBSOCKET_ACCEPT_SIZE] = "bogus";
+    const char *line = strcasestr(backend->head, "\r\nSec-WebSocket-Key: ");
+    if (line) {
+        sscanf(line + 21, "%63[^\r]", key);
+    }
+    if (backend->mode == BACKEND_UPGRADE) {
+        websocket_accept_key(key, accept_value);
+    }
+    int len = snprintf(buf, sizeof(buf),
+                       "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                       "Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n"
+                       "Sec-WebSocket-Protocol: chat\r\n\r\nhello", accept_value);
+    send(fd, buf, (size_t)len, 0);
+
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        send(fd, buf, (size_t)n, MSG_NOSIGNAL);
+    }
+    close(fd);
+    return NULL;
+}
+
+static void start_backend(ws_backend_t *backend, backend_mode_t mode, pthread_t *thread)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+
+    memset(backend, 0, sizeof(*backend));
+    backend->mode = mode;
+    backend->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    cr_assert_eq(bind(backend->listen_fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+    cr_assert_eq(listen(backend->listen_fd, 4), 0);
+    getsockname(backend->listen_fd, (struct sockaddr *)&addr, &len);
+    backend->port = ntohs(addr.sin_port);
+    cr_assert_eq(pthread_create(thread, NULL, ws_backend_thread, backend), 0);
+}
+
+static http1_pool_t *backend_pool(ws_backend_t *backend)
+{
+    char authority[32];
+    snprintf(authority, sizeof(authority), "127.0.0.1:%d", backend->port);
+    http1_pool_t *pool = http1_pool_create(resolver_get_endpoint("127.0.0.1", backend->port),
+                                           authority, 0, 0);
+    cr_assert_not_null(pool);
+    return pool;
+}
+
+/* Waits for backend bytes on a bridged stream and takes them */
+static size_t take_backend_bytes(websocket_stream_t *ws, char *out, size_t len)
+{
+    for (int i = 0; i < 200 && ws->len == 0; i++) {
+        cr_assert_geq(websocket_stream_pull(ws), 0);
+        if (ws->len == 0) {
+            usleep(5000);
+        }
+    }
+    size_t n = websocket_stream_take(ws, (uint8_t *)out, len - 1);
+    out[n] = '\0';
+    return n;
+}
+
+/* An extended CONNECT as the HTTP/2 server hands it over */
+static void connect_request(HttpRequest *req)
+{
+    memset(req, 0, sizeof(*req));
+    req->method = "CONNECT";
+    req->path = "/chat";
+    req->headers[0] = (HttpHeader){"host", "example.com"};
+    req->headers[1] = (HttpHeader){"sec-websocket-protocol", "chat, superchat"};
+    req->headers[2] = (HttpHeader){"sec-websocket-version", "13"};
+    req->header_count = 3;
+}
+
+Test(websocket, accept_key_matches_rfc6455)
+{
+    char accept_value[WEBSOCKET_ACCEPT_SIZE];
+    cr_assert_eq(websocket_accept_key(SAMPLE_KEY, accept_value), 0);
+    cr_assert_str_eq(accept_value, SAMPLE_ACCEPT);
+
+    char a[WEBSOCKET_KEY_SIZE], b[WEBSOCKET_KEY_SIZE];
+    cr_assert_eq(websocket_generate_key(a), 0);
+    cr_assert_eq(websocket_generate_key(b), 0);
+    cr_assert_eq(strlen(a), WEBSOCKET_KEY_SIZE - 1);
+    cr_assert_str_neq(a, b, "Every handshake gets a fresh key");
+}
+
+Test(websocket, extended_connect_upgrades_backend)
+{
+    ws_backend_t backend;
+    pthread_t thread;
+    start_backend(&backend, BACKEND_UPGRADE, &thread);
+    http1_pool_t *pool = backend_pool(&backend);
+
+    HttpRequest req;
+    connect_request(&req);
+    websocket_stream_t *ws = NULL;
+    cr_assert_eq(websocket_stream_open(&ws, pool, &req, 5000), 200);
+    cr_assert_not_null(ws);
+
+    cr_assert(strncmp(backend.head, "GET /chat HTTP/1.1\r\n", 20) == 0, "CONNECT becomes GET: %s",
+              backend.head);
+    cr_assert_not_null(strstr(backend.head, "\r\nUpgrade: websocket\r\nConnection: upgrade\r\n"));
+    cr_assert_not_null(strstr(backend.head, "\r\nSec-WebSocket-Key: "));
+    cr_assert_not_null(strstr(backend.head, "\r\nsec-websocket-version: 13\r\n"));
+    cr_assert_not_null(strstr(backend.head, "\r\nX-Forwarded-Host: example.com\r\n"));
+    cr_assert_str_eq(ws->protocol, "chat");
+
+    char buf[64];
+    take_backend_bytes(ws, buf, sizeof(buf));
+    cr_assert_str_eq(buf, "hello", "Bytes sent with the 101 are kept for the stream");
+
+    cr_assert_eq(websocket_stream_write(ws, (const uint8_t *)"ping", 4), 4);
+    take_backend_bytes(ws, buf, sizeof(buf));
+    cr_assert_str_eq(buf, "ping");
+
+    websocket_stream_shutdown(ws);
+    for (int i = 0; i < 200 && !ws->backend_eof; i++) {
+        cr_assert_geq(websocket_stream_pull(ws), 0);
+        usleep(5000);
+    }
+    cr_assert(ws->backend_eof);
+    websocket_stream_close(ws);
+    pthread_join(thread, NULL);
+    close(backend.listen_fd);
+    http1_pool_destroy(pool);
+    resolver_shutdown();
+}
+
+Test(websocket, slow_backend_queues_instead_of_blocking)
+{
+    int fds[2];
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    websocket_stream_t *ws = calloc(1, sizeof(*ws));
+    cr_assert_not_null(ws);
+    ws->fd = fds[0];
+
+    /* The backend reads nothing; far more than the socket buffer is queued */
+    size_t len = 4 * 1024 * 1024;
+    uint8_t *data = malloc(len);
+    for (size_t i = 0; i < len; i++) {
+        data[i] = (uint8_t)i;
+    }
+    ssize_t sent = websocket_stream_write(ws, data, len);
+    cr_assert_geq(sent, 0);
+    cr_assert_lt((size_t)sent, len);
+    cr_assert_eq(ws->out_len, len - (size_t)sent);
+    cr_assert_eq(websocket_stream_flush(ws), 0, "Still no room");
+
+    /* The client's end of stream waits for the queue to drain */
+    websocket_stream_shutdown(ws);
+    cr_assert(ws->shutdown_pending);
+
+    uint8_t *received = malloc(len);
+    size_t have = 0;
+    size_t flushed = (size_t)sent;
+    for (;;) {
+        ssize_t n = recv(fds[1], received + have, len - have, MSG_DONTWAIT);
+        if (n == 0) {
+            break;
+        }
+        if (n > 0) {
+            have += (size_t)n;
+        }
+        ssize_t more = websocket_stream_flush(ws);
+        cr_assert_geq(more, 0);
+        flushed += (size_t)more;
+    }
+    cr_assert_eq(have, len, "End of stream only after every byte");
+    cr_assert_eq(flushed, len, "Flushes report what the backend took");
+    cr_assert_eq(memcmp(received, data, len), 0);
+
+    free(received);
+    free(data);
+    websocket_stream_close(ws);
+    close(fds[1]);
+}
+
+Test(websocket, extended_connect_reports_failed_handshake)
+{
+    ws_backend_t backend;
+    pthread_t thread;
+    HttpRequest req;
+    websocket_stream_t *ws = NULL;
+
+    start_backend(&backend, BACKEND_WRONG_ACCEPT, &thread);
+    http1_pool_t *pool = backend_pool(&backend);
+    connect_request(&req);
+    cr_assert_eq(websocket_stream_open(&ws, pool, &req, 5000), 502,
+                 "A 101 that does not answer our key is not a WebSocket");
+    cr_assert_null(ws);
+    pthread_join(thread, NULL);
+    close(backend.listen_fd);
+    http1_pool_destroy(pool);
+
+    start_backend(&backend, BACKEND_REJECT, &thread);
+    pool = backend_pool(&backend);
+    cr_assert_eq(websocket_stream_open(&ws, pool, &req, 5000), 403, "The backend's refusal is relayed");
+    cr_assert_null(ws);
+    pthread_join(thread, NULL);
+    close(backend.listen_fd);
+    http1_pool_destroy(pool);
+    resolver_shutdown();
+}
+
+typedef struct {
+    SSL *server;
+    char raw[512];
+    size_t raw_len;
+    HttpRequest req;
+    ServerConfig *config;
+    int result;
+} proxy_call_t;
+
+static void *proxy_thread(void *arg)
+{
+    proxy_call_t *call = arg;
+    call->result = proxy_request_tls(&call->req, call->raw, call->raw_len, call->config, call->server);
+    return NULL;
+}
+
+static void tls_socket_pair(SSL_CTX **server_ctx, SSL_CTX **client_ctx, SSL **server, SSL **client,
+                            int fds[2])
+{
+    cr_assert_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    *server_ctx = SSL_CTX_new(TLS_server_method());
+    cr_assert_eq(SSL_CTX_use_certificate_file(*server_ctx, "certs/dev.crt", SSL_FILETYPE_PEM), 1);
+    cr_assert_eq(SSL_CTX_use_PrivateKey_file(*server_ctx, "certs/dev.key", SSL_FILETYPE_PEM), 1);
+    SSL_CTX_set_mode(*server_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+    *client_ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(*client_ctx, SSL_VERIFY_NONE, NULL);
+
+    *server = SSL_new(*server_ctx);
+    *client = SSL_new(*client_ctx);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    SSL_set_fd(*server, fds[0]);
+    SSL_set_fd(*client, fds[1]);
+    SSL_set_accept_state(*server);
+    SSL_set_connect_state(*client);
+
+    bool client_done = false, server_done = false;
+    for (int i = 0; i < 10000 && (!client_done || !server_done); i++) {
+        if (!client_done) {
+            client_done = SSL_do_handshake(*client) == 1;
+        }
+        if (!server_done) {
+            server_done = SSL_do_handshake(*server) == 1;
+        }
+        usleep(100);
+    }
+    cr_assert(client_done && server_done, "handshake timeout");
+    fcntl(fds[0], F_SETFL, 0);
+    fcntl(fds[1], F_SETFL, 0);
+}
+
+/* Reads from the client until 'expected' shows up in what arrived */
+static void client_expect(SSL *client, char *buf, size_t len, const char *expected)
+{
+    size_t have = 0;
+    buf[0] = '\0';
+    while (!strstr(buf, expected) && have < len - 1) {
+        int n = SSL_read(client, buf + have, (int)(len - 1 - have));
+        cr_assert_gt(n, 0, "Connection ended before '%s' arrived: %s", expected, buf);
+        have += (size_t)n;
+        buf[have] = '\0';
+    }
+}
+
+Test(websocket, http1_upgrade_becomes_tunnel)
+{
+    ws_backend_t backend;
+    pthread_t backend_thread;
+    start_backend(&backend, BACKEND_UPGRADE, &backend_thread);
+
+    ServerConfig config = {0};
+    config.route_count = 1;
+    strcpy(config.routes[0].path, "/ws");
+    strcpy(config.routes[0].technology, "reverse_proxy");
+    snprintf(config.routes[0].backend, sizeof(config.routes[0].backend), "127.0.0.1:%d", backend.port);
+    config.routes[0].websocket_enabled = true;
+    config.routes[0].websocket_idle_timeout_seconds = 5;
+    config.routes[0].h1_pool = backend_pool(&backend);
+
+    SSL_CTX *server_ctx, *client_ctx;
+    SSL *client;
+    int fds[2];
+    proxy_call_t call = {.config = &config};
+    tls_socket_pair(&server_ctx, &client_ctx, &call.server, &client, fds);
+
+    call.raw_len = (size_t)snprintf(call.raw, sizeof(call.raw),
+                                    "GET /ws/chat HTTP/1.1\r\nHost: example.com\r\n"
+                                    "Upgrade: websocket\r\nConnection: keep-alive, Upgrade\r\n"
+                                    "Sec-WebSocket-Key: " SAMPLE_KEY "\r\n"
+                                    "Sec-WebSocket-Version: 13\r\n\r\n");
+    cr_assert_eq(parse_http_request(call.raw, call.raw_len, &call.req), 0);
+    pthread_t thread;
+    cr_assert_eq(pthread_create(&thread, NULL, proxy_thread, &call), 0);
+
+    char buf[1024];
+    client_expect(client, buf, sizeof(buf), "hello");
+    cr_assert(strncmp(buf, "HTTP/1.1 101 Switching Protocols\r\n", 34) == 0);
+    cr_assert_not_null(strstr(buf, "\r\nSec-WebSocket-Accept: " SAMPLE_ACCEPT "\r\n"),
+                       "The backend answered the client's own key: %s", buf);
+    cr_assert_not_null(strstr(backend.head, "\r\nSec-WebSocket-Key: " SAMPLE_KEY "\r\n"));
+    cr_assert_not_null(strstr(backend.head, "\r\nConnection: upgrade\r\n"));
+    cr_assert_null(strstr(backend.head, "keep-alive"));
+
+    cr_assert_eq(SSL_write(client, "ping", 4), 4);
+    client_expect(client, buf, sizeof(buf), "ping");
+
+    /* The client closing ends the tunnel and the client connection with it */
+    SSL_shutdown(client);
+    pthread_join(thread, NULL);
+    cr_assert_eq(call.result, ROUTE_CLOSE_CONNECTION);
+
+    pthread_join(backend_thread, NULL);
+    close(backend.listen_fd);
+    http1_pool_destroy(config.routes[0].h1_pool);
+    SSL_free(call.server);
+    SSL_free(client);
+    SSL_CTX_free(server_ctx);
+    SSL_CTX_free(client_ctx);
+    close(fds[0]);
+    close(fds[1]);
+    resolver_shutdown();
+}